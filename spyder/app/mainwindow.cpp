@@ -52,7 +52,7 @@ MainWindow::MainWindow(const QHash<QString,QVariant>& options)
     open_project = options.value("project", QString()).toString();
     window_title = options.value("window_title", QString()).toString();
 
-    qDebug() << "Start of MainWindow constructor";
+    TimelineSpan span("MainWindow constructor");
 
     this->shortcut_data.clear();
 
@@ -86,6 +86,7 @@ MainWindow::MainWindow(const QHash<QString,QVariant>& options)
     this->projects = nullptr;
     this->outlineexplorer = nullptr;
     this->findinfiles = nullptr;
+    this->historylog = nullptr;
     this->thirdparty_plugins.clear();
 
     this->check_updates_action = nullptr;
@@ -138,6 +139,9 @@ MainWindow::MainWindow(const QHash<QString,QVariant>& options)
 
     // Status bar widgets
     this->mem_status = nullptr;
+    this->cpu_status = nullptr;
+    this->latency_status = nullptr;
+    this->fileops_status = nullptr;
 
     // Toolbars
     this->visible_toolbars.clear();
@@ -184,7 +188,6 @@ MainWindow::MainWindow(const QHash<QString,QVariant>& options)
     this->previous_focused_widget = nullptr;
 
     this->apply_settings();
-    qDebug() << "End of MainWindow constructor";
 }
 
 QToolBar* MainWindow::create_toolbar(const QString& title, const QString& object_name, int iconsize)
@@ -198,8 +201,9 @@ QToolBar* MainWindow::create_toolbar(const QString& title, const QString& object
 
 void MainWindow::setup()
 {
-    qDebug() << "*** Start of MainWindow setup ***";
-    qDebug() << "  ..core actions";
+    TimelineSpan setup_span("setup");
+    Timeline* timeline = Timeline::startup();
+    timeline->begin("core actions");
 
     close_dockwidget_action = new QAction("Close current pane", this);
     close_dockwidget_action->setIcon(ima::icon("DialogCloseButton"));
@@ -282,7 +286,8 @@ void MainWindow::setup()
                       << paste_action << selectall_action;
 
     //namespace = nullptr;,用于Console的构造函数
-    qDebug() << "  ..toolbars";
+    timeline->end();
+    timeline->begin("toolbars");
 
     file_menu = this->menuBar()->addMenu("&File");
     file_toolbar = this->create_toolbar("File toolbar", "file_toolbar");
@@ -317,7 +322,8 @@ void MainWindow::setup()
     status->setObjectName("StatusBar");
     status->showMessage("Welcome to Spyder!", 5000);
 
-    qDebug() << "  ..tools";
+    timeline->end();
+    timeline->begin("tools");
 
     QAction* prefs_action = new QAction(ima::icon("configure"), "Pre&ferences", this);
     connect(prefs_action, SIGNAL(triggered()), SLOT(edit_preferences()));
@@ -344,6 +350,15 @@ void MainWindow::setup()
     tools_menu_actions << reset_spyder_action << nullptr
                        << update_modules_action;
 
+    // 性能跟踪，也可以用环境变量SPYDER_TRACE在启动时开启
+    QAction* trace_action = new QAction("Record performance trace", this);
+    trace_action->setCheckable(true);
+    trace_action->setChecked(Tracer::enabled());
+    connect(trace_action, SIGNAL(toggled(bool)), SLOT(toggle_tracing(bool)));
+    QAction* save_trace_action = new QAction("Save performance trace...", this);
+    connect(save_trace_action, SIGNAL(triggered()), SLOT(save_trace()));
+    tools_menu_actions << nullptr << trace_action << save_trace_action;
+
     external_tools_menu = new QMenu("External Tools");
     external_tools_menu_actions.clear();
 
@@ -370,14 +385,16 @@ void MainWindow::setup()
                          << prefs_action << spyder_path_action;
     main_toolbar = create_toolbar("Main toolbar", "main_toolbar");
 
-    qDebug() << "  ..plugin: internal console";
+    timeline->end();
     //this->console = Console(self, namespace, exitfunc=this->closing,
     //this->console.register_plugin()
 
-    qDebug() << "  ..plugin: working directory";
-    this->workingdirectory = new WorkingDirectory(this, this->init_workdir);
-    this->workingdirectory->register_plugin();
-    this->toolbarslist.append(this->workingdirectory);
+    {
+        TimelineSpan span("plugin: working directory", "plugin");
+        this->workingdirectory = new WorkingDirectory(this, this->init_workdir);
+        this->workingdirectory->register_plugin();
+        this->toolbarslist.append(this->workingdirectory);
+    }
 
     if (CONF_get("help", "enable").toBool()) {
         this->set_splash("Loading help...");
@@ -386,13 +403,17 @@ void MainWindow::setup()
 
     if (CONF_get("outline_explorer", "enable").toBool()) {
         this->set_splash("Loading outline explorer...");
+        TimelineSpan span("plugin: outline explorer", "plugin");
         this->outlineexplorer = new OutlineExplorer(this);
         this->outlineexplorer->register_plugin();
     }
 
-    this->set_splash("Loading editor...");
-    this->editor = new Editor(this);
-    this->editor->register_plugin();
+    {
+        this->set_splash("Loading editor...");
+        TimelineSpan span("plugin: editor", "plugin");
+        this->editor = new Editor(this);
+        this->editor->register_plugin();
+    }
 
     QAction* quit_action = new QAction(ima::icon("exit"), "&Quit", this);
     // triggered=this->console.quit
@@ -405,23 +426,31 @@ void MainWindow::setup()
     restart_action->setShortcutContext(Qt::ApplicationShortcut);
     this->register_shortcut(restart_action, "_", "Restart");
 
-    file_menu_actions << file_switcher_action
+    import_data_action = new QAction(ima::icon("fileimport"), "Import data...", this);
+    import_data_action->setToolTip("Import delimited text data");
+    connect(import_data_action, &QAction::triggered, [this](){this->import_data();});
+
+    file_menu_actions << import_data_action << nullptr << file_switcher_action
                       << symbol_finder_action << nullptr
                       << restart_action << quit_action;
     this->set_splash("");
 
-    qDebug() << "  ..widgets";
-
     if (CONF_get("explorer", "enable").toBool()) {
         this->set_splash("Loading file explorer...");
-        this->explorer = new Explorer(this);
-        this->explorer->register_plugin();
+        this->defer_plugin("explorer", "File explorer", [this](){
+            this->explorer = new Explorer(this);
+            this->explorer->register_plugin();
+            return this->explorer;
+        });
     }
 
     if (CONF_get("historylog", "enable").toBool()) {
         this->set_splash("Loading history plugin...");
-        this->historylog = new HistoryLog(this);
-        this->historylog->register_plugin();
+        this->defer_plugin("historylog", "History log", [this](){
+            this->historylog = new HistoryLog(this);
+            this->historylog->register_plugin();
+            return this->historylog;
+        });
     }
 
     if (CONF_get("onlinehelp", "enable").toBool()) {
@@ -429,15 +458,34 @@ void MainWindow::setup()
         //plugins.onlinehelp import OnlineHelp
     }
 
-    this->set_splash("Loading project explorer...");
-    this->projects = new Projects(this);
-    this->projects->register_plugin();
-    this->project_path = this->projects->get_pythonpath(true);
-
+    {
+        this->set_splash("Loading project explorer...");
+        TimelineSpan span("plugin: project explorer", "plugin");
+        this->projects = new Projects(this);
+        this->projects->register_plugin();
+        this->project_path = this->projects->get_pythonpath(true);
+    }
 
     if (CONF_get("find_in_files", "enable").toBool()) {
-        this->findinfiles = new FindInFiles(this);
-        this->findinfiles->register_plugin();
+        this->defer_plugin("find_in_files", "Find in files", [this](){
+            this->findinfiles = new FindInFiles(this);
+            this->findinfiles->register_plugin();
+            return this->findinfiles;
+        });
+        // 插件构造之前，搜索菜单中的动作也先用占位的动作代替
+        if (this->deferred_plugins.contains("find_in_files")) {
+            QAction* findinfiles_action = new QAction(ima::icon("findf"), "&Find in files", this);
+            connect(findinfiles_action, &QAction::triggered, [this](){
+                SpyderPluginMixin* plugin = this->load_deferred_plugin("find_in_files");
+                if (plugin)
+                    plugin->switch_to_plugin();
+            });
+            findinfiles_action->setShortcut(QKeySequence(CONF_get("shortcuts", "_/switch to find_in_files").toString()));
+            findinfiles_action->setShortcutContext(Qt::WidgetShortcut);
+            findinfiles_action->setToolTip("Search text in multiple files");
+            this->search_menu_actions << nullptr << findinfiles_action;
+            this->search_toolbar_actions << nullptr << findinfiles_action;
+        }
     }
 
     this->set_splash("Loading namespace browser...");
@@ -526,10 +574,16 @@ void MainWindow::setup()
     this->help_menu_actions << nullptr << about_action;
 
     // 1057行
+    timeline->begin("status bar");
     mem_status = new MemoryStatus(this, status);
+    cpu_status = new CPUStatus(this, status);
+    latency_status = new LatencyStatus(this, status);
+    fileops_status = new FileOperationsStatus(this, status);
     this->apply_statusbar_settings();
+    timeline->end();
     //1061行到1076h行第三方插件不实现
 
+    timeline->begin("menus");
     this->plugins_menu = new QMenu("Panes", this);
 
     toolbars_menu = new QMenu("Toolbars", this);
@@ -589,10 +643,10 @@ void MainWindow::setup()
     add_actions(this->run_toolbar, this->run_toolbar_actions);
 
     this->apply_shortcuts();
+    timeline->end();
 
     emit all_actions_defined();
 
-    qDebug() << "Setting up window...";
     this->setup_layout(false);// 这里设置窗口布局
 
 
@@ -615,12 +669,12 @@ void MainWindow::setup()
         }
     }
 
-    qDebug() << "*** End of MainWindow setup ***";
     this->is_starting_up = false;
 }
 
 void MainWindow::post_visible_setup()
 {
+    TimelineSpan span("post_visible_setup");
     emit restore_scrollbar_position();
 
     foreach (QDockWidget* widget, this->floating_dockwidgets) {
@@ -642,14 +696,18 @@ void MainWindow::post_visible_setup()
 
     // 1237行到1246行需要实现
 
-    if (!this->open_project.isEmpty()) {
-        this->projects->open_project(this->open_project);
-    }
-    else {
-        this->projects->reopen_last_project();
+    {
+        TimelineSpan span("open files");
+        if (!this->open_project.isEmpty()) {
+            this->projects->open_project(this->open_project);
+        }
+        else {
+            this->projects->reopen_last_project();
 
-        if (this->projects->get_active_project() == nullptr)
-            this->editor->setup_open_files();
+            if (this->projects->get_active_project() == nullptr)
+                this->editor->setup_open_files();
+        }
+        this->editor->recover_unsaved_files();
     }
 
     if (!DEV && CONF_get("main", "check_updates_on_startup").toBool()) {
@@ -660,6 +718,117 @@ void MainWindow::post_visible_setup()
     this->report_missing_dependencies();
 
     this->is_setting_up = false;
+    // 在第一次进入事件循环时结束记录，包含首次绘制的时间
+    QTimer::singleShot(0, this, SLOT(report_startup_timeline()));
+}
+
+bool MainWindow::plugin_in_saved_layout(const QString &section)
+{
+    if (!CONF_get("main", "deferred_plugin_loading", true).toBool())
+        return true;
+    // "*"表示还没有保存过窗口布局
+    QStringList visible = CONF_get("main", "window/visible_plugins", QStringList("*")).toStringList();
+    return visible.contains("*") || visible.contains(section);
+}
+
+void MainWindow::defer_plugin(const QString &section, const QString &title,
+                              std::function<SpyderPluginMixin *()> factory)
+{
+    if (this->plugin_in_saved_layout(section)) {
+        TimelineSpan span(QString("plugin: %1").arg(section), "plugin");
+        factory();
+        return;
+    }
+
+    this->deferred_plugins[section] = factory;
+    QAction* action = new QAction(title, this);
+    action->setCheckable(true);
+    QString shortcut = CONF_get("shortcuts", QString("_/switch to %1").arg(section)).toString();
+    if (!shortcut.isEmpty()) {
+        action->setShortcut(QKeySequence(shortcut));
+        action->setShortcutContext(Qt::ApplicationShortcut);
+    }
+    connect(action, &QAction::triggered, [this, section](){
+        SpyderPluginMixin* plugin = this->load_deferred_plugin(section);
+        if (plugin)
+            plugin->switch_to_plugin();
+    });
+    this->deferred_actions[section] = action;
+}
+
+SpyderPluginMixin* MainWindow::load_deferred_plugin(const QString &section)
+{
+    if (!this->deferred_plugins.contains(section)) {
+        foreach (SpyderPluginMixin* plugin, this->widgetlist) {
+            if (plugin->CONF_SECTION == section)
+                return plugin;
+        }
+        return nullptr;
+    }
+
+    TraceSpan span("load deferred plugin", "plugin");
+    std::function<SpyderPluginMixin*()> factory = this->deferred_plugins.take(section);
+    SpyderPluginMixin* plugin = factory();
+    // 有保存的位置就恢复，否则保留add_dockwidget中的默认位置
+    this->restoreDockWidget(plugin->dockwidget);
+    this->apply_panes_settings();
+
+    QAction* stub = this->deferred_actions.take(section);
+    if (stub) {
+        QAction* action = plugin->toggle_view_action;
+        action->setChecked(plugin->dockwidget->isVisible());
+        this->plugins_menu->insertAction(stub, action);
+        this->plugins_menu->removeAction(stub);
+        int index = this->plugins_menu_actions.indexOf(stub);
+        if (index > -1)
+            this->plugins_menu_actions[index] = action;
+        stub->deleteLater();
+    }
+    return plugin;
+}
+
+void MainWindow::load_deferred_plugins()
+{
+    foreach (const QString& section, this->deferred_plugins.keys())
+        this->load_deferred_plugin(section);
+}
+
+void MainWindow::report_startup_timeline()
+{
+    Timeline* timeline = Timeline::startup();
+    if (!timeline->is_recording())
+        return;
+    timeline->finish();
+    // 摘要只在调试模式下输出，完整的时间线用SPYDER_STARTUP_TRACE或--profile导出
+    if (DEBUG)
+        qDebug().noquote() << "Startup timeline:\n" + timeline->summary();
+
+    QString filename = QString::fromLocal8Bit(qgetenv("SPYDER_STARTUP_TRACE"));
+    if (filename.isEmpty() && this->profile)
+        filename = get_conf_path("startup_trace.json");
+    if (!filename.isEmpty() && timeline->dump(filename) && DEBUG)
+        qDebug() << "Startup trace written to" << filename;
+}
+
+void MainWindow::toggle_tracing(bool enabled)
+{
+    if (enabled)
+        Tracer::instance()->clear();
+    Tracer::set_enabled(enabled);
+    if (this->latency_status != nullptr)
+        this->latency_status->set_tracing(enabled);
+}
+
+void MainWindow::save_trace()
+{
+    QString filename = QFileDialog::getSaveFileName(this, "Save performance trace",
+                                                    get_conf_path("trace.json"),
+                                                    "Chrome trace (*.json)");
+    if (filename.isEmpty())
+        return;
+    if (!Tracer::instance()->dump(filename))
+        QMessageBox::critical(this, "Save performance trace",
+                              QString("Unable to save trace to <b>%1</b>").arg(filename));
 }
 
 void MainWindow::set_window_title()
@@ -804,6 +973,16 @@ void MainWindow::save_current_window_settings(const QString &prefix, const QStri
         CONF_set(section, prefix+"state", qbytearray_to_str(qba));
     }
     CONF_set(section, prefix+"statusbar", !this->statusBar()->isHidden());
+
+    if (prefix == "window/" && !none_state) {
+        // 记录布局中的插件(包括被其他标签页遮住的)，下次启动时其余插件延迟构造
+        QStringList visible_plugins;
+        foreach (SpyderPluginMixin* plugin, this->widgetlist) {
+            if (plugin->dockwidget && !plugin->dockwidget->isHidden())
+                visible_plugins.append(plugin->CONF_SECTION);
+        }
+        CONF_set(section, prefix+"visible_plugins", visible_plugins);
+    }
 }
 
 void MainWindow::tabify_plugins(SpyderPluginMixin *first, SpyderPluginMixin *second)
@@ -814,8 +993,13 @@ void MainWindow::tabify_plugins(SpyderPluginMixin *first, SpyderPluginMixin *sec
 // --- Layouts
 void MainWindow::setup_layout(bool _default)
 {
+    TimelineSpan span("setup_layout");
     QString prefix = "window/";
-    WindowSettings settings = this->load_window_settings(prefix, _default);
+    WindowSettings settings;
+    {
+        TimelineSpan span("load window settings");
+        settings = this->load_window_settings(prefix, _default);
+    }
     QString hexstate = settings.hexstate;
 
     this->first_spyder_run = false;
@@ -909,6 +1093,29 @@ void MainWindow::setup_default_layouts(int index, const WindowSettings& settings
     tmp.append(QList<SpyderPluginMixin*>({this->historylog}));//在这一行加ipyconsole
     widgets_layout.append(tmp);
 
+    // 延迟构造或被禁用的插件在这里是nullptr，去掉空的行和列
+    QList<QList<QList<SpyderPluginMixin*>>> layout;
+    QList<double> widths;
+    QList<QList<double>> heights;
+    for (int c = 0; c < widgets_layout.size(); ++c) {
+        QList<QList<SpyderPluginMixin*>> column;
+        QList<double> column_heights;
+        for (int r = 0; r < widgets_layout[c].size(); ++r) {
+            QList<SpyderPluginMixin*> row = widgets_layout[c][r];
+            row.removeAll(nullptr);
+            if (!row.isEmpty()) {
+                column.append(row);
+                column_heights.append(height_fraction[c][r]);
+            }
+        }
+        if (!column.isEmpty()) {
+            layout.append(column);
+            widths.append(width_fraction[c]);
+            heights.append(column_heights);
+        }
+    }
+    widgets_layout = layout;
+
     QList<SpyderPluginMixin*> widgets;
     foreach (auto column, widgets_layout) {
         foreach (auto row, column) {
@@ -972,7 +1179,7 @@ void MainWindow::setup_default_layouts(int index, const WindowSettings& settings
     // fix column width
     for (int c = 0; c < widgets_layout.size(); ++c) {
         auto widget = widgets_layout[c][0][0]->dockwidget;
-        int new_width = static_cast<int>(width_fraction[c] * width * 0.95);
+        int new_width = static_cast<int>(widths[c] * width * 0.95);
         widget->setMinimumWidth(new_width);
         widget->setMinimumWidth(new_width);
         widget->updateGeometry();
@@ -983,7 +1190,7 @@ void MainWindow::setup_default_layouts(int index, const WindowSettings& settings
         auto column = widgets_layout[c];
         for (int r = 0; r < column.size()-1; ++r) {
             auto widget = column[r][0]->dockwidget;
-            int new_height = static_cast<int>(height_fraction[c][r] * height * 0.95);
+            int new_height = static_cast<int>(heights[c][r] * height * 0.95);
             widget->setMinimumWidth(new_height);
             widget->setMinimumWidth(new_height);
         }
@@ -1098,8 +1305,10 @@ void MainWindow::reset_window_layout()
                                                               "this affects window position, size and dockwidgets.\n"
                                                               "Do you want to continue?",
                                                               QMessageBox::Yes | QMessageBox::No);
-    if (answer == QMessageBox::Yes)
+    if (answer == QMessageBox::Yes) {
+        this->load_deferred_plugins();
         this->setup_layout(true);
+    }
 }
 
 void MainWindow::quick_layout_save()
@@ -1118,6 +1327,7 @@ void MainWindow::quick_layout_settings()
 
 void MainWindow::quick_layout_switch(int index)
 {
+    this->load_deferred_plugins();
     QString section = "quick_layouts";
     WindowSettings settings;
     try {
@@ -1404,6 +1614,15 @@ void MainWindow::create_plugins_menu()
         else
             tmp.append(action);
     }
+    foreach (const QString& name, this->deferred_actions.keys()) {
+        QAction* action = this->deferred_actions[name];
+        int pos = order.indexOf(name);
+
+        if (pos > -1)
+            tmp[pos] = action;
+        else
+            tmp.append(action);
+    }
     QList<QAction*> actions = tmp;
     foreach (QAction* action, tmp) {
         if (action == nullptr)
@@ -1981,12 +2200,32 @@ void MainWindow::open_file(QString fname, bool external)
     if (encoding::is_text_file(fname))
         this->editor->load(fname);
     //elif this->variableexplorer is not nullptr; and ext in IMPORT_EXT:
+    else if (ext == ".npy") {
+        // 内存映射打开，没有变量浏览器可以写回，所以只读
+        ArrayEditor* dialog = new ArrayEditor(this);
+        if (dialog->setup_and_check_npy(fname, "", true))
+            dialog->show();
+    }
     else if (!external) {
         fname = file_uri(fname);
         programs::start_file(fname);
     }
 }
 
+// 在后台解析分隔符文本，数值数据用数组编辑器打开
+void MainWindow::import_data(QString fname)
+{
+    if (fname.isEmpty()) {
+        fname = QFileDialog::getOpenFileName(this, "Import data", misc::getcwd_or_home(),
+                                             "Delimited text (*.csv *.tsv *.txt *.dat);;"
+                                             "All files (*)");
+        if (fname.isEmpty())
+            return;
+    }
+    ImportWizard* wizard = new ImportWizard(this, fname);
+    wizard->show();
+}
+
 void MainWindow::open_external_file(const QString& fname)
 {
     QFileInfo info(fname);
@@ -2108,6 +2347,11 @@ void MainWindow::apply_statusbar_settings()
             mem_status->setVisible(CONF_get("main", QString("%1/enable").arg(name)).toBool());
             mem_status->set_interval(CONF_get("main", QString("%1/timeout").arg(name)).toInt());
         }
+        if (this->cpu_status != nullptr) {
+            QString name = "cpu_usage";
+            cpu_status->setVisible(CONF_get("main", QString("%1/enable").arg(name)).toBool());
+            cpu_status->set_interval(CONF_get("main", QString("%1/timeout").arg(name)).toInt());
+        }
     }
     else
         return;
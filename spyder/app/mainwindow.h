@@ -13,6 +13,10 @@
 #include "widgets/reporterror.h"
 #include "widgets/pathmanager.h"
 #include "widgets/ipythonconsole/control.h"
+#include "widgets/variableexplorer/arrayeditor.h"
+#include "widgets/variableexplorer/importwizard.h"
+#include "utils/timeline.h"
+#include <functional>
 
 #include "plugins/maininterpreter.h"
 
@@ -127,6 +131,9 @@ public:
 
     // Status bar widgets
     MemoryStatus* mem_status;
+    CPUStatus* cpu_status;
+    LatencyStatus* latency_status;
+    FileOperationsStatus* fileops_status;
 
     // Toolbars
     QList<QToolBar*> visible_toolbars;
@@ -162,6 +169,11 @@ public:
 
     QList<SpyderPluginMixin*> widgetlist;//487行
 
+    // 上次退出时界面中没有的插件延迟到第一次显示时才构造，
+    // 在此之前Panes菜单中只有一个占位的动作
+    QMap<QString, std::function<SpyderPluginMixin*()>> deferred_plugins;
+    QHash<QString, QAction*> deferred_actions;
+
     bool already_closed;
     bool is_starting_up;
     bool is_setting_up;
@@ -187,6 +199,7 @@ public:
     QAction* toggle_previous_layout_action;
     QAction* file_switcher_action;
     QAction* symbol_finder_action;
+    QAction* import_data_action;
 
     QAction* wp_action;//723行
 
@@ -213,6 +226,11 @@ public:
                              int iconsize=24);
     void setup();
     void post_visible_setup();
+    bool plugin_in_saved_layout(const QString& section);
+    void defer_plugin(const QString& section, const QString& title,
+                      std::function<SpyderPluginMixin*()> factory);
+    SpyderPluginMixin* load_deferred_plugin(const QString& section);
+    void load_deferred_plugins();
     void set_window_title();
     void report_missing_dependencies();
 
@@ -257,6 +275,7 @@ public:
     QString render_issue(QString description="", const QString& traceback="");
 
     void open_file(QString fname, bool external=false);
+    void import_data(QString fname=QString());
     QStringList get_spyder_pythonpath() const;
     void add_path_to_sys_path();
     void remove_path_from_sys_path();
@@ -285,6 +304,9 @@ public:
     void report_issue(const QString& body=QString(), const QString& title=QString(),
                       bool open_webpage=false);
 public slots:
+    void report_startup_timeline();
+    void toggle_tracing(bool enabled);
+    void save_trace();
     void toggle_previous_layout();
     void toggle_next_layout();
     void close_current_dockwidget();
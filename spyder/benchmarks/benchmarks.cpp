@@ -0,0 +1,656 @@
+#include "benchmarks.h"
+#include "configparser.h"
+#include "textwrap.h"
+#include "config/config_main.h"
+#include "nsview.h"
+#include "utils/diff.h"
+#include "utils/fileenum.h"
+#include "utils/historystore.h"
+#include "utils/introspection/completion_engine.h"
+#include "utils/localhistory.h"
+#include "utils/syntaxhighlighters.h"
+#include "widgets/editor.h"
+#include "widgets/editortools.h"
+#include "widgets/explorer.h"
+#include "widgets/fileswitcher.h"
+#include "widgets/findinfiles.h"
+#include "widgets/sourcecode/codeeditor.h"
+#include "widgets/sourcecode/diffgutter.h"
+#include "widgets/variableexplorer/collectionseditor.h"
+#include "widgets/variableexplorer/importengine.h"
+
+#include <QtTest>
+
+namespace {
+
+// 生成n行有代表性的python代码：类、函数、字符串、注释、括号
+QString make_python(int lines)
+{
+    QString text = "# -*- coding: utf-8 -*-\n\"\"\"Generated module.\"\"\"\nimport os\n\n";
+    int i = 0;
+    while (text.count('\n') < lines) {
+        text += QString("class Item%1(object):\n"
+                        "    \"\"\"Docstring of item %1.\"\"\"\n"
+                        "    def __init__(self, value=%1):\n"
+                        "        self.value = value  # comment %1\n"
+                        "\n"
+                        "    def compute(self, factor=0.5):\n"
+                        "        return [self.value * factor for _ in range(%1)]\n"
+                        "\n"
+                        "\n"
+                        "def helper_%1(path, name='item_%1'):\n"
+                        "    return os.path.join(path, name, str(Item%1().compute(2)))\n"
+                        "\n").arg(i);
+        i++;
+    }
+    return text;
+}
+
+QString make_cpp(int lines)
+{
+    QString text = "#include <vector>\n\n";
+    int i = 0;
+    while (text.count('\n') < lines) {
+        text += QString("/* Generated function %1\n"
+                        " * with a block comment */\n"
+                        "int compute_%1(const std::vector<int>& values)\n"
+                        "{\n"
+                        "    int total = %1; // line comment\n"
+                        "    for (int value : values)\n"
+                        "        total += value * 0x%1;\n"
+                        "    return total > 0 ? total : -1;\n"
+                        "}\n\n").arg(i);
+        i++;
+    }
+    return text;
+}
+
+QString make_markdown(int lines)
+{
+    QString text;
+    int i = 0;
+    while (text.count('\n') < lines) {
+        text += QString("# Section %1\n\n"
+                        "Some *emphasis* and **strong** text with `code` and a [link](http://example.com/%1).\n\n"
+                        "- first item\n- second item\n\n"
+                        "```python\nprint(%1)\n```\n\n").arg(i);
+        i++;
+    }
+    return text;
+}
+
+void add_line_counts()
+{
+    QTest::addColumn<int>("lines");
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+}
+
+template <typename Highlighter>
+void benchmark_highlighter(const QString& text)
+{
+    QTextDocument doc;
+    doc.setPlainText(text);
+    Highlighter highlighter(&doc, QFont("Monospace", 10), sh::get_color_scheme());
+    QBENCHMARK {
+        highlighter.rehighlight();
+    }
+}
+
+void write_file(const QString& filename, const QString& text)
+{
+    QFile file(filename);
+    file.open(QIODevice::WriteOnly);
+    file.write(text.toUtf8());
+    file.close();
+}
+
+// 多年积累的历史文件：n条命令
+QString make_history(int entries)
+{
+    QStringList lines;
+    for (int i = 0; i < entries; i++)
+        lines << QString("result_%1 = numpy.linspace(0, %1, num=%2)  # run %3")
+                 .arg(i % 997).arg(i % 50 + 10).arg(i);
+    return lines.join('\n') + '\n';
+}
+
+// 每层branches个子目录和files个文件，depth层
+void make_tree(const QString& path, int depth, int branches, int files, QStringList* dirs)
+{
+    QDir().mkpath(path);
+    if (dirs)
+        dirs->append(path);
+    for (int i = 0; i < files; i++)
+        write_file(QString("%1/file_%2.py").arg(path).arg(i), QString());
+    if (depth == 0)
+        return;
+    for (int i = 0; i < branches; i++)
+        make_tree(QString("%1/dir_%2").arg(path).arg(i), depth - 1, branches, files, dirs);
+}
+
+} // namespace
+
+// 模拟一个中等规模的项目：20个包，每个包10个模块
+void Benchmarks::initTestCase()
+{
+    QVERIFY(corpus.isValid());
+    python_text = make_python(2000);
+    QDir root(corpus.path());
+    for (int pkg = 0; pkg < 20; pkg++) {
+        QString package = QString("pkg_%1").arg(pkg);
+        QVERIFY(root.mkpath(package));
+        write_file(root.filePath(package + "/__init__.py"), QString());
+        for (int module = 0; module < 10; module++) {
+            QString filename = root.filePath(QString("%1/module_%2.py").arg(package).arg(module));
+            write_file(filename, make_python(200 + 20 * module));
+            python_files.append(filename);
+        }
+    }
+}
+
+void Benchmarks::highlight_python_data()
+{
+    add_line_counts();
+}
+
+void Benchmarks::highlight_python()
+{
+    QFETCH(int, lines);
+    benchmark_highlighter<sh::PythonSH>(make_python(lines));
+}
+
+void Benchmarks::highlight_cpp_data()
+{
+    add_line_counts();
+}
+
+void Benchmarks::highlight_cpp()
+{
+    QFETCH(int, lines);
+    benchmark_highlighter<sh::CppSH>(make_cpp(lines));
+}
+
+void Benchmarks::highlight_markdown_data()
+{
+    add_line_counts();
+}
+
+void Benchmarks::highlight_markdown()
+{
+    QFETCH(int, lines);
+    benchmark_highlighter<sh::MarkdownSH>(make_markdown(lines));
+}
+
+// 配色改变时按记录的记号重新设置格式，和highlight_python比较
+void Benchmarks::restyle_python_data()
+{
+    add_line_counts();
+}
+
+void Benchmarks::restyle_python()
+{
+    QFETCH(int, lines);
+    QTextDocument doc;
+    doc.setPlainText(make_python(lines));
+    sh::PythonSH highlighter(&doc, QFont("Monospace", 10), sh::get_color_scheme());
+    highlighter.rehighlight();
+    QBENCHMARK {
+        highlighter.set_color_scheme(sh::get_color_scheme());
+        highlighter.restyle_blocks(0, doc.blockCount() - 1);
+    }
+}
+
+void Benchmarks::search_thread()
+{
+    QList<QPair<QString,QString>> texts;
+    texts.append(qMakePair(QString("compute"), QString("compute")));
+    SearchThread thread(nullptr);
+    thread.initialize(StruNotSave(corpus.path(), false, QString(), texts, false, true));
+    QBENCHMARK {
+        thread.find_files_in_path(corpus.path());
+    }
+}
+
+void Benchmarks::outline_populate_branch()
+{
+    QString filename = corpus.filePath("outline.py");
+    write_file(filename, python_text);
+    CodeEditor editor(nullptr);
+    editor.setup_editor(QHash<QString,QVariant>());
+    editor.set_text_from_file(filename);
+    OutlineExplorerTreeWidget tree(nullptr);
+    QBENCHMARK {
+        FileRootItem* root_item = new FileRootItem(filename, &tree);
+        tree.populate_branch(&editor, root_item);
+        delete root_item;
+    }
+}
+
+void Benchmarks::brace_matching()
+{
+    CodeEditor editor(nullptr);
+    editor.setup_editor(QHash<QString,QVariant>());
+    editor.setPlainText("result = compute(" + python_text + ")\n");
+    int position = editor.toPlainText().indexOf('(');
+    QBENCHMARK {
+        editor.find_brace_match(position, '(', true);
+    }
+}
+
+void Benchmarks::mark_occurrences()
+{
+    CodeEditor editor(nullptr);
+    editor.setup_editor(QHash<QString,QVariant>());
+    editor.setPlainText(python_text);
+    QTextCursor cursor = editor.textCursor();
+    cursor.setPosition(editor.toPlainText().indexOf("value") + 1);
+    editor.setTextCursor(cursor);
+    QBENCHMARK {
+        editor.__mark_occurrences();
+    }
+}
+
+// 5万行的文档中打字后更新补全索引，只重新扫描改动的块
+void Benchmarks::completion_typing()
+{
+    QTextDocument document(make_python(50000));
+    CompletionEngine* engine = CompletionEngine::instance();
+    engine->add_document(&document);
+    engine->update_index();
+    QVERIFY(!engine->complete("helper_4", &document).isEmpty());
+
+    QTextCursor cursor(document.findBlockByNumber(25000));
+    cursor.movePosition(QTextCursor::EndOfBlock);
+    int i = 0;
+    QBENCHMARK {
+        cursor.insertText(QString(" typed_word_%1").arg(i++));
+        engine->update_index();
+    }
+    QVERIFY(!engine->complete("typed_word_", &document).isEmpty());
+    cursor.select(QTextCursor::BlockUnderCursor);
+    cursor.removeSelectedText();
+    engine->update_index();
+    QVERIFY(engine->complete("typed_word_", &document).isEmpty());
+}
+
+void Benchmarks::editorstack_load()
+{
+    EditorStack stack(nullptr, QList<QAction*>());
+    QString filename = python_files.last();
+    QBENCHMARK {
+        stack.load(filename);
+        stack.close_file(0, true);
+    }
+}
+
+void Benchmarks::editorstack_save()
+{
+    QString filename = corpus.filePath("save.py");
+    write_file(filename, python_text);
+    EditorStack stack(nullptr, QList<QAction*>());
+    QVERIFY(stack.load(filename) != nullptr);
+    QBENCHMARK {
+        stack.save(0, true);
+    }
+    stack.close_file(0, true);
+}
+
+void Benchmarks::config_get()
+{
+    QBENCHMARK {
+        CONF_get("editor", "wrap");
+    }
+}
+
+void Benchmarks::userconfig_get()
+{
+    UserConfig config("benchmarks", DEFAULTS, false);
+    QBENCHMARK {
+        config.get("editor", "code_folding");
+    }
+}
+
+void Benchmarks::textwrap_wrap()
+{
+    QString paragraph;
+    for (int i = 0; i < 500; i++)
+        paragraph += QString("Word%1 and some more text, ").arg(i);
+    QBENCHMARK {
+        textwrap::wrap(paragraph, 79);
+    }
+}
+
+void Benchmarks::fileswitcher_filter()
+{
+    EditorStack stack(nullptr, QList<QAction*>());
+    for (int i = 0; i < 50; i++)
+        stack.load(python_files[i]);
+    FileSwitcher switcher(&stack, &stack, stack.tabs, stack.data, QIcon());
+    switcher.set_search_text("modu");
+    QBENCHMARK {
+        switcher.setup();
+    }
+}
+
+// 项目浏览器：展开一棵较深的目录树(127个目录、约3800个文件)，
+// 每次迭代重新设置过滤条件后对所有目录计算行数
+void Benchmarks::project_tree_filter()
+{
+    QString root = corpus.filePath("tree");
+    QString project = root + "/project";
+    QStringList dirs;
+    make_tree(project, 6, 2, 30, &dirs);
+    make_tree(root + "/other", 2, 2, 30, nullptr);
+
+    QFileSystemModel model;
+    ProxyModel proxy(nullptr);
+    proxy.setSourceModel(&model);
+    model.setRootPath(root);
+    foreach (const QString& dir, dirs) {
+        QModelIndex index = model.index(dir);
+        int expected = QDir(dir).entryList(QDir::AllEntries | QDir::NoDotAndDotDot).size();
+        model.fetchMore(index);
+        QTRY_COMPARE_WITH_TIMEOUT(model.rowCount(index), expected, 10000);
+    }
+
+    QBENCHMARK {
+        proxy.setup_filter(root, QStringList(project));
+        foreach (const QString& dir, dirs)
+            proxy.rowCount(proxy.mapFromSource(model.index(dir)));
+    }
+    QCOMPARE(proxy.rowCount(proxy.mapFromSource(model.index(root))), 1);
+}
+
+// 历史记录：20万条记录的文件，打开后只读入最后100条
+void Benchmarks::history_read_tail()
+{
+    QString filename = corpus.filePath("history_tail.py");
+    write_file(filename, make_history(200000));
+    HistoryStore store(filename, 1000000);
+
+    QStringList entries;
+    QBENCHMARK {
+        entries = store.read_tail(100);
+    }
+    QCOMPARE(entries.size(), 100);
+    QVERIFY(entries.last().endsWith("# run 199999"));
+    QCOMPARE(store.read_older(100).size(), 100);
+}
+
+// 后台建立索引后在全部20万条记录中查找
+void Benchmarks::history_search()
+{
+    QString filename = corpus.filePath("history_search.py");
+    write_file(filename, make_history(200000));
+    HistoryStore store(filename, 1000000);
+    QTRY_VERIFY_WITH_TIMEOUT(store.index_ready(), 30000);
+
+    QStringList results;
+    QBENCHMARK {
+        results = store.search("result_99 linsp");
+    }
+    QVERIFY(!results.isEmpty());
+    QVERIFY(results.first().startsWith("result_99 "));
+}
+
+// 本地历史：切分1MB的文件；改动一行后只有少数几块和原来不同
+void Benchmarks::local_history_chunking()
+{
+    QByteArray data = make_python(30000).toUtf8();
+    QVector<int> boundaries;
+    QBENCHMARK {
+        boundaries = LocalHistory::chunk_boundaries(data);
+    }
+    QCOMPARE(boundaries.last(), data.size());
+
+    auto chunk_set = [](const QByteArray& bytes) {
+        QSet<QByteArray> chunks;
+        int start = 0;
+        foreach (int end, LocalHistory::chunk_boundaries(bytes)) {
+            chunks.insert(QCryptographicHash::hash(bytes.mid(start, end - start),
+                                                   QCryptographicHash::Sha1));
+            start = end;
+        }
+        return chunks;
+    };
+    QByteArray edited = data;
+    edited.insert(data.size() / 2, "# inserted line\n");
+    QSet<QByteArray> before = chunk_set(data);
+    QSet<QByteArray> after = chunk_set(edited);
+    QVERIFY(after.size() - QSet<QByteArray>(after).intersect(before).size() <= 2);
+}
+
+// 5万行的文件中分散的20处修改
+void Benchmarks::diff_lines()
+{
+    QStringList old_lines = make_python(50000).split('\n');
+    QStringList new_lines = old_lines;
+    for (int i = 0; i < 20; i++)
+        new_lines[i * 2400 + 7] += "  # changed";
+    new_lines.insert(30000, "inserted = True");
+    new_lines.removeAt(45000);
+
+    QVector<DiffHunk> hunks;
+    QBENCHMARK {
+        hunks = diff::diff_lines(old_lines, new_lines);
+    }
+    QVERIFY(hunks.size() >= 20);
+}
+
+// 5万行的文件中打字：每次按键更新dirty范围，再只比较这个范围(不经过后台线程和计时器)
+void Benchmarks::diff_gutter_typing()
+{
+    QString text = make_python(50000);
+    QTextDocument document(text);
+    DiffGutter* gutter = DiffGutter::for_document(&document);
+    QStringList base = DiffWorker::split_lines(text);
+    for (int i = 0; i < 20; i++)
+        base[i * 2400 + 7] += "  # changed";
+    gutter->set_base_text(base);
+    QCOMPARE(gutter->changes().size(), 20);
+
+    QTextCursor cursor(document.findBlockByNumber(25000));
+    cursor.movePosition(QTextCursor::EndOfBlock);
+    QBENCHMARK {
+        cursor.insertText("x");
+        DiffJob job = gutter->dirty_job();
+        DiffWorker::compute(job);
+        gutter->diff_finished(job);
+    }
+    QCOMPARE(gutter->mark(25000), DiffGutter::MODIFIED);
+    QCOMPARE(gutter->mark(25001), DiffGutter::NONE);
+}
+
+// 注释并取消注释5万行，每次都只是一步撤销
+void Benchmarks::comment_lines()
+{
+    CodeEditor editor(nullptr);
+    QHash<QString,QVariant> kwargs;
+    kwargs["language"] = "py";
+    editor.setup_editor(kwargs);
+    QString text = make_python(50000);
+    editor.setPlainText(text);
+
+    QBENCHMARK {
+        int undo_steps = editor.document()->availableUndoSteps();
+        editor.selectAll();
+        editor.comment();
+        QCOMPARE(editor.document()->availableUndoSteps(), undo_steps + 1);
+        editor.selectAll();
+        editor.uncomment();
+    }
+    QCOMPARE(editor.toPlainText(), text);
+}
+
+// 一百万项的字典：打开、显示第一屏、按值和按键排序
+void Benchmarks::collections_model_sort()
+{
+    QHash<QString, QVariant> dict;
+    dict.reserve(1000000);
+    int largest = 0;
+    for (int i = 0; i < 1000000; i++) {
+        int value = (i * 7919) % 1000003;
+        dict.insert(QString("key_%1").arg(i), value);
+        largest = qMax(largest, value);
+    }
+
+    QBENCHMARK {
+        CollectionsModel model(nullptr, dict);
+        for (int row = 0; row < model.rowCount(); row++)
+            model.data(model.index(row, 3));
+        model.sort(3, Qt::DescendingOrder);
+        model.sort(0);
+        QCOMPARE(model.get_key(model.index(0, 0)).toString(), QString("key_0"));
+    }
+
+    // 点击表头排序后重新设置数据，仍按原来的列和顺序排列
+    CollectionsModel model(nullptr, dict);
+    CollectionsEditorTableView view(nullptr, &model);
+    view.sortByColumn(3, Qt::DescendingOrder);
+    model.set_data(dict);
+    QCOMPARE(model.get_value(model.index(0, 3)).toInt(), largest);
+}
+
+// 1000个各有10000个元素的列表
+void Benchmarks::value_to_display_nested()
+{
+    QList<QVariant> inner;
+    for (int i = 0; i < 10000; i++)
+        inner.append(i);
+    QList<QVariant> outer;
+    for (int i = 0; i < 1000; i++)
+        outer.append(QVariant(inner));
+    QVariant value(outer);
+
+    QString display;
+    QBENCHMARK {
+        display = value_to_display(value);
+    }
+    QVERIFY(display.endsWith(" ..."));
+}
+
+// 解析约22MB的CSV(整数、浮点、布尔和带引号的文本列)，单线程和并行各一次，吞吐量为文件大小/耗时
+void Benchmarks::import_delimited_data()
+{
+    QTest::addColumn<int>("nthreads");
+    QTest::newRow("serial") << 1;
+    QTest::newRow("parallel") << 0;
+}
+
+void Benchmarks::import_delimited()
+{
+    QFETCH(int, nthreads);
+    QString filename = corpus.filePath("import.csv");
+    const int rows = 500000;
+    if (!QFile::exists(filename)) {
+        QString text;
+        text.reserve(rows * 70);
+        text += "id,value,ratio,flag,name\n";
+        for (int i = 0; i < rows; i++)
+            text += QString("%1,%2,%3,%4,\"item, %1\"\n").arg(i).arg(i * 37 % 100003)
+                    .arg(i * 0.001, 0, 'f', 6).arg(i % 2 ? "true" : "false");
+        write_file(filename, text);
+    }
+
+    ImportOptions options;
+    options.skiprows = 1;
+    DelimitedParser parser(options);
+    QVERIFY(parser.open(filename));
+    QVector<ImportColumn> columns;
+    QBENCHMARK {
+        QVERIFY(parser.parse(&columns, nthreads));
+    }
+    QCOMPARE(columns.size(), 5);
+    QCOMPARE(columns[0].size(), rows);
+    QCOMPARE(int(columns[0].type), int(ImportColumn::Int));
+    QCOMPARE(int(columns[2].type), int(ImportColumn::Float));
+    QCOMPARE(int(columns[3].type), int(ImportColumn::Bool));
+    QCOMPARE(columns[4].value(rows - 1).toString(), QString("item, %1").arg(rows - 1));
+}
+
+// 项目中build、node_modules各有几千个文件，.gitignore忽略它们和日志文件，
+// 子目录中的.ignore再忽略一个子树
+void Benchmarks::enumerate_ignored_tree()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString root = dir.path();
+    make_tree(root + "/src", 3, 2, 20, nullptr);
+    make_tree(root + "/build", 4, 3, 30, nullptr);
+    make_tree(root + "/node_modules", 3, 4, 30, nullptr);
+    write_file(root + "/.gitignore", "build/\nnode_modules/\n*.log\n!keep.log\n");
+    write_file(root + "/src/.ignore", "/dir_0/dir_1/\n");
+    write_file(root + "/src/debug.log", QString());
+    write_file(root + "/src/keep.log", QString());
+
+    int files = 0;
+    int dirs_read = 0;
+    QBENCHMARK {
+        fileenum::FileEnumerator enumerator(root);
+        enumerator.set_use_git(false);
+        files = 0;
+        // Windows上.gitignore和.ignore不是隐藏文件，不计入
+        enumerator.walk([&files](const QString& path) {
+            if (!path.contains("/."))
+                files++;
+            return true;
+        });
+        dirs_read = enumerator.dirs_read();
+    }
+    // src下15个目录去掉被忽略的3个，每个20个文件，加上keep.log
+    QCOMPARE(files, 12 * 20 + 1);
+    QCOMPARE(dirs_read, 13);
+
+    fileenum::ExcludeMatcher matcher = fileenum::ExcludeMatcher::from_globs(EXCLUDE_PATTERNS.join(','));
+    QVERIFY(matcher.is_valid());
+    QVERIFY(matcher.matches(root + "/src/data.csv", "data.csv", false));
+    QVERIFY(!matcher.matches(root + "/src/file_0.py", "file_0.py", false));
+}
+
+// 打开含有1MB和10MB单行(压缩过的数据)的文件后滚动，每一帧都应该能及时画完
+void Benchmarks::long_line_scrolling_data()
+{
+    QTest::addColumn<int>("megabytes");
+    QTest::newRow("1MB") << 1;
+    QTest::newRow("10MB") << 10;
+}
+
+void Benchmarks::long_line_scrolling()
+{
+    QFETCH(int, megabytes);
+    QString line = "data = [";
+    line.reserve(megabytes * 1024 * 1024 + 16);
+    for (int i = 0; line.size() < megabytes * 1024 * 1024; i++)
+        line += QString("{'id':%1,'name':\"item%1\",'tags':['a','b']},").arg(i);
+    line += "]";
+    QString text = make_python(200) + line + "\n" + make_python(200);
+
+    CodeEditor editor(nullptr);
+    QHash<QString,QVariant> kwargs;
+    kwargs["language"] = "py";
+    kwargs["wrap"] = true;
+    editor.setup_editor(kwargs);
+    editor.resize(1000, 700);
+    editor.set_text(text);
+    QVERIFY(editor.is_long_line_guarded());
+    QVERIFY(editor.wordWrapMode() == QTextOption::NoWrap);
+
+    QImage image(editor.viewport()->size(), QImage::Format_ARGB32);
+    editor.viewport()->render(&image);
+
+    QScrollBar* vbar = editor.verticalScrollBar();
+    QScrollBar* hbar = editor.horizontalScrollBar();
+    qint64 slowest = 0;
+    QBENCHMARK {
+        for (int step = 0; step < 20; step++) {
+            QElapsedTimer timer;
+            timer.start();
+            vbar->setValue(vbar->maximum() * step / 19);
+            hbar->setValue(hbar->maximum() * (step % 5) / 4);
+            editor.viewport()->render(&image);
+            slowest = qMax(slowest, timer.elapsed());
+        }
+    }
+    QVERIFY2(slowest < 100, qPrintable(QString("slowest frame took %1 ms").arg(slowest)));
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <QObject>
+#include <QStringList>
+#include <QTemporaryDir>
+
+// 每个槽是一项QBENCHMARK，测试用的文件在initTestCase中生成到临时目录
+class Benchmarks : public QObject
+{
+    Q_OBJECT
+private:
+    QTemporaryDir corpus;
+    QStringList python_files;
+    QString python_text;
+
+private slots:
+    void initTestCase();
+
+    void highlight_python_data();
+    void highlight_python();
+    void highlight_cpp_data();
+    void highlight_cpp();
+    void highlight_markdown_data();
+    void highlight_markdown();
+    void restyle_python_data();
+    void restyle_python();
+
+    void search_thread();
+    void outline_populate_branch();
+    void brace_matching();
+    void mark_occurrences();
+    void completion_typing();
+    void editorstack_load();
+    void editorstack_save();
+    void config_get();
+    void userconfig_get();
+    void textwrap_wrap();
+    void fileswitcher_filter();
+    void project_tree_filter();
+    void history_read_tail();
+    void history_search();
+    void local_history_chunking();
+    void diff_lines();
+    void diff_gutter_typing();
+    void comment_lines();
+    void collections_model_sort();
+    void value_to_display_nested();
+    void import_delimited_data();
+    void import_delimited();
+    void enumerate_ignored_tree();
+    void long_line_scrolling_data();
+    void long_line_scrolling();
+};
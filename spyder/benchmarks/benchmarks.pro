@@ -0,0 +1,23 @@
+# 性能基准测试，和spyder.pro共用源文件，无界面(offscreen)运行：
+#   qmake benchmarks.pro && make
+#   ./benchmarks -json results.json
+#   python compare.py baseline.json results.json
+# 其余参数交给QtTest，例如只运行一项：./benchmarks highlight_python
+
+QT += testlib
+
+TARGET = benchmarks
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(../spyder.pri)
+
+SOURCES += \
+    main.cpp \
+    benchmarks.cpp
+
+HEADERS += \
+    benchmarks.h
@@ -0,0 +1,68 @@
+# -*- coding: utf-8 -*-
+"""Compare two benchmark result files written by ``benchmarks -json``.
+
+Usage: python compare.py baseline.json results.json [--threshold 10]
+
+Exits with status 1 when any benchmark is slower than the baseline by more
+than the threshold (in percent). A new baseline is just a results file
+copied from a run on the reference machine.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(filename):
+    with open(filename) as fp:
+        data = json.load(fp)
+    return {(item["name"], item["tag"]): item for item in data["benchmarks"]}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="allowed slowdown in percent (default: 10)")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+    regressions = 0
+    for key in sorted(set(baseline) | set(current)):
+        label = "%s[%s]" % key if key[1] else key[0]
+        if key not in current:
+            print("%-40s removed" % label)
+            continue
+        if key not in baseline:
+            print("%-40s new       %12.4f %s" % (label, current[key]["value"],
+                                                 current[key]["metric"]))
+            continue
+        old, new = baseline[key], current[key]
+        if old["metric"] != new["metric"]:
+            print("%-40s skipped   (metric %s -> %s)" % (label, old["metric"],
+                                                        new["metric"]))
+            continue
+        if old["value"] > 0:
+            change = (new["value"] - old["value"]) / old["value"] * 100
+        else:
+            change = 0.0
+        if change > args.threshold:
+            status = "REGRESSION"
+            regressions += 1
+        elif change < -args.threshold:
+            status = "improved"
+        else:
+            status = "ok"
+        print("%-40s %-10s %12.4f -> %12.4f %s (%+.1f%%)"
+              % (label, status, old["value"], new["value"], new["metric"],
+                 change))
+    if regressions:
+        print("%d benchmark(s) regressed by more than %g%%"
+              % (regressions, args.threshold))
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
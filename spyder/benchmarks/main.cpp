@@ -0,0 +1,95 @@
+#include "benchmarks.h"
+#include "config/config_main.h"
+
+#include <QApplication>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSettings>
+#include <QXmlStreamReader>
+#include <QtTest>
+
+// 把QtTest的xml结果转换为json，每项是{name, tag, metric, value, iterations}，
+// value是每次迭代的平均值
+static bool write_json(const QString& xml_path, const QString& json_path)
+{
+    QFile xml_file(xml_path);
+    if (!xml_file.open(QIODevice::ReadOnly))
+        return false;
+    QXmlStreamReader reader(&xml_file);
+    QJsonArray results;
+    QString function;
+    while (!reader.atEnd()) {
+        reader.readNext();
+        if (!reader.isStartElement())
+            continue;
+        QXmlStreamAttributes attributes = reader.attributes();
+        if (reader.name() == QLatin1String("TestFunction"))
+            function = attributes.value("name").toString();
+        else if (reader.name() == QLatin1String("BenchmarkResult")) {
+            QJsonObject result;
+            result["name"] = function;
+            result["tag"] = attributes.value("tag").toString();
+            result["metric"] = attributes.value("metric").toString();
+            result["value"] = attributes.value("value").toDouble();
+            result["iterations"] = attributes.value("iterations").toInt();
+            results.append(result);
+        }
+    }
+    xml_file.close();
+    if (reader.hasError())
+        return false;
+
+    QJsonObject root;
+    root["qt_version"] = QString(qVersion());
+    root["benchmarks"] = results;
+    QFile json_file(json_path);
+    if (!json_file.open(QIODevice::WriteOnly))
+        return false;
+    json_file.write(QJsonDocument(root).toJson());
+    json_file.close();
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    // 使用单独的设置，不影响spyder本身的配置
+    QCoreApplication::setOrganizationName("Quan");
+    QCoreApplication::setApplicationName("spyder-benchmarks");
+    qRegisterMetaType<ColorBoolBool>();
+    qRegisterMetaTypeStreamOperators<ColorBoolBool>("ColorBoolBool");
+    QApplication app(argc, argv);
+
+    QSettings settings;
+    foreach (auto pair, DEFAULTS) {
+        QString section = pair.first;
+        auto dict = pair.second;
+        foreach (QString key, dict.keys())
+            settings.setValue(section + '/' + key, dict[key]);
+    }
+
+    // -json <file>：另外把结果保存为json，其余参数交给QtTest
+    QStringList args = app.arguments();
+    QString json_path;
+    int index = args.indexOf("-json");
+    if (index != -1 && index + 1 < args.size()) {
+        json_path = args[index + 1];
+        args.removeAt(index + 1);
+        args.removeAt(index);
+    }
+    QTemporaryDir output_dir;
+    QString xml_path = output_dir.path() + "/benchmarks.xml";
+    if (!json_path.isEmpty())
+        args << "-o" << xml_path + ",xml" << "-o" << "-,txt";
+
+    Benchmarks benchmarks;
+    int result = QTest::qExec(&benchmarks, args);
+    if (!json_path.isEmpty() && !write_json(xml_path, json_path)) {
+        qWarning() << "Could not write" << json_path;
+        return 1;
+    }
+    return result;
+}
@@ -1,4 +1,5 @@
 #include "config_main.h"
+#include "utils/timeline.h"
 
 
 
@@ -54,6 +55,7 @@ QList<QPair<QString, QHash<QString,QVariant>>> DEFAULTS =
      {"show_internal_errors", true},
      {"check_updates_on_startup", true},
      {"toolbars_visible", true},
+     {"deferred_plugin_loading", true},
 
      {"font/family", MONOSPACE},
      {"font/size", 10},
@@ -156,6 +158,10 @@ QList<QPair<QString, QHash<QString,QVariant>>> DEFAULTS =
      {"blank_spaces", false},
      {"edge_line", true},
      {"edge_line_column", 79},
+     {"code_folding", true},
+     {"diff_gutter", true},
+     {"diff_gutter/base", "disk"},
+     {"crash_recovery", true},
      {"toolbox_panel", true},
      {"calltips", true},
      {"go_to_definition", true},
@@ -186,10 +192,18 @@ QList<QPair<QString, QHash<QString,QVariant>>> DEFAULTS =
     ("historylog", QHash<QString,QVariant>(
     {{"enable", true},
      {"max_entries", 100},
+     {"max_stored_entries", 100000},
      {"wrap", true},
      {"go_to_eof", true}
     })),
     QPair<QString, QHash<QString,QVariant>>
+    ("local_history", QHash<QString,QVariant>(
+    {{"enable", true},
+     {"max_snapshots", 1000},
+     {"max_age_days", 90},
+     {"max_size_mb", 256}
+    })),
+    QPair<QString, QHash<QString,QVariant>>
     ("help", QHash<QString,QVariant>(
     {{"enable", true},
      {"max_history_entries", 20},
@@ -421,7 +435,7 @@ QVariant get_default(const QString& section, const QString& option)
     return QVariant();
 }
 
-QVariant CONF_get(const QString& section, const QString& option, const QVariant& _default)
+static QVariant _conf_get(const QString& section, const QString& option, const QVariant& _default)
 {
     QSettings settings;
     if (!settings.contains(section+"/"+option)) {
@@ -440,6 +454,16 @@ QVariant CONF_get(const QString& section, const QString& option, const QVariant&
     return val;
 }
 
+QVariant CONF_get(const QString& section, const QString& option, const QVariant& _default)
+{
+    // 每次读取都会构造QSettings，启动时间线中统计其次数和耗时
+    QElapsedTimer timer;
+    timer.start();
+    QVariant val = _conf_get(section, option, _default);
+    Timeline::startup()->add_config_read(timer.nsecsElapsed());
+    return val;
+}
+
 void CONF_set(const QString& section, const QString& option, const QVariant& value)
 {
     QSettings settings;
@@ -2,6 +2,7 @@
 
 static QString SCALAR_COLOR = "#0000ff";
 static QString CUSTOM_TYPE_COLOR = "#7755aa";
+static const int DISPLAY_MAX_LENGTH = 70;
 
 int get_size(const QVariant& item)
 {
@@ -36,61 +37,87 @@ QString get_color_name(const QVariant& value)
     return CUSTOM_TYPE_COLOR;
 }
 
-QString collections_display(const QVariant& value,int level)
+// 有长度上限的输出：超过limit后不再追加，嵌套的列表和字典也不再展开，
+// 所以很大的集合只格式化开头的几个元素
+class DisplayWriter
 {
-    bool is_dict = (value.type() == QVariant::Hash);
-    QHash<QString,QVariant> elements_dict;
-    QList<QVariant> elements_list;
-    if (is_dict)
-        elements_dict = value.toHash();
-    else
-        elements_list = value.toList();
+public:
+    QString text;
+    int limit;
 
-    QString display;
+    DisplayWriter(int limit) : limit(limit) { text.reserve(limit + 1); }
+    bool full() const { return text.size() > limit; }
+    void write(const QString& str)
+    {
+        if (!full())
+            text.append(str.midRef(0, limit + 1 - text.size()));
+    }
+};
+
+static void write_collection(DisplayWriter& writer, const QVariant& value, int level);
+
+// 和value_to_display相同的格式，但不截断
+static void write_value(DisplayWriter& writer, const QVariant& value, int level)
+{
+    if (value.type() == QVariant::List || value.type() == QVariant::Hash)
+        write_collection(writer, value, level+1);
+    else if (value.type() == QVariant::String) { //如果是字符串
+        if (level > 0)
+            writer.write("'");
+        writer.write(value.toString());
+        if (level > 0)
+            writer.write("'");
+    }
+    else //如果是数字
+        writer.write(value.toString());
+}
+
+static void write_collection(DisplayWriter& writer, const QVariant& value, int level)
+{
+    bool is_dict = (value.type() == QVariant::Hash);
+    writer.write(is_dict ? "{" : "[");
     if (level <= 2) {
-        QStringList dispalys;
         if (is_dict) {
-            for (auto it =elements_dict.begin() ; it != elements_dict.end(); ++it) {
-                QString k = it.key();
-                QVariant v = it.value();
-                dispalys.append(value_to_display(k,level) + ':' +
-                                value_to_display(v,level));
+            const QHash<QString,QVariant> elements_dict = value.toHash();
+            for (auto it = elements_dict.constBegin(); it != elements_dict.constEnd() && !writer.full(); ++it) {
+                if (it != elements_dict.constBegin())
+                    writer.write(", ");
+                write_value(writer, it.key(), level);
+                writer.write(":");
+                write_value(writer, it.value(), level);
             }
         }
         else {
-            for (int i = 0; i < elements_list.size(); ++i) {
-                QVariant e = elements_list[i];
-                dispalys.append(value_to_display(e));
+            const QList<QVariant> elements_list = value.toList();
+            for (int i = 0; i < elements_list.size() && !writer.full(); ++i) {
+                if (i > 0)
+                    writer.write(", ");
+                write_value(writer, elements_list[i], 0);
             }
         }
-        display = dispalys.join(", ");
     }
     else
-        display = "...";
+        writer.write("...");
+    writer.write(is_dict ? "}" : "]");
+}
 
-    if (is_dict)
-        display = '{' + display + '}';
-    else
-        display = '[' + display + ']';
-    return display;
+// 最多返回DISPLAY_MAX_LENGTH+1个字符，由value_to_display截断
+QString collections_display(const QVariant& value,int level)
+{
+    DisplayWriter writer(DISPLAY_MAX_LENGTH);
+    write_collection(writer, value, level);
+    return writer.text;
 }
 
 QString value_to_display(const QVariant& value,int level)
 {
-    QString display;
-    if (value.type() == QVariant::List || value.type() == QVariant::Hash)
-        display = collections_display(value, level+1);
-    else if (value.type() == QVariant::String) { //如果是字符串
-        display = value.toString();
-        if (level > 0)
-            display = "'" + display + "'";
-    }
-    else //如果是数字
-        display = value.toString();
+    DisplayWriter writer(DISPLAY_MAX_LENGTH);
+    write_value(writer, value, level);
+    QString display = writer.text;
 
-    if (display.size() > 70) {
+    if (display.size() > DISPLAY_MAX_LENGTH) {
         QString ellipses = " ...";
-        display = rstrip(display.left(70)) + ellipses;
+        display = rstrip(display.left(DISPLAY_MAX_LENGTH)) + ellipses;
     }
     return display;
 }
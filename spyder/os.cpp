@@ -68,54 +68,4 @@ void makedirs(const QString& name)
 #endif
 
 
-bool walk(const QString& absolute_path, QStringList* list, const QString& exclude)
-{
-    QDir dir(absolute_path);
-    if (exclude.isEmpty()) {
-        foreach (QString relative_path, dir.entryList()) {
-            if (relative_path == "." || relative_path == "..")
-                continue;
-            QString absolute_sub_path = absolute_path+'/'+relative_path;
-            QFileInfo info(absolute_sub_path);
-            if (info.isDir()) {
-                if (relative_path == ".git" || relative_path == ".hg")
-                    continue;
-                walk(absolute_sub_path, list, exclude);
-            }
-            else if (info.isFile()) {
-                if (encoding::is_text_file(absolute_sub_path))
-                    list->append(absolute_sub_path);
-            }
-        }
-    }
-    else {
-        QRegularExpression re(exclude);
-        if (!re.isValid())
-            return false;
-        foreach (QString relative_path, dir.entryList()) {
-            if (relative_path == "." || relative_path == "..")
-                continue;
-            QString absolute_sub_path = absolute_path+'/'+relative_path;
-            QFileInfo info(absolute_sub_path);
-            if (info.isDir()) {
-                QRegularExpressionMatch match = re.match(absolute_sub_path+sep);
-                if (match.hasMatch())
-                    continue;
-                if (relative_path == ".git" || relative_path == ".hg")
-                    continue;
-                walk(absolute_sub_path, list, exclude);
-            }
-            else if (info.isFile()) {
-                QRegularExpressionMatch match = re.match(absolute_sub_path);
-                if (match.hasMatch())
-                    continue;
-                if (encoding::is_text_file(absolute_sub_path))
-                    list->append(absolute_sub_path);
-            }
-        }
-    }
-    return true;
-}
-
-
 } // namespace os
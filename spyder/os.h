@@ -26,6 +26,5 @@ void makedirs(const QString& name);
 extern QString name;
 extern QString linesep;
 
-bool walk(const QString& absolute_path, QStringList* list, const QString& exclude = QString());
 
 } // namespace os
@@ -13,6 +13,7 @@ HistoryLog::HistoryLog(MainWindow* parent)
     this->menu_actions = QList<QAction*>();
     //self.dockviewer = None 源码所有地方都没有用到dockviewer
     this->wrap_action = nullptr;
+    this->load_older_action = nullptr;
 
     this->editors = QList<CodeEditor*>();
     this->filenames = QStringList();
@@ -35,6 +36,20 @@ HistoryLog::HistoryLog(MainWindow* parent)
     options_button->setMenu(menu);
     this->tabwidget->setCornerWidget(options_button);
 
+    // 在所有历史文件的全部记录中查找，不只是已读入的部分
+    this->search_edit = new QLineEdit(this);
+    search_edit->setPlaceholderText("Search all history");
+    search_edit->setClearButtonEnabled(true);
+    connect(search_edit, SIGNAL(textChanged(QString)), SLOT(search_history()));
+    this->search_results = new QListWidget(this);
+    search_results->setToolTip("Double-click to copy the command to the clipboard");
+    search_results->hide();
+    connect(search_results, SIGNAL(itemActivated(QListWidgetItem*)),
+            SLOT(copy_search_result(QListWidgetItem*)));
+
+    layout->addWidget(this->search_edit);
+    layout->addWidget(this->search_results);
+
     this->find_widget = new FindReplace(this);
     find_widget->hide();
     this->register_widget_shortcuts(this->find_widget);
@@ -87,8 +102,12 @@ QList<QAction*> HistoryLog::get_plugin_actions()
     this->wrap_action->setCheckable(true);
     this->wrap_action->setChecked(this->get_option("wrap").toBool());
 
+    // 内容不足一屏时没有滚动条，不能靠滚动到顶读入更早的记录
+    this->load_older_action = new QAction("Load older entries", this);
+    connect(load_older_action, SIGNAL(triggered(bool)), SLOT(load_older_entries()));
+
     this->menu_actions.clear();
-    menu_actions << HistoryLog_action << wrap_action;
+    menu_actions << HistoryLog_action << wrap_action << load_older_action;
     return this->menu_actions;
 }
 
@@ -149,9 +168,11 @@ void HistoryLog::move_tab(int index_from, int index_to)
 {
     QString filename = this->filenames.takeAt(index_from);
     CodeEditor* editor = this->editors.takeAt(index_from);
+    HistoryStore* store = this->stores.takeAt(index_from);
 
     this->filenames.insert(index_to, filename);
     this->editors.insert(index_to, editor);
+    this->stores.insert(index_to, store);
 }
 
 void HistoryLog::add_history(const QString &filename)
@@ -178,26 +199,21 @@ void HistoryLog::add_history(const QString &filename)
     editor->set_font(this->get_plugin_font(), color_scheme);
     editor->toggle_wrap_mode(this->get_option("wrap").toBool());
 
-    QString text = encoding::read(filename);
-    text = sourcecode::normalize_eols(text);
-    QList<int> linebreaks;
-    QRegularExpression re("\n");
-    QRegularExpressionMatchIterator it = re.globalMatch(text);
-    while (it.hasNext()) {
-        QRegularExpressionMatch match = it.next();
-        linebreaks.append(match.capturedStart());
-    }
-    int maxNline = this->get_option("max_entries").toInt();
-    if (linebreaks.size() >maxNline) {
-        int idx = linebreaks.size() - maxNline - 1;
-        text = text.mid(linebreaks[idx]+1);
-        encoding::write(text, filename);
-    }
-    editor->set_text(text);
+    // 只读入最近的max_entries条，往上滚动到顶时再读更早的记录
+    editor->document()->setUndoRedoEnabled(false);
+    HistoryStore* store = new HistoryStore(filename, this->get_option("max_stored_entries").toInt(),
+                                           this);
+    connect(store, SIGNAL(sig_index_ready()), SLOT(search_history()));
+    editor->set_text(store->read_tail(this->get_option("max_entries").toInt()).join('\n'));
     editor->set_cursor_position("eof");
+    connect(editor->verticalScrollBar(), &QScrollBar::valueChanged, this, [this, editor](int value){
+        if (value == editor->verticalScrollBar()->minimum())
+            this->load_older(editor);
+    });
 
     this->editors.append(editor);
     this->filenames.append(filename);
+    this->stores.append(store);
     int index = this->tabwidget->addTab(editor, info.fileName());
     this->find_widget->set_editor(editor);
     this->tabwidget->setTabToolTip(index, filename);
@@ -208,12 +224,42 @@ void HistoryLog::append_to_history(const QString &filename, const QString &comma
 {
     int index = this->filenames.indexOf(filename);
     Q_ASSERT(index >= 0);
+    this->stores[index]->append(command);
     this->editors[index]->append(command);
     if (this->get_option("go_to_eof").toBool())
         this->editors[index]->set_cursor_position("eof");
     this->tabwidget->setCurrentIndex(index);
 }
 
+void HistoryLog::load_older(CodeEditor *editor)
+{
+    int index = this->editors.indexOf(editor);
+    if (index < 0)
+        return;
+    // 读入一批后仍不足一屏(没有可滚动的范围)时继续读，直到出现滚动条或读到开头
+    QScrollBar* scrollbar = editor->verticalScrollBar();
+    do {
+        if (this->stores[index]->at_start())
+            return;
+        QStringList older = this->stores[index]->read_older(this->get_option("max_entries").toInt());
+        if (older.isEmpty())
+            return;
+        // 在开头插入后保持原来显示的内容不动
+        int maximum = scrollbar->maximum();
+        QTextCursor cursor(editor->document());
+        cursor.movePosition(QTextCursor::Start);
+        cursor.insertText(older.join('\n') + '\n');
+        scrollbar->setValue(scrollbar->value() + scrollbar->maximum() - maximum);
+    } while (scrollbar->maximum() == scrollbar->minimum());
+}
+
+void HistoryLog::load_older_entries()
+{
+    CodeEditor* editor = qobject_cast<CodeEditor*>(this->tabwidget->currentWidget());
+    if (editor)
+        this->load_older(editor);
+}
+
 void HistoryLog::change_history_depth()
 {
     bool valid;
@@ -234,3 +280,27 @@ void HistoryLog::toggle_wrap_mode(bool checked)
     }
     this->set_option("wrap", checked);
 }
+
+void HistoryLog::search_history()
+{
+    QString query = this->search_edit->text();
+    this->search_results->clear();
+    this->search_results->setVisible(!query.trimmed().isEmpty());
+    if (query.trimmed().isEmpty())
+        return;
+    QSet<QString> seen;
+    for (int i = 0; i < this->stores.size(); i++) {
+        foreach (const QString& entry, this->stores[i]->search(query)) {
+            if (seen.contains(entry))
+                continue;
+            seen.insert(entry);
+            QListWidgetItem* item = new QListWidgetItem(entry, this->search_results);
+            item->setToolTip(this->filenames[i]);
+        }
+    }
+}
+
+void HistoryLog::copy_search_result(QListWidgetItem *item)
+{
+    QApplication::clipboard()->setText(item->text());
+}
@@ -4,6 +4,7 @@
 #include "widgets/tabs.h"
 #include "widgets/sourcecode/codeeditor.h"
 #include "widgets/findreplace.h"
+#include "utils/historystore.h"
 
 class HistoryLog : public SpyderPluginWidget
 {
@@ -15,9 +16,13 @@ public:
     QList<QAction*> menu_actions;
 
     QAction* wrap_action;
+    QAction* load_older_action;
     QList<CodeEditor*> editors;
     QStringList filenames;
+    QList<HistoryStore*> stores;
     FindReplace* find_widget;
+    QLineEdit* search_edit;
+    QListWidget* search_results;
 
     HistoryLog(MainWindow* parent);
     virtual QString get_plugin_title() const;
@@ -34,10 +39,14 @@ public:
 
     void add_history(const QString& filename);
     void append_to_history(const QString& filename, const QString& command);
+    void load_older(CodeEditor* editor);
 public slots:
     void switch_to_plugin(){SpyderPluginMixin::switch_to_plugin();}
     void refresh_plugin();
     void move_tab(int index_from, int index_to);
     void change_history_depth();
     void toggle_wrap_mode(bool checked);
+    void load_older_entries();
+    void search_history();
+    void copy_search_result(QListWidgetItem* item);
 };
@@ -1,6 +1,8 @@
 #include "plugins_editor.h"
 #include "app/mainwindow.h"
 #include "plugins/projects.h"
+#include "widgets/localhistory.h"
+#include "utils/editjournal.h"
 
 // load_breakpoints()函数的返回值是
 //QList<QPair<int, QString> >
@@ -331,6 +333,10 @@ QList<QAction*> Editor::get_plugin_actions()
     this->revert_action->setToolTip("Revert file from disk");
     connect(revert_action, SIGNAL(triggered(bool)), this, SLOT(revert()));
 
+    this->local_history_action = new QAction("Local &history...", this);
+    this->local_history_action->setToolTip("Browse and compare the snapshots taken on each save");
+    connect(local_history_action, SIGNAL(triggered(bool)), this, SLOT(show_local_history()));
+
     this->save_action = new QAction("&Save", this);
     this->save_action->setIcon(ima::icon("filesave"));
     this->save_action->setToolTip("Save file");
@@ -670,7 +676,7 @@ QList<QAction*> Editor::get_plugin_actions()
     file_menu_actions << new_action << nullptr
                       << open_action << open_last_closed_action << recent_file_menu
                       << nullptr << nullptr << save_action << save_all_action
-                      << save_as_action << save_copy_as_action << revert_action
+                      << save_as_action << save_copy_as_action << revert_action << local_history_action
                       << nullptr << print_preview_action << print_action << nullptr
                       << close_action << close_all_action << nullptr;
     this->main->file_menu_actions.append(file_menu_actions);
@@ -932,6 +938,9 @@ void Editor::register_editorstack(EditorStack *editorstack)
     editorstack->set_linenumbers_enabled(this->get_option("line_numbers").toBool());
     editorstack->set_edgeline_enabled(this->get_option("edge_line").toBool());
     editorstack->set_edgeline_column(this->get_option("edge_line_column").toInt());
+    editorstack->set_code_folding_enabled(this->get_option("code_folding").toBool());
+    editorstack->set_diff_gutter_enabled(this->get_option("diff_gutter").toBool());
+    editorstack->set_diff_gutter_base(this->get_option("diff_gutter/base").toString());
     editorstack->set_codecompletion_auto_enabled(this->get_option("codecompletion/auto").toBool());
     editorstack->set_codecompletion_case_enabled(this->get_option("codecompletion/case_sensitive").toBool());
     editorstack->set_codecompletion_enter_enabled(this->get_option("codecompletion/enter_key").toBool());
@@ -1951,6 +1960,50 @@ void Editor::revert()
     editorstack->revert();
 }
 
+void Editor::show_local_history()
+{
+    FileInfo* finfo = this->get_current_finfo();
+    if (finfo == nullptr)
+        return;
+    LocalHistoryDialog* dialog = new LocalHistoryDialog(finfo->filename, finfo->editor, this);
+    dialog->show();
+}
+
+// 上次没有正常退出时，用日志重建还没有保存的文档，恢复后的内容作为一次可以撤销的修改
+void Editor::recover_unsaved_files()
+{
+    QList<RecoveredDocument> documents = EditJournal::instance()->recovered();
+    if (documents.isEmpty()) {
+        EditJournal::instance()->discard_recovered();
+        return;
+    }
+    QStringList names;
+    foreach (const RecoveredDocument& document, documents)
+        names.append(document.filename);
+    QMessageBox::StandardButton answer = QMessageBox::question(
+                this, "Recover unsaved changes",
+                QString("Spyder was not closed properly. Unsaved changes were found in:"
+                        "<br><br>%1<br><br>Do you want to recover them?").arg(names.join("<br>")),
+                QMessageBox::Yes | QMessageBox::No);
+    if (answer == QMessageBox::Yes) {
+        foreach (const RecoveredDocument& document, documents) {
+            if (QFileInfo(document.filename).isFile())
+                this->load(document.filename);
+            else
+                this->_new();
+            CodeEditor* editor = this->get_current_editor();
+            if (editor == nullptr)
+                continue;
+            QTextCursor cursor(editor->document());
+            cursor.beginEditBlock();
+            cursor.select(QTextCursor::Document);
+            cursor.insertText(document.text);
+            cursor.endEditBlock();
+        }
+    }
+    EditJournal::instance()->discard_recovered();
+}
+
 void Editor::find()
 {
     EditorStack* editorstack = this->get_current_editorstack();
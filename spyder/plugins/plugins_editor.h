@@ -88,6 +88,7 @@ public:
     QAction* open_last_closed_action;
     QAction* open_action;
     QAction* revert_action;
+    QAction* local_history_action;
     QAction* save_action;
     QAction* save_all_action;
 
@@ -259,6 +260,8 @@ public slots:
     void save_copy_as();//
     void save_all();//
     void revert();//
+    void show_local_history();
+    void recover_unsaved_files();
 
     void find();//
     void find_next();//
@@ -182,8 +182,11 @@ void FindInFiles::register_plugin()
     findinfiles_action->setShortcutContext(Qt::WidgetShortcut);
     findinfiles_action->setToolTip("Search text in multiple files");
 
-    this->main->search_menu_actions << nullptr << findinfiles_action;
-    this->main->search_toolbar_actions << nullptr << findinfiles_action;
+    // 延迟构造时菜单已经建好，其中是MainWindow创建的占位动作
+    if (this->main->is_starting_up) {
+        this->main->search_menu_actions << nullptr << findinfiles_action;
+        this->main->search_toolbar_actions << nullptr << findinfiles_action;
+    }
 }
 
 bool FindInFiles::closing_plugin(bool cancelable)
@@ -131,6 +131,8 @@ void Projects::register_plugin()
     connect(this, &Projects::sig_project_loaded,
             [this](){this->main->editor->setup_open_files();});
     connect(this, SIGNAL(sig_project_loaded(const QString&)), SLOT(update_explorer()));
+    connect(this, &Projects::sig_project_loaded,
+            [](QString path){CompletionEngine::instance()->index_project(path);});
 
     connect(this, &Projects::sig_project_closed,
             [this](){this->main->workingdirectory->chdir(this->get_last_working_dir());});
@@ -138,6 +140,8 @@ void Projects::register_plugin()
             [this](){this->main->set_window_title();});
     connect(this, &Projects::sig_project_closed,
             [this](){this->main->editor->setup_open_files();});
+    connect(this, &Projects::sig_project_closed,
+            [](){CompletionEngine::instance()->clear_project();});
 
     connect(recent_project_menu, SIGNAL(aboutToShow()), SLOT(setup_menu_actions()));
 }
@@ -0,0 +1,195 @@
+# spyder.pro和benchmarks/benchmarks.pro共用的设置和源文件(main.cpp除外)
+
+QT       += core gui printsupport
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+CONFIG += c++11
+
+LIBS += -lwsock32
+win32: LIBS += -lpsapi
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/utils/icon_manager.cpp \
+    $$PWD/config/base.cpp \
+    $$PWD/widgets/helperwidgets.cpp \
+    $$PWD/widgets/arraybuilder.cpp \
+    $$PWD/utils/sourcecode.cpp \
+    $$PWD/saxutils.cpp \
+    $$PWD/os.cpp \
+    $$PWD/textwrap.cpp \
+    $$PWD/str.cpp \
+    $$PWD/widgets/mixins.cpp \
+    $$PWD/widgets/calltip.cpp \
+    $$PWD/widgets/sourcecode/widgets_base.cpp \
+    $$PWD/widgets/sourcecode/decorations.cpp \
+    $$PWD/widgets/sourcecode/folding.cpp \
+    $$PWD/widgets/sourcecode/diffgutter.cpp \
+    $$PWD/builtins.cpp \
+    $$PWD/keyword.cpp \
+    $$PWD/utils/syntaxhighlighters.cpp \
+    $$PWD/widgets/sourcecode/codeeditor.cpp \
+    $$PWD/widgets/sourcecode/kill_ring.cpp \
+    $$PWD/utils/qthelpers.cpp \
+    $$PWD/widgets/editortools.cpp \
+    $$PWD/widgets/onecolumntree.cpp \
+    $$PWD/widgets/variableexplorer/texteditor.cpp \
+    $$PWD/widgets/variableexplorer/arrayeditor.cpp \
+    $$PWD/widgets/variableexplorer/arraybuffer.cpp \
+    $$PWD/widgets/variableexplorer/objecteditor.cpp \
+    $$PWD/widgets/variableexplorer/collectionseditor.cpp \
+    $$PWD/nsview.cpp \
+    $$PWD/widgets/variableexplorer/importwizard.cpp \
+    $$PWD/widgets/variableexplorer/importengine.cpp \
+    $$PWD/widgets/explorer.cpp \
+    $$PWD/utils/encoding.cpp \
+    $$PWD/utils/check.cpp \
+    $$PWD/utils/programs.cpp \
+    $$PWD/utils/misc.cpp \
+    $$PWD/widgets/comboboxes.cpp \
+    $$PWD/widgets/waitingspinner.cpp \
+    $$PWD/widgets/findinfiles.cpp \
+    $$PWD/fnmatch.cpp \
+    $$PWD/config/config_main.cpp \
+    $$PWD/widgets/editor.cpp \
+    $$PWD/widgets/tabs.cpp \
+    $$PWD/widgets/fileswitcher.cpp \
+    $$PWD/config/utils.cpp \
+    $$PWD/widgets/status.cpp \
+    $$PWD/utils/resourcemonitor.cpp \
+    $$PWD/utils/timeline.cpp \
+    $$PWD/utils/tracing.cpp \
+    $$PWD/utils/fileops.cpp \
+    $$PWD/utils/historystore.cpp \
+    $$PWD/utils/fileenum.cpp \
+    $$PWD/utils/localhistory.cpp \
+    $$PWD/utils/diff.cpp \
+    $$PWD/widgets/localhistory.cpp \
+    $$PWD/utils/editjournal.cpp \
+    $$PWD/widgets/colors.cpp \
+    $$PWD/app/mainwindow.cpp \
+    $$PWD/plugins/plugins.cpp \
+    $$PWD/config/gui.cpp \
+    $$PWD/config/fonts.cpp \
+    $$PWD/widgets/projects/projects_explorer.cpp \
+    $$PWD/widgets/findreplace.cpp \
+    $$PWD/widgets/pathmanager.cpp \
+    $$PWD/widgets/github/gh_login.cpp \
+    $$PWD/utils/external/github.cpp \
+    $$PWD/widgets/github/backend.cpp \
+    $$PWD/widgets/sourcecode/terminal.cpp \
+    $$PWD/widgets/reporterror.cpp \
+    $$PWD/widgets/ipythonconsole/control.cpp \
+    $$PWD/plugins/plugins_findinfiles.cpp \
+    $$PWD/plugins/plugins_explorer.cpp \
+    $$PWD/plugins/outlineexplorer.cpp \
+    $$PWD/plugins/configdialog.cpp \
+    $$PWD/plugins/plugins_editor.cpp \
+    $$PWD/plugins/history.cpp \
+    $$PWD/plugins/ipythonconsole.cpp \
+    $$PWD/plugins/workingdirectory.cpp \
+    $$PWD/widgets/projects/type/projects_type.cpp \
+    $$PWD/widgets/projects/projects_config.cpp \
+    $$PWD/configparser.cpp \
+    $$PWD/widgets/projects/projectdialog.cpp \
+    $$PWD/plugins/projects.cpp \
+    $$PWD/plugins/maininterpreter.cpp \
+    $$PWD/plugins/runconfig.cpp \
+    $$PWD/windows_socket.cpp \
+    $$PWD/utils/introspection/plugin_client.cpp \
+    $$PWD/utils/introspection/completion_engine.cpp
+
+HEADERS += \
+    $$PWD/utils/icon_manager.h \
+    $$PWD/config/base.h \
+    $$PWD/widgets/helperwidgets.h \
+    $$PWD/widgets/arraybuilder.h \
+    $$PWD/utils/sourcecode.h \
+    $$PWD/saxutils.h \
+    $$PWD/os.h \
+    $$PWD/textwrap.h \
+    $$PWD/str.h \
+    $$PWD/widgets/mixins.h \
+    $$PWD/widgets/calltip.h \
+    $$PWD/widgets/tests/test_mixins.h \
+    $$PWD/widgets/tests/test_console.h \
+    $$PWD/widgets/tests/test_decorations.h \
+    $$PWD/widgets/tests/test_editjournal.h \
+    $$PWD/widgets/sourcecode/widgets_base.h \
+    $$PWD/widgets/sourcecode/decorations.h \
+    $$PWD/widgets/sourcecode/folding.h \
+    $$PWD/widgets/sourcecode/diffgutter.h \
+    $$PWD/builtins.h \
+    $$PWD/keyword.h \
+    $$PWD/utils/syntaxhighlighters.h \
+    $$PWD/widgets/sourcecode/codeeditor.h \
+    $$PWD/widgets/sourcecode/kill_ring.h \
+    $$PWD/utils/qthelpers.h \
+    $$PWD/widgets/editortools.h \
+    $$PWD/widgets/onecolumntree.h \
+    $$PWD/widgets/variableexplorer/texteditor.h \
+    $$PWD/widgets/variableexplorer/arrayeditor.h \
+    $$PWD/widgets/variableexplorer/arraybuffer.h \
+    $$PWD/widgets/variableexplorer/objecteditor.h \
+    $$PWD/widgets/variableexplorer/collectionseditor.h \
+    $$PWD/nsview.h \
+    $$PWD/widgets/variableexplorer/importwizard.h \
+    $$PWD/widgets/variableexplorer/importengine.h \
+    $$PWD/widgets/explorer.h \
+    $$PWD/utils/encoding.h \
+    $$PWD/utils/check.h \
+    $$PWD/utils/programs.h \
+    $$PWD/utils/misc.h \
+    $$PWD/widgets/comboboxes.h \
+    $$PWD/widgets/waitingspinner.h \
+    $$PWD/widgets/findinfiles.h \
+    $$PWD/fnmatch.h \
+    $$PWD/config/config_main.h \
+    $$PWD/widgets/editor.h \
+    $$PWD/widgets/tabs.h \
+    $$PWD/widgets/fileswitcher.h \
+    $$PWD/config/utils.h \
+    $$PWD/widgets/status.h \
+    $$PWD/utils/resourcemonitor.h \
+    $$PWD/utils/timeline.h \
+    $$PWD/utils/tracing.h \
+    $$PWD/utils/fileops.h \
+    $$PWD/utils/historystore.h \
+    $$PWD/utils/fileenum.h \
+    $$PWD/utils/localhistory.h \
+    $$PWD/utils/diff.h \
+    $$PWD/widgets/localhistory.h \
+    $$PWD/utils/editjournal.h \
+    $$PWD/widgets/colors.h \
+    $$PWD/plugins/plugins.h \
+    $$PWD/config/gui.h \
+    $$PWD/config/fonts.h \
+    $$PWD/widgets/projects/projects_explorer.h \
+    $$PWD/widgets/findreplace.h \
+    $$PWD/widgets/pathmanager.h \
+    $$PWD/widgets/github/gh_login.h \
+    $$PWD/utils/external/github.h \
+    $$PWD/widgets/github/backend.h \
+    $$PWD/widgets/sourcecode/terminal.h \
+    $$PWD/widgets/reporterror.h \
+    $$PWD/widgets/ipythonconsole/control.h \
+    $$PWD/app/mainwindow.h \
+    $$PWD/plugins/plugins_findinfiles.h \
+    $$PWD/plugins/plugins_explorer.h \
+    $$PWD/plugins/outlineexplorer.h \
+    $$PWD/plugins/configdialog.h \
+    $$PWD/plugins/plugins_editor.h \
+    $$PWD/plugins/history.h \
+    $$PWD/plugins/ipythonconsole.h \
+    $$PWD/plugins/runconfig.h \
+    $$PWD/plugins/workingdirectory.h \
+    $$PWD/widgets/projects/type/projects_type.h \
+    $$PWD/widgets/projects/projects_config.h \
+    $$PWD/configparser.h \
+    $$PWD/widgets/projects/projectdialog.h \
+    $$PWD/plugins/projects.h \
+    $$PWD/plugins/maininterpreter.h \
+    $$PWD/utils/introspection/plugin_client.h \
+    $$PWD/utils/introspection/completion_engine.h
@@ -0,0 +1,185 @@
+#include "diff.h"
+
+#include <QHash>
+#include <algorithm>
+
+namespace diff {
+
+// Myers O(ND)算法，返回从a变到b的操作序列：'='相同，'-'删除a的一行，'+'插入b的一行。
+// 编辑距离超过max_cost时返回空序列
+static QVector<char> myers(const QVector<int>& a, const QVector<int>& b, int max_cost)
+{
+    int n = a.size();
+    int m = b.size();
+    int max = qMin(n + m, max_cost);
+    QVector<int> v(2 * max + 3, 0);
+    int offset = max + 1;
+    // 每一步结束时v[-d..d]的副本，用于回溯
+    QVector<QVector<int>> trace;
+    int found = -1;
+    for (int d = 0; d <= max && found < 0; d++) {
+        for (int k = -d; k <= d; k += 2) {
+            int x;
+            if (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1]))
+                x = v[offset + k + 1];
+            else
+                x = v[offset + k - 1] + 1;
+            int y = x - k;
+            while (x < n && y < m && a[x] == b[y]) {
+                x++;
+                y++;
+            }
+            v[offset + k] = x;
+            if (x >= n && y >= m) {
+                found = d;
+                break;
+            }
+        }
+        trace.append(v.mid(offset - d, 2 * d + 1));
+    }
+    if (found < 0)
+        return QVector<char>();
+
+    QVector<char> ops;
+    ops.reserve(n + m);
+    int x = n, y = m;
+    for (int d = found; d > 0; d--) {
+        const QVector<int>& prev = trace[d - 1];
+        // prev[i]对应k = i - (d - 1)
+        auto at = [&prev, d](int k) { return prev[k + d - 1]; };
+        int k = x - y;
+        int prev_k;
+        if (k == -d || (k != d && at(k - 1) < at(k + 1)))
+            prev_k = k + 1;
+        else
+            prev_k = k - 1;
+        int prev_x = at(prev_k);
+        int prev_y = prev_x - prev_k;
+        while (x > prev_x && y > prev_y) {
+            ops.append('=');
+            x--;
+            y--;
+        }
+        ops.append(x == prev_x ? '+' : '-');
+        x = prev_x;
+        y = prev_y;
+    }
+    while (x > 0 && y > 0) {
+        ops.append('=');
+        x--;
+        y--;
+    }
+    std::reverse(ops.begin(), ops.end());
+    return ops;
+}
+
+QVector<DiffHunk> diff_lines(const QStringList &old_lines, const QStringList &new_lines,
+                             int max_cost)
+{
+    QVector<DiffHunk> hunks;
+    int n = old_lines.size();
+    int m = new_lines.size();
+    int prefix = 0;
+    while (prefix < n && prefix < m && old_lines[prefix] == new_lines[prefix])
+        prefix++;
+    int suffix = 0;
+    while (suffix < n - prefix && suffix < m - prefix &&
+           old_lines[n - 1 - suffix] == new_lines[m - 1 - suffix])
+        suffix++;
+    if (prefix + suffix == n && prefix + suffix == m)
+        return hunks;
+
+    QHash<QString, int> ids;
+    auto id_of = [&ids](const QString& line) {
+        auto it = ids.find(line);
+        if (it == ids.end())
+            it = ids.insert(line, ids.size());
+        return it.value();
+    };
+    QVector<int> a, b;
+    a.reserve(n - prefix - suffix);
+    b.reserve(m - prefix - suffix);
+    for (int i = prefix; i < n - suffix; i++)
+        a.append(id_of(old_lines[i]));
+    for (int i = prefix; i < m - suffix; i++)
+        b.append(id_of(new_lines[i]));
+
+    QVector<char> ops;
+    if (!a.isEmpty() && !b.isEmpty())
+        ops = myers(a, b, max_cost);
+    if (ops.isEmpty()) {
+        // 一边为空，或者差别太大
+        DiffHunk hunk;
+        hunk.old_start = prefix;
+        hunk.old_count = a.size();
+        hunk.new_start = prefix;
+        hunk.new_count = b.size();
+        hunks.append(hunk);
+        return hunks;
+    }
+
+    int x = prefix, y = prefix;
+    int i = 0;
+    while (i < ops.size()) {
+        if (ops[i] == '=') {
+            x++;
+            y++;
+            i++;
+            continue;
+        }
+        DiffHunk hunk;
+        hunk.old_start = x;
+        hunk.new_start = y;
+        for (; i < ops.size() && ops[i] != '='; i++) {
+            if (ops[i] == '-')
+                x++;
+            else
+                y++;
+        }
+        hunk.old_count = x - hunk.old_start;
+        hunk.new_count = y - hunk.new_start;
+        hunks.append(hunk);
+    }
+    return hunks;
+}
+
+QString unified_diff(const QStringList &old_lines, const QStringList &new_lines,
+                     const QString &old_name, const QString &new_name, int context)
+{
+    QVector<DiffHunk> hunks = diff_lines(old_lines, new_lines);
+    if (hunks.isEmpty())
+        return QString();
+    QStringList out;
+    out << QString("--- %1").arg(old_name) << QString("+++ %1").arg(new_name);
+
+    // 相距不超过2*context行的修改合并为一组
+    int i = 0;
+    while (i < hunks.size()) {
+        int j = i;
+        while (j + 1 < hunks.size() &&
+               hunks[j + 1].old_start - (hunks[j].old_start + hunks[j].old_count) <= 2 * context)
+            j++;
+        int old_begin = qMax(0, hunks[i].old_start - context);
+        int new_begin = qMax(0, hunks[i].new_start - context);
+        int old_end = qMin(old_lines.size(), hunks[j].old_start + hunks[j].old_count + context);
+        int new_end = qMin(new_lines.size(), hunks[j].new_start + hunks[j].new_count + context);
+        out << QString("@@ -%1,%2 +%3,%4 @@").arg(old_begin + 1).arg(old_end - old_begin)
+               .arg(new_begin + 1).arg(new_end - new_begin);
+        int line = old_begin;
+        for (int h = i; h <= j; h++) {
+            for (; line < hunks[h].old_start; line++)
+                out << ' ' + old_lines[line];
+            for (int k = 0; k < hunks[h].old_count; k++)
+                out << '-' + old_lines[hunks[h].old_start + k];
+            for (int k = 0; k < hunks[h].new_count; k++)
+                out << '+' + new_lines[hunks[h].new_start + k];
+            line = hunks[h].old_start + hunks[h].old_count;
+        }
+        for (; line < old_end; line++)
+            out << ' ' + old_lines[line];
+        i = j + 1;
+    }
+    return out.join('\n');
+}
+
+} // namespace diff
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <QVector>
+#include <QStringList>
+
+// 一处修改：旧文本[old_start, old_start+old_count)行被替换为新文本[new_start, new_start+new_count)行。
+// old_count为0是新增，new_count为0是删除
+struct DiffHunk
+{
+    int old_start;
+    int old_count;
+    int new_start;
+    int new_count;
+};
+
+namespace diff {
+
+// 超过这个编辑距离时放弃逐行比较，剩下的中间部分作为一处整体修改
+const int MAX_COST = 4000;
+
+// 先去掉相同的开头和结尾，再对中间部分做Myers差分(行先转换为整数再比较)
+QVector<DiffHunk> diff_lines(const QStringList& old_lines, const QStringList& new_lines,
+                             int max_cost = MAX_COST);
+
+// 统一格式(unified diff)的文本，context为每处修改前后保留的相同行数
+QString unified_diff(const QStringList& old_lines, const QStringList& new_lines,
+                     const QString& old_name, const QString& new_name, int context = 3);
+
+} // namespace diff
@@ -0,0 +1,509 @@
+#include "editjournal.h"
+#include "config/base.h"
+#include "config/config_main.h"
+#include "utils/encoding.h"
+
+#include <QDir>
+#include <QDataStream>
+#include <QTextCursor>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+
+#include <cstdio>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+static void sync_file(QFile& file)
+{
+    file.flush();
+#ifdef Q_OS_WIN
+    _commit(file.handle());
+#else
+    ::fsync(file.handle());
+#endif
+}
+
+// 用source原子地替换dest：任何时刻磁盘上都有完整的旧文件或新文件。
+// QFile::rename在目标存在时会失败，只能先删除目标，中间崩溃会丢失日志
+static bool replace_file(const QString& source, const QString& dest)
+{
+#ifdef Q_OS_WIN
+    return MoveFileExW(reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(source).utf16()),
+                       reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(dest).utf16()),
+                       MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return std::rename(QFile::encodeName(source).constData(),
+                       QFile::encodeName(dest).constData()) == 0;
+#endif
+}
+
+
+/********** JournalWriter **********/
+JournalWriter::JournalWriter(const QString& path)
+    : QObject (nullptr)
+{
+    this->path = path;
+    this->rotation_pending = false;
+    this->rotate_requested = false;
+    this->file = nullptr;
+    this->timer = nullptr;
+}
+
+QByteArray JournalWriter::header()
+{
+    return QByteArray("SPYJRNL1");
+}
+
+// OPEN：文件在磁盘上时记录内容的哈希，恢复时读文件并核对；否则记录内容本身
+QByteArray JournalWriter::serialize(const QVector<JournalRecord> &records)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_6);
+    foreach (const JournalRecord& record, records) {
+        out << quint8(record.type) << record.id;
+        switch (record.type) {
+        case JournalRecord::OPEN:
+            if (record.on_disk)
+                out << record.filename << EditJournal::text_hash(record.text) << QString();
+            else
+                out << record.filename << QByteArray()
+                    << (record.text.isNull() ? QString("") : record.text);
+            break;
+        case JournalRecord::EDIT:
+            out << qint32(record.position) << qint32(record.removed) << record.text;
+            break;
+        case JournalRecord::CHECKPOINT:
+            out << record.text;
+            break;
+        case JournalRecord::SAVE:
+            out << record.filename << EditJournal::text_hash(record.text);
+            break;
+        default:
+            break;
+        }
+    }
+    return data;
+}
+
+void JournalWriter::enqueue(const JournalRecord &record)
+{
+    QMutexLocker locker(&mutex);
+    queue.append(record);
+}
+
+void JournalWriter::rotate(const QVector<JournalRecord> &records)
+{
+    QMutexLocker locker(&mutex);
+    rotation = records;
+    rotation_pending = true;
+    queue.clear();
+}
+
+bool JournalWriter::open_log()
+{
+    if (file == nullptr)
+        file = new QFile(path, this);
+    if (!file->open(QIODevice::WriteOnly | QIODevice::Append))
+        return false;
+    if (file->size() == 0)
+        file->write(header());
+    return true;
+}
+
+void JournalWriter::start()
+{
+    timer = new QTimer(this);
+    timer->setInterval(FLUSH_INTERVAL);
+    connect(timer, SIGNAL(timeout()), this, SLOT(flush()));
+    timer->start();
+    this->open_log();
+}
+
+void JournalWriter::flush()
+{
+    QVector<JournalRecord> records;
+    QVector<JournalRecord> replacement;
+    bool rotating;
+    {
+        QMutexLocker locker(&mutex);
+        records.swap(queue);
+        replacement.swap(rotation);
+        rotating = rotation_pending;
+        rotation_pending = false;
+    }
+    if (file == nullptr)
+        return;
+
+    if (rotating) {
+        // 新日志写完并落盘后才替换旧日志
+        QString temp = path + ".new";
+        QFile out(temp);
+        if (out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            out.write(header() + serialize(replacement) + serialize(records));
+            sync_file(out);
+            out.close();
+            file->close();
+            bool replaced = replace_file(temp, path);
+            this->open_log();
+            if (replaced) {
+                rotate_requested = false;
+                return;
+            }
+            // 替换失败时旧日志仍然完整，新记录接着写在后面
+            QFile::remove(temp);
+        }
+        else
+            records = replacement + records;
+    }
+    if (records.isEmpty() || !file->isOpen())
+        return;
+    file->write(serialize(records));
+    sync_file(*file);
+    if (file->size() > MAX_LOG_SIZE && !rotate_requested) {
+        rotate_requested = true;
+        emit sig_rotate_requested();
+    }
+}
+
+void JournalWriter::finish()
+{
+    this->flush();
+    if (timer)
+        timer->stop();
+    if (file)
+        file->close();
+    QFile::remove(path);
+}
+
+
+/********** EditJournal **********/
+EditJournal* EditJournal::instance()
+{
+    static EditJournal* journal = new EditJournal;
+    return journal;
+}
+
+EditJournal::EditJournal()
+    : QObject (nullptr)
+{
+    next_id = 1;
+    QString dir = get_conf_path("recovery");
+    QDir().mkpath(dir);
+    QString path = dir + "/journal.log";
+    crashed_path = dir + "/journal.crashed.log";
+    // 日志没有被删除说明上次没有正常退出，留给recovered()。
+    // 替换是原子的，只有.new时说明旧版本在替换前就只剩下它，也可以用来恢复
+    QString new_path = path + ".new";
+    QString last_path = QFileInfo::exists(path) ? path : new_path;
+    if (QFileInfo(last_path).size() > JournalWriter::header().size()) {
+        QFile::remove(crashed_path);
+        QFile::rename(last_path, crashed_path);
+    }
+    QFile::remove(path);
+    QFile::remove(new_path);
+
+    writer = new JournalWriter(path);
+    thread = new QThread;
+    thread->setObjectName("EditJournal");
+    writer->moveToThread(thread);
+    connect(thread, SIGNAL(started()), writer, SLOT(start()));
+    connect(writer, SIGNAL(sig_rotate_requested()), this, SLOT(rotate()));
+    thread->start(QThread::LowPriority);
+
+    if (qApp)
+        connect(qApp, &QCoreApplication::aboutToQuit, [this](){ this->shutdown(); });
+}
+
+void EditJournal::shutdown()
+{
+    if (!thread->isRunning())
+        return;
+    QMetaObject::invokeMethod(writer, "finish", Qt::BlockingQueuedConnection);
+    thread->quit();
+    thread->wait();
+}
+
+QByteArray EditJournal::text_hash(QString text)
+{
+    text.replace("\r\n", "\n");
+    text.replace('\r', '\n');
+    return QCryptographicHash::hash(text.toUtf8(), QCryptographicHash::Sha1);
+}
+
+void EditJournal::track(QTextDocument *document, const QString &filename, const QString &text)
+{
+    if (documents.contains(document) || !CONF_get("editor", "crash_recovery", true).toBool())
+        return;
+    DocumentState state;
+    state.id = next_id++;
+    state.filename = filename;
+    state.revision = document->revision();
+    state.bytes_since_checkpoint = 0;
+    documents.insert(document, state);
+    connect(document, SIGNAL(contentsChange(int,int,int)), this, SLOT(contents_change(int,int,int)));
+    connect(document, SIGNAL(destroyed(QObject*)), this, SLOT(document_destroyed(QObject*)));
+
+    JournalRecord record;
+    record.type = JournalRecord::OPEN;
+    record.id = state.id;
+    record.filename = filename;
+    record.text = text;
+    record.on_disk = QFileInfo(filename).isFile();
+    writer->enqueue(record);
+}
+
+void EditJournal::saved(QTextDocument *document, const QString &filename, const QString &text)
+{
+    auto it = documents.find(document);
+    if (it == documents.end())
+        return;
+    it->filename = filename;
+    it->bytes_since_checkpoint = 0;
+    JournalRecord record;
+    record.type = JournalRecord::SAVE;
+    record.id = it->id;
+    record.filename = filename;
+    record.text = text;
+    writer->enqueue(record);
+}
+
+// 每次按键调用：只取出新增的文本，其余工作在后台线程中完成
+void EditJournal::contents_change(int position, int removed, int added)
+{
+    QTextDocument* document = qobject_cast<QTextDocument*>(sender());
+    auto it = documents.find(document);
+    if (it == documents.end())
+        return;
+    // markContentsDirty(高亮、折叠)也发出contentsChange，但不改变revision
+    int revision = document->revision();
+    if ((removed == added && revision == it->revision) || (removed == 0 && added == 0))
+        return;
+    it->revision = revision;
+
+    // 替换整个文档时Qt报告的删除和新增长度都包含末尾的段落分隔符
+    int excess = qMax(0, position + added - (document->characterCount() - 1));
+    added -= excess;
+    removed = qMax(0, removed - excess);
+
+    JournalRecord record;
+    record.type = JournalRecord::EDIT;
+    record.id = it->id;
+    record.position = position;
+    record.removed = removed;
+    if (added > 0) {
+        QTextCursor cursor(document);
+        cursor.setPosition(position);
+        cursor.setPosition(position + added, QTextCursor::KeepAnchor);
+        // 和toPlainText的转换一致
+        record.text = cursor.selectedText();
+        record.text.replace(QChar::ParagraphSeparator, '\n');
+        record.text.replace(QChar::LineSeparator, '\n');
+        record.text.replace(QChar::Nbsp, ' ');
+    }
+    writer->enqueue(record);
+
+    it->bytes_since_checkpoint += 2 * record.text.size() + 16;
+    if (it->bytes_since_checkpoint > CHECKPOINT_BYTES && !checkpoint_pending.contains(document)) {
+        checkpoint_pending.append(document);
+        QTimer::singleShot(0, this, SLOT(checkpoint()));
+    }
+}
+
+void EditJournal::enqueue_checkpoint(QTextDocument *document, DocumentState &state)
+{
+    JournalRecord record;
+    record.type = JournalRecord::CHECKPOINT;
+    record.id = state.id;
+    record.text = document->toPlainText();
+    writer->enqueue(record);
+    state.bytes_since_checkpoint = 0;
+}
+
+void EditJournal::checkpoint()
+{
+    foreach (QTextDocument* document, checkpoint_pending) {
+        auto it = documents.find(document);
+        if (it != documents.end())
+            this->enqueue_checkpoint(document, *it);
+    }
+    checkpoint_pending.clear();
+}
+
+void EditJournal::document_destroyed(QObject *object)
+{
+    checkpoint_pending.removeAll(static_cast<QTextDocument*>(object));
+    auto it = documents.find(object);
+    if (it == documents.end())
+        return;
+    JournalRecord record;
+    record.type = JournalRecord::CLOSE;
+    record.id = it->id;
+    documents.erase(it);
+    writer->enqueue(record);
+}
+
+// 日志太大：每个文档重新记录一次，修改过的文档带上检查点
+void EditJournal::rotate()
+{
+    QVector<JournalRecord> records;
+    for (auto it = documents.begin(); it != documents.end(); ++it) {
+        QTextDocument* document = static_cast<QTextDocument*>(it.key());
+        JournalRecord record;
+        record.type = JournalRecord::OPEN;
+        record.id = it->id;
+        record.filename = it->filename;
+        if (document->isModified()) {
+            record.text = QString("");
+            records.append(record);
+            record.type = JournalRecord::CHECKPOINT;
+            record.text = document->toPlainText();
+        }
+        else {
+            record.text = document->toPlainText();
+            record.on_disk = QFileInfo(it->filename).isFile();
+        }
+        records.append(record);
+        it->bytes_since_checkpoint = 0;
+    }
+    checkpoint_pending.clear();
+    writer->rotate(records);
+}
+
+QList<RecoveredDocument> EditJournal::recovered()
+{
+    QFile file(crashed_path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QList<RecoveredDocument>();
+    return replay(file.readAll());
+}
+
+void EditJournal::discard_recovered()
+{
+    QFile::remove(crashed_path);
+}
+
+// 重放日志。最后一条记录可能只写了一部分，读到不完整的记录时停止
+QList<RecoveredDocument> EditJournal::replay(const QByteArray &data)
+{
+    struct State
+    {
+        QString filename;
+        QByteArray base_hash;
+        // 不为null时是初始内容，否则初始内容是磁盘上哈希为base_hash的文件
+        QString base_text;
+        QString text;
+        bool has_text;
+        bool broken;
+    };
+    // 第一次修改时才读入初始内容，磁盘上的文件已经不同时放弃这个文档
+    auto ensure_text = [](State& state) {
+        if (state.has_text || state.broken)
+            return !state.broken;
+        if (!state.base_text.isNull())
+            state.text = state.base_text;
+        else {
+            bool ok;
+            encoding::DecodedText decoded = encoding::read_file(state.filename, &ok);
+            if (!ok || text_hash(decoded.text) != state.base_hash) {
+                state.broken = true;
+                return false;
+            }
+            state.text = decoded.text;
+        }
+        state.has_text = true;
+        return true;
+    };
+
+    QList<RecoveredDocument> result;
+    QByteArray magic = JournalWriter::header();
+    if (!data.startsWith(magic))
+        return result;
+    QDataStream in(data.mid(magic.size()));
+    in.setVersion(QDataStream::Qt_5_6);
+    QHash<quint32, State> states;
+    QList<quint32> order;
+    while (!in.atEnd()) {
+        quint8 type;
+        quint32 id;
+        in >> type >> id;
+        if (in.status() != QDataStream::Ok)
+            break;
+        if (type == JournalRecord::OPEN) {
+            State state;
+            in >> state.filename >> state.base_hash >> state.base_text;
+            if (in.status() != QDataStream::Ok)
+                break;
+            state.has_text = false;
+            state.broken = false;
+            states[id] = state;
+            if (!order.contains(id))
+                order.append(id);
+        }
+        else if (type == JournalRecord::EDIT) {
+            qint32 position, removed;
+            QString text;
+            in >> position >> removed >> text;
+            if (in.status() != QDataStream::Ok)
+                break;
+            auto it = states.find(id);
+            if (it == states.end() || !ensure_text(*it))
+                continue;
+            position = qBound(0, int(position), it->text.size());
+            removed = qBound(0, int(removed), it->text.size() - position);
+            it->text.replace(position, removed, text);
+        }
+        else if (type == JournalRecord::CHECKPOINT) {
+            QString text;
+            in >> text;
+            if (in.status() != QDataStream::Ok)
+                break;
+            auto it = states.find(id);
+            if (it == states.end())
+                continue;
+            it->text = text;
+            it->has_text = true;
+            it->broken = false;
+        }
+        else if (type == JournalRecord::SAVE) {
+            QString filename;
+            QByteArray hash;
+            in >> filename >> hash;
+            if (in.status() != QDataStream::Ok)
+                break;
+            auto it = states.find(id);
+            if (it == states.end())
+                continue;
+            it->filename = filename;
+            it->base_hash = hash;
+            it->base_text = QString();
+            it->text.clear();
+            it->has_text = false;
+            it->broken = false;
+        }
+        else if (type == JournalRecord::CLOSE)
+            states.remove(id);
+        else
+            break;
+    }
+
+    foreach (quint32 id, order) {
+        auto it = states.find(id);
+        if (it == states.end() || !it->has_text || it->broken)
+            continue;
+        bool unchanged = it->base_text.isNull() ? text_hash(it->text) == it->base_hash
+                                                : it->text == it->base_text;
+        if (unchanged)
+            continue;
+        RecoveredDocument document;
+        document.filename = it->filename;
+        document.text = it->text;
+        result.append(document);
+    }
+    return result;
+}
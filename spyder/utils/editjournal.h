@@ -0,0 +1,121 @@
+#pragma once
+
+#include <QHash>
+#include <QFile>
+#include <QMutex>
+#include <QTimer>
+#include <QThread>
+#include <QVector>
+#include <QTextDocument>
+
+// 日志中的一条记录。OPEN记录文件名和初始内容的SHA-1(文件不在磁盘上时记录内容本身)，
+// EDIT是一次contentsChange，CHECKPOINT是整个文档的内容，SAVE之后以磁盘上的文件为准
+struct JournalRecord
+{
+    enum Type { OPEN = 1, EDIT, CHECKPOINT, SAVE, CLOSE };
+
+    int type;
+    quint32 id;
+    int position;
+    int removed;
+    QString text;
+    QString filename;
+    bool on_disk;
+
+    JournalRecord() : type(CLOSE), id(0), position(0), removed(0), on_disk(false) {}
+};
+
+struct RecoveredDocument
+{
+    QString filename;
+    QString text;
+};
+
+
+// 在后台线程中把记录写入日志，每隔FLUSH_INTERVAL毫秒写一次并fsync。
+// 日志超过MAX_LOG_SIZE时请求界面线程给出所有文档的检查点，写入新的日志后替换旧的
+class JournalWriter : public QObject
+{
+    Q_OBJECT
+signals:
+    void sig_rotate_requested();
+
+public:
+    static const int FLUSH_INTERVAL = 1000;
+    static const qint64 MAX_LOG_SIZE = 32 * 1024 * 1024;
+
+    JournalWriter(const QString& path);
+    void enqueue(const JournalRecord& record);
+    // 用records代替日志中已有的内容，之后入队的记录写在它们后面
+    void rotate(const QVector<JournalRecord>& records);
+
+    // 日志文件开头的标记和格式版本
+    static QByteArray header();
+    static QByteArray serialize(const QVector<JournalRecord>& records);
+
+public slots:
+    void start();
+    void flush();
+    // 正常退出：写完后删除日志
+    void finish();
+
+private:
+    QString path;
+    QMutex mutex;
+    QVector<JournalRecord> queue;
+    QVector<JournalRecord> rotation;
+    bool rotation_pending;
+    bool rotate_requested;
+    QFile* file;
+    QTimer* timer;
+
+    bool open_log();
+};
+
+
+// 崩溃恢复日志：记录每个打开的文档的每次修改，而不是定期保存整个文件。
+// 界面线程中每次修改只取出新增的文本放入队列；序列化、计算哈希和写盘都在后台线程。
+// 一个文档累计记录的修改超过CHECKPOINT_BYTES时写一个检查点，恢复时不需要从头重放
+class EditJournal : public QObject
+{
+    Q_OBJECT
+public:
+    static const int CHECKPOINT_BYTES = 512 * 1024;
+
+    static EditJournal* instance();
+
+    void track(QTextDocument* document, const QString& filename, const QString& text);
+    void saved(QTextDocument* document, const QString& filename, const QString& text);
+    // 上次没有正常退出时日志中尚未保存的文档
+    QList<RecoveredDocument> recovered();
+    void discard_recovered();
+    void shutdown();
+
+    static QList<RecoveredDocument> replay(const QByteArray& data);
+    static QByteArray text_hash(QString text);
+
+private slots:
+    void contents_change(int position, int removed, int added);
+    void document_destroyed(QObject* object);
+    void rotate();
+    void checkpoint();
+
+private:
+    struct DocumentState
+    {
+        quint32 id;
+        QString filename;
+        int revision;
+        qint64 bytes_since_checkpoint;
+    };
+
+    QThread* thread;
+    JournalWriter* writer;
+    QHash<QObject*, DocumentState> documents;
+    QList<QTextDocument*> checkpoint_pending;
+    quint32 next_id;
+    QString crashed_path;
+
+    EditJournal();
+    void enqueue_checkpoint(QTextDocument* document, DocumentState& state);
+};
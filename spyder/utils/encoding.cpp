@@ -1,16 +1,232 @@
 #include "encoding.h"
 #include <QDebug>
+#include <QtEndian>
+#include <cstring>
 
 namespace encoding {
 
+DecodedText::DecodedText()
+{
+    mixed_eol = false;
+    line_count = 0;
+    lf_count = 0;
+    crlf_count = 0;
+    cr_count = 0;
+}
+
+static const quint64 LOW_BITS = Q_UINT64_C(0x0101010101010101);
+static const quint64 HIGH_BITS = Q_UINT64_C(0x8080808080808080);
+
+// 一次检查8个字节中是否有等于byte的字节
+static inline bool has_byte(quint64 word, uchar byte)
+{
+    quint64 x = word ^ (LOW_BITS * byte);
+    return ((x - LOW_BITS) & ~x & HIGH_BITS) != 0;
+}
+
+static inline bool is_continuation(uchar byte)
+{
+    return (byte & 0xC0) == 0x80;
+}
+
+// 解码UTF-8，同时把换行符统一为"\n"并计数。遇到非法的UTF-8时返回nullptr
+static QChar* decode_utf8(const uchar* p, const uchar* end, QChar* out, DecodedText& result)
+{
+    while (p < end) {
+        // 不含换行符的纯ASCII，8个字节一起处理
+        if (end - p >= 8) {
+            quint64 word;
+            std::memcpy(&word, p, 8);
+            if (!(word & HIGH_BITS) && !has_byte(word, '\n') && !has_byte(word, '\r')) {
+                for (int i = 0; i < 8; i++)
+                    out[i] = QLatin1Char(char(p[i]));
+                out += 8;
+                p += 8;
+                continue;
+            }
+        }
 
+        uchar c = *p;
+        if (c < 0x80) {
+            p++;
+            if (c == '\r') {
+                if (p < end && *p == '\n') {
+                    p++;
+                    result.crlf_count++;
+                }
+                else
+                    result.cr_count++;
+                c = '\n';
+            }
+            else if (c == '\n')
+                result.lf_count++;
+            *out++ = QLatin1Char(char(c));
+        }
+        else if (c >= 0xC2 && c <= 0xDF) {
+            if (end - p < 2 || !is_continuation(p[1]))
+                return nullptr;
+            *out++ = QChar(ushort(((c & 0x1F) << 6) | (p[1] & 0x3F)));
+            p += 2;
+        }
+        else if (c >= 0xE0 && c <= 0xEF) {
+            if (end - p < 3 || !is_continuation(p[1]) || !is_continuation(p[2]))
+                return nullptr;
+            // 排除过长编码和代理项
+            if ((c == 0xE0 && p[1] < 0xA0) || (c == 0xED && p[1] >= 0xA0))
+                return nullptr;
+            *out++ = QChar(ushort(((c & 0x0F) << 12) | ((p[1] & 0x3F) << 6) | (p[2] & 0x3F)));
+            p += 3;
+        }
+        else if (c >= 0xF0 && c <= 0xF4) {
+            if (end - p < 4 || !is_continuation(p[1]) || !is_continuation(p[2]) || !is_continuation(p[3]))
+                return nullptr;
+            if ((c == 0xF0 && p[1] < 0x90) || (c == 0xF4 && p[1] >= 0x90))
+                return nullptr;
+            uint ucs4 = (uint(c & 0x07) << 18) | (uint(p[1] & 0x3F) << 12) |
+                    (uint(p[2] & 0x3F) << 6) | uint(p[3] & 0x3F);
+            *out++ = QChar(QChar::highSurrogate(ucs4));
+            *out++ = QChar(QChar::lowSurrogate(ucs4));
+            p += 4;
+        }
+        else
+            return nullptr;
+    }
+    return out;
+}
+
+// Latin-1(width=1)或UTF-16(width=2)，同样统一换行符
+static QChar* decode_units(const uchar* p, const uchar* end, int width, bool big_endian,
+                           QChar* out, DecodedText& result)
+{
+    auto unit = [=](const uchar* q) -> ushort {
+        if (width == 1)
+            return *q;
+        return big_endian ? qFromBigEndian<quint16>(q) : qFromLittleEndian<quint16>(q);
+    };
+    end -= (end - p) % width;
+    while (p < end) {
+        ushort ch = unit(p);
+        p += width;
+        if (ch == '\r') {
+            if (p < end && unit(p) == '\n') {
+                p += width;
+                result.crlf_count++;
+            }
+            else
+                result.cr_count++;
+            ch = '\n';
+        }
+        else if (ch == '\n')
+            result.lf_count++;
+        *out++ = QChar(ch);
+    }
+    return out;
+}
 
-bool write(const QString& text,const QString& filename,QIODevice::OpenMode mode)
+// 根据BOM判断编码，没有BOM时按UTF-8解码，不是合法的UTF-8时按Latin-1解码。
+// 解码、换行符统一和计数在同一次遍历中完成，只有回退到Latin-1时才会再遍历一次
+DecodedText decode(const QByteArray& data)
+{
+    DecodedText result;
+    const uchar* begin = reinterpret_cast<const uchar*>(data.constData());
+    const uchar* end = begin + data.size();
+
+    QString text(data.size(), Qt::Uninitialized);
+    QChar* out_begin = text.data();
+    QChar* out = nullptr;
+    if (data.size() >= 2 && begin[0] == 0xFF && begin[1] == 0xFE) {
+        result.encoding = "utf-16le";
+        out = decode_units(begin + 2, end, 2, false, out_begin, result);
+    }
+    else if (data.size() >= 2 && begin[0] == 0xFE && begin[1] == 0xFF) {
+        result.encoding = "utf-16be";
+        out = decode_units(begin + 2, end, 2, true, out_begin, result);
+    }
+    else {
+        bool bom = data.size() >= 3 && begin[0] == 0xEF && begin[1] == 0xBB && begin[2] == 0xBF;
+        result.encoding = bom ? "utf-8-bom" : "utf-8";
+        out = decode_utf8(bom ? begin + 3 : begin, end, out_begin, result);
+        if (out == nullptr) {
+            result = DecodedText();
+            result.encoding = "latin-1";
+            out = decode_units(begin, end, 1, false, out_begin, result);
+        }
+    }
+    text.resize(int(out - out_begin));
+    result.text = text;
+
+    int kinds = (result.crlf_count > 0) + (result.lf_count > 0) + (result.cr_count > 0);
+    result.mixed_eol = kinds > 1;
+    if (kinds > 0) {
+        // 数量相同时和sourcecode::get_eol_chars的顺序一致
+        if (result.crlf_count >= result.lf_count && result.crlf_count >= result.cr_count)
+            result.eol_chars = "\r\n";
+        else if (result.lf_count >= result.cr_count)
+            result.eol_chars = "\n";
+        else
+            result.eol_chars = "\r";
+    }
+    result.line_count = result.lf_count + result.crlf_count + result.cr_count + 1;
+    return result;
+}
+
+DecodedText read_file(const QString& filename, bool* ok)
+{
+    QFile file(filename);
+    bool opened = file.open(QIODevice::ReadOnly);
+    if (ok)
+        *ok = opened;
+    if (!opened)
+        return DecodedText();
+    QByteArray data = file.readAll();
+    file.close();
+    return decode(data);
+}
+
+// 按原来的编码保存，文本中有该编码不能表示的字符时改用UTF-8
+QByteArray encode(const QString& text, const QString& encoding)
+{
+    if (encoding == "utf-8-bom")
+        return QByteArray("\xEF\xBB\xBF") + text.toUtf8();
+    if (encoding == "utf-16le" || encoding == "utf-16be") {
+        bool big_endian = encoding == "utf-16be";
+        QByteArray data(2 + 2 * text.size(), Qt::Uninitialized);
+        uchar* out = reinterpret_cast<uchar*>(data.data());
+        if (big_endian)
+            qToBigEndian<quint16>(0xFEFF, out);
+        else
+            qToLittleEndian<quint16>(0xFEFF, out);
+        out += 2;
+        foreach (const QChar& ch, text) {
+            if (big_endian)
+                qToBigEndian<quint16>(ch.unicode(), out);
+            else
+                qToLittleEndian<quint16>(ch.unicode(), out);
+            out += 2;
+        }
+        return data;
+    }
+    if (encoding == "latin-1") {
+        bool representable = true;
+        foreach (const QChar& ch, text) {
+            if (ch.unicode() > 0xFF) {
+                representable = false;
+                break;
+            }
+        }
+        if (representable)
+            return text.toLatin1();
+    }
+    return text.toUtf8();
+}
+
+bool write(const QString& text,const QString& filename,QIODevice::OpenMode mode,
+           const QString& encoding)
 {
     QFile file(filename);
     bool ok = file.open(mode);
     if (ok) {
-        file.write(text.toUtf8());
+        file.write(encode(text, encoding));
         file.close();
     }
     return ok;
@@ -23,20 +239,14 @@ bool writelines(const QStringList& lines,const QString& filename,QIODevice::Open
 
 QString read(const QString& filename)
 {
-    QFile file(filename);
-    bool ok = file.open(QIODevice::ReadOnly);
-    if (ok) {
-        QString text = file.readAll();
-        file.close();
-        return text;
-    }
-    return QString();
+    return read_file(filename).text;
 }
 
+// read()返回的文本换行符已经统一为"\n"
 QStringList readlines(const QString& filename)
 {
     QString text = read(filename);
-    return text.split(os::linesep);
+    return text.split('\n');
 }
 
 bool is_text_file(const QString& filename)
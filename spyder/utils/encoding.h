@@ -5,7 +5,29 @@
 
 namespace encoding {
 
-bool write(const QString& text,const QString& filename,QIODevice::OpenMode mode=QIODevice::WriteOnly);
+// 读入文件的结果：文本中的换行符统一为"\n"，同时记录原来的编码和换行符
+struct DecodedText
+{
+    QString text;
+    // "utf-8", "utf-8-bom", "utf-16le", "utf-16be", "latin-1"
+    QString encoding;
+    // 出现最多的换行符，没有换行符时为空
+    QString eol_chars;
+    bool mixed_eol;
+    int line_count;
+    int lf_count;
+    int crlf_count;
+    int cr_count;
+
+    DecodedText();
+};
+
+DecodedText decode(const QByteArray& data);
+DecodedText read_file(const QString& filename, bool* ok=nullptr);
+QByteArray encode(const QString& text, const QString& encoding);
+
+bool write(const QString& text,const QString& filename,QIODevice::OpenMode mode=QIODevice::WriteOnly,
+           const QString& encoding="utf-8");
 bool writelines(const QStringList& lines,const QString& filename,QIODevice::OpenMode mode=QIODevice::WriteOnly);
 
 QString read(const QString& filename);
@@ -0,0 +1,512 @@
+#include "fileenum.h"
+#include "fnmatch.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QProcess>
+
+namespace fileenum {
+
+static bool has_wildcard(const QString& pattern)
+{
+    for (int i = 0; i < pattern.size(); i++) {
+        QChar ch = pattern[i];
+        if (ch == '*' || ch == '?' || ch == '[' || ch == '\\')
+            return true;
+    }
+    return false;
+}
+
+// path在base之下时返回相对路径，path就是base时返回空字符串，否则返回QString()
+static QString relative_to(const QString& base, const QString& path)
+{
+    if (path == base)
+        return QString("");
+    QString prefix = base.endsWith('/') ? base : base + '/';
+    if (!path.startsWith(prefix))
+        return QString();
+    return path.mid(prefix.size());
+}
+
+static QString join_path(const QString& base, const QString& relative)
+{
+    if (relative.isEmpty())
+        return base;
+    return base.endsWith('/') ? base + relative : base + '/' + relative;
+}
+
+static QString read_text(const QString& filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+        return QString();
+    return QString::fromUtf8(file.readAll());
+}
+
+
+/********** ExcludeMatcher **********/
+ExcludeMatcher::ExcludeMatcher()
+{
+    this->has_name_re = false;
+    this->has_path_re = false;
+}
+
+ExcludeMatcher ExcludeMatcher::from_globs(const QString &text)
+{
+    ExcludeMatcher matcher;
+    QStringList name_patterns;
+    QStringList path_patterns;
+    foreach (QString item, text.split(',')) {
+        item = item.trimmed();
+        if (item.isEmpty())
+            continue;
+        bool dir_only = item.size() > 1 && item.endsWith('/');
+        QString glob = dir_only ? item.left(item.size() - 1) : item;
+        bool is_path = glob.contains('/');
+        if (!is_path && !has_wildcard(glob)) {
+            if (dir_only)
+                matcher.dir_names.insert(glob);
+            else
+                matcher.names.insert(glob);
+            continue;
+        }
+        if (!is_path && !dir_only && glob.startsWith("*.") && !has_wildcard(glob.mid(1))) {
+            matcher.suffixes.insert(glob.mid(1));
+            continue;
+        }
+        // 去掉末尾的"\Z"：目录的名字和路径匹配时后面加了'/'
+        QString pattern = fnmatch::translate(glob);
+        pattern.chop(2);
+        pattern += dir_only ? "/\\Z" : "/?\\Z";
+        if (is_path)
+            path_patterns.append(pattern);
+        else
+            name_patterns.append(pattern);
+    }
+
+    if (!name_patterns.isEmpty()) {
+        matcher.name_re = QRegularExpression("^(?:" + name_patterns.join('|') + ")");
+        matcher.name_re.optimize();
+        matcher.has_name_re = true;
+        if (!matcher.name_re.isValid())
+            matcher.error = matcher.name_re.errorString();
+    }
+    if (!path_patterns.isEmpty()) {
+        matcher.path_re = QRegularExpression("(?:" + path_patterns.join('|') + ")");
+        matcher.path_re.optimize();
+        matcher.has_path_re = true;
+        if (!matcher.path_re.isValid())
+            matcher.error = matcher.path_re.errorString();
+    }
+    return matcher;
+}
+
+ExcludeMatcher ExcludeMatcher::from_regexp(const QString &pattern)
+{
+    ExcludeMatcher matcher;
+    if (pattern.isEmpty())
+        return matcher;
+    matcher.path_re = QRegularExpression(pattern);
+    matcher.path_re.optimize();
+    matcher.has_path_re = true;
+    if (!matcher.path_re.isValid())
+        matcher.error = matcher.path_re.errorString();
+    return matcher;
+}
+
+bool ExcludeMatcher::is_empty() const
+{
+    return names.isEmpty() && dir_names.isEmpty() && suffixes.isEmpty() &&
+            !has_name_re && !has_path_re;
+}
+
+bool ExcludeMatcher::matches(const QString &path, const QString &name, bool is_dir) const
+{
+    if (names.contains(name) || (is_dir && dir_names.contains(name)))
+        return true;
+    if (!suffixes.isEmpty()) {
+        // ".tar.gz"这样的扩展名也要查
+        for (int i = name.indexOf('.'); i >= 0; i = name.indexOf('.', i + 1)) {
+            if (suffixes.contains(name.mid(i)))
+                return true;
+        }
+    }
+    if (has_name_re && name_re.match(is_dir ? name + '/' : name).hasMatch())
+        return true;
+    if (has_path_re && path_re.match(is_dir ? path + '/' : path).hasMatch())
+        return true;
+    return false;
+}
+
+
+/********** IgnoreRules **********/
+void IgnoreRules::parse(const QString &text)
+{
+    foreach (QString line, text.split('\n')) {
+        if (line.endsWith('\r'))
+            line.chop(1);
+        // 末尾的空格要用'\'转义
+        while (line.endsWith(' ') && !line.endsWith("\\ "))
+            line.chop(1);
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+
+        Rule rule;
+        rule.negated = false;
+        if (line.startsWith('!')) {
+            rule.negated = true;
+            line = line.mid(1);
+        }
+        else if (line.startsWith("\\!") || line.startsWith("\\#"))
+            line = line.mid(1);
+        rule.dir_only = line.endsWith('/');
+        if (rule.dir_only)
+            line.chop(1);
+        rule.anchored = line.contains('/');
+        if (line.startsWith('/'))
+            line = line.mid(1);
+        if (line.isEmpty())
+            continue;
+
+        if (has_wildcard(line)) {
+            rule.re = QRegularExpression(translate(line));
+            if (!rule.re.isValid())
+                continue;
+            rule.re.optimize();
+        }
+        else
+            rule.literal = line;
+        rules.append(rule);
+    }
+}
+
+IgnoreRules::Result IgnoreRules::match(const QStringRef &relative, const QStringRef &name, bool is_dir) const
+{
+    for (int i = rules.size() - 1; i >= 0; i--) {
+        const Rule& rule = rules[i];
+        if (rule.dir_only && !is_dir)
+            continue;
+        const QStringRef& subject = rule.anchored ? relative : name;
+        bool matched;
+        if (rule.literal.isNull())
+            matched = rule.re.match(subject).hasMatch();
+        else
+            matched = (subject == rule.literal);
+        if (matched)
+            return rule.negated ? INCLUDED : IGNORED;
+    }
+    return NONE;
+}
+
+QString IgnoreRules::translate(const QString &pattern)
+{
+    QString res;
+    int n = pattern.size();
+    for (int i = 0; i < n; i++) {
+        QChar c = pattern[i];
+        if (c == '*') {
+            // 只有单独作为一层的"**"匹配多层目录
+            if (i + 1 < n && pattern[i+1] == '*' && (i == 0 || pattern[i-1] == '/')) {
+                if (i + 2 == n) {
+                    res += ".*";
+                    break;
+                }
+                if (pattern[i+2] == '/') {
+                    res += "(?:.*/)?";
+                    i += 2;
+                    continue;
+                }
+            }
+            res += "[^/]*";
+        }
+        else if (c == '?')
+            res += "[^/]";
+        else if (c == '[') {
+            int j = i + 1;
+            if (j < n && (pattern[j] == '!' || pattern[j] == '^'))
+                j++;
+            if (j < n && pattern[j] == ']')
+                j++;
+            while (j < n && pattern[j] != ']')
+                j++;
+            if (j >= n)
+                res += "\\[";
+            else {
+                QString stuff = pattern.mid(i + 1, j - i - 1);
+                stuff.replace("\\", "\\\\");
+                if (stuff.startsWith('!'))
+                    stuff[0] = '^';
+                res += '[' + stuff + ']';
+                i = j;
+            }
+        }
+        else if (c == '\\' && i + 1 < n) {
+            i++;
+            res += QRegularExpression::escape(pattern.mid(i, 1));
+        }
+        else
+            res += QRegularExpression::escape(QString(c));
+    }
+    return "^" + res + "$";
+}
+
+
+/********** IgnoreTree **********/
+const QStringList IgnoreTree::FILENAMES = {".gitignore", ".ignore"};
+
+IgnoreTree::IgnoreTree(const QString &root)
+{
+    this->_in_git_repo = false;
+    this->set_root(root);
+}
+
+void IgnoreTree::set_root(const QString &root)
+{
+    this->clear();
+    _root = root.isEmpty() ? QString() : QDir::cleanPath(QFileInfo(root).absoluteFilePath());
+    _base = _root;
+    _in_git_repo = false;
+    info_exclude = IgnoreRules();
+    if (_root.isEmpty())
+        return;
+
+    QDir dir(_root);
+    do {
+        QFileInfo git(dir.filePath(".git"));
+        if (git.exists()) {
+            _base = dir.absolutePath();
+            _in_git_repo = true;
+            // 子模块和工作树中的.git是一个文件
+            if (git.isDir())
+                info_exclude.parse(read_text(git.filePath() + "/info/exclude"));
+            break;
+        }
+    } while (dir.cdUp());
+}
+
+void IgnoreTree::clear()
+{
+    cache.clear();
+    dir_cache.clear();
+}
+
+IgnoreRules IgnoreTree::read_rules(const QString &dir)
+{
+    IgnoreRules rules;
+    QString text;
+    foreach (const QString& name, FILENAMES)
+        text += read_text(dir + '/' + name) + '\n';
+    rules.parse(text);
+    return rules;
+}
+
+const IgnoreRules& IgnoreTree::rules(const QString &relative_dir)
+{
+    auto it = cache.find(relative_dir);
+    if (it == cache.end())
+        it = cache.insert(relative_dir, read_rules(join_path(_base, relative_dir)));
+    return it.value();
+}
+
+QVector<IgnoreFrame> IgnoreTree::frames(const QString &relative_dir)
+{
+    QVector<IgnoreFrame> result;
+    if (_base.isEmpty())
+        return result;
+    if (!info_exclude.is_empty())
+        result.append(IgnoreFrame{0, info_exclude});
+    QString dir("");
+    while (true) {
+        const IgnoreRules& dir_rules = this->rules(dir);
+        if (!dir_rules.is_empty())
+            result.append(IgnoreFrame{dir.isEmpty() ? 0 : dir.size() + 1, dir_rules});
+        if (dir.size() >= relative_dir.size())
+            break;
+        int next = relative_dir.indexOf('/', dir.isEmpty() ? 0 : dir.size() + 1);
+        dir = next < 0 ? relative_dir : relative_dir.left(next);
+    }
+    return result;
+}
+
+// 从最深一级目录的规则开始，第一个匹配的规则决定结果
+bool IgnoreTree::is_ignored(const QVector<IgnoreFrame> &frames, const QString &relative,
+                            const QStringRef &name, bool is_dir)
+{
+    for (int i = frames.size() - 1; i >= 0; i--) {
+        const IgnoreFrame& frame = frames[i];
+        IgnoreRules::Result result = frame.rules.match(relative.midRef(frame.offset), name, is_dir);
+        if (result != IgnoreRules::NONE)
+            return result == IgnoreRules::IGNORED;
+    }
+    return false;
+}
+
+bool IgnoreTree::dir_ignored(const QString &relative_dir)
+{
+    auto it = dir_cache.constFind(relative_dir);
+    if (it != dir_cache.constEnd())
+        return it.value();
+    int slash = relative_dir.lastIndexOf('/');
+    QString parent = slash < 0 ? QString("") : relative_dir.left(slash);
+    bool ignored = !parent.isEmpty() && this->dir_ignored(parent);
+    if (!ignored)
+        ignored = is_ignored(this->frames(parent), relative_dir, relative_dir.midRef(slash + 1), true);
+    dir_cache.insert(relative_dir, ignored);
+    return ignored;
+}
+
+bool IgnoreTree::is_ignored(const QString &path, bool is_dir)
+{
+    if (_base.isEmpty())
+        return false;
+    QString relative = relative_to(_base, QDir::cleanPath(path));
+    if (relative.isEmpty())
+        return false;
+    if (is_dir)
+        return this->dir_ignored(relative);
+    int slash = relative.lastIndexOf('/');
+    QString parent = slash < 0 ? QString("") : relative.left(slash);
+    if (!parent.isEmpty() && this->dir_ignored(parent))
+        return true;
+    return is_ignored(this->frames(parent), relative, relative.midRef(slash + 1), false);
+}
+
+
+/********** FileEnumerator **********/
+FileEnumerator::FileEnumerator(const QString &root)
+{
+    this->root = QDir::cleanPath(root);
+    this->respect_ignore = true;
+    this->use_git = true;
+    this->_dirs_read = 0;
+}
+
+bool FileEnumerator::walk(const std::function<bool (const QString &)> &callback)
+{
+    _dirs_read = 0;
+    QVector<IgnoreFrame> frames;
+    if (!respect_ignore)
+        return this->walk_dir(root, QString(""), frames, callback);
+
+    IgnoreTree tree(root);
+    if (use_git && tree.in_git_repo()) {
+        QStringList files;
+        if (git_ls_files(root, &files))
+            return this->walk_git(files, callback);
+    }
+    QString relative = relative_to(tree.base(), tree.root());
+    frames = tree.frames(relative);
+    return this->walk_dir(root, relative, frames, callback);
+}
+
+QStringList FileEnumerator::files()
+{
+    QStringList list;
+    this->walk([&list](const QString& filename) {
+        list.append(filename);
+        return true;
+    });
+    return list;
+}
+
+// relative是path相对于规则树根目录的路径，frames已包含path本身的规则
+bool FileEnumerator::walk_dir(const QString &path, const QString &relative, QVector<IgnoreFrame> &frames,
+                              const std::function<bool (const QString &)> &callback)
+{
+    QDir dir(path);
+    _dirs_read++;
+    foreach (const QFileInfo& info, dir.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot)) {
+        QString name = info.fileName();
+        QString sub_path = path + '/' + name;
+        QString sub_relative = relative.isEmpty() ? name : relative + '/' + name;
+        if (info.isDir()) {
+            if (name == ".git" || name == ".hg")
+                continue;
+            if (respect_ignore && IgnoreTree::is_ignored(frames, sub_relative, QStringRef(&name), true))
+                continue;
+            if (exclude.matches(sub_path, name, true))
+                continue;
+
+            IgnoreRules rules;
+            if (respect_ignore)
+                rules = IgnoreTree::read_rules(sub_path);
+            bool pushed = !rules.is_empty();
+            if (pushed)
+                frames.append(IgnoreFrame{sub_relative.size() + 1, rules});
+            bool finished = this->walk_dir(sub_path, sub_relative, frames, callback);
+            if (pushed)
+                frames.removeLast();
+            if (!finished)
+                return false;
+        }
+        else if (info.isFile()) {
+            if (respect_ignore && IgnoreTree::is_ignored(frames, sub_relative, QStringRef(&name), false))
+                continue;
+            if (exclude.matches(sub_path, name, false))
+                continue;
+            if (!callback(sub_path))
+                return false;
+        }
+    }
+    return true;
+}
+
+bool FileEnumerator::walk_git(const QStringList &files, const std::function<bool (const QString &)> &callback)
+{
+    // 目录是否被排除，按相对路径缓存
+    QHash<QString, bool> excluded;
+    QString previous;
+    foreach (const QString& relative, files) {
+        // 有冲突的文件出现多次；没有提交的嵌套仓库以'/'结尾
+        if (relative == previous || relative.endsWith('/'))
+            continue;
+        previous = relative;
+
+        bool skip = false;
+        for (int i = relative.indexOf('/'); i >= 0 && !skip; i = relative.indexOf('/', i + 1)) {
+            QString dir = relative.left(i);
+            auto it = excluded.constFind(dir);
+            if (it == excluded.constEnd()) {
+                QString name = dir.mid(dir.lastIndexOf('/') + 1);
+                it = excluded.insert(dir, exclude.matches(root + '/' + dir, name, true));
+            }
+            skip = it.value();
+        }
+        if (skip)
+            continue;
+
+        QString path = root + '/' + relative;
+        if (exclude.matches(path, relative.mid(relative.lastIndexOf('/') + 1), false))
+            continue;
+        // 索引中已在磁盘上删除的文件和子模块
+        if (!QFileInfo(path).isFile())
+            continue;
+        if (!callback(path))
+            return false;
+    }
+    return true;
+}
+
+// 已提交的文件和没有被.gitignore忽略的新文件，路径相对于root。不是git仓库或没有安装git时返回false
+bool FileEnumerator::git_ls_files(const QString &root, QStringList *files)
+{
+    QProcess process;
+    process.setWorkingDirectory(root);
+    process.start("git", QStringList() << "ls-files" << "-z" << "--cached" << "--others"
+                  << "--exclude-standard");
+    if (!process.waitForFinished(10000)) {
+        process.kill();
+        process.waitForFinished(1000);
+        return false;
+    }
+    if (process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0)
+        return false;
+    foreach (const QByteArray& item, process.readAllStandardOutput().split('\0')) {
+        if (!item.isEmpty())
+            files->append(QString::fromUtf8(item));
+    }
+    return true;
+}
+
+} // namespace fileenum
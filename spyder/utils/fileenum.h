@@ -0,0 +1,149 @@
+#pragma once
+
+#include <QSet>
+#include <QHash>
+#include <QVector>
+#include <QStringList>
+#include <QRegularExpression>
+#include <functional>
+
+namespace fileenum {
+
+// 逗号分隔的glob或者一个正则表达式编译成的排除规则。
+// glob中"*.ext"按扩展名、没有通配符的按名字查哈希表，其余不含'/'的合并为一个只匹配文件名的
+// 正则表达式，含'/'的合并为一个匹配整个路径的正则表达式，所以每个路径最多匹配两次。
+// 以'/'结尾的glob只排除目录
+class ExcludeMatcher
+{
+public:
+    ExcludeMatcher();
+    static ExcludeMatcher from_globs(const QString& text);
+    static ExcludeMatcher from_regexp(const QString& pattern);
+
+    bool is_empty() const;
+    bool is_valid() const { return error.isEmpty(); }
+    QString error_string() const { return error; }
+
+    // path是绝对路径，name是其中的文件名；正则表达式匹配目录时path后面加'/'
+    bool matches(const QString& path, const QString& name, bool is_dir) const;
+
+private:
+    QSet<QString> suffixes;
+    QSet<QString> names;
+    QSet<QString> dir_names;
+    QRegularExpression name_re;
+    QRegularExpression path_re;
+    bool has_name_re;
+    bool has_path_re;
+    QString error;
+};
+
+
+// 一个.gitignore或.ignore文件中的规则，和git一样后面的规则优先，以'!'开头的规则重新包含
+class IgnoreRules
+{
+public:
+    enum Result { NONE, IGNORED, INCLUDED };
+
+    void parse(const QString& text);
+    bool is_empty() const { return rules.isEmpty(); }
+
+    // relative是相对于规则文件所在目录的路径，用'/'分隔
+    Result match(const QStringRef& relative, const QStringRef& name, bool is_dir) const;
+
+    // gitignore的glob：'*'和'?'不匹配'/'，"**/"匹配任意层目录
+    static QString translate(const QString& pattern);
+
+private:
+    struct Rule
+    {
+        // 没有通配符时直接比较字符串
+        QString literal;
+        QRegularExpression re;
+        bool negated;
+        bool dir_only;
+        // 含'/'的规则匹配相对路径，否则匹配任意一层的文件名
+        bool anchored;
+    };
+    QVector<Rule> rules;
+};
+
+
+// 某一级目录的规则，offset是该目录相对于规则树根目录的路径长度(含末尾的'/')
+struct IgnoreFrame
+{
+    int offset;
+    IgnoreRules rules;
+};
+
+
+// root下各级目录的忽略规则。root在git仓库中时，仓库根目录到root之间的.gitignore、.ignore
+// 和.git/info/exclude同样生效。规则文件按需读入并缓存，目录内容改变后调用clear
+class IgnoreTree
+{
+public:
+    static const QStringList FILENAMES;
+
+    IgnoreTree(const QString& root = QString());
+    void set_root(const QString& root);
+    void clear();
+
+    QString root() const { return _root; }
+    // 规则生效的最上层目录：git仓库的根目录，不在仓库中时就是root
+    QString base() const { return _base; }
+    bool in_git_repo() const { return _in_git_repo; }
+
+    static IgnoreRules read_rules(const QString& dir);
+    // base到dir(含)之间各级目录的规则，dir相对于base
+    QVector<IgnoreFrame> frames(const QString& relative_dir);
+    static bool is_ignored(const QVector<IgnoreFrame>& frames, const QString& relative,
+                           const QStringRef& name, bool is_dir);
+
+    // path是root下的绝对路径，上级目录被忽略时也返回true
+    bool is_ignored(const QString& path, bool is_dir);
+
+private:
+    QString _root;
+    QString _base;
+    bool _in_git_repo;
+    IgnoreRules info_exclude;
+    QHash<QString, IgnoreRules> cache;
+    QHash<QString, bool> dir_cache;
+
+    const IgnoreRules& rules(const QString& relative_dir);
+    bool dir_ignored(const QString& relative_dir);
+};
+
+
+// 遍历root下的文件，对每个文件调用callback，callback返回false时停止。
+// .git、.hg、被忽略和被排除的目录在读入之前跳过。root在git仓库中并且use_git为true时
+// 改为读取git ls-files的输出(已提交的和没有被忽略的新文件)，这时.ignore不生效
+class FileEnumerator
+{
+public:
+    FileEnumerator(const QString& root);
+    void set_exclude(const ExcludeMatcher& exclude) { this->exclude = exclude; }
+    void set_respect_ignore(bool respect_ignore) { this->respect_ignore = respect_ignore; }
+    void set_use_git(bool use_git) { this->use_git = use_git; }
+
+    // 全部遍历完返回true
+    bool walk(const std::function<bool(const QString&)>& callback);
+    QStringList files();
+    // 上次遍历读过的目录数
+    int dirs_read() const { return _dirs_read; }
+
+    static bool git_ls_files(const QString& root, QStringList* files);
+
+private:
+    QString root;
+    ExcludeMatcher exclude;
+    bool respect_ignore;
+    bool use_git;
+    int _dirs_read;
+
+    bool walk_dir(const QString& path, const QString& relative, QVector<IgnoreFrame>& frames,
+                  const std::function<bool(const QString&)>& callback);
+    bool walk_git(const QStringList& files, const std::function<bool(const QString&)>& callback);
+};
+
+} // namespace fileenum
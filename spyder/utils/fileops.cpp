@@ -0,0 +1,341 @@
+#include "fileops.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QCoreApplication>
+#include <QDirIterator>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
+
+// 每次读写或copy_file_range的块大小，也是检查取消的粒度
+static const qint64 CHUNK_SIZE = 4 * 1024 * 1024;
+// 进度信号的最小间隔
+static const int REPORT_INTERVAL_MS = 100;
+
+QString FileOperation::description() const
+{
+    QString name = QFileInfo(source).fileName();
+    if (kind == COPY)
+        return QString("Copying %1").arg(name);
+    if (kind == MOVE)
+        return QString("Moving %1").arg(name);
+    return QString("Deleting %1").arg(name);
+}
+
+
+FileOperations* FileOperations::instance()
+{
+    static FileOperations* operations = nullptr;
+    if (operations == nullptr) {
+        qRegisterMetaType<FileOperation>("FileOperation");
+        operations = new FileOperations;
+    }
+    return operations;
+}
+
+FileOperations::FileOperations()
+    : QObject (nullptr), busy(false), cancelled(false)
+{
+    done_bytes = 0;
+    total_bytes = 0;
+    last_report_ms = 0;
+
+    thread = new QThread;
+    thread->setObjectName("FileOperations");
+    this->moveToThread(thread);
+    thread->start();
+
+    if (qApp)
+        connect(qApp, &QCoreApplication::aboutToQuit, [this](){ this->shutdown(); });
+}
+
+void FileOperations::enqueue(const FileOperation &operation)
+{
+    {
+        QMutexLocker locker(&mutex);
+        queue.enqueue(operation);
+        busy = true;
+    }
+    QMetaObject::invokeMethod(this, "process", Qt::QueuedConnection);
+}
+
+void FileOperations::cancel()
+{
+    QMutexLocker locker(&mutex);
+    queue.clear();
+    cancelled = true;
+}
+
+void FileOperations::shutdown()
+{
+    if (!thread->isRunning())
+        return;
+    this->cancel();
+    thread->quit();
+    thread->wait();
+}
+
+int FileOperations::pending()
+{
+    QMutexLocker locker(&mutex);
+    return queue.size();
+}
+
+// 在后台线程中执行，每次调用处理完队列中的所有操作
+void FileOperations::process()
+{
+    while (true) {
+        FileOperation operation;
+        {
+            // busy和队列在同一个锁内更新，队列为空时才变为空闲，
+            // 不会在界面线程刚入队时提前发出sig_idle
+            QMutexLocker locker(&mutex);
+            if (queue.isEmpty()) {
+                if (!busy)
+                    return;
+                busy = false;
+                break;
+            }
+            operation = queue.dequeue();
+            cancelled = false;
+        }
+        emit sig_started(operation);
+        QString error;
+        bool ok = this->run(operation, &error);
+        if (!ok && cancelled)
+            error = "Cancelled";
+        emit sig_finished(operation, ok, error);
+    }
+    emit sig_idle();
+}
+
+void FileOperations::advance(qint64 bytes)
+{
+    done_bytes += bytes;
+    qint64 elapsed = clock.elapsed();
+    if (elapsed - last_report_ms < REPORT_INTERVAL_MS && done_bytes < total_bytes)
+        return;
+    last_report_ms = elapsed;
+    double speed = elapsed > 0 ? done_bytes * 1000.0 / elapsed : 0.0;
+    emit sig_progress(done_bytes, total_bytes, speed, this->pending());
+}
+
+static qint64 tree_size(const QString& path, bool count_entries)
+{
+    QFileInfo info(path);
+    if (!info.isDir() || info.isSymLink())
+        return count_entries ? 1 : info.size();
+    qint64 total = count_entries ? 1 : 0;
+    QDirIterator it(path, QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System,
+                    QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        total += count_entries ? 1 : it.fileInfo().size();
+    }
+    return total;
+}
+
+bool FileOperations::run(const FileOperation &operation, QString *error)
+{
+    done_bytes = 0;
+    last_report_ms = 0;
+    clock.start();
+    // 删除按条目数计算进度，复制按字节数
+    bool deleting = operation.kind == FileOperation::REMOVE;
+    total_bytes = tree_size(operation.source, deleting);
+    emit sig_progress(0, total_bytes, 0.0, this->pending());
+
+    if (deleting)
+        return this->remove_tree(operation.source, error);
+
+    if (QFileInfo::exists(operation.dest) || QFileInfo(operation.dest).isSymLink()) {
+        if (!operation.overwrite) {
+            *error = QString("%1 already exists").arg(operation.dest);
+            return false;
+        }
+        qint64 total = total_bytes;
+        bool removed = this->remove_tree(operation.dest, error);
+        done_bytes = 0;
+        total_bytes = total;
+        if (!removed)
+            return false;
+    }
+
+    if (operation.kind == FileOperation::MOVE) {
+        // 同一设备上直接改名
+        if (QDir().rename(operation.source, operation.dest)) {
+            this->advance(total_bytes);
+            return true;
+        }
+    }
+    if (!this->copy_tree(operation.source, operation.dest, error)) {
+        QString ignored;
+        if (QFileInfo::exists(operation.dest) && (cancelled || operation.is_dir))
+            this->remove_tree(operation.dest, &ignored);
+        return false;
+    }
+    if (operation.kind == FileOperation::MOVE) {
+        qint64 done = done_bytes, total = total_bytes;
+        bool removed = this->remove_tree(operation.source, error);
+        done_bytes = done;
+        total_bytes = total;
+        return removed;
+    }
+    return true;
+}
+
+bool FileOperations::copy_tree(const QString &source, const QString &dest, QString *error)
+{
+    QFileInfo info(source);
+    if (!info.isDir() || info.isSymLink())
+        return this->copy_file(source, dest, error);
+    if (!QDir().mkpath(dest)) {
+        *error = QString("Unable to create %1").arg(dest);
+        return false;
+    }
+    QDir dir(source);
+    QFileInfoList entries = dir.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot |
+                                              QDir::Hidden | QDir::System);
+    foreach (const QFileInfo& entry, entries) {
+        if (cancelled)
+            return false;
+        if (!this->copy_tree(entry.filePath(), dest + '/' + entry.fileName(), error))
+            return false;
+    }
+    QFile::setPermissions(dest, info.permissions());
+    return true;
+}
+
+bool FileOperations::copy_file(const QString &source, const QString &dest, QString *error)
+{
+    QFileInfo info(source);
+    if (info.isSymLink()) {
+        if (QFile::link(info.symLinkTarget(), dest))
+            return true;
+        *error = QString("Unable to create link %1").arg(dest);
+        return false;
+    }
+
+    QFile in(source);
+    QFile out(dest);
+    if (!in.open(QIODevice::ReadOnly)) {
+        *error = QString("%1: %2").arg(source).arg(in.errorString());
+        return false;
+    }
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        *error = QString("%1: %2").arg(dest).arg(out.errorString());
+        return false;
+    }
+    bool ok = false;
+    if (this->copy_file_data(in.handle(), out.handle(), info.size(), error))
+        ok = true;
+    else if (error->isEmpty() && !cancelled) {
+        // 不支持快速复制，分块读写
+        ok = true;
+        QByteArray buffer;
+        while (!in.atEnd()) {
+            if (cancelled) {
+                ok = false;
+                break;
+            }
+            buffer = in.read(CHUNK_SIZE);
+            if (buffer.isEmpty() && in.error() != QFile::NoError) {
+                *error = QString("%1: %2").arg(source).arg(in.errorString());
+                ok = false;
+                break;
+            }
+            if (out.write(buffer) != buffer.size()) {
+                *error = QString("%1: %2").arg(dest).arg(out.errorString());
+                ok = false;
+                break;
+            }
+            this->advance(buffer.size());
+        }
+    }
+    out.close();
+    if (!ok) {
+        QFile::remove(dest);
+        return false;
+    }
+    out.setPermissions(in.permissions());
+    return true;
+}
+
+// 内核中复制，返回false且error为空表示不支持，调用者改为分块读写
+bool FileOperations::copy_file_data(int source_fd, int dest_fd, qint64 size, QString *error)
+{
+#ifdef Q_OS_LINUX
+#ifdef FICLONE
+    if (::ioctl(dest_fd, FICLONE, source_fd) == 0) {
+        this->advance(size);
+        return true;
+    }
+#endif
+#ifdef SYS_copy_file_range
+    qint64 copied = 0;
+    while (copied < size || size == 0) {
+        if (cancelled)
+            return false;
+        ssize_t n = ::syscall(SYS_copy_file_range, source_fd, nullptr, dest_fd, nullptr,
+                              size_t(CHUNK_SIZE), 0u);
+        if (n < 0) {
+            // 第一次调用就失败时(跨文件系统、内核不支持)改为分块读写
+            if (copied == 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+                                errno == EOPNOTSUPP || errno == EBADF))
+                return false;
+            *error = QString::fromLocal8Bit(strerror(errno));
+            return false;
+        }
+        if (n == 0)
+            break;
+        copied += n;
+        this->advance(n);
+    }
+    return true;
+#endif
+#endif
+    Q_UNUSED(source_fd);
+    Q_UNUSED(dest_fd);
+    Q_UNUSED(size);
+    Q_UNUSED(error);
+    return false;
+}
+
+// 从最深处开始删除；只读的文件先改为可写(Windows上只读文件不能删除)
+bool FileOperations::remove_tree(const QString &path, QString *error)
+{
+    QFileInfo info(path);
+    if (!info.isDir() || info.isSymLink()) {
+        if (!info.isWritable())
+            QFile::setPermissions(path, info.permissions() | QFile::WriteOwner);
+        if (!QFile::remove(path)) {
+            *error = QString("Unable to remove %1").arg(path);
+            return false;
+        }
+        this->advance(1);
+        return true;
+    }
+    QDir dir(path);
+    QFileInfoList entries = dir.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot |
+                                              QDir::Hidden | QDir::System);
+    foreach (const QFileInfo& entry, entries) {
+        if (cancelled)
+            return false;
+        if (!this->remove_tree(entry.filePath(), error))
+            return false;
+    }
+    if (!dir.rmdir(path)) {
+        *error = QString("Unable to remove %1").arg(path);
+        return false;
+    }
+    this->advance(1);
+    return true;
+}
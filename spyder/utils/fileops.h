@@ -0,0 +1,75 @@
+#pragma once
+
+#include <QMutex>
+#include <QQueue>
+#include <QThread>
+#include <QMetaType>
+#include <QElapsedTimer>
+#include <atomic>
+
+// 一个复制、移动或删除操作。冲突由界面先询问用户：overwrite为true时覆盖已有的目标
+struct FileOperation
+{
+    enum Kind { COPY, MOVE, REMOVE };
+
+    int kind;
+    QString source;
+    // 目标的完整路径，删除时为空
+    QString dest;
+    bool is_dir;
+    bool overwrite;
+    // 发起操作的对象，只用于在完成时判断是否由自己处理，后台线程中不访问
+    QObject* owner;
+
+    FileOperation() : kind(COPY), is_dir(false), overwrite(false), owner(nullptr) {}
+    QString description() const;
+};
+Q_DECLARE_METATYPE(FileOperation)
+
+
+// 在独立线程中按顺序执行文件操作，整个目录树的复制、移动、删除不阻塞界面。
+// Linux上复制文件先尝试reflink(FICLONE)，再尝试copy_file_range，
+// 都不支持时分块读写；同一设备上的移动直接改名
+class FileOperations : public QObject
+{
+    Q_OBJECT
+signals:
+    void sig_started(const FileOperation& operation);
+    // 当前操作的进度，bytes_per_second为该操作开始以来的平均速度
+    void sig_progress(qint64 done, qint64 total, double bytes_per_second, int pending);
+    void sig_finished(const FileOperation& operation, bool ok, const QString& error);
+    void sig_idle();
+
+public:
+    static FileOperations* instance();
+
+    void enqueue(const FileOperation& operation);
+    // 取消当前的操作和所有排队的操作，已复制的部分被删除
+    void cancel();
+    bool is_busy() const { return busy; }
+    void shutdown();
+
+public slots:
+    void process();
+
+private:
+    QThread* thread;
+    QMutex mutex;
+    QQueue<FileOperation> queue;
+    std::atomic<bool> busy;
+    std::atomic<bool> cancelled;
+
+    qint64 done_bytes;
+    qint64 total_bytes;
+    QElapsedTimer clock;
+    qint64 last_report_ms;
+
+    FileOperations();
+    int pending();
+    void advance(qint64 bytes);
+    bool run(const FileOperation& operation, QString* error);
+    bool copy_tree(const QString& source, const QString& dest, QString* error);
+    bool copy_file(const QString& source, const QString& dest, QString* error);
+    bool copy_file_data(int source_fd, int dest_fd, qint64 size, QString* error);
+    bool remove_tree(const QString& path, QString* error);
+};
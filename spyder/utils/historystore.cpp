@@ -0,0 +1,447 @@
+#include "historystore.h"
+#include "utils/encoding.h"
+
+#include <QDir>
+#include <QMap>
+#include <QSet>
+#include <QFile>
+#include <QFileInfo>
+#include <algorithm>
+#include <iterator>
+
+// 往前读时每次读入的字节数
+static const qint64 READ_BLOCK = 64 * 1024;
+
+static int line_count(const QByteArray& data)
+{
+    int count = data.count('\n');
+    if (!data.isEmpty() && !data.endsWith('\n'))
+        count++;
+    return count;
+}
+
+// 从end往前读最多count行(倒序放入lines)，返回读完后的位置，读完整个文件或出错时返回0
+static qint64 read_lines_backward(QFile& file, qint64 end, int count, QList<QByteArray>& lines)
+{
+    QByteArray buffer;
+    qint64 buffer_start = end;
+    while (lines.size() < count && end > 0) {
+        int size = int(end - buffer_start);
+        int nl = size >= 2 ? buffer.lastIndexOf('\n', size - 2) : -1;
+        while (nl < 0 && buffer_start > 0) {
+            qint64 start = qMax<qint64>(0, buffer_start - READ_BLOCK);
+            if (!file.seek(start))
+                return 0;
+            QByteArray block = file.read(buffer_start - start);
+            if (block.size() != buffer_start - start)
+                return 0;
+            buffer.prepend(block);
+            buffer_start = start;
+            size = int(end - buffer_start);
+            nl = size >= 2 ? buffer.lastIndexOf('\n', size - 2) : -1;
+        }
+        int line_end = (size > 0 && buffer[size - 1] == '\n') ? size - 1 : size;
+        QByteArray line = buffer.mid(nl + 1, line_end - nl - 1);
+        if (line.endsWith('\r'))
+            line.chop(1);
+        lines.append(line);
+        end = buffer_start + nl + 1;
+        buffer.truncate(nl + 1);
+    }
+    return end;
+}
+
+
+/********** HistoryIndex **********/
+void HistoryIndex::add(const QString &entry, bool sorted)
+{
+    int id = entries.size();
+    entries.append(entry);
+    foreach (const QString& word, HistoryStore::tokens(entry)) {
+        QVector<int>& ids = postings[word];
+        if (ids.isEmpty()) {
+            if (sorted)
+                vocabulary.insert(std::lower_bound(vocabulary.begin(), vocabulary.end(), word),
+                                  word);
+            else
+                vocabulary.append(word);
+        }
+        if (ids.isEmpty() || ids.last() != id)
+            ids.append(id);
+    }
+}
+
+void HistoryIndex::sort_vocabulary()
+{
+    std::sort(vocabulary.begin(), vocabulary.end());
+}
+
+
+/********** HistoryCompactThread **********/
+HistoryCompactThread::HistoryCompactThread(HistoryStore* store)
+    : QThread (store)
+{
+    this->stopped = false;
+    this->store = store;
+}
+
+void HistoryCompactThread::stop()
+{
+    this->stopped = true;
+}
+
+void HistoryCompactThread::run()
+{
+    QByteArray active;
+    int max_entries = 0;
+    QStringList sealed = store->sealed_segments(&active, &max_entries);
+
+    QList<QByteArray> contents;
+    QVector<int> counts;
+    int total = line_count(active);
+    foreach (const QString& path, sealed) {
+        QFile file(path);
+        QByteArray data;
+        if (file.open(QIODevice::ReadOnly))
+            data = file.readAll();
+        contents.append(data);
+        counts.append(line_count(data));
+        total += counts.last();
+    }
+
+    // 先整段删除最旧的段，再去掉剩下最旧一段的开头
+    int excess = total - max_entries;
+    while (excess > 0 && !sealed.isEmpty() && counts.first() <= excess && !stopped) {
+        store->remove_segment(sealed.takeFirst());
+        excess -= counts.takeFirst();
+        contents.removeFirst();
+    }
+    if (excess > 0 && !sealed.isEmpty() && !stopped) {
+        QByteArray& data = contents.first();
+        int pos = 0;
+        for (int i = 0; i < excess && pos >= 0; i++) {
+            pos = data.indexOf('\n', pos);
+            if (pos >= 0)
+                pos++;
+        }
+        if (pos > 0) {
+            QString replacement = sealed.first() + ".tmp";
+            QFile out(replacement);
+            if (out.open(QIODevice::WriteOnly | QIODevice::Truncate) &&
+                    out.write(data.constData() + pos, data.size() - pos) == data.size() - pos) {
+                out.close();
+                store->replace_segment(sealed.first(), replacement, pos);
+                data = data.mid(pos);
+            }
+            else {
+                out.close();
+                QFile::remove(replacement);
+            }
+        }
+    }
+
+    contents.append(active);
+    foreach (const QByteArray& data, contents) {
+        // 与编辑器读文件一样识别编码，不是UTF-8的旧记录也能搜索
+        foreach (const QString& line, encoding::decode(data).text.split('\n')) {
+            if (stopped)
+                return;
+            QString entry = line.trimmed();
+            if (!entry.isEmpty())
+                index.add(entry);
+        }
+    }
+    index.sort_vocabulary();
+}
+
+
+/********** HistoryStore **********/
+HistoryStore::HistoryStore(const QString& filename, int max_stored_entries, QObject* parent)
+    : QObject (parent)
+{
+    this->_filename = filename;
+    this->max_stored_entries = max_stored_entries;
+    this->next_segment = 1;
+    this->active_needs_newline = false;
+    this->indexing = false;
+    this->compact_pending = false;
+    this->_index_ready = false;
+    this->older.segment = 0;
+    this->older.offset = 0;
+    this->load_segments();
+
+    thread = new HistoryCompactThread(this);
+    connect(thread, SIGNAL(finished()), this, SLOT(compaction_finished()));
+    this->start_compaction();
+}
+
+HistoryStore::~HistoryStore()
+{
+    thread->stop();
+    thread->wait();
+}
+
+void HistoryStore::load_segments()
+{
+    QFileInfo info(_filename);
+    QDir dir = info.absoluteDir();
+    QString prefix = info.fileName() + '.';
+    QMap<int, QString> numbered;
+    foreach (const QString& name, dir.entryList(QStringList(prefix + '*'), QDir::Files)) {
+        bool ok;
+        int number = name.mid(prefix.size()).toInt(&ok);
+        if (ok && number > 0)
+            numbered[number] = dir.filePath(name);
+    }
+    segments = numbered.values();
+    segments.append(_filename);
+    next_segment = numbered.isEmpty() ? 1 : numbered.lastKey() + 1;
+
+    if (info.size() > 0) {
+        QFile file(_filename);
+        if (file.open(QIODevice::ReadOnly) && file.seek(info.size() - 1))
+            active_needs_newline = file.read(1) != "\n";
+    }
+    // 旧版本的历史文件可能很大，先封存，由压缩线程截断
+    if (info.size() > SEGMENT_SIZE)
+        this->seal_active();
+}
+
+QStringList HistoryStore::segment_files()
+{
+    QMutexLocker locker(&mutex);
+    return segments;
+}
+
+// 调用前已加锁。当前段改名后下标不变，已读入位置仍然指向同一个文件
+void HistoryStore::seal_active()
+{
+    QString sealed = QString("%1.%2").arg(_filename).arg(next_segment);
+    if (!QFile::rename(_filename, sealed))
+        return;
+    next_segment++;
+    segments.insert(segments.size() - 1, sealed);
+    active_needs_newline = false;
+}
+
+void HistoryStore::start_compaction()
+{
+    if (indexing) {
+        compact_pending = true;
+        return;
+    }
+    indexing = true;
+    thread->index = HistoryIndex();
+    thread->start(QThread::LowPriority);
+}
+
+// 调用前已加锁，position移到读入的最旧一行之前
+QStringList HistoryStore::read_before(HistoryPosition &position, int count)
+{
+    QList<QByteArray> lines;
+    while (lines.size() < count) {
+        if (position.offset <= 0) {
+            if (position.segment <= 0)
+                break;
+            position.segment--;
+            position.offset = QFileInfo(segments[position.segment]).size();
+            continue;
+        }
+        QFile file(segments[position.segment]);
+        if (!file.open(QIODevice::ReadOnly)) {
+            position.offset = 0;
+            continue;
+        }
+        position.offset = read_lines_backward(file, position.offset, count, lines);
+    }
+    if (lines.isEmpty())
+        return QStringList();
+    QByteArray data;
+    for (int i = lines.size() - 1; i >= 0; i--) {
+        data.append(lines[i]);
+        if (i > 0)
+            data.append('\n');
+    }
+    return encoding::decode(data).text.split('\n');
+}
+
+QStringList HistoryStore::read_tail(int count)
+{
+    QMutexLocker locker(&mutex);
+    older.segment = segments.size() - 1;
+    older.offset = QFileInfo(_filename).size();
+    return this->read_before(older, count);
+}
+
+QStringList HistoryStore::read_older(int count)
+{
+    QMutexLocker locker(&mutex);
+    return this->read_before(older, count);
+}
+
+bool HistoryStore::at_start()
+{
+    QMutexLocker locker(&mutex);
+    return older.segment <= 0 && older.offset <= 0;
+}
+
+void HistoryStore::append(const QString &command)
+{
+    QByteArray data = command.toUtf8();
+    if (data.isEmpty())
+        return;
+    if (!data.endsWith('\n'))
+        data += '\n';
+
+    QMutexLocker locker(&mutex);
+    QFile file(_filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+        return;
+    if (active_needs_newline)
+        data.prepend('\n');
+    file.write(data);
+    qint64 size = file.size();
+    file.close();
+    active_needs_newline = false;
+
+    foreach (const QString& line, command.split('\n')) {
+        QString entry = line.trimmed();
+        if (entry.isEmpty())
+            continue;
+        if (indexing)
+            pending_entries.append(entry);
+        else
+            index.add(entry, true);
+    }
+    if (size > SEGMENT_SIZE) {
+        this->seal_active();
+        locker.unlock();
+        this->start_compaction();
+    }
+}
+
+void HistoryStore::set_max_stored_entries(int max_stored_entries)
+{
+    {
+        QMutexLocker locker(&mutex);
+        if (this->max_stored_entries == max_stored_entries)
+            return;
+        this->max_stored_entries = max_stored_entries;
+    }
+    this->start_compaction();
+}
+
+QStringList HistoryStore::sealed_segments(QByteArray *active, int *max_entries)
+{
+    QMutexLocker locker(&mutex);
+    QFile file(_filename);
+    if (file.open(QIODevice::ReadOnly))
+        *active = file.readAll();
+    *max_entries = max_stored_entries;
+    pending_entries.clear();
+    return segments.mid(0, segments.size() - 1);
+}
+
+void HistoryStore::remove_segment(const QString &path)
+{
+    QMutexLocker locker(&mutex);
+    int index = segments.indexOf(path);
+    if (index < 0)
+        return;
+    QFile::remove(path);
+    segments.removeAt(index);
+    if (older.segment > index)
+        older.segment--;
+    else if (older.segment == index)
+        older.offset = 0;
+}
+
+void HistoryStore::replace_segment(const QString &path, const QString &replacement, qint64 trimmed)
+{
+    QMutexLocker locker(&mutex);
+    int index = segments.indexOf(path);
+    if (index < 0 || !QFile::remove(path) || !QFile::rename(replacement, path)) {
+        QFile::remove(replacement);
+        return;
+    }
+    if (older.segment == index)
+        older.offset = qMax<qint64>(0, older.offset - trimmed);
+}
+
+void HistoryStore::compaction_finished()
+{
+    if (thread->stopped)
+        return;
+    {
+        QMutexLocker locker(&mutex);
+        index = thread->index;
+        thread->index = HistoryIndex();
+        foreach (const QString& entry, pending_entries)
+            index.add(entry, true);
+        pending_entries.clear();
+    }
+    indexing = false;
+    _index_ready = true;
+    emit sig_index_ready();
+    if (compact_pending) {
+        compact_pending = false;
+        this->start_compaction();
+    }
+}
+
+QStringList HistoryStore::tokens(const QString &text)
+{
+    QStringList words;
+    QString word;
+    foreach (const QChar& ch, text) {
+        if (ch.isLetterOrNumber() || ch == '_')
+            word += ch.toLower();
+        else if (!word.isEmpty()) {
+            words.append(word);
+            word.clear();
+        }
+    }
+    if (!word.isEmpty())
+        words.append(word);
+    return words;
+}
+
+QStringList HistoryStore::search(const QString &query, int max_results)
+{
+    QStringList result;
+    QStringList words = tokens(query);
+    if (!_index_ready || words.isEmpty())
+        return result;
+
+    QVector<int> candidates;
+    bool first = true;
+    foreach (const QString& word, words) {
+        QVector<int> ids;
+        auto it = std::lower_bound(index.vocabulary.constBegin(), index.vocabulary.constEnd(), word);
+        for (; it != index.vocabulary.constEnd() && it->startsWith(word); ++it)
+            ids += index.postings.value(*it);
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        if (first)
+            candidates = ids;
+        else {
+            QVector<int> both;
+            std::set_intersection(candidates.constBegin(), candidates.constEnd(),
+                                  ids.constBegin(), ids.constEnd(), std::back_inserter(both));
+            candidates = both;
+        }
+        first = false;
+        if (candidates.isEmpty())
+            return result;
+    }
+
+    QSet<QString> seen;
+    for (int i = candidates.size() - 1; i >= 0 && result.size() < max_results; i--) {
+        const QString& entry = index.entries[candidates[i]];
+        if (seen.contains(entry))
+            continue;
+        seen.insert(entry);
+        result.append(entry);
+    }
+    return result;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+#include <QStringList>
+#include <atomic>
+
+class HistoryStore;
+
+// 已读入视图的最旧一条记录在哪一段、哪个位置
+struct HistoryPosition
+{
+    int segment;
+    qint64 offset;
+};
+
+// 历史记录的单词索引：每个单词(小写)出现在哪些记录中，单词表排好序用于前缀查找
+struct HistoryIndex
+{
+    QStringList entries;
+    QHash<QString, QVector<int>> postings;
+    QStringList vocabulary;
+
+    // sorted为true时新单词按顺序插入单词表，否则最后调用sort_vocabulary
+    void add(const QString& entry, bool sorted = false);
+    void sort_vocabulary();
+};
+
+
+// 在后台删除超过保留条数的旧记录，然后重新建立索引
+class HistoryCompactThread : public QThread
+{
+    Q_OBJECT
+public:
+    std::atomic<bool> stopped;
+    HistoryIndex index;
+
+    HistoryCompactThread(HistoryStore* store);
+    void stop();
+protected:
+    void run() override;
+private:
+    HistoryStore* store;
+};
+
+
+// 只追加的分段历史文件。当前段就是原来的历史文件，超过SEGMENT_SIZE后改名为
+// filename.1、filename.2……(数字越小越旧)，以后不再修改，只在压缩时整段删除
+// 或去掉开头。视图从末尾读入最近的记录，往上滚动时再读更早的记录
+class HistoryStore : public QObject
+{
+    Q_OBJECT
+    friend class HistoryCompactThread;
+signals:
+    void sig_index_ready();
+
+public:
+    static const qint64 SEGMENT_SIZE = 256 * 1024;
+
+    HistoryStore(const QString& filename, int max_stored_entries, QObject* parent = nullptr);
+    ~HistoryStore();
+
+    QString filename() const { return _filename; }
+    QStringList segment_files();
+
+    // 最近的count条记录，按时间顺序
+    QStringList read_tail(int count);
+    // 上次读入的记录之前的count条，已经到最旧的记录时返回空列表
+    QStringList read_older(int count);
+    bool at_start();
+
+    void append(const QString& command);
+    void set_max_stored_entries(int max_stored_entries);
+
+    bool index_ready() const { return _index_ready; }
+    // 所有段中包含query中每个单词(作为单词前缀)的记录，最新的在前，相同的只保留一条
+    QStringList search(const QString& query, int max_results = 200);
+
+    static QStringList tokens(const QString& text);
+
+private slots:
+    void compaction_finished();
+
+private:
+    QString _filename;
+    int max_stored_entries;
+    QMutex mutex;
+    // 已封存的段和最后的当前段
+    QStringList segments;
+    int next_segment;
+    // 当前段的最后一行没有换行符(旧的历史文件)
+    bool active_needs_newline;
+    HistoryPosition older;
+
+    HistoryCompactThread* thread;
+    // 从启动线程到compaction_finished处理完结果为true
+    bool indexing;
+    bool compact_pending;
+    HistoryIndex index;
+    bool _index_ready;
+    // 建立索引期间追加的记录，索引完成后补上
+    QStringList pending_entries;
+
+    void load_segments();
+    void seal_active();
+    void start_compaction();
+    QStringList read_before(HistoryPosition& position, int count);
+
+    // 以下由压缩线程调用
+    QStringList sealed_segments(QByteArray* active, int* max_entries);
+    void remove_segment(const QString& path);
+    void replace_segment(const QString& path, const QString& replacement, qint64 trimmed);
+};
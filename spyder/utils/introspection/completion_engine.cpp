@@ -0,0 +1,564 @@
+#include "completion_engine.h"
+#include "keyword.h"
+#include "builtins.h"
+#include "utils/fileenum.h"
+
+#include <QFile>
+#include <QTextBlock>
+#include <algorithm>
+
+static inline bool is_identifier_start(QChar ch)
+{
+    return ch.isLetter() || ch == '_';
+}
+
+static inline bool is_identifier_char(QChar ch)
+{
+    return ch.isLetterOrNumber() || ch == '_';
+}
+
+// 对每个长度不小于2的标识符调用callback(word, kind)，kind为1表示紧跟在def之后，2表示紧跟在class之后
+template <typename F>
+static void scan_words(const QString& text, F callback)
+{
+    const QChar* data = text.constData();
+    int length = text.size();
+    QString previous;
+    int i = 0;
+    while (i < length) {
+        if (!is_identifier_start(data[i])) {
+            // 跳过数字字面量中的字母，例如0x1f、1e5
+            if (data[i].isDigit()) {
+                while (i < length && is_identifier_char(data[i]))
+                    i++;
+            }
+            else
+                i++;
+            continue;
+        }
+        int start = i;
+        while (i < length && is_identifier_char(data[i]))
+            i++;
+        if (i - start < 2) {
+            previous.clear();
+            continue;
+        }
+        QString word(data + start, i - start);
+        int kind = 0;
+        if (previous == "def")
+            kind = 1;
+        else if (previous == "class")
+            kind = 2;
+        callback(word, kind);
+        previous = word;
+    }
+}
+
+IdentifierCounts scan_identifiers(const QString& text)
+{
+    IdentifierCounts result;
+    scan_words(text, [&result](const QString& word, int kind) {
+        result.counts[word]++;
+        if (kind == 1)
+            result.kinds[word] = "function";
+        else if (kind == 2)
+            result.kinds[word] = "class";
+    });
+    return result;
+}
+
+// 字符集合的位图：a-z、0-9、'_'各占一位，其余字符按编码分散到剩下的位上。
+// needle的位图不是单词位图的子集时，needle不可能是单词的子序列
+quint64 char_mask(const QString& lower)
+{
+    quint64 mask = 0;
+    foreach (const QChar& ch, lower) {
+        ushort c = ch.unicode();
+        int bit;
+        if (c >= 'a' && c <= 'z')
+            bit = c - 'a';
+        else if (c >= '0' && c <= '9')
+            bit = 26 + c - '0';
+        else if (c == '_')
+            bit = 36;
+        else
+            bit = 37 + c % 27;
+        mask |= quint64(1) << bit;
+    }
+    return mask;
+}
+
+// 子序列匹配的得分，不匹配返回-1。连续匹配和在单词边界上的匹配得分更高
+static int fuzzy_score(const QString& needle, const QString& hay)
+{
+    int score = 200;
+    int j = 0;
+    int last = -1;
+    for (int i = 0; i < needle.size(); ++i) {
+        QChar ch = needle[i];
+        while (j < hay.size() && hay[j] != ch)
+            j++;
+        if (j == hay.size())
+            return -1;
+        if (last >= 0)
+            score -= 10 * (j - last - 1);
+        if (j > 0 && hay[j-1] == '_')
+            score += 20;
+        last = j;
+        j++;
+    }
+    return qMax(score, 0);
+}
+
+
+/********** ProjectIndexThread **********/
+ProjectIndexThread::ProjectIndexThread(QObject* parent, const QString& root)
+    : QThread (parent)
+{
+    this->stopped = false;
+    this->root = root;
+}
+
+void ProjectIndexThread::stop()
+{
+    this->stopped = true;
+}
+
+void ProjectIndexThread::run()
+{
+    const int max_files = 5000;
+    const qint64 max_size = 1024 * 1024;
+    // 不进入.gitignore中忽略的目录(build、虚拟环境等)
+    fileenum::FileEnumerator enumerator(root);
+    enumerator.walk([this, max_size](const QString& path) {
+        if (stopped || results.size() >= max_files)
+            return false;
+        if (!path.endsWith(".py") && !path.endsWith(".pyw"))
+            return true;
+        QFile file(path);
+        if (file.size() > max_size || !file.open(QIODevice::ReadOnly))
+            return true;
+        results[path] = scan_identifiers(QString::fromUtf8(file.readAll()));
+        return true;
+    });
+}
+
+
+/********** CompletionEngine **********/
+CompletionEngine* CompletionEngine::instance()
+{
+    static CompletionEngine* engine = new CompletionEngine;
+    return engine;
+}
+
+CompletionEngine::CompletionEngine()
+    : QObject (nullptr)
+{
+    this->kinds_changed = false;
+    this->project_thread = nullptr;
+
+    this->timer = new QTimer(this);
+    this->timer->setSingleShot(true);
+    this->timer->setInterval(300);
+    connect(timer, SIGNAL(timeout()), this, SLOT(update_index()));
+
+    IdentifierCounts names;
+    foreach (const QString& name, keyword::kwlist + builtins::builtlist) {
+        names.counts[name] = 1;
+        static_names.insert(name);
+    }
+    this->set_source("<builtins>", names);
+    this->flush_entries();
+}
+
+void CompletionEngine::add_document(QTextDocument *document)
+{
+    if (documents.contains(document))
+        return;
+    DocumentIndex index;
+    index.key = QString("<document 0x%1>").arg(quintptr(document), 0, 16);
+    index.dirty_first = -1;
+    index.dirty_last = -1;
+    documents.insert(document, index);
+    sources.insert(index.key, IdentifierCounts());
+    connect(document, SIGNAL(contentsChange(int,int,int)), this, SLOT(contents_change(int,int,int)));
+    connect(document, SIGNAL(destroyed(QObject*)), this, SLOT(document_destroyed(QObject*)));
+    // 已有的内容当作一次整体插入
+    this->mark_changed(document, 0, document->characterCount());
+}
+
+void CompletionEngine::contents_change(int position, int removed, int added)
+{
+    Q_UNUSED(removed);
+    QTextDocument* document = qobject_cast<QTextDocument*>(this->sender());
+    if (document && documents.contains(document))
+        this->mark_changed(document, position, added);
+}
+
+static int block_number(QTextDocument* document, int position)
+{
+    QTextBlock block = document->findBlock(position);
+    return block.isValid() ? block.blockNumber() : document->blockCount() - 1;
+}
+
+// 被改动的块立即从计数中减去，换成待扫描的空块；块数的变化由新旧块数之差推算
+void CompletionEngine::mark_changed(QTextDocument *document, int position, int added)
+{
+    DocumentIndex& index = documents[document];
+    int count = document->blockCount();
+    int first = block_number(document, position);
+    int new_last = block_number(document, position + added);
+    int old_last = new_last - (count - index.blocks.size());
+    if (first > old_last + 1 || first > new_last + 1 || old_last >= index.blocks.size()) {
+        // 不一致时整个文档重新扫描
+        first = 0;
+        old_last = index.blocks.size() - 1;
+        new_last = count - 1;
+    }
+
+    IdentifierCounts& source = sources[index.key];
+    bool had_defs = false;
+    for (int n = first; n <= old_last; n++) {
+        const BlockWords& block_words = index.blocks[n];
+        foreach (int id, block_words.words)
+            this->change_count(source, words[id], -1);
+        had_defs = had_defs || !block_words.defs.isEmpty();
+    }
+    index.blocks.remove(first, old_last - first + 1);
+    index.blocks.insert(first, new_last - first + 1, BlockWords());
+
+    if (index.dirty_first < 0) {
+        index.dirty_first = first;
+        index.dirty_last = new_last;
+    }
+    else {
+        int delta = new_last - old_last;
+        if (index.dirty_first > old_last)
+            index.dirty_first += delta;
+        if (index.dirty_last > old_last)
+            index.dirty_last += delta;
+        index.dirty_first = qMin(index.dirty_first, first);
+        index.dirty_last = qMax(index.dirty_last, new_last);
+    }
+    if (had_defs)
+        this->update_kinds(index);
+    dirty.insert(document);
+    timer->start();
+}
+
+void CompletionEngine::document_destroyed(QObject *object)
+{
+    dirty.remove(object);
+    QString key = documents.take(object).key;
+    if (!key.isEmpty()) {
+        this->remove_source(key);
+        this->flush_entries();
+    }
+}
+
+// 只扫描dirty范围内被标记的块
+void CompletionEngine::update_index()
+{
+    foreach (QObject* object, dirty) {
+        QTextDocument* document = qobject_cast<QTextDocument*>(object);
+        auto found = documents.find(object);
+        if (document == nullptr || found == documents.end() || found->dirty_first < 0)
+            continue;
+        DocumentIndex& index = found.value();
+        IdentifierCounts& source = sources[index.key];
+        bool has_defs = false;
+        int last = qMin(index.dirty_last, index.blocks.size() - 1);
+        QTextBlock block = document->findBlockByNumber(index.dirty_first);
+        for (int n = index.dirty_first; n <= last && block.isValid(); n++, block = block.next()) {
+            BlockWords& block_words = index.blocks[n];
+            if (!block_words.dirty)
+                continue;
+            block_words.dirty = false;
+            scan_words(block.text(), [&](const QString& word, int kind) {
+                int id = this->word_id(word);
+                block_words.words.append(id);
+                this->change_count(source, word, 1);
+                if (kind)
+                    block_words.defs.append(id * 2 + (kind == 2 ? 1 : 0));
+            });
+            has_defs = has_defs || !block_words.defs.isEmpty();
+        }
+        index.dirty_first = -1;
+        index.dirty_last = -1;
+        if (has_defs)
+            this->update_kinds(index);
+    }
+    dirty.clear();
+    this->flush_entries();
+}
+
+void CompletionEngine::index_project(const QString &root)
+{
+    this->clear_project();
+    project_thread = new ProjectIndexThread(this, root);
+    connect(project_thread, SIGNAL(finished()), this, SLOT(project_indexed()));
+    project_thread->start(QThread::LowPriority);
+}
+
+void CompletionEngine::clear_project()
+{
+    if (project_thread) {
+        disconnect(project_thread, SIGNAL(finished()), this, SLOT(project_indexed()));
+        project_thread->stop();
+        connect(project_thread, SIGNAL(finished()), project_thread, SLOT(deleteLater()));
+        project_thread = nullptr;
+    }
+    foreach (const QString& key, project_sources)
+        this->remove_source(key);
+    project_sources.clear();
+    this->flush_entries();
+}
+
+void CompletionEngine::project_indexed()
+{
+    ProjectIndexThread* thread = qobject_cast<ProjectIndexThread*>(this->sender());
+    if (thread == nullptr || thread != project_thread)
+        return;
+    for (auto it = thread->results.constBegin(); it != thread->results.constEnd(); ++it) {
+        this->set_source(it.key(), it.value());
+        project_sources.append(it.key());
+    }
+    project_thread = nullptr;
+    thread->deleteLater();
+    this->flush_entries();
+}
+
+int CompletionEngine::word_id(const QString &word)
+{
+    auto it = word_ids.constFind(word);
+    if (it != word_ids.constEnd())
+        return it.value();
+    int id = words.size();
+    words.append(word);
+    word_ids.insert(word, id);
+    return id;
+}
+
+// 一个来源中word的次数加delta，同时更新总数
+void CompletionEngine::change_count(IdentifierCounts &source, const QString &word, int delta)
+{
+    auto count = source.counts.find(word);
+    if (count == source.counts.end()) {
+        if (delta <= 0)
+            return;
+        count = source.counts.insert(word, 0);
+    }
+    *count += delta;
+    if (*count <= 0)
+        source.counts.erase(count);
+
+    auto total = totals.find(word);
+    if (total == totals.end()) {
+        if (delta <= 0)
+            return;
+        total = totals.insert(word, 0);
+        pending_added.append(word);
+    }
+    *total += delta;
+    if (*total <= 0) {
+        totals.erase(total);
+        pending_removed.append(word);
+    }
+}
+
+// def/class定义很少，改动涉及定义时从各块重新收集
+void CompletionEngine::update_kinds(DocumentIndex &index)
+{
+    IdentifierCounts& source = sources[index.key];
+    source.kinds.clear();
+    foreach (const BlockWords& block_words, index.blocks) {
+        foreach (int def, block_words.defs)
+            source.kinds[words[def / 2]] = def % 2 ? "class" : "function";
+    }
+    kinds_changed = true;
+}
+
+// 只按新旧两次扫描的差异更新总数，没有变化的单词不会进入待处理列表
+void CompletionEngine::set_source(const QString &key, const IdentifierCounts &source)
+{
+    static const IdentifierCounts empty;
+    auto found = sources.constFind(key);
+    const IdentifierCounts& old = found != sources.constEnd() ? found.value() : empty;
+
+    for (auto it = source.counts.constBegin(); it != source.counts.constEnd(); ++it) {
+        int delta = it.value() - old.counts.value(it.key());
+        if (delta == 0)
+            continue;
+        int& total = totals[it.key()];
+        if (total == 0)
+            pending_added.append(it.key());
+        total += delta;
+    }
+    for (auto it = old.counts.constBegin(); it != old.counts.constEnd(); ++it) {
+        if (source.counts.contains(it.key()))
+            continue;
+        auto total = totals.find(it.key());
+        if (total == totals.end())
+            continue;
+        *total -= it.value();
+        if (*total <= 0) {
+            totals.erase(total);
+            pending_removed.append(it.key());
+        }
+    }
+    if (old.kinds != source.kinds)
+        kinds_changed = true;
+    sources[key] = source;
+}
+
+void CompletionEngine::remove_source(const QString &key)
+{
+    auto found = sources.find(key);
+    if (found == sources.end())
+        return;
+    for (auto it = found->counts.constBegin(); it != found->counts.constEnd(); ++it) {
+        auto total = totals.find(it.key());
+        if (total == totals.end())
+            continue;
+        *total -= it.value();
+        if (*total <= 0) {
+            totals.erase(total);
+            pending_removed.append(it.key());
+        }
+    }
+    if (!found->kinds.isEmpty())
+        kinds_changed = true;
+    sources.erase(found);
+}
+
+int CompletionEngine::find_entry(const QString &word) const
+{
+    Entry key;
+    key.lower = word.toLower();
+    key.word = word;
+    auto it = std::lower_bound(entries.begin(), entries.end(), key);
+    if (it != entries.end() && it->word == word)
+        return int(it - entries.begin());
+    return -1;
+}
+
+// 少量变化时在有序数组中插入/删除，变化很多(例如打开项目)时整体重建
+void CompletionEngine::flush_entries()
+{
+    if (pending_added.size() + pending_removed.size() > 256) {
+        entries.clear();
+        entries.reserve(totals.size());
+        for (auto it = totals.constBegin(); it != totals.constEnd(); ++it) {
+            Entry entry;
+            entry.lower = it.key().toLower();
+            entry.word = it.key();
+            entry.mask = char_mask(entry.lower);
+            entries.append(entry);
+        }
+        std::sort(entries.begin(), entries.end());
+    }
+    else {
+        foreach (const QString& word, pending_removed) {
+            if (totals.contains(word))
+                continue;
+            int index = this->find_entry(word);
+            if (index >= 0)
+                entries.remove(index);
+        }
+        foreach (const QString& word, pending_added) {
+            if (!totals.contains(word) || this->find_entry(word) >= 0)
+                continue;
+            Entry entry;
+            entry.lower = word.toLower();
+            entry.word = word;
+            entry.mask = char_mask(entry.lower);
+            entries.insert(std::lower_bound(entries.begin(), entries.end(), entry), entry);
+        }
+    }
+    pending_added.clear();
+    pending_removed.clear();
+
+    if (kinds_changed) {
+        kinds.clear();
+        foreach (const IdentifierCounts& source, sources) {
+            for (auto it = source.kinds.constBegin(); it != source.kinds.constEnd(); ++it)
+                kinds[it.key()] = it.value();
+        }
+        kinds_changed = false;
+    }
+}
+
+QList<QPair<QString,QString>> CompletionEngine::complete(const QString &prefix, QTextDocument *current,
+                                                          bool case_sensitive, int max_results)
+{
+    QList<QPair<QString,QString>> result;
+    if (prefix.isEmpty())
+        return result;
+    QString lower = prefix.toLower();
+    const IdentifierCounts* local = nullptr;
+    auto document = documents.constFind(current);
+    if (current && document != documents.constEnd()) {
+        auto it = sources.constFind(document->key);
+        if (it != sources.constEnd())
+            local = &it.value();
+    }
+
+    struct Candidate
+    {
+        int score;
+        const Entry* entry;
+    };
+    QVector<Candidate> candidates;
+    auto bonus = [&](const QString& word) {
+        int score = 8 * qMin(totals.value(word), 64) - word.size();
+        if (local && local->counts.contains(word))
+            score += 200;
+        return score;
+    };
+
+    Entry key;
+    key.lower = lower;
+    auto begin = std::lower_bound(entries.constBegin(), entries.constEnd(), key);
+    for (auto it = begin; it != entries.constEnd() && it->lower.startsWith(lower); ++it) {
+        // 正在输入的单词本身也会被索引，只出现一次时不作为候选
+        if (it->word == prefix && totals.value(it->word) < 2 && !static_names.contains(it->word))
+            continue;
+        bool exact = it->word.startsWith(prefix);
+        if (case_sensitive && !exact)
+            continue;
+        candidates.append({(exact ? 3000 : 2000) + bonus(it->word), it});
+    }
+
+    if (prefix.size() >= 2) {
+        Entry first;
+        first.lower = lower.left(1);
+        auto it = std::lower_bound(entries.constBegin(), entries.constEnd(), first);
+        QString needle = case_sensitive ? prefix : lower;
+        quint64 needle_mask = char_mask(lower);
+        for (; it != entries.constEnd() && it->lower.startsWith(first.lower); ++it) {
+            // 先用字符集合排除，大多数单词不必逐字符比较
+            if ((needle_mask & ~it->mask) != 0 || it->lower.startsWith(lower))
+                continue;
+            int score = fuzzy_score(needle, case_sensitive ? it->word : it->lower);
+            if (score >= 0)
+                candidates.append({1000 + score + bonus(it->word), it});
+        }
+    }
+
+    auto by_score = [](const Candidate& a, const Candidate& b) {
+        if (a.score != b.score)
+            return a.score > b.score;
+        return a.entry->word < b.entry->word;
+    };
+    if (candidates.size() > max_results) {
+        std::partial_sort(candidates.begin(), candidates.begin() + max_results,
+                          candidates.end(), by_score);
+        candidates.resize(max_results);
+    }
+    else
+        std::sort(candidates.begin(), candidates.end(), by_score);
+
+    foreach (const Candidate& candidate, candidates)
+        result.append(qMakePair(candidate.entry->word, kinds.value(candidate.entry->word, QString(""))));
+    return result;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <QSet>
+#include <QHash>
+#include <QTimer>
+#include <QThread>
+#include <QVector>
+#include <QTextDocument>
+#include <atomic>
+
+// 一个来源(打开的文档或项目中的文件)里出现的标识符及其次数，
+// 以及通过def/class定义的名字的类型
+struct IdentifierCounts
+{
+    QHash<QString,int> counts;
+    QHash<QString,QString> kinds;
+};
+
+IdentifierCounts scan_identifiers(const QString& text);
+quint64 char_mask(const QString& lower);
+
+
+// 在后台线程中扫描项目目录下的Python文件
+class ProjectIndexThread : public QThread
+{
+    Q_OBJECT
+public:
+    std::atomic<bool> stopped;
+    QString root;
+    QHash<QString, IdentifierCounts> results;
+
+    ProjectIndexThread(QObject* parent, const QString& root);
+    void stop();
+protected:
+    void run() override;
+};
+
+
+// 进程内的标识符补全：索引所有打开的文档、当前项目的文件以及关键字和内置名字。
+// 文档按块记录其中的标识符，修改时立即减去被改动块的计数，延迟后只重新扫描这些块。
+// 索引按小写排序，前缀查询是二分查找，模糊匹配只在首字母相同的范围内、
+// 并且包含needle全部字符的单词上进行
+class CompletionEngine : public QObject
+{
+    Q_OBJECT
+public:
+    static CompletionEngine* instance();
+
+    void add_document(QTextDocument* document);
+    void index_project(const QString& root);
+    void clear_project();
+    QList<QPair<QString,QString>> complete(const QString& prefix, QTextDocument* current = nullptr,
+                                           bool case_sensitive = true, int max_results = 100);
+    int size() const { return entries.size(); }
+
+public slots:
+    void update_index();
+
+private slots:
+    void contents_change(int position, int removed, int added);
+    void document_destroyed(QObject* object);
+    void project_indexed();
+
+private:
+    struct Entry
+    {
+        QString lower;
+        QString word;
+        // lower中出现的字符集合，见char_mask
+        quint64 mask;
+        bool operator<(const Entry& other) const
+        { return lower < other.lower || (lower == other.lower && word < other.word); }
+    };
+
+    // 一个块中的标识符(word_ids中的编号)，defs是def/class定义的名字，编号*2+是否为类
+    struct BlockWords
+    {
+        QVector<int> words;
+        QVector<int> defs;
+        bool dirty;
+        BlockWords() : dirty(true) {}
+    };
+
+    struct DocumentIndex
+    {
+        QString key;
+        QVector<BlockWords> blocks;
+        // 需要重新扫描的块所在的范围，没有时dirty_first为-1
+        int dirty_first;
+        int dirty_last;
+    };
+
+    QHash<QString, IdentifierCounts> sources;
+    QHash<QObject*, DocumentIndex> documents;
+    QSet<QObject*> dirty;
+    QHash<QString,int> word_ids;
+    QStringList words;
+    QHash<QString,int> totals;
+    QHash<QString,QString> kinds;
+    QSet<QString> static_names;
+    QVector<Entry> entries;
+    QStringList pending_added;
+    QStringList pending_removed;
+    bool kinds_changed;
+    QTimer* timer;
+    ProjectIndexThread* project_thread;
+    QStringList project_sources;
+
+    CompletionEngine();
+    void mark_changed(QTextDocument* document, int position, int added);
+    int word_id(const QString& word);
+    void change_count(IdentifierCounts& source, const QString& word, int delta);
+    void update_kinds(DocumentIndex& index);
+    void set_source(const QString& key, const IdentifierCounts& source);
+    void remove_source(const QString& key);
+    void flush_entries();
+    int find_entry(const QString& word) const;
+};
@@ -0,0 +1,373 @@
+#include "localhistory.h"
+#include "config/base.h"
+#include "config/config_main.h"
+
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QDirIterator>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <algorithm>
+
+// 块的最小、最大长度；哈希值最高CHUNK_BITS位全为0时切分，平均8KB
+static const int MIN_CHUNK = 2 * 1024;
+static const int MAX_CHUNK = 64 * 1024;
+static const int CHUNK_BITS = 13;
+// 每记录这么多次回收一次没有引用的块
+static const int GC_INTERVAL = 100;
+
+static const QVector<quint32>& gear_table()
+{
+    // splitmix64生成，种子固定，保证每次运行切分的边界相同
+    static const QVector<quint32> table = []() {
+        QVector<quint32> values(256);
+        quint64 state = 0;
+        for (int i = 0; i < 256; i++) {
+            state += Q_UINT64_C(0x9E3779B97F4A7C15);
+            quint64 z = state;
+            z = (z ^ (z >> 30)) * Q_UINT64_C(0xBF58476D1CE4E5B9);
+            z = (z ^ (z >> 27)) * Q_UINT64_C(0x94D049BB133111EB);
+            values[i] = quint32((z ^ (z >> 31)) >> 32);
+        }
+        return values;
+    }();
+    return table;
+}
+
+static QByteArray sha1(const QByteArray& data)
+{
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+}
+
+
+LocalHistory* LocalHistory::instance()
+{
+    static LocalHistory* history = new LocalHistory;
+    return history;
+}
+
+LocalHistory::LocalHistory()
+    : QObject (nullptr)
+{
+    root = get_conf_path("local_history");
+    QDir().mkpath(root + "/objects");
+    QDir().mkpath(root + "/files");
+    foreach (const QString& name, QDir(root + "/files").entryList(QStringList("*.idx"), QDir::Files))
+        known.insert(name.left(name.size() - 4));
+
+    max_snapshots = CONF_get("local_history", "max_snapshots", 1000).toInt();
+    max_age_ms = CONF_get("local_history", "max_age_days", 90).toLongLong() * 24 * 3600 * 1000;
+    max_size = CONF_get("local_history", "max_size_mb", 256).toLongLong() * 1024 * 1024;
+    object_bytes = -1;
+    records_since_gc = 0;
+
+    thread = new QThread;
+    thread->setObjectName("LocalHistory");
+    this->moveToThread(thread);
+    thread->start(QThread::LowPriority);
+    // 启动时统计已用空间并回收上次没有回收的块
+    QMetaObject::invokeMethod(this, "collect_garbage", Qt::QueuedConnection);
+
+    if (qApp)
+        connect(qApp, &QCoreApplication::aboutToQuit, [this](){ this->shutdown(); });
+}
+
+void LocalHistory::shutdown()
+{
+    if (!thread->isRunning())
+        return;
+    thread->quit();
+    thread->wait();
+}
+
+QVector<int> LocalHistory::chunk_boundaries(const QByteArray &data)
+{
+    const QVector<quint32>& gear = gear_table();
+    const uchar* bytes = reinterpret_cast<const uchar*>(data.constData());
+    QVector<int> boundaries;
+    quint32 hash = 0;
+    int start = 0;
+    for (int i = 0; i < data.size(); i++) {
+        hash = (hash << 1) + gear[bytes[i]];
+        int length = i - start + 1;
+        if ((length >= MIN_CHUNK && (hash >> (32 - CHUNK_BITS)) == 0) || length >= MAX_CHUNK) {
+            boundaries.append(i + 1);
+            start = i + 1;
+            hash = 0;
+        }
+    }
+    if (start < data.size())
+        boundaries.append(data.size());
+    return boundaries;
+}
+
+QString LocalHistory::file_key(const QString &filename)
+{
+    QString path = QDir::cleanPath(QFileInfo(filename).absoluteFilePath());
+    return QString::fromLatin1(sha1(path.toUtf8()));
+}
+
+QString LocalHistory::manifest_path(const QString &filename) const
+{
+    return QString("%1/files/%2.idx").arg(root).arg(file_key(filename));
+}
+
+QString LocalHistory::object_path(const QByteArray &hash) const
+{
+    QString name = QString::fromLatin1(hash);
+    return QString("%1/objects/%2/%3").arg(root).arg(name.left(2)).arg(name.mid(2));
+}
+
+void LocalHistory::track(const QString &filename, const QString &text)
+{
+    if (!CONF_get("local_history", "enable", true).toBool() || this->has_snapshots(filename))
+        return;
+    QMetaObject::invokeMethod(this, "store_original", Qt::QueuedConnection,
+                              Q_ARG(QString, filename), Q_ARG(QString, text));
+}
+
+void LocalHistory::record(const QString &filename, const QString &text)
+{
+    if (!CONF_get("local_history", "enable", true).toBool())
+        return;
+    {
+        QMutexLocker locker(&mutex);
+        max_snapshots = CONF_get("local_history", "max_snapshots", 1000).toInt();
+        max_age_ms = CONF_get("local_history", "max_age_days", 90).toLongLong() * 24 * 3600 * 1000;
+        max_size = CONF_get("local_history", "max_size_mb", 256).toLongLong() * 1024 * 1024;
+    }
+    QMetaObject::invokeMethod(this, "store", Qt::QueuedConnection,
+                              Q_ARG(QString, filename), Q_ARG(QString, text));
+}
+
+bool LocalHistory::has_snapshots(const QString &filename)
+{
+    QMutexLocker locker(&mutex);
+    return known.contains(file_key(filename));
+}
+
+QList<Snapshot> LocalHistory::snapshots(const QString &filename) const
+{
+    return this->read_manifest(this->manifest_path(filename));
+}
+
+QString LocalHistory::content(const Snapshot &snapshot, bool *ok) const
+{
+    QByteArray data;
+    data.reserve(int(snapshot.size));
+    bool valid = true;
+    foreach (const QByteArray& hash, snapshot.chunks) {
+        QFile file(this->object_path(hash));
+        if (!file.open(QIODevice::ReadOnly)) {
+            valid = false;
+            break;
+        }
+        data += qUncompress(file.readAll());
+    }
+    // 块被回收或者损坏
+    valid = valid && sha1(data) == snapshot.hash;
+    if (ok)
+        *ok = valid;
+    return valid ? QString::fromUtf8(data) : QString();
+}
+
+// 第一行是文件名，之后每行一个快照：时间 大小 SHA-1 各块的SHA-1
+QList<Snapshot> LocalHistory::read_manifest(const QString &path, QString *filename) const
+{
+    QList<Snapshot> snapshots;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return snapshots;
+    QByteArray header = file.readLine();
+    if (header.endsWith('\n'))
+        header.chop(1);
+    if (filename)
+        *filename = QString::fromUtf8(header);
+    while (!file.atEnd()) {
+        QList<QByteArray> parts = file.readLine().trimmed().split('\t');
+        if (parts.size() != 4)
+            continue;
+        Snapshot snapshot;
+        snapshot.time = parts[0].toLongLong();
+        snapshot.size = parts[1].toLongLong();
+        snapshot.hash = parts[2];
+        if (!parts[3].isEmpty())
+            snapshot.chunks = parts[3].split(',');
+        snapshots.append(snapshot);
+    }
+    return snapshots;
+}
+
+static QByteArray manifest_line(const Snapshot& snapshot)
+{
+    return QByteArray::number(snapshot.time) + '\t' + QByteArray::number(snapshot.size) + '\t' +
+            snapshot.hash + '\t' + snapshot.chunks.join(',') + '\n';
+}
+
+bool LocalHistory::write_manifest(const QString &path, const QString &filename,
+                                  const QList<Snapshot> &snapshots)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(filename.toUtf8() + '\n');
+    foreach (const Snapshot& snapshot, snapshots)
+        file.write(manifest_line(snapshot));
+    return file.commit();
+}
+
+bool LocalHistory::write_object(const QByteArray &hash, const QByteArray &data)
+{
+    QString path = this->object_path(hash);
+    if (QFile::exists(path))
+        return true;
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QByteArray compressed = qCompress(data, 6);
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(compressed);
+    if (!file.commit())
+        return false;
+    if (object_bytes >= 0)
+        object_bytes += compressed.size();
+    return true;
+}
+
+// 在后台线程中执行。内容和上一个快照相同时不记录
+void LocalHistory::store(const QString &filename, const QString &text)
+{
+    QByteArray data = text.toUtf8();
+    QString path = this->manifest_path(filename);
+    QList<Snapshot> snapshots = this->read_manifest(path);
+
+    Snapshot snapshot;
+    snapshot.hash = sha1(data);
+    if (!snapshots.isEmpty() && snapshots.last().hash == snapshot.hash)
+        return;
+    snapshot.time = QDateTime::currentMSecsSinceEpoch();
+    snapshot.size = data.size();
+    int start = 0;
+    foreach (int end, chunk_boundaries(data)) {
+        QByteArray chunk = data.mid(start, end - start);
+        QByteArray hash = sha1(chunk);
+        if (!this->write_object(hash, chunk))
+            return;
+        snapshot.chunks.append(hash);
+        start = end;
+    }
+    snapshots.append(snapshot);
+
+    int limit;
+    qint64 max_age, size_limit;
+    {
+        QMutexLocker locker(&mutex);
+        limit = qMax(1, max_snapshots);
+        max_age = max_age_ms;
+        size_limit = max_size;
+    }
+    // 最新的快照总是保留
+    int drop = qMax(0, snapshots.size() - limit);
+    while (drop < snapshots.size() - 1 && snapshots[drop].time < snapshot.time - max_age)
+        drop++;
+    bool written;
+    if (drop > 0 || snapshots.size() == 1)
+        written = this->write_manifest(path, filename, snapshots.mid(drop));
+    else {
+        QFile file(path);
+        written = file.open(QIODevice::WriteOnly | QIODevice::Append) &&
+                file.write(manifest_line(snapshot)) > 0;
+    }
+    if (!written)
+        return;
+    {
+        QMutexLocker locker(&mutex);
+        known.insert(file_key(filename));
+    }
+    // 删除快照后不马上回收：回收要读所有清单、遍历所有块，每次保存都做太慢，
+    // 被删除快照引用的块等到定期回收或超过总大小时再删除
+    records_since_gc++;
+    if (records_since_gc >= GC_INTERVAL ||
+            (object_bytes >= 0 && object_bytes > size_limit))
+        this->collect_garbage();
+    emit sig_recorded(filename);
+}
+
+// 在后台线程中执行。同一个文件可能在处理前被打开多次，已有清单时不再记录
+void LocalHistory::store_original(const QString &filename, const QString &text)
+{
+    if (QFile::exists(this->manifest_path(filename)))
+        return;
+    this->store(filename, text);
+}
+
+// 删除没有被任何快照引用的块；总大小仍超过上限时删除最旧的快照后重新回收
+void LocalHistory::collect_garbage()
+{
+    records_since_gc = 0;
+    while (true) {
+        QSet<QByteArray> referenced;
+        QDirIterator manifests(root + "/files", QStringList("*.idx"), QDir::Files);
+        while (manifests.hasNext()) {
+            foreach (const Snapshot& snapshot, this->read_manifest(manifests.next())) {
+                foreach (const QByteArray& hash, snapshot.chunks)
+                    referenced.insert(hash);
+            }
+        }
+
+        qint64 total = 0;
+        QDirIterator objects(root + "/objects", QDir::Files, QDirIterator::Subdirectories);
+        while (objects.hasNext()) {
+            QString path = objects.next();
+            QFileInfo info = objects.fileInfo();
+            QByteArray hash = (info.dir().dirName() + info.fileName()).toLatin1();
+            if (referenced.contains(hash))
+                total += info.size();
+            else
+                QFile::remove(path);
+        }
+        object_bytes = total;
+
+        qint64 size_limit;
+        {
+            QMutexLocker locker(&mutex);
+            size_limit = max_size;
+        }
+        if (total <= size_limit || !this->drop_oldest(0.1))
+            break;
+    }
+}
+
+// 删除所有文件中最旧的一部分快照(每个文件的最新快照除外)，没有可删除的快照时返回false
+bool LocalHistory::drop_oldest(double fraction)
+{
+    QStringList paths;
+    QVector<qint64> times;
+    QDirIterator manifests(root + "/files", QStringList("*.idx"), QDir::Files);
+    while (manifests.hasNext()) {
+        QString path = manifests.next();
+        QList<Snapshot> snapshots = this->read_manifest(path);
+        for (int i = 0; i < snapshots.size() - 1; i++)
+            times.append(snapshots[i].time);
+        paths.append(path);
+    }
+    if (times.isEmpty())
+        return false;
+    std::sort(times.begin(), times.end());
+    int count = qMax(1, int(times.size() * fraction));
+    qint64 cutoff = times[count - 1];
+
+    foreach (const QString& path, paths) {
+        QString filename;
+        QList<Snapshot> snapshots = this->read_manifest(path, &filename);
+        QList<Snapshot> kept;
+        for (int i = 0; i < snapshots.size(); i++) {
+            if (i == snapshots.size() - 1 || snapshots[i].time > cutoff)
+                kept.append(snapshots[i]);
+        }
+        if (kept.size() != snapshots.size())
+            this->write_manifest(path, filename, kept);
+    }
+    return true;
+}
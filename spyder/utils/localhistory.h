@@ -0,0 +1,74 @@
+#pragma once
+
+#include <QSet>
+#include <QMutex>
+#include <QThread>
+#include <QDateTime>
+#include <QStringList>
+
+// 一次保存的快照：内容的SHA-1和按内容切分的各块的SHA-1
+struct Snapshot
+{
+    qint64 time;
+    qint64 size;
+    QByteArray hash;
+    QList<QByteArray> chunks;
+
+    QDateTime date_time() const { return QDateTime::fromMSecsSinceEpoch(time); }
+};
+
+
+// 本地历史：每次保存时在后台记录一个快照。文件内容按内容定义的边界(gear哈希)切成
+// 平均8KB的块，每块以SHA-1命名、压缩后存入objects目录，相同的块只存一份，
+// 所以频繁保存大文件时只有修改过的块占用空间。每个文件一个清单，每行一个快照。
+// 超过每个文件的快照数或保存天数的快照被删除，总大小超过上限时从最旧的快照开始删除，
+// 之后没有被引用的块在后台回收
+class LocalHistory : public QObject
+{
+    Q_OBJECT
+signals:
+    void sig_recorded(const QString& filename);
+
+public:
+    static LocalHistory* instance();
+
+    // 在界面线程中调用，打开文件时。text是刚从磁盘读入的内容，还没有快照的文件在后台
+    // 把它记为第一个快照，之后的保存不会在记录前覆盖它
+    void track(const QString& filename, const QString& text);
+    // 在界面线程中调用，写文件成功之后
+    void record(const QString& filename, const QString& text);
+    bool has_snapshots(const QString& filename);
+    // 按时间顺序
+    QList<Snapshot> snapshots(const QString& filename) const;
+    QString content(const Snapshot& snapshot, bool* ok = nullptr) const;
+    void shutdown();
+
+    static QVector<int> chunk_boundaries(const QByteArray& data);
+
+public slots:
+    void store(const QString& filename, const QString& text);
+    void store_original(const QString& filename, const QString& text);
+    void collect_garbage();
+
+private:
+    QThread* thread;
+    QString root;
+    QMutex mutex;
+    QSet<QString> known;
+    int max_snapshots;
+    qint64 max_age_ms;
+    qint64 max_size;
+    // 以下只在后台线程中使用
+    qint64 object_bytes;
+    int records_since_gc;
+
+    LocalHistory();
+    static QString file_key(const QString& filename);
+    QString manifest_path(const QString& filename) const;
+    QString object_path(const QByteArray& hash) const;
+    bool write_object(const QByteArray& hash, const QByteArray& data);
+    QList<Snapshot> read_manifest(const QString& path, QString* filename = nullptr) const;
+    bool write_manifest(const QString& path, const QString& filename,
+                        const QList<Snapshot>& snapshots);
+    bool drop_oldest(double fraction);
+};
@@ -0,0 +1,316 @@
+#include "resourcemonitor.h"
+
+#include <QCoreApplication>
+
+#if defined(Q_OS_LINUX)
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#elif defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+qint64 ResourceSample::children_rss_kb() const
+{
+    qint64 total = 0;
+    foreach (const ChildProcessInfo& child, children)
+        total += child.rss_kb;
+    return total;
+}
+
+double ResourceSample::children_cpu_percent() const
+{
+    double total = 0.0;
+    foreach (const ChildProcessInfo& child, children)
+        total += child.cpu_percent;
+    return total;
+}
+
+
+#if defined(Q_OS_LINUX)
+// /proc下的文件大小都显示为0，直接用read()读到EOF，避免QFile的额外开销
+static bool read_proc_file(const char* path, QByteArray* out)
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    out->clear();
+    char buf[4096];
+    ssize_t n;
+    while ((n = ::read(fd, buf, sizeof(buf))) > 0)
+        out->append(buf, int(n));
+    ::close(fd);
+    return !out->isEmpty();
+}
+
+struct ProcStat
+{
+    qint64 pid;
+    qint64 ppid;
+    QString name;
+    double cpu_s;
+    int threads;
+    qint64 rss_pages;
+};
+
+// 解析/proc/<pid>/stat。进程名可能包含空格和括号，所以从最后一个')'之后开始分割
+static bool parse_proc_stat(const QByteArray& text, ProcStat* stat)
+{
+    int open_paren = text.indexOf('(');
+    int close_paren = text.lastIndexOf(')');
+    if (open_paren < 0 || close_paren < open_paren)
+        return false;
+    stat->pid = text.left(open_paren).trimmed().toLongLong();
+    stat->name = QString::fromLocal8Bit(text.mid(open_paren + 1, close_paren - open_paren - 1));
+    QList<QByteArray> fields = text.mid(close_paren + 2).split(' ');
+    // fields[0]是第3个字段(state)
+    if (fields.size() < 22)
+        return false;
+    static const double ticks = double(sysconf(_SC_CLK_TCK));
+    stat->ppid = fields[1].toLongLong();
+    stat->cpu_s = (fields[11].toLongLong() + fields[12].toLongLong()) / ticks;
+    stat->threads = fields[17].toInt();
+    stat->rss_pages = fields[21].toLongLong();
+    return true;
+}
+
+static qint64 meminfo_value(const QByteArray& text, const char* key)
+{
+    int pos = text.indexOf(key);
+    if (pos < 0)
+        return -1;
+    pos += int(qstrlen(key));
+    int end = text.indexOf('\n', pos);
+    QByteArray value = text.mid(pos, end - pos).trimmed();
+    if (value.endsWith("kB"))
+        value.chop(2);
+    return value.trimmed().toLongLong();
+}
+#endif
+
+
+/********** ResourceSampler **********/
+ResourceSampler* ResourceSampler::instance()
+{
+    static ResourceSampler* sampler = nullptr;
+    if (sampler == nullptr) {
+        qRegisterMetaType<ResourceSample>("ResourceSample");
+        sampler = new ResourceSampler;
+    }
+    return sampler;
+}
+
+ResourceSampler::ResourceSampler()
+    : QObject (nullptr)
+{
+    last_wall_ms = -1;
+    last_ide_cpu_s = 0.0;
+    last_system_busy = 0;
+    last_system_total = 0;
+
+    thread = new QThread;
+    thread->setObjectName("ResourceSampler");
+    timer = new QTimer(this);
+    connect(timer, SIGNAL(timeout()), this, SLOT(take_sample()));
+    this->moveToThread(thread);
+    thread->start(QThread::LowPriority);
+
+    if (qApp)
+        connect(qApp, &QCoreApplication::aboutToQuit, [this](){ this->shutdown(); });
+}
+
+void ResourceSampler::subscribe(QObject *receiver, int interval)
+{
+    {
+        QMutexLocker locker(&mutex);
+        intervals[receiver] = qMax(interval, 100);
+    }
+    QMetaObject::invokeMethod(this, "update_interval", Qt::QueuedConnection);
+}
+
+void ResourceSampler::unsubscribe(QObject *receiver)
+{
+    {
+        QMutexLocker locker(&mutex);
+        intervals.remove(receiver);
+    }
+    QMetaObject::invokeMethod(this, "update_interval", Qt::QueuedConnection);
+}
+
+void ResourceSampler::shutdown()
+{
+    if (!thread->isRunning())
+        return;
+    QMetaObject::invokeMethod(timer, "stop", Qt::BlockingQueuedConnection);
+    thread->quit();
+    thread->wait();
+}
+
+// 在采样线程中执行
+void ResourceSampler::update_interval()
+{
+    int interval = -1;
+    {
+        QMutexLocker locker(&mutex);
+        foreach (int value, intervals) {
+            if (interval < 0 || value < interval)
+                interval = value;
+        }
+    }
+    if (interval < 0) {
+        timer->stop();
+        return;
+    }
+    bool was_active = timer->isActive();
+    timer->start(interval);
+    if (!was_active)
+        take_sample();
+}
+
+void ResourceSampler::take_sample()
+{
+    emit sig_sample(sample());
+}
+
+double ResourceSampler::system_cpu_percent()
+{
+#if defined(Q_OS_LINUX)
+    QByteArray text;
+    if (!read_proc_file("/proc/stat", &text))
+        return -1;
+    QList<QByteArray> fields = text.left(text.indexOf('\n')).simplified().split(' ');
+    if (fields.size() < 5 || fields[0] != "cpu")
+        return -1;
+    qint64 total = 0;
+    for (int i = 1; i < fields.size(); i++)
+        total += fields[i].toLongLong();
+    // idle + iowait
+    qint64 idle = fields[4].toLongLong() + (fields.size() > 5 ? fields[5].toLongLong() : 0);
+    qint64 busy = total - idle;
+    double percent = -1;
+    if (last_system_total > 0 && total > last_system_total)
+        percent = 100.0 * (busy - last_system_busy) / (total - last_system_total);
+    last_system_busy = busy;
+    last_system_total = total;
+    return percent;
+#elif defined(Q_OS_WIN)
+    FILETIME idle_time, kernel_time, user_time;
+    if (!GetSystemTimes(&idle_time, &kernel_time, &user_time))
+        return -1;
+    auto to_int = [](const FILETIME& ft) {
+        return qint64((quint64(ft.dwHighDateTime) << 32) | ft.dwLowDateTime);
+    };
+    // kernel时间包含了idle时间
+    qint64 total = to_int(kernel_time) + to_int(user_time);
+    qint64 busy = total - to_int(idle_time);
+    double percent = -1;
+    if (last_system_total > 0 && total > last_system_total)
+        percent = 100.0 * (busy - last_system_busy) / (total - last_system_total);
+    last_system_busy = busy;
+    last_system_total = total;
+    return percent;
+#else
+    return -1;
+#endif
+}
+
+ResourceSample ResourceSampler::sample()
+{
+    ResourceSample result;
+    if (!clock.isValid())
+        clock.start();
+    qint64 wall_ms = clock.elapsed();
+    double elapsed_s = last_wall_ms < 0 ? 0.0 : (wall_ms - last_wall_ms) / 1000.0;
+
+    result.system_cpu_percent = system_cpu_percent();
+
+#if defined(Q_OS_LINUX)
+    static const qint64 page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    QByteArray text;
+
+    if (read_proc_file("/proc/meminfo", &text)) {
+        result.system_total_kb = meminfo_value(text, "MemTotal:");
+        result.system_available_kb = meminfo_value(text, "MemAvailable:");
+        if (result.system_available_kb < 0)
+            result.system_available_kb = meminfo_value(text, "MemFree:");
+        if (result.system_total_kb > 0 && result.system_available_kb >= 0)
+            result.system_memory_percent = 100.0 * (result.system_total_kb - result.system_available_kb)
+                    / result.system_total_kb;
+    }
+
+    ProcStat self;
+    if (read_proc_file("/proc/self/stat", &text) && parse_proc_stat(text, &self)) {
+        result.ide_rss_kb = self.rss_pages * page_kb;
+        result.thread_count = self.threads;
+        if (elapsed_s > 0)
+            result.ide_cpu_percent = 100.0 * (self.cpu_s - last_ide_cpu_s) / elapsed_s;
+        last_ide_cpu_s = self.cpu_s;
+    }
+
+    // 扫描/proc建立父子关系，找出本进程的所有后代进程(控制台内核、分析器等)
+    QHash<qint64, ProcStat> procs;
+    QMultiHash<qint64, qint64> children_of;
+    DIR* dir = opendir("/proc");
+    if (dir) {
+        struct dirent* entry;
+        char path[64];
+        while ((entry = readdir(dir)) != nullptr) {
+            const char* name = entry->d_name;
+            if (name[0] < '0' || name[0] > '9')
+                continue;
+            qsnprintf(path, sizeof(path), "/proc/%s/stat", name);
+            ProcStat stat;
+            if (read_proc_file(path, &text) && parse_proc_stat(text, &stat)) {
+                procs.insert(stat.pid, stat);
+                children_of.insert(stat.ppid, stat.pid);
+            }
+        }
+        closedir(dir);
+    }
+
+    QHash<qint64,double> child_cpu_s;
+    QList<qint64> pending = children_of.values(qint64(getpid()));
+    while (!pending.isEmpty()) {
+        qint64 pid = pending.takeFirst();
+        const ProcStat& stat = procs[pid];
+        ChildProcessInfo info;
+        info.pid = pid;
+        info.name = stat.name;
+        info.rss_kb = stat.rss_pages * page_kb;
+        if (elapsed_s > 0 && last_child_cpu_s.contains(pid))
+            info.cpu_percent = 100.0 * (stat.cpu_s - last_child_cpu_s[pid]) / elapsed_s;
+        child_cpu_s[pid] = stat.cpu_s;
+        result.children.append(info);
+        pending.append(children_of.values(pid));
+    }
+    last_child_cpu_s = child_cpu_s;
+
+#elif defined(Q_OS_WIN)
+    MEMORYSTATUSEX memorystatus;
+    memorystatus.dwLength = sizeof(memorystatus);
+    if (GlobalMemoryStatusEx(&memorystatus)) {
+        result.system_total_kb = qint64(memorystatus.ullTotalPhys / 1024);
+        result.system_available_kb = qint64(memorystatus.ullAvailPhys / 1024);
+        result.system_memory_percent = memorystatus.dwMemoryLoad;
+    }
+
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        result.ide_rss_kb = qint64(counters.WorkingSetSize / 1024);
+
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time)) {
+        auto to_s = [](const FILETIME& ft) {
+            return ((quint64(ft.dwHighDateTime) << 32) | ft.dwLowDateTime) / 1e7;
+        };
+        double cpu_s = to_s(kernel_time) + to_s(user_time);
+        if (elapsed_s > 0)
+            result.ide_cpu_percent = 100.0 * (cpu_s - last_ide_cpu_s) / elapsed_s;
+        last_ide_cpu_s = cpu_s;
+    }
+#endif
+
+    last_wall_ms = wall_ms;
+    return result;
+}
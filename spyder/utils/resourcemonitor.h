@@ -0,0 +1,76 @@
+#pragma once
+
+#include <QHash>
+#include <QMutex>
+#include <QList>
+#include <QTimer>
+#include <QThread>
+#include <QMetaType>
+#include <QElapsedTimer>
+
+struct ChildProcessInfo
+{
+    qint64 pid;
+    QString name;
+    qint64 rss_kb;
+    double cpu_percent;
+    ChildProcessInfo() : pid(0), rss_kb(0), cpu_percent(0.0) {}
+};
+
+// 一次采样的结果；无法获取的值为-1
+struct ResourceSample
+{
+    qint64 system_total_kb;
+    qint64 system_available_kb;
+    double system_memory_percent;
+    double system_cpu_percent;
+    qint64 ide_rss_kb;
+    double ide_cpu_percent;
+    int thread_count;
+    QList<ChildProcessInfo> children;
+    ResourceSample()
+        : system_total_kb(-1), system_available_kb(-1), system_memory_percent(-1),
+          system_cpu_percent(-1), ide_rss_kb(-1), ide_cpu_percent(-1), thread_count(-1) {}
+    qint64 children_rss_kb() const;
+    double children_cpu_percent() const;
+};
+Q_DECLARE_METATYPE(ResourceSample)
+
+
+// 在独立线程中定时采样系统和本进程(及其子进程)的资源占用，结果通过信号发回GUI线程
+class ResourceSampler : public QObject
+{
+    Q_OBJECT
+signals:
+    void sig_sample(const ResourceSample&);
+public:
+    static ResourceSampler* instance();
+
+    // 每个订阅者登记自己的刷新间隔，采样线程按其中最小的间隔运行；
+    // 没有订阅者时停止采样
+    void subscribe(QObject* receiver, int interval);
+    void unsubscribe(QObject* receiver);
+    void shutdown();
+
+public slots:
+    void update_interval();
+    void take_sample();
+
+private:
+    QThread* thread;
+    QTimer* timer;
+    QMutex mutex;
+    QHash<QObject*,int> intervals;
+
+    // 上一次采样时的CPU时间，用于计算区间内的使用率
+    QElapsedTimer clock;
+    qint64 last_wall_ms;
+    double last_ide_cpu_s;
+    qint64 last_system_busy;
+    qint64 last_system_total;
+    QHash<qint64,double> last_child_cpu_s;
+
+    ResourceSampler();
+    ResourceSample sample();
+    double system_cpu_percent();
+};
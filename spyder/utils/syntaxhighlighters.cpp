@@ -1,7 +1,15 @@
 #include "syntaxhighlighters.h"
+#include "utils/tracing.h"
+
+#include <algorithm>
 
 namespace sh {
 
+// 显示空白时降低前景色的透明度，格式取决于该位置原来的格式
+static const int BLANK_STYLE = -1;
+// 后台重新设置格式时每批处理的块数
+static const int RESTYLE_CHUNK = 1000;
+
 QHash<QString, QString> COLOR_SCHEME_KEYS =
 {{"background", "Background:"},
 {"currentline", "Current line:"},
@@ -49,6 +57,16 @@ BaseSH::BaseSH(QTextDocument *parent,const QFont& font,const QHash<QString,Color
     this->setup_formats(font);
 
     this->cell_separators = QStringList();
+    this->cell_index_block_count = 0;
+    this->records_tokens = false;
+    this->_line_limit = 0;
+
+    this->_restyle_pending = false;
+    this->restyle_next = -1;
+    this->restyle_timer = new QTimer(this);
+    this->restyle_timer->setSingleShot(true);
+    this->restyle_timer->setInterval(0);
+    connect(restyle_timer, SIGNAL(timeout()), this, SLOT(restyle_chunk()));
 }
 
 QColor BaseSH::get_background_color() const
@@ -152,7 +170,7 @@ void BaseSH::set_color_scheme(const QHash<QString,ColorBoolBool> &color_scheme)
     else
         this->color_scheme = get_color_scheme();
     setup_formats();
-    rehighlight();
+    restyle();
 }
 
 void BaseSH::highlight_spaces(const QString &text, int offset)
@@ -167,21 +185,33 @@ void BaseSH::highlight_spaces(const QString &text, int offset)
             int start = match.capturedStart(), end=match.capturedEnd();
             start = qMax(0, start+offset);
             end = qMax(0, end+offset);
-            if (end==text.size() && !format_trailing.isEmpty())
+            if (end==text.size() && !format_trailing.isEmpty()) {
                 this->setFormat(start, end, format_trailing);
-            if (start==0 && !format_leading.isEmpty())
+                this->add_run(start, end, TOKEN_NONE, style_id("trailing"));
+            }
+            if (start==0 && !format_leading.isEmpty()) {
                 this->setFormat(start, end, format_leading);
+                this->add_run(start, end, TOKEN_NONE, style_id("leading"));
+            }
 
             QTextCharFormat format = this->format(start);
             QColor color_foreground = format.foreground().color();
             double alpha_new = this->BLANK_ALPHA_FACTOR * color_foreground.alphaF();
             color_foreground.setAlphaF(alpha_new);
             this->setFormat(start, end-start, color_foreground);
+            this->add_run(start, end-start, TOKEN_NONE, BLANK_STYLE);
             match = this->BLANKPROG.match(text, match.capturedEnd());
         }
     }
 }
 
+QString BaseSH::bounded_text(const QString &text) const
+{
+    if (_line_limit > 0 && text.size() > _line_limit)
+        return text.left(_line_limit);
+    return text;
+}
+
 QHash<int,OutlineExplorerData> BaseSH::get_outlineexplorer_data() const
 {
     return this->outlineexplorer_data;
@@ -189,22 +219,283 @@ QHash<int,OutlineExplorerData> BaseSH::get_outlineexplorer_data() const
 
 
 
+// 在highlightBlock中调用，记录当前块是否为单元格分隔行。
+// 插入或删除行后，QSyntaxHighlighter从修改处的块开始重新高亮，
+// 此时块数已经变化，把该块之后的分隔行整体平移，其余的块会被重新高亮
+void BaseSH::update_cell_separator(bool is_separator)
+{
+    int block_nb = this->currentBlock().blockNumber();
+    int count = this->document()->blockCount();
+    if (count != this->cell_index_block_count) {
+        int delta = count - this->cell_index_block_count;
+        auto it = std::upper_bound(cell_blocks.begin(), cell_blocks.end(), block_nb);
+        int keep = int(it - cell_blocks.begin());
+        for (int i = keep; i < cell_blocks.size(); i++) {
+            int shifted = cell_blocks[i] + delta;
+            if (shifted > block_nb)
+                cell_blocks[keep++] = shifted;
+        }
+        cell_blocks.resize(keep);
+        this->cell_index_block_count = count;
+    }
+
+    auto it = std::lower_bound(cell_blocks.begin(), cell_blocks.end(), block_nb);
+    bool present = it != cell_blocks.end() && *it == block_nb;
+    if (is_separator && !present)
+        cell_blocks.insert(it, block_nb);
+    else if (!is_separator && present)
+        cell_blocks.erase(it);
+    this->found_cell_separators = !cell_blocks.isEmpty();
+}
+
+// 不在highlightBlock中自行识别分隔行的高亮器用text判断
+void BaseSH::update_cell_separator(const QString &text)
+{
+    this->update_cell_separator(!this->cell_separators.isEmpty() &&
+                                startswith(lstrip(text), this->cell_separators));
+}
+
+const QVector<int>& BaseSH::cell_separator_blocks()
+{
+    // 块数变化了却没有经过高亮(例如高亮器刚创建)，重新扫描一遍
+    QTextDocument* doc = this->document();
+    if (doc && doc->blockCount() != this->cell_index_block_count) {
+        cell_blocks.clear();
+        if (!this->cell_separators.isEmpty()) {
+            for (QTextBlock block = doc->begin(); block.isValid(); block = block.next()) {
+                if (startswith(lstrip(block.text()), this->cell_separators))
+                    cell_blocks.append(block.blockNumber());
+            }
+        }
+        this->cell_index_block_count = doc->blockCount();
+    }
+    return cell_blocks;
+}
+
+bool BaseSH::is_cell_separator_block(int block_number)
+{
+    const QVector<int>& blocks = this->cell_separator_blocks();
+    return std::binary_search(blocks.begin(), blocks.end(), block_number);
+}
+
+int BaseSH::token_kind(const QString &key)
+{
+    static const QHash<QString,int> kinds = {{"keyword", TOKEN_KEYWORD},
+                                             {"builtin", TOKEN_BUILTIN},
+                                             {"definition", TOKEN_DEFINITION},
+                                             {"instance", TOKEN_INSTANCE},
+                                             {"number", TOKEN_NUMBER},
+                                             {"string", TOKEN_STRING},
+                                             {"comment", TOKEN_COMMENT}};
+    return kinds.value(key, TOKEN_CODE);
+}
+
+// formats的键和编号的对应关系，所有高亮器共用
+static QStringList& style_keys()
+{
+    static QStringList keys;
+    return keys;
+}
+
+int BaseSH::style_id(const QString &key)
+{
+    static QHash<QString,int> ids;
+    auto it = ids.find(key);
+    if (it != ids.end())
+        return it.value();
+    int id = style_keys().size();
+    style_keys().append(key);
+    ids.insert(key, id);
+    return id;
+}
+
+QString BaseSH::style_key(int style)
+{
+    const QStringList& keys = style_keys();
+    return (style >= 0 && style < keys.size()) ? keys[style] : QString();
+}
+
+void BaseSH::add_run(int start, int length, int kind, int style)
+{
+    if (length <= 0)
+        return;
+    TokenRun run;
+    run.start = start;
+    run.length = length;
+    run.kind = kind;
+    run.style = style;
+    current_tokens.append(run);
+}
+
+// 代替setFormat(start, length, formats[key])，同时记录记号
+void BaseSH::set_style(int start, int length, const QString &key)
+{
+    this->setFormat(start, length, this->formats[key]);
+    this->add_run(start, length, token_kind(key), style_id(key));
+}
+
+// 在highlightBlock的最后调用。和单元格分隔行的索引一样，
+// 插入或删除行后把当前块之后的记号整体平移，其余的块会被重新高亮
+void BaseSH::store_tokens()
+{
+    int block_nb = this->currentBlock().blockNumber();
+    int count = this->document()->blockCount();
+    int delta = count - tokens.size();
+    if (delta != 0) {
+        int at = qMin(block_nb + 1, tokens.size());
+        if (delta > 0)
+            tokens.insert(at, delta, QVector<TokenRun>());
+        else
+            tokens.remove(at, qMin(-delta, tokens.size() - at));
+        tokens.resize(count);
+    }
+    if (block_nb >= 0 && block_nb < tokens.size())
+        tokens[block_nb].swap(current_tokens);
+    current_tokens.clear();
+}
+
+const QVector<TokenRun>& BaseSH::block_tokens(const QTextBlock &block) const
+{
+    static const QVector<TokenRun> no_tokens;
+    int block_nb = block.blockNumber();
+    if (block_nb < 0 || block_nb >= tokens.size())
+        return no_tokens;
+    return tokens[block_nb];
+}
+
+int BaseSH::token_at(const QTextBlock &block, int pos) const
+{
+    const QVector<TokenRun>& runs = this->block_tokens(block);
+    for (int i = runs.size() - 1; i >= 0; i--) {
+        const TokenRun& run = runs[i];
+        // 普通代码和只影响显示的格式不覆盖前面的字符串、注释等
+        if (run.kind > TOKEN_CODE && run.start <= pos && pos < run.start + run.length)
+            return run.kind;
+    }
+    return TOKEN_CODE;
+}
+
 void BaseSH::rehighlight()
 {
     this->outlineexplorer_data.clear();
+    this->cell_blocks.clear();
+    this->tokens.clear();
+    this->_restyle_pending = false;
+    this->restyle_next = -1;
+    this->restyle_timer->stop();
+    this->cell_index_block_count = this->document() ? this->document()->blockCount() : 0;
     QApplication::setOverrideCursor(QCursor(Qt::WaitCursor));
     QSyntaxHighlighter::rehighlight();
     QApplication::restoreOverrideCursor();
 }
 
+void BaseSH::restyle()
+{
+    this->_restyle_pending = true;
+    this->restyle_next = -1;
+    this->restyle_timer->stop();
+}
+
+void BaseSH::apply_restyle(int first_block, int last_block)
+{
+    this->_restyle_pending = false;
+    QTextDocument* doc = this->document();
+    if (!doc)
+        return;
+    // 还没有完整地高亮过(例如高亮器刚创建)，只能重新分析
+    if (tokens.size() != doc->blockCount()) {
+        this->rehighlight();
+        return;
+    }
+    this->restyle_blocks(first_block, last_block);
+    this->restyle_next = 0;
+    this->restyle_timer->start();
+}
+
+void BaseSH::restyle_chunk()
+{
+    QTextDocument* doc = this->document();
+    if (!doc || this->restyle_next < 0)
+        return;
+    int first = this->restyle_next;
+    int last = first + RESTYLE_CHUNK - 1;
+    this->restyle_blocks(first, last);
+    if (last + 1 < tokens.size()) {
+        this->restyle_next = last + 1;
+        this->restyle_timer->start();
+    }
+    else
+        this->restyle_next = -1;
+}
+
+// 按记录的记号重放setFormat，和QSyntaxHighlighter一样逐字符合并格式，
+// 再直接设置到块的布局上。markContentsDirty只让布局重新计算，不产生contentsChange
+void BaseSH::restyle_blocks(int first_block, int last_block)
+{
+    QTextDocument* doc = this->document();
+    if (!doc)
+        return;
+    first_block = qMax(0, first_block);
+    last_block = qMin(last_block, qMin(tokens.size(), doc->blockCount()) - 1);
+    if (first_block > last_block)
+        return;
+    QTextBlock block = doc->findBlockByNumber(first_block);
+    int start_pos = block.position();
+    QTextBlock end_block = block;
+    QVector<QTextCharFormat> chars;
+    for (int nb = first_block; block.isValid() && nb <= last_block; nb++) {
+        int length = block.length() - 1;
+        chars.fill(QTextCharFormat(), length);
+        foreach (const TokenRun& run, tokens[nb]) {
+            if (run.start < 0 || run.start >= length)
+                continue;
+            int end = qMin(run.start + run.length, length);
+            QTextCharFormat format;
+            if (run.style == BLANK_STYLE) {
+                QColor color = chars[run.start].foreground().color();
+                color.setAlphaF(this->BLANK_ALPHA_FACTOR * color.alphaF());
+                format.setForeground(color);
+            }
+            else
+                format = this->formats.value(style_key(run.style));
+            for (int i = run.start; i < end; i++)
+                chars[i] = format;
+        }
+
+        QVector<QTextLayout::FormatRange> ranges;
+        int i = 0;
+        while (i < length) {
+            int j = i + 1;
+            while (j < length && chars[j] == chars[i])
+                j++;
+            if (chars[i] != QTextCharFormat()) {
+                QTextLayout::FormatRange range;
+                range.start = i;
+                range.length = j - i;
+                range.format = chars[i];
+                ranges.append(range);
+            }
+            i = j;
+        }
+        block.layout()->setFormats(ranges);
+        end_block = block;
+        block = block.next();
+    }
+    doc->markContentsDirty(start_pos, end_block.position() + end_block.length() - start_pos);
+}
+
 
 TextSH::TextSH(QTextDocument *parent,const QFont& font,const QHash<QString,ColorBoolBool>& color_scheme)
     : BaseSH (parent, font, color_scheme)
 {}
 
-void TextSH::highlightBlock(const QString &text)
+void TextSH::highlightBlock(const QString &block_text)
 {
+    TraceSpan span("highlightBlock", "highlighter");
+    const QString text = this->bounded_text(block_text);
     highlight_spaces(text);
+    update_cell_separator(text);
+    store_tokens();
 }
 
 
@@ -334,6 +625,9 @@ PythonSH::PythonSH(QTextDocument *parent,const QFont& font,const QHash<QString,C
     import_statements = QHash<int,QString>();
     found_cell_separators = false;
     cell_separators = sourcecode::CELL_LANGUAGES["Python"];
+    records_tokens = true;
+    formats["leading"] = formats["normal"];
+    formats["trailing"] = formats["normal"];
 
     for (int i = 1; i < this->PROG.namedCaptureGroups().size(); ++i) {
         if (!this->PROG.namedCaptureGroups()[i].isEmpty())
@@ -343,25 +637,26 @@ PythonSH::PythonSH(QTextDocument *parent,const QFont& font,const QHash<QString,C
 
 void PythonSH::highlightBlock(const QString &text)
 {
+    TraceSpan span("highlightBlock", "highlighter");
     int prev_state = this->previousBlockState();
     int offset;
-    QString text_ = text;
+    QString text_ = this->bounded_text(text);
     switch (prev_state) {
     case INSIDE_DQ3STRING:
         offset = -4;
-        text_ = "\"\"\" "+text;
+        text_ = "\"\"\" "+text_;
         break;
     case INSIDE_SQ3STRING:
         offset = -4;
-        text_ = "''' "+text;
+        text_ = "''' "+text_;
         break;
     case INSIDE_DQSTRING:
         offset = -2;
-        text_ = "\" "+text;
+        text_ = "\" "+text_;
         break;
     case INSIDE_SQSTRING:
         offset = -2;
-        text_ = "' "+text;
+        text_ = "' "+text_;
         break;
     default:
         offset = 0;
@@ -372,7 +667,7 @@ void PythonSH::highlightBlock(const QString &text)
     OutlineExplorerData oedata;
     QString import_stmt;
 
-    this->setFormat(0, text_.size(), formats["normal"]);
+    this->set_style(0, text_.size(), "normal");
 
     int state = this->NORMAL;
     QRegularExpressionMatch match = this->PROG.match(text_);
@@ -388,31 +683,26 @@ void PythonSH::highlightBlock(const QString &text)
                 end = qMax(0, end+offset);
 
                 if (key == "uf_sq3string") {
-                    this->setFormat(start, end-start,
-                                    this->formats["string"]);
+                    this->set_style(start, end-start, "string");
                     state = INSIDE_SQ3STRING;
                 }
                 else if (key == "uf_dq3string") {
-                    this->setFormat(start, end-start,
-                                    this->formats["string"]);
+                    this->set_style(start, end-start, "string");
                     state = INSIDE_DQ3STRING;
                 }
                 else if (key == "uf_sqstring") {
-                    this->setFormat(start, end-start,
-                                    this->formats["string"]);
+                    this->set_style(start, end-start, "string");
                     state = INSIDE_SQSTRING;
                 }
                 else if (key == "uf_dqstring") {
-                    this->setFormat(start, end-start,
-                                    this->formats["string"]);
+                    this->set_style(start, end-start, "string");
                     state = INSIDE_DQSTRING;
                 }
                 else {
-                    this->setFormat(start, end-start, formats[key]);
+                    this->set_style(start, end-start, key);
                     if (key == "comment") {
                         QRegularExpressionMatch tmp = OECOMMENT.match(lstrip(text_));
                         if (startswith(lstrip(text_),cell_separators)) {
-                            found_cell_separators = true;
                             oedata.text = text_.trimmed();
                             oedata.fold_level = start;
                             oedata.def_type = OutlineExplorerData::CELL;
@@ -431,7 +721,7 @@ void PythonSH::highlightBlock(const QString &text)
                             if (match1.capturedStart() == end) {
                                 int start1 = match1.capturedStart(1);
                                 int end1 = match1.capturedEnd(1);
-                                setFormat(start1, end1-start1, formats["definition"]);
+                                set_style(start1, end1-start1, "definition");
                                 oedata.text = text_;
                                 oedata.fold_level = start;
                                 oedata.def_type = DEF_TYPES[value];
@@ -464,7 +754,7 @@ void PythonSH::highlightBlock(const QString &text)
                                     break;
                                 start = match1.capturedStart(1);
                                 end = match1.capturedEnd(1);
-                                setFormat(start, end-start, formats["keyword"]);
+                                set_style(start, end-start, "keyword");
                             }
                         }
                     }
@@ -476,8 +766,6 @@ void PythonSH::highlightBlock(const QString &text)
     }
 
     setCurrentBlockState(state);
-    formats["leading"] = formats["normal"];
-    formats["trailing"] = formats["normal"];
     highlight_spaces(text_,offset);
 
     if (oedata.fold_level != -1) {
@@ -488,6 +776,8 @@ void PythonSH::highlightBlock(const QString &text)
         int block_nb = currentBlock().blockNumber();
         import_statements[block_nb] = import_stmt;
     }
+    update_cell_separator(oedata.def_type == OutlineExplorerData::CELL);
+    store_tokens();
 }
 
 QStringList PythonSH::get_import_statements()
@@ -495,6 +785,20 @@ QStringList PythonSH::get_import_statements()
     return import_statements.values();
 }
 
+// 行首行尾的空白用普通文本的格式，放在这里使重新设置格式时也能取到
+void PythonSH::setup_formats()
+{
+    BaseSH::setup_formats();
+    formats["leading"] = formats["normal"];
+    formats["trailing"] = formats["normal"];
+}
+
+void PythonSH::setup_formats(const QFont& font)
+{
+    this->font = font;
+    this->setup_formats();
+}
+
 void PythonSH::rehighlight()
 {
     import_statements.clear();
@@ -554,19 +858,23 @@ CppSH::CppSH(QTextDocument *parent,const QFont& font,const QHash<QString,ColorBo
 {
     this->PROG = QRegularExpression(make_cpp_patterns(),
                               QRegularExpression::DotMatchesEverythingOption);
+    this->records_tokens = true;
     for (int i = 1; i < this->PROG.namedCaptureGroups().size(); ++i) {
         if (!this->PROG.namedCaptureGroups()[i].isEmpty())
             match_index_list.append(i);
     }
 }
 
-void CppSH::highlightBlock(const QString &text)
+void CppSH::highlightBlock(const QString &block_text)
 {
+    TraceSpan span("highlightBlock", "highlighter");
+    const QString text = this->bounded_text(block_text);
     bool inside_comment = this->previousBlockState() == this->INSIDE_COMMENT;
-    if (inside_comment)
-        this->setFormat(0, text.size(), this->formats["comment"]);
+    if (inside_comment) {
+        this->set_style(0, text.size(), "comment");
+    }
     else
-        this->setFormat(0, text.size(), this->formats["normal"]);
+        this->set_style(0, text.size(), "normal");
 
     QRegularExpressionMatch match = this->PROG.match(text);
     int index = 0;
@@ -581,23 +889,21 @@ void CppSH::highlightBlock(const QString &text)
                 index += end-start;
                 if (key == "comment_start") {
                     inside_comment = true;
-                    this->setFormat(start, text.size()-start,
-                                    this->formats["comment"]);
+                    this->set_style(start, text.size()-start, "comment");
                 }
                 else if (key == "comment_end") {
                     inside_comment = false;
-                    this->setFormat(start, end-start,
-                                    this->formats["comment"]);
+                    this->set_style(start, end-start, "comment");
+                }
+                else if (inside_comment) {
+                    this->set_style(start, end-start, "comment");
+                }
+                else if (key == "define") {
+                    this->set_style(start, end-start, "number");
+                }
+                else {
+                    this->set_style(start, end-start, key);
                 }
-                else if (inside_comment)
-                    this->setFormat(start, end-start,
-                                    this->formats["comment"]);
-                else if (key == "define")
-                    this->setFormat(start, end-start,
-                                    this->formats["number"]);
-                else
-                    this->setFormat(start, end-start,
-                                    this->formats[key]);
             }
         }
         match = PROG.match(text, match.capturedEnd());
@@ -610,6 +916,8 @@ void CppSH::highlightBlock(const QString &text)
     else
         last_state = this->NORMAL;
     this->setCurrentBlockState(last_state);
+    this->update_cell_separator(text);
+    this->store_tokens();
 }
 
 
@@ -679,15 +987,17 @@ MarkdownSH::MarkdownSH(QTextDocument *parent,const QFont& font,const QHash<QStri
     }
 }
 
-void MarkdownSH::highlightBlock(const QString &text)
+void MarkdownSH::highlightBlock(const QString &block_text)
 {
+    TraceSpan span("highlightBlock", "highlighter");
+    const QString text = this->bounded_text(block_text);
     int previous_state = this->previousBlockState();
 
     if (previous_state == this->CODE)
-        this->setFormat(0, text.size(), this->formats["code"]);
+        this->set_style(0, text.size(), "code");
     else {
         previous_state = this->NORMAL;
-        this->setFormat(0, text.size(), this->formats["normal"]);
+        this->set_style(0, text.size(), "normal");
     }
 
     this->setCurrentBlockState(previous_state);
@@ -708,7 +1018,7 @@ void MarkdownSH::highlightBlock(const QString &text)
 
                 if (previous_state == this->CODE) {
                     if (key == "code") {
-                        this->setFormat(0, text.size(), this->formats["normal"]);
+                        this->set_style(0, text.size(), "normal");
                         this->setCurrentBlockState(this->NORMAL);
                     }
                     else
@@ -716,12 +1026,12 @@ void MarkdownSH::highlightBlock(const QString &text)
                 }
                 else {
                     if (key == "code") {
-                        this->setFormat(0, text.size(), this->formats["code"]);
+                        this->set_style(0, text.size(), "code");
                         this->setCurrentBlockState(this->CODE);
                         continue;
                     }
                 }
-                this->setFormat(start, end-start, this->formats[key]);
+                this->set_style(start, end-start, key);
             }
         }
 
@@ -729,6 +1039,8 @@ void MarkdownSH::highlightBlock(const QString &text)
         match_count++;
     }
     this->highlight_spaces(text);
+    this->update_cell_separator(text);
+    this->store_tokens();
 }
 
 
@@ -9,6 +9,7 @@
 #include "config/config_main.h"
 #include <QSettings>
 #include <QTextDocument>
+#include <QTimer>
 #include <QApplication>
 #include <QSyntaxHighlighter>
 #include <QRegularExpression>
@@ -22,6 +23,24 @@ QHash<QString,ColorBoolBool> get_color_scheme();
 
 class OutlineExplorerData;
 
+// 高亮时记录的记号类型，编辑器据此判断光标是否在字符串、注释中。
+// TOKEN_NONE是只影响显示的格式(行首行尾的空白)，查询记号时忽略
+enum TokenKind {
+    TOKEN_NONE = -1,
+    TOKEN_CODE, TOKEN_KEYWORD, TOKEN_BUILTIN, TOKEN_DEFINITION,
+    TOKEN_INSTANCE, TOKEN_NUMBER, TOKEN_STRING, TOKEN_COMMENT
+};
+
+// 块内[start, start+length)的一段记号。style是formats中的键的编号，
+// 和记号类型分开保存，配色或字体改变时只需按style重新取格式
+struct TokenRun
+{
+    int start;
+    int length;
+    int kind;
+    int style;
+};
+
 class BaseSH : public QSyntaxHighlighter
 {
     Q_OBJECT
@@ -48,13 +67,46 @@ public:
     virtual void setup_formats();
     virtual void setup_formats(const QFont& font);
     void set_color_scheme(const QHash<QString,ColorBoolBool>& color_scheme);
+
+    // 配色或字体改变后，按记录的记号重新设置各块的格式，不重新分析文本。
+    // restyle只做标记，由显示该文档的编辑器调用apply_restyle：
+    // 先同步处理可见的块，其余的块在事件循环中分批处理
+    void restyle();
+    bool restyle_pending() const { return _restyle_pending; }
+    void apply_restyle(int first_block, int last_block);
+    void restyle_blocks(int first_block, int last_block);
     void highlight_spaces(const QString& text,int offset=0);
     QHash<int,OutlineExplorerData> get_outlineexplorer_data() const;
+
+    // 单元格分隔行的块号(升序)，查找当前单元格时二分查找
+    const QVector<int>& cell_separator_blocks();
+    bool is_cell_separator_block(int block_number);
+
+    // 记号类型是否可用于判断字符串、注释(Python和C/C++)
+    bool has_tokens() const { return records_tokens; }
+    const QVector<TokenRun>& block_tokens(const QTextBlock& block) const;
+    int token_at(const QTextBlock& block, int pos) const;
+    static int token_kind(const QString& key);
+
+    // 大于0时每行只分析开头limit个字符，其余部分显示为普通文本(长行保护模式)。
+    // 改变后由调用者重新高亮
+    void set_line_limit(int limit) { _line_limit = limit; }
+    int line_limit() const { return _line_limit; }
 protected:
     void highlightBlock(const QString &text) = 0;
+    // highlightBlock中代替text使用
+    QString bounded_text(const QString& text) const;
+    void update_cell_separator(bool is_separator);
+    void update_cell_separator(const QString& text);
+    void set_style(int start, int length, const QString& key);
+    void store_tokens();
+
+    bool records_tokens;
 
 public slots:
     void rehighlight();
+private slots:
+    void restyle_chunk();
 
 public:
     QHash<int,OutlineExplorerData> outlineexplorer_data;
@@ -72,6 +124,24 @@ public:
     QString unmatched_p_color;
     QHash<QString,QTextCharFormat> formats;
     QStringList cell_separators;
+private:
+    QVector<int> cell_blocks;
+    // 索引对应的文档块数，不一致时说明有行被插入或删除
+    int cell_index_block_count;
+    // 按块号保存的记号，按setFormat的调用顺序排列(后面的覆盖前面的)
+    QVector<QVector<TokenRun>> tokens;
+    QVector<TokenRun> current_tokens;
+
+    int _line_limit;
+
+    bool _restyle_pending;
+    // 后台分批处理时下一个块的块号，-1表示没有在处理
+    int restyle_next;
+    QTimer* restyle_timer;
+
+    void add_run(int start, int length, int kind, int style);
+    static int style_id(const QString& key);
+    static QString style_key(int style);
 };
 
 
@@ -136,6 +206,8 @@ public:
     PythonSH(QTextDocument *parent,const QFont& font,
            const QHash<QString,ColorBoolBool>& color_scheme);
     QStringList get_import_statements();
+    void setup_formats() override;
+    void setup_formats(const QFont& font) override;
 
 protected:
     void highlightBlock(const QString &text);
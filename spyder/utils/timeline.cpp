@@ -0,0 +1,144 @@
+#include "timeline.h"
+
+#include <QFile>
+#include <QThread>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QCoreApplication>
+
+Timeline* Timeline::startup()
+{
+    static Timeline* timeline = new Timeline;
+    return timeline;
+}
+
+Timeline::Timeline()
+    : recording(true), config_reads(0), config_ns(0)
+{
+    clock.start();
+}
+
+// 启动完成后停止记录，之后的begin和配置计数都是空操作
+void Timeline::finish()
+{
+    recording = false;
+}
+
+void Timeline::begin(const QString &name, const QString &category)
+{
+    if (!recording)
+        return;
+    QMutexLocker locker(&mutex);
+    TimelineEvent event;
+    event.name = name;
+    event.category = category;
+    event.start_us = clock.nsecsElapsed() / 1000;
+    event.duration_us = -1;
+    event.depth = stack.size();
+    event.config_reads = 0;
+    event.config_us = 0;
+    _events.append(event);
+
+    OpenSpan span;
+    span.index = _events.size() - 1;
+    span.config_reads = config_reads;
+    span.config_ns = config_ns;
+    stack.append(span);
+}
+
+void Timeline::end()
+{
+    QMutexLocker locker(&mutex);
+    if (stack.isEmpty())
+        return;
+    OpenSpan span = stack.takeLast();
+    TimelineEvent& event = _events[span.index];
+    event.duration_us = clock.nsecsElapsed() / 1000 - event.start_us;
+    event.config_reads = config_reads - span.config_reads;
+    event.config_us = (config_ns - span.config_ns) / 1000;
+}
+
+void Timeline::add_config_read(qint64 nsecs)
+{
+    if (!recording)
+        return;
+    config_reads++;
+    config_ns += nsecs;
+}
+
+QList<TimelineEvent> Timeline::events() const
+{
+    QMutexLocker locker(&mutex);
+    return _events;
+}
+
+QByteArray Timeline::to_chrome_trace() const
+{
+    QJsonArray trace_events;
+    qint64 pid = QCoreApplication::applicationPid();
+    foreach (const TimelineEvent& event, events()) {
+        if (event.duration_us < 0)
+            continue;
+        QJsonObject args;
+        args["config_reads"] = event.config_reads;
+        args["config_us"] = event.config_us;
+        QJsonObject obj;
+        obj["name"] = event.name;
+        obj["cat"] = event.category;
+        obj["ph"] = "X";
+        obj["ts"] = event.start_us;
+        obj["dur"] = event.duration_us;
+        obj["pid"] = pid;
+        obj["tid"] = 0;
+        obj["args"] = args;
+        trace_events.append(obj);
+    }
+    QJsonObject root;
+    root["traceEvents"] = trace_events;
+    root["displayTimeUnit"] = "ms";
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
+
+bool Timeline::dump(const QString &filename) const
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    file.write(to_chrome_trace());
+    return true;
+}
+
+QString Timeline::summary() const
+{
+    QStringList lines;
+    foreach (const TimelineEvent& event, events()) {
+        if (event.duration_us < 0)
+            continue;
+        lines << QString("%1%2: %3 ms (%4 config reads, %5 ms)")
+                 .arg(QString(event.depth * 2, ' '))
+                 .arg(event.name)
+                 .arg(event.duration_us / 1000.0, 0, 'f', 1)
+                 .arg(event.config_reads)
+                 .arg(event.config_us / 1000.0, 0, 'f', 1);
+    }
+    return lines.join('\n');
+}
+
+
+/********** TimelineSpan **********/
+TimelineSpan::TimelineSpan(const QString &name, const QString &category)
+{
+    // 只记录GUI线程上的阶段，嵌套关系依赖于单一的调用栈
+    Timeline* timeline = Timeline::startup();
+    QCoreApplication* app = QCoreApplication::instance();
+    active = timeline->is_recording() && (!app || QThread::currentThread() == app->thread());
+    if (active)
+        timeline->begin(name, category);
+}
+
+TimelineSpan::~TimelineSpan()
+{
+    if (active)
+        Timeline::startup()->end();
+}
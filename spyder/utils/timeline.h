@@ -0,0 +1,69 @@
+#pragma once
+
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QElapsedTimer>
+#include <atomic>
+
+struct TimelineEvent
+{
+    QString name;
+    QString category;
+    qint64 start_us;
+    qint64 duration_us;
+    int depth;
+    // 该阶段内读取配置的次数和耗时
+    qint64 config_reads;
+    qint64 config_us;
+};
+
+
+// 启动过程的时间线：记录各阶段和各插件的耗时，可以导出为Chrome trace格式
+// (chrome://tracing 或 https://ui.perfetto.dev 打开)，用于比较不同版本的启动速度
+class Timeline
+{
+public:
+    static Timeline* startup();
+
+    bool is_recording() const { return recording; }
+    void finish();
+
+    void begin(const QString& name, const QString& category = "startup");
+    void end();
+    void add_config_read(qint64 nsecs);
+
+    QList<TimelineEvent> events() const;
+    QByteArray to_chrome_trace() const;
+    bool dump(const QString& filename) const;
+    QString summary() const;
+
+private:
+    struct OpenSpan
+    {
+        int index;
+        qint64 config_reads;
+        qint64 config_ns;
+    };
+
+    QElapsedTimer clock;
+    mutable QMutex mutex;
+    QList<TimelineEvent> _events;
+    QList<OpenSpan> stack;
+    std::atomic<bool> recording;
+    std::atomic<qint64> config_reads;
+    std::atomic<qint64> config_ns;
+
+    Timeline();
+};
+
+
+// 作用域内的一个阶段，析构时结束
+class TimelineSpan
+{
+public:
+    TimelineSpan(const QString& name, const QString& category = "startup");
+    ~TimelineSpan();
+private:
+    bool active;
+};
@@ -0,0 +1,243 @@
+#include "tracing.h"
+
+#include <QFile>
+#include <QThread>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QCoreApplication>
+#include <algorithm>
+#include <cmath>
+
+static const int MAX_RETIRED = 8;
+
+TraceBuffer::TraceBuffer(quint64 tid, const QString &thread_name)
+    : tid(tid), thread_name(thread_name), events(CAPACITY), head(0)
+{
+}
+
+void TraceBuffer::push(const TraceEvent &event)
+{
+    quint64 index = head.load(std::memory_order_relaxed);
+    events[int(index % CAPACITY)] = event;
+    head.store(index + 1, std::memory_order_release);
+}
+
+QVector<TraceEvent> TraceBuffer::snapshot() const
+{
+    quint64 end = head.load(std::memory_order_acquire);
+    quint64 begin = end > quint64(CAPACITY) ? end - CAPACITY : 0;
+    QVector<TraceEvent> result;
+    result.reserve(int(end - begin));
+    for (quint64 i = begin; i < end; i++)
+        result.append(events[int(i % CAPACITY)]);
+    // 复制期间写入线程可能已经覆盖了最前面的几个槽位(包括正在写入的那个)
+    quint64 now = head.load(std::memory_order_acquire);
+    quint64 valid = now + 1 > quint64(CAPACITY) ? now + 1 - CAPACITY : 0;
+    if (valid > begin)
+        result.remove(0, qMin(int(valid - begin), result.size()));
+    return result;
+}
+
+void TraceBuffer::clear()
+{
+    head.store(0, std::memory_order_release);
+}
+
+
+/********** LatencyHistogram **********/
+LatencyHistogram::LatencyHistogram()
+{
+    this->clear();
+}
+
+int LatencyHistogram::bucket_of(double ms)
+{
+    int i = 0;
+    double limit = 1.0;
+    while (i < BUCKETS - 1 && ms >= limit) {
+        i++;
+        limit *= 2;
+    }
+    return i;
+}
+
+QString LatencyHistogram::bucket_label(int i)
+{
+    if (i == 0)
+        return "<1 ms";
+    if (i == BUCKETS - 1)
+        return QString(">=%1 ms").arg(1 << (i - 1));
+    return QString("%1-%2 ms").arg(1 << (i - 1)).arg(1 << i);
+}
+
+void LatencyHistogram::add(double ms)
+{
+    if (samples.size() < WINDOW)
+        samples.append(ms);
+    else {
+        buckets[bucket_of(samples[next])]--;
+        samples[next] = ms;
+    }
+    next = (next + 1) % WINDOW;
+    buckets[bucket_of(ms)]++;
+}
+
+void LatencyHistogram::clear()
+{
+    samples.clear();
+    next = 0;
+    std::fill(buckets, buckets + BUCKETS, 0);
+}
+
+double LatencyHistogram::percentile(double p) const
+{
+    if (samples.isEmpty())
+        return -1;
+    QVector<double> sorted = samples;
+    int k = qBound(0, int(std::ceil(p / 100.0 * sorted.size())) - 1, sorted.size() - 1);
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    return sorted[k];
+}
+
+
+/********** Tracer **********/
+std::atomic<bool> Tracer::_enabled(false);
+
+Tracer* Tracer::instance()
+{
+    static Tracer* tracer = new Tracer;
+    return tracer;
+}
+
+Tracer::Tracer()
+    : next_tid(1), pending_key_ns(-1)
+{
+    clock.start();
+    if (!qEnvironmentVariableIsEmpty("SPYDER_TRACE"))
+        _enabled = true;
+}
+
+void Tracer::set_enabled(bool enabled)
+{
+    Tracer* tracer = instance();
+    if (!enabled)
+        tracer->pending_key_ns = -1;
+    _enabled = enabled;
+}
+
+// 线程结束时把缓冲区交还给Tracer
+struct ThreadTraceBuffer
+{
+    TraceBuffer* buffer = nullptr;
+    ~ThreadTraceBuffer()
+    {
+        if (buffer)
+            Tracer::instance()->retire(buffer);
+    }
+};
+
+TraceBuffer* Tracer::thread_buffer()
+{
+    static thread_local ThreadTraceBuffer local;
+    if (local.buffer == nullptr) {
+        QThread* thread = QThread::currentThread();
+        QString name = thread->objectName();
+        if (name.isEmpty()) {
+            QCoreApplication* app = QCoreApplication::instance();
+            name = (app && thread == app->thread()) ? "GUI" : thread->metaObject()->className();
+        }
+        local.buffer = new TraceBuffer(next_tid++, name);
+        QMutexLocker locker(&mutex);
+        buffers.append(local.buffer);
+    }
+    return local.buffer;
+}
+
+void Tracer::retire(TraceBuffer *buffer)
+{
+    QMutexLocker locker(&mutex);
+    buffers.removeOne(buffer);
+    retired.append(buffer);
+    while (retired.size() > MAX_RETIRED)
+        delete retired.takeFirst();
+}
+
+void Tracer::record(const char *name, const char *category, qint64 start_ns, qint64 duration_ns)
+{
+    TraceEvent event;
+    event.name = name;
+    event.category = category;
+    event.start_ns = start_ns;
+    event.duration_ns = duration_ns;
+    this->thread_buffer()->push(event);
+}
+
+void Tracer::clear()
+{
+    QMutexLocker locker(&mutex);
+    foreach (TraceBuffer* buffer, buffers)
+        buffer->clear();
+    qDeleteAll(retired);
+    retired.clear();
+    histogram.clear();
+}
+
+QByteArray Tracer::to_chrome_trace() const
+{
+    QJsonArray trace_events;
+    qint64 pid = QCoreApplication::applicationPid();
+    QMutexLocker locker(&mutex);
+    foreach (TraceBuffer* buffer, buffers + retired) {
+        QJsonObject thread_name;
+        thread_name["name"] = "thread_name";
+        thread_name["ph"] = "M";
+        thread_name["pid"] = pid;
+        thread_name["tid"] = qint64(buffer->tid);
+        QJsonObject args;
+        args["name"] = buffer->thread_name;
+        thread_name["args"] = args;
+        trace_events.append(thread_name);
+
+        foreach (const TraceEvent& event, buffer->snapshot()) {
+            QJsonObject obj;
+            obj["name"] = event.name;
+            obj["cat"] = event.category;
+            obj["ph"] = "X";
+            obj["ts"] = event.start_ns / 1000.0;
+            obj["dur"] = event.duration_ns / 1000.0;
+            obj["pid"] = pid;
+            obj["tid"] = qint64(buffer->tid);
+            trace_events.append(obj);
+        }
+    }
+    QJsonObject root;
+    root["traceEvents"] = trace_events;
+    root["displayTimeUnit"] = "ms";
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
+
+bool Tracer::dump(const QString &filename) const
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    file.write(to_chrome_trace());
+    return true;
+}
+
+void Tracer::key_pressed()
+{
+    if (enabled() && pending_key_ns < 0)
+        pending_key_ns = now_ns();
+}
+
+void Tracer::painted()
+{
+    if (pending_key_ns < 0)
+        return;
+    qint64 now = now_ns();
+    histogram.add((now - pending_key_ns) / 1e6);
+    this->record("keypress-to-paint", "latency", pending_key_ns, now - pending_key_ns);
+    pending_key_ns = -1;
+}
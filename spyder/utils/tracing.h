@@ -0,0 +1,120 @@
+#pragma once
+
+#include <QList>
+#include <QMutex>
+#include <QVector>
+#include <QString>
+#include <QElapsedTimer>
+#include <atomic>
+
+// 一个已结束的区间。name和category必须是字符串字面量，记录时不分配内存
+struct TraceEvent
+{
+    const char* name;
+    const char* category;
+    qint64 start_ns;
+    qint64 duration_ns;
+};
+
+
+// 每个线程一个环形缓冲区，只有所属线程写入；导出时其他线程无锁地读取，
+// 丢弃读取期间可能被覆盖的旧事件
+class TraceBuffer
+{
+public:
+    enum { CAPACITY = 4096 };
+
+    TraceBuffer(quint64 tid, const QString& thread_name);
+    void push(const TraceEvent& event);
+    QVector<TraceEvent> snapshot() const;
+    void clear();
+
+    quint64 tid;
+    QString thread_name;
+private:
+    QVector<TraceEvent> events;
+    std::atomic<quint64> head;
+};
+
+
+// 最近若干次按键到绘制完成的延迟(毫秒)，按2的幂分桶。只在GUI线程中使用
+class LatencyHistogram
+{
+public:
+    enum { WINDOW = 512, BUCKETS = 10 };
+
+    LatencyHistogram();
+    void add(double ms);
+    void clear();
+    int count() const { return samples.size(); }
+    double percentile(double p) const;
+    // 第i个桶是[2^(i-1), 2^i)毫秒，第0个桶小于1毫秒，最后一个桶不设上限
+    int bucket_count(int i) const { return buckets[i]; }
+    static QString bucket_label(int i);
+private:
+    QVector<double> samples;
+    int next;
+    int buckets[BUCKETS];
+    static int bucket_of(double ms);
+};
+
+
+// 运行时的性能跟踪：各热点路径用TraceSpan记录区间，可以导出为Chrome trace格式
+// (chrome://tracing 或 https://ui.perfetto.dev 打开)。
+// 关闭时TraceSpan只读一次原子变量。环境变量SPYDER_TRACE不为空时启动即开启
+class Tracer
+{
+public:
+    static Tracer* instance();
+    static bool enabled() { return _enabled.load(std::memory_order_relaxed); }
+    static void set_enabled(bool enabled);
+
+    qint64 now_ns() const { return clock.nsecsElapsed(); }
+    void record(const char* name, const char* category, qint64 start_ns, qint64 duration_ns);
+    void clear();
+
+    QByteArray to_chrome_trace() const;
+    bool dump(const QString& filename) const;
+
+    // 按键到下一次编辑器绘制完成的延迟；连续按键时从最早的未绘制按键算起
+    void key_pressed();
+    void painted();
+    const LatencyHistogram& latency() const { return histogram; }
+
+private:
+    static std::atomic<bool> _enabled;
+    QElapsedTimer clock;
+    mutable QMutex mutex;
+    QList<TraceBuffer*> buffers;
+    // 已结束线程的缓冲区，保留最近几个以便导出
+    QList<TraceBuffer*> retired;
+    std::atomic<quint64> next_tid;
+    qint64 pending_key_ns;
+    LatencyHistogram histogram;
+
+    friend struct ThreadTraceBuffer;
+    Tracer();
+    TraceBuffer* thread_buffer();
+    void retire(TraceBuffer* buffer);
+};
+
+
+// 作用域内的一个区间，析构时记录
+class TraceSpan
+{
+public:
+    TraceSpan(const char* name, const char* category = "editor")
+        : name(name), category(category),
+          start_ns(Tracer::enabled() ? Tracer::instance()->now_ns() : -1) {}
+    ~TraceSpan()
+    {
+        if (start_ns >= 0) {
+            Tracer* tracer = Tracer::instance();
+            tracer->record(name, category, start_ns, tracer->now_ns() - start_ns);
+        }
+    }
+private:
+    const char* name;
+    const char* category;
+    qint64 start_ns;
+};
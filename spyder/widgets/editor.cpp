@@ -1,5 +1,8 @@
 //#include "fileswitcher.h"
 #include "editor.h"
+#include "utils/tracing.h"
+#include "utils/localhistory.h"
+#include "utils/editjournal.h"
 #include "plugins/plugins_editor.h"
 
 static bool DEBUG_EDITOR = DEBUG >= 3;//
@@ -116,6 +119,7 @@ AnalysisThread::AnalysisThread(QObject* parent, FUNC_CHECKER checker,
 
 void AnalysisThread::run()
 {
+    TraceSpan span("code analysis", "analysis");
     this->results = this->checker(this->source_code);
 }
 
@@ -657,6 +661,9 @@ EditorStack::EditorStack(QWidget* parent, const QList<QAction*>& actions)
     linenumbers_enabled = true;
     blanks_enabled = false;
     edgeline_enabled = true;
+    code_folding_enabled = true;
+    diff_gutter_enabled = true;
+    diff_gutter_base = "disk";
     edgeline_column = 79;
     codecompletion_auto_enabled = true;
     codecompletion_case_enabled = false;
@@ -921,6 +928,23 @@ void EditorStack::setup_editorstack(QWidget *parent, QVBoxLayout *layout)
 #endif
     connect(this->tabs,SIGNAL(currentChanged(int)),this,SLOT(current_changed(int)));
 
+    guard_banner = new QFrame(this);
+    guard_banner->setAutoFillBackground(true);
+    guard_banner->setBackgroundRole(QPalette::ToolTipBase);
+    guard_label = new QLabel(guard_banner);
+    guard_label->setForegroundRole(QPalette::ToolTipText);
+    guard_label->setWordWrap(true);
+    QPushButton* full_button = new QPushButton("Enable all features", guard_banner);
+    full_button->setToolTip("Highlight whole lines, wrap lines and mark occurrences.\n"
+                            "This may be very slow for this file.");
+    connect(full_button, SIGNAL(clicked()), this, SLOT(enable_full_features()));
+    QHBoxLayout* banner_layout = new QHBoxLayout(guard_banner);
+    banner_layout->setContentsMargins(6, 3, 6, 3);
+    banner_layout->addWidget(guard_label, 1);
+    banner_layout->addWidget(full_button);
+    guard_banner->hide();
+
+    layout->addWidget(guard_banner);
     layout->addWidget(tabs);
 }
 
@@ -1150,6 +1174,67 @@ void EditorStack::set_edgeline_enabled(bool state)
     }
 }
 
+void EditorStack::set_code_folding_enabled(bool state)
+{
+    code_folding_enabled = state;
+    if (!this->data.isEmpty()) {
+        foreach (FileInfo* finfo, this->data)
+            finfo->editor->set_folding_enabled(state);
+    }
+}
+
+void EditorStack::set_diff_gutter_enabled(bool state)
+{
+    diff_gutter_enabled = state;
+    if (!this->data.isEmpty()) {
+        foreach (FileInfo* finfo, this->data) {
+            finfo->editor->set_diff_gutter_enabled(state);
+            this->refresh_diff_base(finfo);
+        }
+    }
+}
+
+// "disk"：和磁盘上保存的版本比较；"git"：和git HEAD中的版本比较
+void EditorStack::set_diff_gutter_base(const QString &base)
+{
+    diff_gutter_base = base;
+    if (!this->data.isEmpty()) {
+        foreach (FileInfo* finfo, this->data)
+            this->refresh_diff_base(finfo);
+    }
+}
+
+// 打开、保存、重新加载和改名后重新读入差异标记的基准
+void EditorStack::refresh_diff_base(FileInfo *finfo)
+{
+    DiffGutter* gutter = finfo->editor->diff_gutter;
+    if (this->diff_gutter_enabled && !finfo->newly_created)
+        gutter->set_file(finfo->filename, this->diff_gutter_base == "git");
+    else if (gutter->has_base())
+        gutter->clear();
+}
+
+void EditorStack::update_guard_banner()
+{
+    CodeEditor* editor = this->get_current_editor();
+    if (!editor || !editor->is_long_line_guarded()) {
+        guard_banner->hide();
+        return;
+    }
+    guard_label->setText(QString("This file has lines of up to %1 characters. Only the first %2 "
+                                 "characters of each line are highlighted, and line wrapping "
+                                 "and occurrence highlighting are off.")
+                         .arg(editor->long_line_length).arg(int(CodeEditor::LONG_LINE_HIGHLIGHT)));
+    guard_banner->show();
+}
+
+void EditorStack::enable_full_features()
+{
+    CodeEditor* editor = this->get_current_editor();
+    if (editor)
+        editor->enable_full_features();
+}
+
 void EditorStack::set_edgeline_column(int column)
 {
     edgeline_column = column;
@@ -1507,6 +1592,7 @@ int EditorStack::rename_in_data(const QString &original_filename, const QString
     bool set_new_index = index == get_stack_index();
     QString current_fname = get_current_filename();
     finfo->filename = new_filename;
+    this->refresh_diff_base(finfo);
     int new_index = data.indexOf(finfo);
     this->__repopulate_stack();
     if (set_new_index)
@@ -1840,6 +1926,7 @@ bool EditorStack::save_if_changed(bool cancelable, int index)
 
 bool EditorStack::save(int index, bool force)
 {
+    TraceSpan span("save", "io");
     if (index == -1) {
         if (!get_stack_count())
             return false;//源码是return
@@ -1857,10 +1944,11 @@ bool EditorStack::save(int index, bool force)
     if (always_remove_trailing_spaces)
         this->remove_trailing_spaces(index);
     QString txt = finfo->editor->get_text_with_eol();
-    //源码是encoding.write(txt, finfo.filename,finfo.encoding)
-    //encoding是类似"utf-8"的QString,本代码没有用到编码
-    bool ok = encoding::write(txt, finfo->filename);
+    bool ok = encoding::write(txt, finfo->filename, QIODevice::WriteOnly, finfo->encoding);
     if (ok) {
+        // 写成功后才在后台记录快照
+        LocalHistory::instance()->record(finfo->filename, txt);
+        EditJournal::instance()->saved(finfo->editor->document(), finfo->filename, txt);
         finfo->newly_created = false;
         emit encoding_changed(finfo->encoding);
         finfo->lastmodified = QFileInfo(finfo->filename).lastModified();
@@ -1868,6 +1956,7 @@ bool EditorStack::save(int index, bool force)
         size_t id = reinterpret_cast<size_t>(this);
         emit file_saved(QString::number(id), finfo->filename, finfo->filename);
         finfo->editor->document()->setModified(false);
+        this->refresh_diff_base(finfo);
         this->modification_changed(-1, index);
         this->analyze_script(index);
         //introspector.validate()
@@ -1976,7 +2065,7 @@ bool EditorStack::save_copy_as(int index)
                 index--;
         }
         QString txt = finfo->editor->get_text_with_eol();
-        bool ok = encoding::write(txt, filename);
+        bool ok = encoding::write(txt, filename, QIODevice::WriteOnly, finfo->encoding);
         if (ok) {
             emit plugin_load(filename);
             return true;
@@ -2088,6 +2177,7 @@ void EditorStack::current_changed(int index)
     else
         emit reset_statusbar();
     emit opened_files_list_changed();
+    this->update_guard_banner();
 
     stack_history.refresh();
 
@@ -2308,13 +2398,17 @@ void EditorStack::refresh_eol_chars(const QString &eol_chars)
 
 void EditorStack::reload(int index)
 {
+    TraceSpan span("reload", "io");
     Q_ASSERT(0 <= index && index < this->data.size());
     FileInfo* finfo = data[index];
-    QString txt = encoding::read(finfo->filename);
+    encoding::DecodedText decoded = encoding::read_file(finfo->filename);
+    finfo->encoding = decoded.encoding;
     finfo->lastmodified = QFileInfo(finfo->filename).lastModified();
     int position = finfo->editor->get_position("cursor");
-    finfo->editor->set_text(txt);
+    finfo->editor->set_text(decoded.text);
+    finfo->editor->eol_chars = decoded.eol_chars;
     finfo->editor->document()->setModified(false);
+    this->refresh_diff_base(finfo);
     finfo->editor->set_cursor_position(position);
     //introspector.validate()
 
@@ -2374,6 +2468,8 @@ FileInfo* EditorStack::create_new_editor(const QString &fname, const QString &en
     kwargs["linenumbers"] = this->linenumbers_enabled;
     kwargs["show_blanks"] = this->blanks_enabled;
     kwargs["edge_line"] = this->edgeline_enabled;
+    kwargs["code_folding"] = this->code_folding_enabled;
+    kwargs["diff_gutter"] = this->diff_gutter_enabled;
     kwargs["edge_line_column"] = this->edgeline_column;
     kwargs["language"] = language;
     kwargs["markers"] = this->has_markers();
@@ -2412,11 +2508,15 @@ FileInfo* EditorStack::create_new_editor(const QString &fname, const QString &en
     kwargs["filename"] = fname;
 
     editor->setup_editor(kwargs);
+    connect(editor,SIGNAL(sig_long_line_guard_changed(bool)),this,SLOT(update_guard_banner()));
 
     if (cloned_from == nullptr) {
         editor->set_text(txt);
         editor->document()->setModified(false);
+        EditJournal::instance()->track(editor->document(), fname, txt);
+        this->refresh_diff_base(finfo);
     }
+    CompletionEngine::instance()->add_document(editor->document());
     connect(finfo,SIGNAL(text_changed_at(QString, int)),this,SIGNAL(text_changed_at(QString, int)));
     connect(editor,SIGNAL(sig_cursor_position_changed(int,int)),
             this,SLOT(editor_cursor_position_changed(int,int)));
@@ -2464,16 +2564,23 @@ FileInfo* EditorStack::_new(const QString &filename, const QString &encoding,
 
 FileInfo* EditorStack::load(QString filename, bool set_current)
 {
+    TraceSpan span("load", "io");
     QFileInfo info(filename);
     filename = info.absoluteFilePath();
     emit starting_long_process(QString("Loading %1...").arg(filename));
-    QString text = encoding::read(filename);
-    FileInfo* finfo = this->create_new_editor(filename,"utf-8",text,set_current);
+    // 编码、换行符在读文件时一次得到，不再扫描文本
+    encoding::DecodedText decoded = encoding::read_file(filename);
+    FileInfo* finfo = this->create_new_editor(filename,decoded.encoding,decoded.text,set_current);
+    finfo->editor->eol_chars = decoded.eol_chars;
+    // 把读入的内容交给后台作为第一个快照，不等到保存时再读磁盘
+    LocalHistory::instance()->track(filename, decoded.text);
+    if (set_current)
+        this->refresh_eol_chars(finfo->editor->get_line_separator());
     int index = data.indexOf(finfo);
     this->_refresh_outlineexplorer(index, true);
     emit ending_long_process("");
     /*if (isVisible() && checkeolchars_enabled
-            && sourcecode::has_mixed_eol_chars(text)) {
+            && decoded.mixed_eol) {
         QString name = info.fileName();
         msgbox = new QMessageBox(QMessageBox::Warning,
                                  this->title,
@@ -204,6 +204,9 @@ public:
     //FileSwitcher* fileswitcher_dlg;
     BaseTabs* tabs;
     TabSwitcherWidget* tabs_switcher;
+    // 当前文件处于长行保护模式时显示
+    QFrame* guard_banner;
+    QLabel* guard_label;
 
     FindReplace* find_widget;
     QList<FileInfo*> data;
@@ -228,6 +231,9 @@ public:
     bool linenumbers_enabled;
     bool blanks_enabled;
     bool edgeline_enabled;
+    bool code_folding_enabled;
+    bool diff_gutter_enabled;
+    QString diff_gutter_base;
     int edgeline_column;
     bool codecompletion_auto_enabled;
     bool codecompletion_case_enabled;
@@ -310,6 +316,12 @@ public slots:
     void set_linenumbers_enabled(bool state,FileInfo* current_finfo=nullptr);
     void set_blanks_enabled(bool state);
     void set_edgeline_enabled(bool state);
+    void set_code_folding_enabled(bool state);
+    void set_diff_gutter_enabled(bool state);
+    void set_diff_gutter_base(const QString& base);
+    void refresh_diff_base(FileInfo* finfo);
+    void update_guard_banner();
+    void enable_full_features();
     void set_edgeline_column(int column);
 
     void set_codecompletion_auto_enabled(bool state);
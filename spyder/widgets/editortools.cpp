@@ -1,4 +1,5 @@
 #include "editortools.h"
+#include "utils/tracing.h"
 #include "sourcecode/codeeditor.h"
 
 //******************* FileRootItem
@@ -431,6 +432,7 @@ void OutlineExplorerTreeWidget::file_renamed(CodeEditor *editor, const QString &
 
 void OutlineExplorerTreeWidget::update_all()
 {
+    TraceSpan span("outline update_all", "outline");
     save_expanded_state();
     for (auto it=editor_ids.begin();it!=editor_ids.end();it++) {
         CodeEditor* editor = it.key();
@@ -486,6 +488,7 @@ QHash<int,ItemLevelDebug> OutlineExplorerTreeWidget::populate_branch(CodeEditor
                                                                      QTreeWidgetItem *root_item,
                                                                      QHash<int, ItemLevelDebug> tree_cache)
 {
+    TraceSpan span("outline populate_branch", "outline");
     foreach (int _l, tree_cache.keys()) {
         if (_l >= editor->get_line_count()) {
             if (tree_cache.contains(_l))
@@ -498,7 +501,7 @@ QHash<int,ItemLevelDebug> OutlineExplorerTreeWidget::populate_branch(CodeEditor
     int previous_level = -1;
 
     QHash<int,sh::OutlineExplorerData> oe_data = editor->highlighter->get_outlineexplorer_data();
-    editor->has_cell_separators = editor->highlighter->found_cell_separators;
+    editor->has_cell_separators = !editor->highlighter->cell_separator_blocks().isEmpty();
     for (int block_nb = 0; block_nb < editor->get_line_count(); ++block_nb) {
         int line_nb = block_nb+1;
         // TODO源码是data = oe_data.get(block_nb);if data is None:
@@ -2,6 +2,8 @@
 #include "widgets/projects/projects_explorer.h"
 #include "plugins/plugins_explorer.h"
 
+#include <atomic>
+
 
 void open_file_in_external_explorer(QString filename)
 {
@@ -63,53 +65,209 @@ QHash<QString,QString> IconProvider::OFFICE_FILES =
  {".docx", "WordFileIcon"},
  {".pptx", "PowerpointFileIcon"}};
 
+// 扩展名(或没有扩展名的文件名)到图标名的缓存，空字符串表示无法按扩展名判断
+static QMutex icon_mutex;
+static QHash<QString,QString> extension_icons;
+static QHash<QString,QString> sniffed_icons;
+static std::atomic<bool> any_sniffed(false);
+
+// 图标名到QIcon，只在GUI线程中创建一次，之后只读
+static QHash<QString,QIcon> make_icon_table()
+{
+    QStringList names = {"DirOpenIcon", "FileIcon", "TextFileIcon", "AudioFileIcon",
+                         "VideoFileIcon", "ImageFileIcon"};
+    names += IconProvider::APP_FILES.values();
+    names += IconProvider::OFFICE_FILES.values();
+    QHash<QString,QIcon> table;
+    foreach (const QString& name, names)
+        table[name] = ima::icon(name);
+    return table;
+}
+
+static const QHash<QString,QIcon>& icon_table()
+{
+    static QHash<QString,QIcon> table = make_icon_table();
+    return table;
+}
+
 IconProvider::IconProvider(QTreeView* treeview)
     : QFileIconProvider ()
 {
     this->treeview = treeview;
     application_icons = APP_FILES;
+    icon_table();
+}
+
+QIcon IconProvider::icon_by_name(const QString &name)
+{
+    return icon_table().value(name, icon_table().value("FileIcon"));
+}
+
+QString IconProvider::icon_name_for_mime(const QString &mime_type, const QString &extension)
+{
+    QString name = OFFICE_FILES.value(extension, "FileIcon");
+    QString file_type = mime_type.section('/', 0, 0);
+    QString bin_name = mime_type.section('/', 1);
+    if (file_type == "text")
+        name = "TextFileIcon";
+    else if (file_type == "audio")
+        name = "AudioFileIcon";
+    else if (file_type == "video")
+        name = "VideoFileIcon";
+    else if (file_type == "image")
+        name = "ImageFileIcon";
+    else if (file_type == "application" && APP_FILES.contains(bin_name))
+        name = APP_FILES[bin_name];
+    return name;
+}
+
+// 只按文件名匹配，不读取文件
+QString IconProvider::icon_name_for_file(const QString &filename, bool *known)
+{
+    int dot = filename.lastIndexOf('.');
+    QString key = dot > 0 ? filename.mid(dot).toLower() : filename;
+    {
+        QMutexLocker locker(&icon_mutex);
+        auto it = extension_icons.constFind(key);
+        if (it != extension_icons.constEnd()) {
+            *known = !it.value().isEmpty();
+            return *known ? it.value() : "FileIcon";
+        }
+    }
+    QMimeDatabase db;
+    QMimeType mime = db.mimeTypeForFile(filename, QMimeDatabase::MatchExtension);
+    QString extension = dot > 0 ? filename.mid(dot) : QString();
+    QString name;
+    if (!mime.isDefault() || OFFICE_FILES.contains(extension))
+        name = icon_name_for_mime(mime.isDefault() ? QString() : mime.name(), extension);
+    QMutexLocker locker(&icon_mutex);
+    extension_icons[key] = name;
+    *known = !name.isEmpty();
+    return *known ? name : "FileIcon";
+}
+
+QIcon IconProvider::sniffed_icon(const QString &path)
+{
+    QMutexLocker locker(&icon_mutex);
+    auto it = sniffed_icons.constFind(path);
+    if (it == sniffed_icons.constEnd())
+        return QIcon();
+    return icon_by_name(it.value());
+}
+
+bool IconProvider::has_sniffed_icons()
+{
+    return any_sniffed;
+}
+
+void IconProvider::add_sniffed_icon(const QString &path, const QString &name)
+{
+    QMutexLocker locker(&icon_mutex);
+    sniffed_icons[path] = name;
+    any_sniffed = true;
 }
 
 QIcon IconProvider::icon(const QFileInfo &qfileinfo) const
 {
     if (qfileinfo.isDir())
-        return ima::icon("DirOpenIcon");
-    else {
-        // osp.basename()   <==>   info.fileName()
-        QString basename = qfileinfo.fileName();
-        QString extension = "." + qfileinfo.suffix();
-        QMimeDatabase db;
-        QMimeType mime = db.mimeTypeForFile(qfileinfo);
-        QString mime_type = mime.name();
-        QIcon icon = ima::icon("FileIcon");
-
-        if (OFFICE_FILES.contains(extension))
-            icon = ima::icon(OFFICE_FILES[extension]);
-
-        if (!mime_type.isEmpty()) {
-            QString file_type, bin_name;
-            try {
-                QStringList list = mime_type.split('/');
-                file_type = list[0];
-                bin_name = list[1];
-            } catch (...) {
-                file_type = "text";
-            }
-            if (file_type == "text")
-                icon = ima::icon("TextFileIcon");
-            else if (file_type == "audio")
-                icon = ima::icon("AudioFileIcon");
-            else if (file_type == "video")
-                icon = ima::icon("VideoFileIcon");
-            else if (file_type == "image")
-                icon = ima::icon("ImageFileIcon");
-            else if (file_type == "application") {
-                if (application_icons.contains(bin_name))
-                    icon = ima::icon(application_icons[bin_name]);
-            }
-        }
+        return icon_by_name("DirOpenIcon");
+    bool known = false;
+    QString name = icon_name_for_file(qfileinfo.fileName(), &known);
+    if (known)
+        return icon_by_name(name);
+    QString path = qfileinfo.absoluteFilePath();
+    QIcon icon = sniffed_icon(path);
+    if (!icon.isNull())
         return icon;
+    IconSniffer::instance()->request(path);
+    return icon_by_name(name);
+}
+
+
+/********** IconSniffer **********/
+IconSniffer* IconSniffer::instance()
+{
+    static IconSniffer* sniffer = nullptr;
+    static QMutex instance_mutex;
+    QMutexLocker locker(&instance_mutex);
+    if (sniffer == nullptr) {
+        sniffer = new IconSniffer;
+        // 不指定接收对象，在GUI线程中直接调用
+        QCoreApplication* app = QCoreApplication::instance();
+        if (app)
+            QObject::connect(app, &QCoreApplication::aboutToQuit, [](){ instance()->shutdown(); });
+    }
+    return sniffer;
+}
+
+IconSniffer::IconSniffer()
+    : QObject (nullptr)
+{
+    thread = new QThread;
+    thread->setObjectName("IconSniffer");
+    this->moveToThread(thread);
+    thread->start(QThread::LowPriority);
+}
+
+void IconSniffer::request(const QString &path)
+{
+    {
+        QMutexLocker locker(&mutex);
+        if (requested.contains(path))
+            return;
+        requested.insert(path);
+    }
+    QMetaObject::invokeMethod(this, "sniff", Qt::QueuedConnection, Q_ARG(QString, path));
+}
+
+void IconSniffer::shutdown()
+{
+    if (!thread->isRunning())
+        return;
+    thread->quit();
+    thread->wait();
+}
+
+// 在后台线程中执行
+void IconSniffer::sniff(const QString &path)
+{
+    QMimeDatabase db;
+    QMimeType mime = db.mimeTypeForFile(path, QMimeDatabase::MatchContent);
+    if (mime.isDefault())
+        return;
+    QFileInfo info(path);
+    QString extension = info.suffix().isEmpty() ? QString() : "." + info.suffix();
+    QString name = IconProvider::icon_name_for_mime(mime.name(), extension);
+    if (name == "FileIcon")
+        return;
+    IconProvider::add_sniffed_icon(path, name);
+    emit sig_icon_ready(path);
+}
+
+
+/********** FileSystemModel **********/
+FileSystemModel::FileSystemModel(QObject* parent)
+    : QFileSystemModel (parent)
+{
+    connect(IconSniffer::instance(), SIGNAL(sig_icon_ready(QString)),
+            this, SLOT(icon_ready(QString)));
+}
+
+QVariant FileSystemModel::data(const QModelIndex &index, int role) const
+{
+    if (role == Qt::DecorationRole && index.column() == 0 && IconProvider::has_sniffed_icons()) {
+        QIcon icon = IconProvider::sniffed_icon(this->filePath(index));
+        if (!icon.isNull())
+            return icon;
     }
+    return QFileSystemModel::data(index, role);
+}
+
+void FileSystemModel::icon_ready(const QString &path)
+{
+    QModelIndex index = this->index(path);
+    if (index.isValid())
+        emit dataChanged(index, index, QVector<int>({Qt::DecorationRole}));
 }
 
 
@@ -127,12 +285,15 @@ DirView::DirView(QWidget* parent)
     this->fsmodel = nullptr;
     this->setup_fs_model();
     this->_scrollbar_positions = QPoint();
+
+    connect(FileOperations::instance(), SIGNAL(sig_finished(FileOperation,bool,QString)),
+            this, SLOT(file_operation_finished(FileOperation,bool,QString)));
 }
 
 void DirView::setup_fs_model()
 {
     QDir::Filters filters = QDir::AllDirs | QDir::Files | QDir::Drives | QDir::NoDotAndDotDot;
-    fsmodel = new QFileSystemModel(this);
+    fsmodel = new FileSystemModel(this);
     fsmodel->setFilter(filters);
     fsmodel->setNameFilterDisables(false);
 }
@@ -611,7 +772,8 @@ void DirView::open(QStringList fnames)
         fnames = this->get_selected_filenames();
     foreach (QString fname, fnames) {
         QFileInfo info(fname);
-        if (info.isFile() && encoding::is_text_file(fname)) {
+        // .npy由主窗口用数组编辑器打开
+        if (info.isFile() && (encoding::is_text_file(fname) || info.suffix() == "npy")) {
             ExplorerWidget* widget1 = dynamic_cast<ExplorerWidget*>(parent_widget);
             ProjectExplorerWidget* widget2 = dynamic_cast<ProjectExplorerWidget*>(parent_widget);
             if (widget1)
@@ -660,13 +822,72 @@ void DirView::run(QStringList fnames)
     }
 }
 
+// 在后台删除，只读文件先改为可写
 void DirView::remove_tree(const QString &dirname)
 {
-    QDir dir(dirname);
-    dir.removeRecursively();
-    //当文件夹下包含只读文件，该函数返回false;
-    //源码在这种情况下，更改该文件的权限，再进行删除
-    //这里没有进行这种处理
+    this->queue_file_operation(FileOperation::REMOVE, dirname);
+}
+
+void DirView::queue_file_operation(int kind, const QString &source, const QString &dest,
+                                   bool overwrite)
+{
+    FileOperation operation;
+    operation.kind = kind;
+    operation.source = source;
+    operation.dest = dest;
+    operation.is_dir = QFileInfo(source).isDir();
+    operation.overwrite = overwrite;
+    operation.owner = this;
+    FileOperations::instance()->enqueue(operation);
+}
+
+void DirView::notify_removed(const QString &fname, bool is_dir)
+{
+    Explorer* parent = dynamic_cast<Explorer*>(parent_widget);
+    if (parent == nullptr)
+        return;
+    if (is_dir)
+        emit parent->removed_tree(fname);
+    else
+        emit parent->removed(fname);
+}
+
+void DirView::notify_renamed(const QString &source, const QString &dest, bool is_dir)
+{
+    Explorer* parent = dynamic_cast<Explorer*>(parent_widget);
+    if (parent == nullptr)
+        return;
+    if (is_dir)
+        emit parent->renamed_tree(source, dest);
+    else
+        emit parent->renamed(source, dest);
+}
+
+void DirView::file_operation_finished(const FileOperation &operation, bool ok,
+                                      const QString &error)
+{
+    if (operation.owner != this)
+        return;
+    if (!ok) {
+        // 用户点击取消不是错误，已复制的部分由后台线程清理
+        if (error == "Cancelled")
+            return;
+        QString action_str = "copy";
+        if (operation.kind == FileOperation::MOVE)
+            action_str = "move";
+        else if (operation.kind == FileOperation::REMOVE)
+            action_str = "delete";
+        QString title = dynamic_cast<Explorer*>(parent_widget) ? "File explorer"
+                                                               : "Project explorer";
+        QMessageBox::critical(this, title,
+                              QString("<b>Unable to %1 <i>%2</i></b><br><br>Error message:<br>%3")
+                              .arg(action_str).arg(operation.source).arg(error));
+        return;
+    }
+    if (operation.kind == FileOperation::REMOVE)
+        this->notify_removed(operation.source, operation.is_dir);
+    else if (operation.kind == FileOperation::MOVE)
+        this->notify_renamed(operation.source, operation.dest, operation.is_dir);
 }
 
 int DirView::delete_file(const QString &fname, bool multiple, int yes_to_all)
@@ -693,16 +914,10 @@ int DirView::delete_file(const QString &fname, bool multiple, int yes_to_all)
     try {
         if (info.isFile()) {
             misc::remove_file(fname);
-            Explorer* parent = dynamic_cast<Explorer*>(parent_widget);
-            if (parent)
-                emit parent->removed(fname);
+            this->notify_removed(fname, false);
         }
-        else {
+        else
             this->remove_tree(fname);
-            Explorer* parent = dynamic_cast<Explorer*>(parent_widget);
-            if (parent)
-                emit parent->removed_tree(fname);
-        }
         return yes_to_all;
     } catch (std::exception error) {
         QString action_str = "delete";
@@ -771,16 +986,7 @@ QString DirView::rename_file(const QString &fname)
         }
         try {
             misc::rename_file(fname, path);
-            if (info.isFile()) {
-                Explorer* parent = dynamic_cast<Explorer*>(parent_widget);
-                if (parent)
-                    emit parent->renamed(fname, path);
-            }
-            else {
-                Explorer* parent = dynamic_cast<Explorer*>(parent_widget);
-                if (parent)
-                    emit parent->renamed_tree(fname, path);
-            }
+            this->notify_renamed(fname, path, !info.isFile());
             return path;
         } catch (std::exception error) {
             QMessageBox::critical(this, "Rename",
@@ -837,16 +1043,11 @@ void DirView::move(QStringList fnames, const QString &directory)
             return;
     }
     foreach (QString fname, fnames) {
-        QFileInfo fileinfo(fname);
-        QString basename = fileinfo.fileName();
-        try {
-            misc::move_file(fname, folder+'/'+basename);
-        } catch (std::exception error) {
-            QMessageBox::critical(this, "Error",
-                                  QString("<b>Unable to move <i>%1</i></b>"
-                                          "<br><br>Error message:<br>%2")
-                                  .arg(basename).arg(error.what()));
-        }
+        // 与拖放一样，不能把文件夹移动到它自己或它的子文件夹里
+        if (folder == fname || folder.startsWith(fname + '/'))
+            continue;
+        QString basename = QFileInfo(fname).fileName();
+        this->queue_file_operation(FileOperation::MOVE, fname, folder+'/'+basename);
     }
 }
 
@@ -1077,21 +1278,105 @@ ProxyModel::ProxyModel(QObject* parent)
 {
     this->root_path = QString();
     this->path_list = QStringList();
+    this->hide_ignored = true;
     this->setDynamicSortFilter(true);
 }
 
+void ProxyModel::setSourceModel(QAbstractItemModel *source_model)
+{
+    if (this->sourceModel())
+        disconnect(this->sourceModel(), nullptr, this, SLOT(clear_cache()));
+    QSortFilterProxyModel::setSourceModel(source_model);
+    this->clear_cache();
+    if (!source_model)
+        return;
+    connect(source_model, SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)), SLOT(clear_cache()));
+    connect(source_model, SIGNAL(modelReset()), SLOT(clear_cache()));
+    connect(source_model, SIGNAL(layoutChanged()), SLOT(clear_cache()));
+    if (qobject_cast<QFileSystemModel*>(source_model))
+        connect(source_model, SIGNAL(fileRenamed(QString,QString,QString)), SLOT(clear_cache()));
+    connect(source_model, SIGNAL(rowsInserted(QModelIndex,int,int)),
+            SLOT(rows_inserted(QModelIndex,int,int)));
+    connect(source_model, SIGNAL(dataChanged(QModelIndex,QModelIndex)),
+            SLOT(source_data_changed(QModelIndex,QModelIndex)));
+}
+
 void ProxyModel::setup_filter(const QString &root_path, const QStringList &path_list)
 {
     QFileInfo info(root_path);
     this->root_path = info.canonicalFilePath();
     this->path_list.clear();
+    trie.clear();
+    trie.insert(this->root_path, false);
+    trie.insert(QDir::cleanPath(info.absoluteFilePath()), false);
     foreach (QString p,path_list) {
         QFileInfo fileinfo(p);
         this->path_list.append(fileinfo.canonicalFilePath());
+        trie.insert(fileinfo.canonicalFilePath(), true);
+        trie.insert(QDir::cleanPath(fileinfo.absoluteFilePath()), true);
     }
+    // 重新打开项目时重新读入规则
+    ignore_tree.set_root(this->path_list.value(0));
+    this->clear_cache();
     this->invalidateFilter();
 }
 
+void ProxyModel::set_hide_ignored(bool hide_ignored)
+{
+    if (this->hide_ignored == hide_ignored)
+        return;
+    this->hide_ignored = hide_ignored;
+    this->invalidateFilter();
+}
+
+void ProxyModel::clear_cache()
+{
+    parent_cache.clear();
+    ignore_tree.clear();
+}
+
+// 新建或修改了.gitignore/.ignore时重新读入规则
+void ProxyModel::rows_inserted(const QModelIndex &parent_index, int first, int last)
+{
+    for (int row = first; row <= last; row++) {
+        QString name = this->sourceModel()->index(row, 0, parent_index).data().toString();
+        if (fileenum::IgnoreTree::FILENAMES.contains(name)) {
+            ignore_tree.clear();
+            this->invalidateFilter();
+            return;
+        }
+    }
+}
+
+void ProxyModel::source_data_changed(const QModelIndex &top_left, const QModelIndex &bottom_right)
+{
+    this->rows_inserted(top_left.parent(), top_left.row(), bottom_right.row());
+}
+
+ProxyModel::ParentState ProxyModel::parent_state(const QModelIndex &parent_index) const
+{
+    ParentState state;
+    state.inside = false;
+    if (!parent_index.isValid()) {
+        state.node = trie.root();
+        return state;
+    }
+    void* key = parent_index.internalPointer();
+    auto it = parent_cache.constFind(key);
+    if (it != parent_cache.constEnd())
+        return it.value();
+
+    state = this->parent_state(parent_index.parent());
+    if (!state.inside && state.node) {
+        QFileSystemModel* model = qobject_cast<QFileSystemModel*>(this->sourceModel());
+        QString name = model ? model->fileName(parent_index) : parent_index.data().toString();
+        state.node = PathTrie::child(state.node, name);
+        state.inside = state.node && state.node->terminal;
+    }
+    parent_cache.insert(key, state);
+    return state;
+}
+
 void ProxyModel::sort(int column, Qt::SortOrder order)
 {
     this->sourceModel()->sort(column, order);
@@ -1101,20 +1386,20 @@ bool ProxyModel::filterAcceptsRow(int row, const QModelIndex &parent_index) cons
 {
     if (root_path.isEmpty())
         return true;
+    // 根目录的上级目录、项目路径及其上级目录、项目路径下的所有文件
+    ParentState state = this->parent_state(parent_index);
     QModelIndex index = this->sourceModel()->index(row, 0, parent_index);
     QFileSystemModel* model = qobject_cast<QFileSystemModel*>(this->sourceModel());
-    QFileInfo info(model->filePath(index));
-    QString path = info.canonicalFilePath();
-    if (root_path.startsWith(path))
+    if (state.inside) {
+        // 被忽略的目录不显示，也就不会展开读入
+        if (hide_ignored && model)
+            return !ignore_tree.is_ignored(model->filePath(index), model->isDir(index));
         return true;
-    else {
-        foreach (QString p,path_list) {
-            //sep = "\\";altsep = "/";
-            if (path == p || path.startsWith(p+os::altsep))
-                return true;
-        }
-        return false;
     }
+    if (!state.node)
+        return false;
+    QString name = model ? model->fileName(index) : index.data().toString();
+    return PathTrie::child(state.node, name) != nullptr;
 }
 
 QVariant ProxyModel::data(const QModelIndex &index, int role) const
@@ -1130,6 +1415,43 @@ QVariant ProxyModel::data(const QModelIndex &index, int role) const
 }
 
 
+/********** PathTrie **********/
+void PathTrie::clear()
+{
+    qDeleteAll(_root.children);
+    _root.children.clear();
+    _root.terminal = false;
+}
+
+// QFileSystemModel中的路径都用'/'分隔，Unix的根目录是名为"/"的节点
+QStringList PathTrie::components(const QString &path)
+{
+    QStringList parts = QDir::fromNativeSeparators(path).split('/', QString::SkipEmptyParts);
+    if (path.startsWith('/'))
+        parts.prepend("/");
+    return parts;
+}
+
+void PathTrie::insert(const QString &path, bool terminal)
+{
+    if (path.isEmpty())
+        return;
+    Node* node = &_root;
+    foreach (const QString& name, components(path)) {
+        Node*& next = node->children[name];
+        if (next == nullptr)
+            next = new Node;
+        node = next;
+    }
+    node->terminal = node->terminal || terminal;
+}
+
+const PathTrie::Node* PathTrie::child(const Node *node, const QString &name)
+{
+    return node->children.value(name, nullptr);
+}
+
+
 /********** FilteredDirView **********/
 FilteredDirView::FilteredDirView(QWidget* parent)
     : DirView (parent)
@@ -1186,11 +1508,18 @@ QString FilteredDirView::get_filename(const QModelIndex &index) const
     return QString();
 }
 
+void FilteredDirView::set_show_all(bool state)
+{
+    DirView::set_show_all(state);
+    proxymodel->set_hide_ignored(!state);
+}
+
 void FilteredDirView::setup_project_view()
 {
     for (int i=1;i<=3;i++)
         this->hideColumn(i);
     this->setHeaderHidden(true);
+    proxymodel->set_hide_ignored(!this->show_all);
     this->filter_directories();
 }
 
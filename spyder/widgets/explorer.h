@@ -1,6 +1,8 @@
 #pragma once
 
 #include "utils/encoding.h"
+#include "utils/fileenum.h"
+#include "utils/fileops.h"
 #include "utils/icon_manager.h"
 #include "utils/misc.h"
 #include "utils/programs.h"
@@ -13,6 +15,9 @@ void show_in_external_file_explorer(const QStringList& fnames = QStringList());
 
 class ExplorerWidget;
 
+// 文件图标按扩展名查找，结果缓存后所有视图共用；同一类型的文件共用一个QIcon。
+// icon()在QFileSystemModel的后台线程中调用，不访问文件内容。
+// 扩展名无法判断类型时先返回普通文件图标，再由IconSniffer在后台按内容判断
 class IconProvider : public QFileIconProvider
 {
 public:
@@ -24,6 +29,48 @@ public:
 
     IconProvider(QTreeView* treeview);
     QIcon icon(const QFileInfo &qfileinfo) const override;
+
+    static QString icon_name_for_mime(const QString& mime_type, const QString& extension);
+    static QIcon icon_by_name(const QString& name);
+    // 按内容判断出的图标，没有时返回空图标
+    static QIcon sniffed_icon(const QString& path);
+    static bool has_sniffed_icons();
+    static void add_sniffed_icon(const QString& path, const QString& name);
+private:
+    static QString icon_name_for_file(const QString& filename, bool* known);
+};
+
+
+// 在独立线程中按文件内容判断类型，每个文件只判断一次
+class IconSniffer : public QObject
+{
+    Q_OBJECT
+signals:
+    void sig_icon_ready(const QString& path);
+public:
+    static IconSniffer* instance();
+    // 可以在任意线程中调用
+    void request(const QString& path);
+    void shutdown();
+public slots:
+    void sniff(const QString& path);
+private:
+    QThread* thread;
+    QMutex mutex;
+    QSet<QString> requested;
+    IconSniffer();
+};
+
+
+// 后台判断出图标后通知视图更新该行
+class FileSystemModel : public QFileSystemModel
+{
+    Q_OBJECT
+public:
+    FileSystemModel(QObject* parent = nullptr);
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+public slots:
+    void icon_ready(const QString& path);
 };
 
 
@@ -46,7 +93,7 @@ public:
     virtual void install_model();
     void setup_view();
     void set_name_filters(const QStringList& name_filters);
-    void set_show_all(bool state);
+    virtual void set_show_all(bool state);
     virtual QString get_filename(const QModelIndex &index) const;
     virtual QModelIndex get_index(const QString& filename) const;
     QStringList get_selected_filenames() const;
@@ -76,6 +123,11 @@ public:
     void open_interpreter(QStringList fnames);
     void run(QStringList fnames = QStringList());
     virtual void remove_tree(const QString& dirname);
+    // 把复制、移动、删除交给后台线程，完成后在file_operation_finished中通知
+    void queue_file_operation(int kind, const QString& source, const QString& dest=QString(),
+                              bool overwrite=false);
+    virtual void notify_removed(const QString& fname, bool is_dir);
+    virtual void notify_renamed(const QString& source, const QString& dest, bool is_dir);
     // 源码yes_to_all为bool，返回值为bool
     int delete_file(const QString& fname,bool multiple,int yes_to_all);
     void _delete(QStringList fnames = QStringList());
@@ -111,6 +163,30 @@ public slots:
     void convert_notebooks();
     virtual void go_to_parent_directory() {}
     void restore_directory_state(const QString& fname);
+    void file_operation_finished(const FileOperation& operation, bool ok, const QString& error);
+};
+
+
+// 按路径的各级目录名建立的前缀树。terminal表示该节点是某个项目路径，
+// 其下的所有文件都显示；非terminal的节点是项目路径的上级目录
+class PathTrie
+{
+public:
+    struct Node
+    {
+        QHash<QString,Node*> children;
+        bool terminal = false;
+        ~Node() { qDeleteAll(children); }
+    };
+
+    ~PathTrie() { this->clear(); }
+    void clear();
+    void insert(const QString& path, bool terminal);
+    const Node* root() const { return &_root; }
+    static const Node* child(const Node* node, const QString& name);
+    static QStringList components(const QString& path);
+private:
+    Node _root;
 };
 
 
@@ -122,11 +198,37 @@ public:
     QStringList path_list;
 
     ProxyModel(QObject* parent);
+    void setSourceModel(QAbstractItemModel* source_model) override;
     void setup_filter(const QString& root_path,const QStringList& path_list);
+    void set_hide_ignored(bool hide_ignored);
     void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
     bool filterAcceptsRow(int row, const QModelIndex &parent_index) const override;
     QVariant data(const QModelIndex &index, int role) const override;
 
+public slots:
+    void clear_cache();
+    void rows_inserted(const QModelIndex& parent_index, int first, int last);
+    void source_data_changed(const QModelIndex& top_left, const QModelIndex& bottom_right);
+
+private:
+    // 父节点在前缀树中的位置：inside表示已在某个项目路径之下，
+    // node为空且inside为false表示父节点不显示
+    struct ParentState
+    {
+        const PathTrie::Node* node;
+        bool inside;
+    };
+
+    // 根目录和项目路径规范化后的写法和原来的写法都加入前缀树，
+    // 判断时只用模型中缓存的文件名，不访问文件系统
+    PathTrie trie;
+    // 按QFileSystemModel的内部节点指针缓存，文件删除、改名或模型重置时清空
+    mutable QHash<void*,ParentState> parent_cache;
+    // 项目中.gitignore/.ignore忽略的文件和目录不显示，"显示所有文件"时显示
+    bool hide_ignored;
+    mutable fileenum::IgnoreTree ignore_tree;
+
+    ParentState parent_state(const QModelIndex& parent_index) const;
 };
 
 
@@ -144,6 +246,7 @@ public:
     QModelIndex get_index(const QString& filename) const override;
     void set_folder_names(const QStringList& folder_names);
     QString get_filename(const QModelIndex &index) const override;
+    void set_show_all(bool state) override;
     void setup_project_view();
 };
 
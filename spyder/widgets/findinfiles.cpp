@@ -1,4 +1,5 @@
 #include "findinfiles.h"
+#include "utils/tracing.h"
 #include "plugins/plugins_findinfiles.h"
 
 const QString ON = "on";
@@ -33,14 +34,17 @@ SearchThread::SearchThread(QObject *parent)
     this->case_sensitive = true;
     this->total_matches = 0;
     this->is_file = false;
+    this->exclude_re = false;
 }
 
 void SearchThread::initialize(const StruNotSave &stru)
 {
     this->rootpath = stru.path;
     this->is_file = stru.is_file;
-    if (!stru.exclude.isEmpty())
+    if (!stru.exclude.isEmpty()) {
         this->exclude = stru.exclude;
+        this->exclude_re = stru.exclude_re;
+    }
     this->texts = stru.texts;
     this->text_re = stru.text_re;
     this->case_sensitive = stru.case_sensitive;
@@ -51,6 +55,7 @@ void SearchThread::initialize(const StruNotSave &stru)
 
 void SearchThread::run()
 {
+    TraceSpan span("find in files", "search");
     try {
         if (this->is_file)
             this->find_string_in_file(this->rootpath);
@@ -72,17 +77,25 @@ void SearchThread::stop()
 bool SearchThread::find_files_in_path(const QString &path)
 {
     this->pathlist.append(path);
-    QStringList list;
-    bool ok = os::walk(path, &list, this->exclude);
-    //我实现的walk()函数不像python中是生成器的形式，因此无法中途停止搜索
-    if (ok) {
-        foreach (QString filename, list)
-            this->find_string_in_file(filename);
-    }
-    else {
+    fileenum::ExcludeMatcher matcher = exclude_re ? fileenum::ExcludeMatcher::from_regexp(exclude)
+                                                  : fileenum::ExcludeMatcher::from_globs(exclude);
+    if (!matcher.is_valid()) {
         this->error_flag = "invalid regular expression";
         return false;
     }
+    // 边遍历边搜索，停止时不再读其余的目录
+    fileenum::FileEnumerator enumerator(path);
+    enumerator.set_exclude(matcher);
+    enumerator.walk([this](const QString& filename) {
+        if (true) {
+            QMutexLocker locker(&mutex);
+            if (stopped)
+                return false;
+        }
+        if (encoding::is_text_file(filename))
+            this->find_string_in_file(filename);
+        return true;
+    });
     return true;
 }
 
@@ -552,17 +565,11 @@ StruNotSave FindOptions::get_options_not_save()
     bool file_search = this->path_selection_combo->is_file_search();
     QString path = this->path_selection_combo->get_current_searchpath();
 
-    if (!exclude_re) {
-        QStringList items;
-        foreach (QString item, exclude.split(",")) {
-            if (item.trimmed() != "")
-                items.append(fnmatch::translate(item.trimmed()));
-        }
-        exclude = items.join('|');
-    }
-
+    // glob在SearchThread中合并为一个匹配器，这里只检查是否有效
     if (!exclude.isEmpty()) {
-        QString error_msg = misc::regexp_error_msg(exclude);
+        fileenum::ExcludeMatcher matcher = exclude_re ? fileenum::ExcludeMatcher::from_regexp(exclude)
+                                                      : fileenum::ExcludeMatcher::from_globs(exclude);
+        QString error_msg = matcher.error_string();
         if (!error_msg.isEmpty()) {
             QLineEdit* exclude_edit = exclude_pattern->lineEdit();
             exclude_edit->setStyleSheet(REGEX_INVALID);
@@ -582,7 +589,7 @@ StruNotSave FindOptions::get_options_not_save()
             return StruNotSave();
         }
     }
-    return StruNotSave(path, file_search, exclude, texts, text_re, case_sensitive);
+    return StruNotSave(path, file_search, exclude, texts, text_re, case_sensitive, exclude_re);
 }
 
 QString FindOptions::path() const
@@ -1,7 +1,7 @@
 #pragma once
 
-#include "fnmatch.h"
 #include "os.h"
+#include "utils/fileenum.h"
 #include "config/config_main.h"
 #include "utils/icon_manager.h"
 #include "utils/encoding.h"
@@ -20,13 +20,16 @@ struct StruNotSave
     QList<QPair<QString,QString>> texts;
     bool text_re;
     bool case_sensitive;
+    // exclude是正则表达式，否则是逗号分隔的glob
+    bool exclude_re;
     StruNotSave() = default;
     StruNotSave(QString _path,
                 bool _is_file,
                 QString _exclude,
                 QList<QPair<QString,QString>> _texts,
                 bool _text_re,
-                bool _case_sensitive)
+                bool _case_sensitive,
+                bool _exclude_re = false)
     {
         path = _path;
         is_file = _is_file;
@@ -34,6 +37,7 @@ struct StruNotSave
         texts = _texts;
         text_re = _text_re;
         case_sensitive = _case_sensitive;
+        exclude_re = _exclude_re;
     }
 };
 
@@ -57,6 +61,7 @@ public:
     QString error_flag;//既有bool还有字符串
     QString rootpath;
     QString exclude;
+    bool exclude_re;
     QList<QPair<QString,QString>> texts;
     bool text_re;
     bool completed;
@@ -0,0 +1,188 @@
+#include "localhistory.h"
+#include "utils/diff.h"
+#include "utils/icon_manager.h"
+
+static QStringList split_lines(const QString& text)
+{
+    QStringList lines = text.split('\n');
+    for (int i = 0; i < lines.size(); i++) {
+        if (lines[i].endsWith('\r'))
+            lines[i].chop(1);
+    }
+    return lines;
+}
+
+DiffHighlighter::DiffHighlighter(QTextDocument* parent)
+    : QSyntaxHighlighter (parent)
+{
+    added.setForeground(QColor("#00a000"));
+    removed.setForeground(QColor("#d00000"));
+    header.setForeground(QColor("#0060c0"));
+    header.setFontWeight(QFont::Bold);
+}
+
+void DiffHighlighter::highlightBlock(const QString &text)
+{
+    if (text.startsWith("@@") || text.startsWith("+++") || text.startsWith("---"))
+        setFormat(0, text.size(), header);
+    else if (text.startsWith('+'))
+        setFormat(0, text.size(), added);
+    else if (text.startsWith('-'))
+        setFormat(0, text.size(), removed);
+}
+
+
+/********** LocalHistoryDialog **********/
+LocalHistoryDialog::LocalHistoryDialog(const QString& filename, QPlainTextEdit* editor,
+                                       QWidget* parent)
+    : QDialog (parent)
+{
+    setAttribute(Qt::WA_DeleteOnClose);
+    this->filename = filename;
+    this->editor = editor;
+
+    list = new QListWidget(this);
+    list->setSelectionMode(QAbstractItemView::ExtendedSelection);
+    list->setToolTip("Select one snapshot to compare it with the editor, "
+                     "or two snapshots to compare them");
+    connect(list, SIGNAL(itemSelectionChanged()), SLOT(selection_changed()));
+
+    diff_view = new QPlainTextEdit(this);
+    diff_view->setReadOnly(true);
+    diff_view->setLineWrapMode(QPlainTextEdit::NoWrap);
+    if (editor)
+        diff_view->setFont(editor->font());
+    new DiffHighlighter(diff_view->document());
+
+    QSplitter* splitter = new QSplitter(this);
+    splitter->addWidget(list);
+    splitter->addWidget(diff_view);
+    splitter->setStretchFactor(1, 3);
+
+    restore_button = new QPushButton("Restore");
+    restore_button->setToolTip("Replace the editor contents with the selected snapshot");
+    restore_button->setEnabled(false);
+    connect(restore_button, SIGNAL(clicked(bool)), SLOT(restore()));
+    btn_close = new QPushButton("Close");
+    btn_close->setDefault(true);
+    connect(btn_close, SIGNAL(clicked(bool)), SLOT(reject()));
+
+    QHBoxLayout* btn_layout = new QHBoxLayout;
+    btn_layout->addStretch();
+    btn_layout->addWidget(restore_button);
+    btn_layout->addWidget(btn_close);
+
+    QVBoxLayout* layout = new QVBoxLayout;
+    layout->addWidget(splitter);
+    layout->addLayout(btn_layout);
+    setLayout(layout);
+
+    connect(LocalHistory::instance(), SIGNAL(sig_recorded(QString)), SLOT(refresh(QString)));
+
+    setWindowFlags(Qt::Window);
+    setWindowIcon(ima::icon("revert"));
+    setWindowTitle(QString("Local history - %1").arg(QFileInfo(filename).fileName()));
+    resize(900, 600);
+    this->refresh();
+}
+
+void LocalHistoryDialog::refresh(const QString &filename)
+{
+    if (!filename.isEmpty() && filename != this->filename)
+        return;
+    snapshots = LocalHistory::instance()->snapshots(this->filename);
+    list->clear();
+    // 最新的在上面
+    for (int i = snapshots.size() - 1; i >= 0; i--) {
+        QListWidgetItem* item = new QListWidgetItem(
+                    QString("%1  (%2 KB)").arg(snapshots[i].date_time().toString("yyyy-MM-dd hh:mm:ss"))
+                    .arg(snapshots[i].size / 1024.0, 0, 'f', 1), list);
+        item->setData(Qt::UserRole, i);
+    }
+    if (list->count())
+        list->setCurrentRow(0);
+    else
+        diff_view->setPlainText("No snapshot of this file");
+}
+
+QStringList LocalHistoryDialog::snapshot_lines(int index, bool *ok)
+{
+    const Snapshot& snapshot = snapshots[index];
+    *ok = true;
+    if (lines_cache.contains(snapshot.hash))
+        return lines_cache[snapshot.hash];
+    QString text = LocalHistory::instance()->content(snapshot, ok);
+    if (!*ok)
+        return QStringList();
+    QStringList lines = split_lines(text);
+    lines_cache[snapshot.hash] = lines;
+    return lines;
+}
+
+QString LocalHistoryDialog::snapshot_name(int index) const
+{
+    return QString("%1 (%2)").arg(QFileInfo(filename).fileName())
+            .arg(snapshots[index].date_time().toString("yyyy-MM-dd hh:mm:ss"));
+}
+
+void LocalHistoryDialog::selection_changed()
+{
+    QList<int> selected;
+    foreach (QListWidgetItem* item, list->selectedItems())
+        selected.append(item->data(Qt::UserRole).toInt());
+    std::sort(selected.begin(), selected.end());
+    restore_button->setEnabled(selected.size() == 1 && editor);
+    if (selected.isEmpty() || selected.size() > 2) {
+        diff_view->clear();
+        return;
+    }
+
+    bool ok;
+    QStringList old_lines = this->snapshot_lines(selected.first(), &ok);
+    if (!ok) {
+        diff_view->setPlainText("This snapshot is no longer available");
+        return;
+    }
+    QStringList new_lines;
+    QString new_name;
+    if (selected.size() == 2) {
+        new_lines = this->snapshot_lines(selected.last(), &ok);
+        if (!ok) {
+            diff_view->setPlainText("This snapshot is no longer available");
+            return;
+        }
+        new_name = this->snapshot_name(selected.last());
+    }
+    else if (editor) {
+        new_lines = split_lines(editor->toPlainText());
+        new_name = QString("%1 (editor)").arg(QFileInfo(filename).fileName());
+    }
+    else
+        return;
+
+    QString text = diff::unified_diff(old_lines, new_lines,
+                                      this->snapshot_name(selected.first()), new_name);
+    diff_view->setPlainText(text.isEmpty() ? QString("No differences") : text);
+}
+
+// 作为一次可以撤销的修改替换编辑器中的全部内容
+void LocalHistoryDialog::restore()
+{
+    QList<QListWidgetItem*> items = list->selectedItems();
+    if (items.size() != 1 || !editor)
+        return;
+    bool ok;
+    QString text = LocalHistory::instance()->content(snapshots[items.first()->data(Qt::UserRole).toInt()], &ok);
+    if (!ok) {
+        QMessageBox::critical(this, "Local history", "This snapshot is no longer available");
+        return;
+    }
+    text.replace("\r\n", "\n");
+    text.replace('\r', '\n');
+    QTextCursor cursor(editor->document());
+    cursor.beginEditBlock();
+    cursor.select(QTextCursor::Document);
+    cursor.insertText(text);
+    cursor.endEditBlock();
+    this->selection_changed();
+}
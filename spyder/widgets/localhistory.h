@@ -0,0 +1,48 @@
+#pragma once
+
+#include "utils/localhistory.h"
+
+#include <QtWidgets>
+
+// 统一格式差分的着色：新增行、删除行和每组修改的标题
+class DiffHighlighter : public QSyntaxHighlighter
+{
+    Q_OBJECT
+public:
+    DiffHighlighter(QTextDocument* parent);
+protected:
+    void highlightBlock(const QString& text) override;
+private:
+    QTextCharFormat added;
+    QTextCharFormat removed;
+    QTextCharFormat header;
+};
+
+
+// 浏览一个文件的本地历史。选中一个快照时和编辑器中当前的内容比较，
+// 选中两个快照时比较这两个快照；读出的快照按行缓存，切换选择时只重新比较
+class LocalHistoryDialog : public QDialog
+{
+    Q_OBJECT
+public:
+    QListWidget* list;
+    QPlainTextEdit* diff_view;
+    QPushButton* restore_button;
+    QPushButton* btn_close;
+
+    LocalHistoryDialog(const QString& filename, QPlainTextEdit* editor, QWidget* parent = nullptr);
+
+public slots:
+    void refresh(const QString& filename = QString());
+    void selection_changed();
+    void restore();
+
+private:
+    QString filename;
+    QPointer<QPlainTextEdit> editor;
+    QList<Snapshot> snapshots;
+    QHash<QByteArray, QStringList> lines_cache;
+
+    QStringList snapshot_lines(int index, bool* ok);
+    QString snapshot_name(int index) const;
+};
@@ -279,6 +279,9 @@ QString BaseEditMixin<T>::get_text_with_eol() const
     //QString txt = lines.join(linesep);
     //if (utext.endsWith("\n"))
     //    utext += linesep;
+    // 打开文件时记录了原来的换行符，保存时还原
+    if (!this->eol_chars.isEmpty() && this->eol_chars != "\n")
+        utext.replace('\n', this->eol_chars);
     return utext;
 }
 
@@ -1,4 +1,5 @@
 #include "projects_explorer.h"
+#include "plugins/projects.h"
 
 ProjectsExplorerTreeWidget::ProjectsExplorerTreeWidget(QWidget* parent, bool show_hscrollbar)
     : FilteredDirView (parent)
@@ -50,6 +51,7 @@ void ProjectsExplorerTreeWidget::dragMoveEvent(QDragMoveEvent *event)
         event->ignore();
 }
 
+// 冲突在这里询问用户，复制和移动在后台线程中进行
 void ProjectsExplorerTreeWidget::dropEvent(QDropEvent *event)
 {
     event->ignore();
@@ -61,7 +63,7 @@ void ProjectsExplorerTreeWidget::dropEvent(QDropEvent *event)
     int yes_to_all=-1, no_to_all=-1;
     QStringList src_list;
     foreach (QUrl url, event->mimeData()->urls())
-        src_list.append(url.toString());
+        src_list.append(url.toLocalFile());
     QMessageBox::StandardButtons buttons;
     if (src_list.size() > 1)
         buttons = QMessageBox::Yes | QMessageBox::YesAll |
@@ -69,10 +71,16 @@ void ProjectsExplorerTreeWidget::dropEvent(QDropEvent *event)
     else
         buttons = QMessageBox::Yes | QMessageBox::No;
     foreach (QString src, src_list) {
-        if (src == dst)
+        if (src.isEmpty() || src == dst)
             continue;
         QFileInfo info(src);
         QString dst_fname = dst + '/' + info.fileName();
+        if (src == dst_fname)
+            continue;
+        // 不能把文件夹放进它自己里面
+        if (info.isDir() && dst_fname.startsWith(src + '/'))
+            continue;
+        bool overwrite = false;
         if (QFileInfo::exists(dst_fname)) {
             if (yes_to_all != -1 || no_to_all != -1) {
                 if (no_to_all == 1)
@@ -101,38 +109,38 @@ void ProjectsExplorerTreeWidget::dropEvent(QDropEvent *event)
                 event->setDropAction(Qt::CopyAction);
                 return;
             }
+            overwrite = true;
         }
-        try {
-            if (action == Qt::CopyAction) {
-                if (info.isFile())
-                    QFile::copy(src, dst);
-                else
-                    QFile::copy(src, dst);//shutil.copytree(src, dst) TODO
-            }
-            else {
-                if (info.isFile())
-                    misc::move_file(src, dst);
-                else {
-                    QFile::copy(src, dst);
-                    QFile::remove(src);
-                }
-                //    TODO
-                //emit this->parent_widget->removed(src);
-            }
-        } catch (std::exception error) {
-            QString action_str;
-            if (action == Qt::CopyAction)
-                action_str = "copy";
-            else
-                action_str = "move";
-            QMessageBox::critical(this, "Project Explorer",
-                                  QString("<b>Unable to %1 <i>%2</i></b>"
-                                          "<br><br>Error message:<br>%3")
-                                  .arg(action_str).arg(src).arg(error.what()));
-        }
+        if (action == Qt::CopyAction)
+            this->queue_file_operation(FileOperation::COPY, src, dst_fname, overwrite);
+        else
+            this->queue_file_operation(FileOperation::MOVE, src, dst_fname, overwrite);
     }
 }
 
+void ProjectsExplorerTreeWidget::notify_removed(const QString &fname, bool is_dir)
+{
+    Projects* projects = dynamic_cast<Projects*>(parent_widget);
+    if (projects == nullptr)
+        return;
+    if (is_dir)
+        emit projects->removed_tree(fname);
+    else
+        emit projects->removed(fname);
+}
+
+void ProjectsExplorerTreeWidget::notify_renamed(const QString &source, const QString &dest,
+                                                bool is_dir)
+{
+    Projects* projects = dynamic_cast<Projects*>(parent_widget);
+    if (projects == nullptr)
+        return;
+    if (is_dir)
+        emit projects->renamed_tree(source, dest);
+    else
+        emit projects->renamed(source, dest);
+}
+
 void ProjectsExplorerTreeWidget::_delete(QStringList fnames)
 {
     if (fnames.isEmpty())
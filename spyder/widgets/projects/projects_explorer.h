@@ -15,6 +15,8 @@ public:
 
     ProjectsExplorerTreeWidget(QWidget* parent, bool show_hscrollbar=true);
     QList<QObject*> setup_common_actions();
+    void notify_removed(const QString& fname, bool is_dir) override;
+    void notify_renamed(const QString& source, const QString& dest, bool is_dir) override;
 protected:
     void dragMoveEvent(QDragMoveEvent *event);
     void dropEvent(QDropEvent *event);
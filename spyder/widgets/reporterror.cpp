@@ -278,6 +278,8 @@ void SpyderErrorDialog::_submit_to_github()
 void SpyderErrorDialog::append_traceback(const QString &text)
 {
     this->error_traceback += text;
+    // 输出经缓冲区合并，隐藏时也随时写入，显示时不必重新插入全部文本
+    this->details->write(text, true);
 }
 
 void SpyderErrorDialog::_show_details()
@@ -288,8 +290,7 @@ void SpyderErrorDialog::_show_details()
     }
     else {
         this->resize(570, 700);
-        this->details->document()->setPlainText("");
-        this->details->append_text_to_shell(this->error_traceback, true, false);
+        this->details->flush();
         this->details->show();
         this->details_btn->setText("Hide details");
     }
@@ -1,4 +1,7 @@
 #include "codeeditor.h"
+#include "utils/tracing.h"
+
+#include <algorithm>
 
 GoToLineDialog::GoToLineDialog(CodeEditor* editor)
     : QDialog (editor, Qt::WindowTitleHint
@@ -110,6 +113,32 @@ void LineNumberArea::wheelEvent(QWheelEvent *event)
     code_editor->wheelEvent(event);
 }
 
+FoldingArea::FoldingArea(CodeEditor* editor)
+    : QWidget (editor)
+{
+    code_editor = editor;
+}
+
+QSize FoldingArea::sizeHint() const
+{
+    return QSize(code_editor->compute_foldingarea_width(), 0);
+}
+
+void FoldingArea::paintEvent(QPaintEvent *event)
+{
+    code_editor->foldingarea_paint_event(event);
+}
+
+void FoldingArea::mousePressEvent(QMouseEvent *event)
+{
+    code_editor->foldingarea_mousepress_event(event);
+}
+
+void FoldingArea::wheelEvent(QWheelEvent *event)
+{
+    code_editor->wheelEvent(event);
+}
+
 int ScrollFlagArea::WIDTH = 12;
 int ScrollFlagArea::FLAGS_DX = 4;
 int ScrollFlagArea::FLAGS_DY = 2;
@@ -296,8 +325,27 @@ CodeEditor::CodeEditor(QWidget* parent)
     connect(this,SIGNAL(updateRequest(QRect,int)),
             this,SLOT(update_linenumberarea(QRect,int)));
     linenumberarea_pressed = -1;
+
+    folding_enabled = false;
+    foldingarea = new FoldingArea(this);
+    foldingarea->setVisible(false);
+    fold_index = nullptr;
+    this->setup_fold_index();
     linenumberarea_released = -1;
 
+    diff_gutter_enabled = false;
+    diff_gutter_width = 3;
+    diff_gutter = nullptr;
+    diff_added_color = "#2CBE4E";
+    diff_modified_color = "#3B8EEA";
+    diff_deleted_color = "#EA2B0E";
+    this->setup_diff_gutter();
+
+    long_line_guard = false;
+    full_features = false;
+    long_line_length = 0;
+    wrap_requested = false;
+
     occurrence_color = QColor();
     ctrl_click_color = QColor();
     sideareas_color = QColor();
@@ -385,8 +433,10 @@ CodeEditor::CodeEditor(QWidget* parent)
     __visible_blocks = QList<IntIntTextblock>();
 
     connect(this,SIGNAL(painted(QPaintEvent*)),SLOT(_draw_editor_cell_divider()));
+    connect(this,SIGNAL(painted(QPaintEvent*)),SLOT(_draw_folded_blocks()));
     connect(verticalScrollBar(),&QAbstractSlider::valueChanged,
             [=](int){ this->rehighlight_cells(); });
+    connect(this,SIGNAL(get_completions(bool)),this,SLOT(show_local_completions(bool)));
 }
 
 void CodeEditor::cb_maker(int attr)
@@ -669,9 +719,20 @@ void CodeEditor::set_as_clone(CodeEditor *editor)
 {
     // Set as clone editor
     this->setDocument(editor->document());
+    this->watch_document();
+    this->setup_fold_index();
+    this->setup_diff_gutter();
     document_id = editor->get_document_id();
     highlighter = editor->highlighter;
     eol_chars = editor->eol_chars;
+    long_line_length = editor->long_line_length;
+    full_features = editor->full_features;
+    this->set_long_line_guard(editor->long_line_guard);
+    // 长行保护属于文档：任何一个克隆退出或进入保护时其他克隆跟着改变
+    connect(editor, SIGNAL(sig_long_line_guard_changed(bool)),
+            this, SLOT(sync_long_line_guard(bool)));
+    connect(this, SIGNAL(sig_long_line_guard_changed(bool)),
+            editor, SLOT(sync_long_line_guard(bool)));
     this->_apply_highlighter_color_scheme();
 }
 
@@ -679,12 +740,15 @@ void CodeEditor::set_as_clone(CodeEditor *editor)
 //-----Widget setup and options
 void CodeEditor::toggle_wrap_mode(bool enable)
 {
-    this->set_wrap_mode(enable ? "word" : QString());
+    this->wrap_requested = enable;
+    this->set_wrap_mode(enable && !long_line_guard ? "word" : QString());
 }
 
 void CodeEditor::setup_editor(const QHash<QString, QVariant> &kwargs)
 {
     bool linenumbers = kwargs.value("linenumbers", true).toBool();
+    bool code_folding = kwargs.value("code_folding", true).toBool();
+    bool diff_gutter = kwargs.value("diff_gutter", false).toBool();
     QString language = kwargs.value("language", QString()).toString();
     bool markers = kwargs.value("markers", false).toBool();
 
@@ -749,6 +813,8 @@ void CodeEditor::setup_editor(const QHash<QString, QVariant> &kwargs)
     if (kwargs.contains("cloned_from") && kwargs.contains("font"))
         this->setFont(kwargs.value("font").value<QFont>());
     this->setup_margins(linenumbers, markers);
+    this->set_folding_enabled(code_folding);
+    this->set_diff_gutter_enabled(diff_gutter);
 
     this->set_language(language, filename);
 
@@ -959,6 +1025,9 @@ void CodeEditor::_set_highlighter(const QString& sh_class)
         highlighter = new sh::TextSH(this->document(),
                                      this->font(),
                                      this->color_scheme);
+    // 新的高亮器在事件循环中才第一次高亮
+    if (this->highlighter)
+        this->highlighter->set_line_limit(long_line_guard ? LONG_LINE_HIGHLIGHT : 0);
     this->_apply_highlighter_color_scheme();
 }
 
@@ -1027,7 +1096,9 @@ void CodeEditor::intelligent_backtab()
     else if (this->in_comment_or_string())
         this->unindent();
     else if (leading_text.back()=='(' || leading_text.back()==',' || leading_text.endsWith(", ")) {
-        int position = this->get_position("cursor");
+        int position = this->find_enclosing_call();
+        if (position == -1)
+            position = this->get_position("cursor");
         this->show_object_info(position);
     }
     else
@@ -1051,6 +1122,18 @@ void CodeEditor::rehighlight()
         this->unhighlight_current_line();
 }
 
+// 配色或字体改变后，只有显示着的编辑器立即更新可见部分的格式，
+// 其余的块由高亮器在后台处理；未显示的编辑器等到显示时再更新
+void CodeEditor::apply_pending_restyle()
+{
+    if (!this->highlighter || !this->highlighter->restyle_pending() || !this->isVisible())
+        return;
+    QVector<ViewportBlock> blocks = this->viewport_blocks();
+    int first = blocks.isEmpty() ? 0 : blocks.first().block.blockNumber();
+    int last = blocks.isEmpty() ? -1 : blocks.last().block.blockNumber();
+    this->highlighter->apply_restyle(first, last);
+}
+
 void CodeEditor::rehighlight_cells()
 {
     if (this->highlight_current_cell_enabled)
@@ -1067,40 +1150,78 @@ void CodeEditor::setup_margins(bool linenumbers, bool markers)
 void CodeEditor::remove_trailing_spaces()
 {
     // 删除尾随空格
-    QTextCursor cursor = this->textCursor();
-    cursor.beginEditBlock();
-    cursor.movePosition(QTextCursor::Start);
-    while (true) {
-        cursor.movePosition(QTextCursor::EndOfBlock);
-        QString text = cursor.block().text();
+    QVector<LineEdit> edits;
+    int block_nb = 0;
+    for (QTextBlock block = this->document()->begin(); block.isValid(); block = block.next()) {
+        QString text = block.text();
         int length = text.size() - rstrip(text).size();
         if (length > 0) {
-            cursor.movePosition(QTextCursor::Left,QTextCursor::KeepAnchor,
-                                length);
-            cursor.removeSelectedText();
+            LineEdit edit;
+            edit.block_nb = block_nb;
+            edit.column = text.size() - length;
+            edit.removed = length;
+            edits.append(edit);
         }
-        if (cursor.atEnd())
-            break;
-        cursor.movePosition(QTextCursor::NextBlock);
+        block_nb++;
     }
-    cursor.endEditBlock();
+    this->apply_line_edits(edits);
 }
 
+// 逐行把制表符替换为空格，只修改含有制表符的行，可以撤销
 void CodeEditor::fix_indentation()
 {
-    QString text_before = this->toPlainText();
-    QString text_after  = sourcecode::fix_indentation(text_before);
-    if (text_before != text_after) {
-        this->setPlainText(text_before);
-        this->document()->setModified(true);
+    QVector<LineEdit> edits;
+    int block_nb = 0;
+    for (QTextBlock block = this->document()->begin(); block.isValid(); block = block.next()) {
+        QString text = block.text();
+        LineEdit edit;
+        if (text.contains('\t') &&
+                TextEditBaseWidget::line_edit(block_nb, text, sourcecode::fix_indentation(text), &edit))
+            edits.append(edit);
+        block_nb++;
     }
+    this->apply_line_edits(edits);
 }
 
+// 表达式不会跨行(get_primary_at按非标识符字符分割)，只需要当前行
 QString CodeEditor::get_current_object()
 {
-    QString source_code = this->toPlainText();
-    int offset = this->get_position("cursor");
-    return sourcecode::get_primary_at(source_code, offset);
+    QTextCursor cursor = this->textCursor();
+    QTextBlock block = cursor.block();
+    return sourcecode::get_primary_at(block.text(), cursor.position() - block.position());
+}
+
+// 光标所在调用的左括号之后的位置，不在调用中时返回-1。
+// 只向前查找有限的几行，字符串和注释中的括号不算
+int CodeEditor::find_enclosing_call(QTextCursor cursor)
+{
+    const int max_lines = 50;
+    if (cursor.isNull())
+        cursor = this->textCursor();
+    QTextBlock block = cursor.block();
+    int end = cursor.position() - block.position();
+    int depth = 0;
+    for (int n = 0; block.isValid() && n < max_lines; n++) {
+        QString text = block.text();
+        for (int i = qMin(end, text.size()) - 1; i >= 0; i--) {
+            QChar ch = text[i];
+            bool closing = ch == ')' || ch == ']' || ch == '}';
+            bool opening = ch == '(' || ch == '[' || ch == '{';
+            if (!(closing || opening) || !this->__is_code_position(block, i))
+                continue;
+            if (closing)
+                depth++;
+            else if (depth > 0)
+                depth--;
+            else if (ch == '(')
+                return block.position() + i + 1;
+            else
+                return -1;
+        }
+        block = block.previous();
+        end = block.length();
+    }
+    return -1;
 }
 
 //@Slot()
@@ -1140,6 +1261,11 @@ QTextCursor CodeEditor::__find_next(const QString &text, QTextCursor cursor)
 
 void CodeEditor::__cursor_position_changed()
 {
+    // 光标移到了折叠区域内(查找、跳转到行等)，展开该区域
+    QTextBlock cursor_block = this->textCursor().block();
+    if (!cursor_block.isVisible())
+        this->fold_index->reveal(cursor_block.blockNumber());
+
     auto pair = this->get_cursor_line_column();
     int line = pair.first, column=pair.second;
     emit sig_cursor_position_changed(line,column);
@@ -1171,7 +1297,6 @@ void CodeEditor::__highlight_selection(const QString &key, const QTextCursor &cu
                                        QTextCharFormat::UnderlineStyle underline_style,
                                        bool update)
 {
-    QList<QTextEdit::ExtraSelection> extra_selections = get_extra_selections(key);
     QTextEdit::ExtraSelection selection;
     if (foreground_color.isValid())
         selection.format.setForeground(foreground_color);
@@ -1186,8 +1311,7 @@ void CodeEditor::__highlight_selection(const QString &key, const QTextCursor &cu
     selection.format.setProperty(QTextFormat::FullWidthSelection,
                                  true);
     selection.cursor = cursor;
-    extra_selections.append(selection);
-    set_extra_selections(key,extra_selections);
+    append_extra_selection(key,selection);
     if (update)
         update_extra_selections();
 }
@@ -1196,7 +1320,8 @@ void CodeEditor::__highlight_selection(const QString &key, const QTextCursor &cu
 void CodeEditor::__mark_occurrences()
 {
     __clear_occurrences();
-    if (!supported_language)
+    // 查找会扫过整个文档，包括很长的行
+    if (!supported_language || long_line_guard)
         return;
 
     QString text = get_current_word();
@@ -1306,24 +1431,32 @@ int CodeEditor::compute_linenumberarea_width()
         linenumbers_margin  = 3+this->fontMetrics().width(QString(digits,'9'));
     else
         linenumbers_margin = 0;
-    return linenumbers_margin + this->get_markers_margin();
+    return linenumbers_margin + this->get_markers_margin() + this->get_diff_gutter_margin();
 }
 
 void CodeEditor::update_linenumberarea_width(int new_block_count)
 {
     Q_UNUSED(new_block_count);
-    this->setViewportMargins(this->compute_linenumberarea_width(),0,
+    this->setViewportMargins(this->compute_linenumberarea_width()+
+                             this->compute_foldingarea_width(),0,
                              this->get_scrollflagarea_width(),0);
+    this->__set_foldingarea_geometry();
 }
 
 void CodeEditor::update_linenumberarea(const QRect &qrect, int dy)
 {
-    if (dy)
+    if (dy) {
         this->linenumberarea->scroll(0, dy);
-    else
+        this->foldingarea->scroll(0, dy);
+    }
+    else {
         this->linenumberarea->update(0, qrect.y(),
                                      linenumberarea->width(),
                                      qrect.height());
+        this->foldingarea->update(0, qrect.y(),
+                                  foldingarea->width(),
+                                  qrect.height());
+    }
     if (qrect.contains(this->viewport()->rect()))
         this->update_linenumberarea_width();
 }
@@ -1351,6 +1484,27 @@ void CodeEditor::linenumberarea_paint_event(QPaintEvent *event)
         painter.drawPixmap(0, ytop + (font_height-pixmap_height) / 2, pixmap);
     };
 
+    // 行号右边的竖条：新增绿色、修改蓝色，删除的行在下一行顶部画一个红色三角形
+    int diff_x = linenumberarea->width() - this->diff_gutter_width;
+    auto draw_diff_mark = [&](const QTextBlock& block, int top)
+    {
+        DiffGutter::Mark mark = this->diff_gutter->mark(block.blockNumber());
+        if (mark == DiffGutter::NONE)
+            return;
+        if (mark == DiffGutter::DELETED) {
+            QPolygon triangle;
+            triangle << QPoint(diff_x, top - 3) << QPoint(diff_x + diff_gutter_width + 1, top)
+                     << QPoint(diff_x, top + 3);
+            painter.setPen(Qt::NoPen);
+            painter.setBrush(QColor(this->diff_deleted_color));
+            painter.drawPolygon(triangle);
+            return;
+        }
+        int height = static_cast<int>(this->blockBoundingRect(block).height());
+        QColor color(mark == DiffGutter::ADDED ? this->diff_added_color : this->diff_modified_color);
+        painter.fillRect(diff_x, top, this->diff_gutter_width, height, color);
+    };
+
     foreach (auto pair, this->__visible_blocks) {
         int top = pair.top;
         int line_number = pair.line_number;
@@ -1367,7 +1521,7 @@ void CodeEditor::linenumberarea_paint_event(QPaintEvent *event)
                 painter.setPen(this->linenumbers_color);
             }
 
-            painter.drawText(0, top, linenumberarea->width(),
+            painter.drawText(0, top, linenumberarea->width() - this->get_diff_gutter_margin(),
                              font_height,
                              Qt::AlignRight | Qt::AlignBottom,
                              QString::number(line_number));
@@ -1396,7 +1550,162 @@ void CodeEditor::linenumberarea_paint_event(QPaintEvent *event)
                     draw_pixmap(top,this->bpc_pixmap);
             }
         }
+
+        if (this->diff_gutter_enabled)
+            draw_diff_mark(block, top);
+    }
+}
+
+//-----foldingarea
+void CodeEditor::setup_fold_index()
+{
+    if (this->fold_index)
+        disconnect(this->fold_index, nullptr, this, nullptr);
+    this->fold_index = FoldIndex::for_document(this->document());
+    connect(this->fold_index, &FoldIndex::sig_folding_changed, this, [=](){
+        this->viewport()->update();
+        this->linenumberarea->update();
+        this->foldingarea->update();
+        this->scrollflagarea->update();
+    });
+}
+
+void CodeEditor::set_folding_enabled(bool state)
+{
+    this->folding_enabled = state;
+    this->foldingarea->setVisible(state);
+    if (!state)
+        this->fold_index->unfold_all();
+    this->update_linenumberarea_width();
+}
+
+int CodeEditor::compute_foldingarea_width()
+{
+    if (!this->folding_enabled)
+        return 0;
+    return this->fontMetrics().height();
+}
+
+void CodeEditor::__set_foldingarea_geometry()
+{
+    QRect cr = this->contentsRect();
+    this->foldingarea->setGeometry(QRect(cr.left()+this->compute_linenumberarea_width(),
+                                         cr.top(),
+                                         this->compute_foldingarea_width(),
+                                         cr.height()));
+}
+
+QTextBlock CodeEditor::next_visible_block(const QTextBlock &block)
+{
+    return this->fold_index->next_visible_block(block);
+}
+
+//-----diff gutter
+void CodeEditor::setup_diff_gutter()
+{
+    if (this->diff_gutter)
+        disconnect(this->diff_gutter, nullptr, this, nullptr);
+    this->diff_gutter = DiffGutter::for_document(this->document());
+    connect(this->diff_gutter, &DiffGutter::sig_changed, this, [=](){
+        if (!this->diff_gutter_enabled)
+            return;
+        this->linenumberarea->update();
+        this->scrollflagarea->update();
+    });
+}
+
+void CodeEditor::set_diff_gutter_enabled(bool state)
+{
+    this->diff_gutter_enabled = state;
+    this->update_linenumberarea_width();
+    this->linenumberarea->update();
+    this->scrollflagarea->update();
+}
+
+int CodeEditor::get_diff_gutter_margin()
+{
+    if (this->diff_gutter_enabled)
+        return this->diff_gutter_width;
+    else
+        return 0;
+}
+
+// 和QTextDocument一样，\r、\n和段落分隔符都结束一行
+int CodeEditor::longest_line(const QString &text)
+{
+    int longest = 0;
+    int length = 0;
+    for (auto it = text.constBegin(); it != text.constEnd(); ++it) {
+        ushort ch = it->unicode();
+        if (ch == '\n' || ch == '\r' || ch == QChar::ParagraphSeparator) {
+            longest = qMax(longest, length);
+            length = 0;
+        }
+        else
+            length++;
     }
+    return qMax(longest, length);
+}
+
+// 只改变设置，不重新高亮。读入文本时在setPlainText之前调用，使第一次高亮和布局就受限制
+void CodeEditor::set_long_line_guard(bool enable)
+{
+    if (enable == this->long_line_guard)
+        return;
+    this->long_line_guard = enable;
+    if (this->highlighter)
+        this->highlighter->set_line_limit(enable ? LONG_LINE_HIGHLIGHT : 0);
+    this->brace_line_limit = enable ? LONG_LINE_LIMIT : 0;
+    this->set_wrap_mode(wrap_requested && !enable ? "word" : QString());
+    if (enable)
+        this->__clear_occurrences();
+    emit sig_long_line_guard_changed(enable);
+}
+
+void CodeEditor::foldingarea_paint_event(QPaintEvent *event)
+{
+    QPainter painter(this->foldingarea);
+    painter.fillRect(event->rect(), this->sideareas_color);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(this->linenumbers_color);
+
+    int font_height = this->fontMetrics().height();
+    qreal size = font_height * 0.4;
+    qreal center_x = this->foldingarea->width() / 2.0;
+    foreach (auto pair, this->__visible_blocks) {
+        QTextBlock block = pair.block;
+        qreal center_y = pair.top + font_height / 2.0;
+        QPolygonF triangle;
+        if (this->fold_index->is_folded(block.blockNumber())) {
+            // ▸
+            triangle << QPointF(center_x - size/2, center_y - size/2)
+                     << QPointF(center_x + size/2, center_y)
+                     << QPointF(center_x - size/2, center_y + size/2);
+        }
+        else if (this->fold_index->is_fold_start(block)) {
+            // ▾
+            triangle << QPointF(center_x - size/2, center_y - size/2)
+                     << QPointF(center_x + size/2, center_y - size/2)
+                     << QPointF(center_x, center_y + size/2);
+        }
+        else
+            continue;
+        painter.drawPolygon(triangle);
+    }
+}
+
+void CodeEditor::foldingarea_mousepress_event(QMouseEvent *event)
+{
+    if (event->button() != Qt::LeftButton)
+        return;
+    int line_number = this->__get_linenumber_from_mouse_event(event);
+    QTextBlock block = this->document()->findBlockByNumber(line_number-1);
+    if (!block.isValid())
+        return;
+    if (this->fold_index->is_folded(block.blockNumber()) ||
+            this->fold_index->is_fold_start(block))
+        this->fold_index->toggle(block);
 }
 
 int CodeEditor::__get_linenumber_from_mouse_event(QMouseEvent *event)
@@ -1407,11 +1716,12 @@ int CodeEditor::__get_linenumber_from_mouse_event(QMouseEvent *event)
                   translated(this->contentOffset()).top();
     double bottom = top + blockBoundingRect(block).height();
 
+    // 折叠的块高度为0，要跳过，否则会数到折叠区域的最后一行
     while (block.isValid() && top < event->pos().y()) {
-        block = block.next();
+        line_number = block.blockNumber()+1;
+        block = this->next_visible_block(block);
         top = bottom;
         bottom = top + blockBoundingRect(block).height();
-        line_number++;
     }
     return line_number;
 }
@@ -1593,6 +1903,29 @@ void CodeEditor::do_completion(bool automatic)
         emit this->get_completions(automatic);
 }
 
+// 用进程内的标识符索引补全光标前的单词
+void CodeEditor::show_local_completions(bool automatic)
+{
+    if (this->in_comment_or_string())
+        return;
+    QString line = this->get_text("sol", "cursor");
+    int start = line.size();
+    while (start > 0 && (line[start-1].isLetterOrNumber() || line[start-1] == '_'))
+        start--;
+    QString prefix = line.mid(start);
+    if (prefix.isEmpty() || prefix[0].isDigit())
+        return;
+
+    QList<QPair<QString,QString>> completions = CompletionEngine::instance()->complete(
+                prefix, this->document(), this->codecompletion_case);
+    if (completions.isEmpty() ||
+            (completions.size() == 1 && completions[0].first == prefix))
+        return;
+    // 候选项已经按相关性排好序，不经过show_completion_list的字母排序
+    this->completion_text = prefix;
+    this->show_completion_widget(completions, automatic);
+}
+
 void CodeEditor::do_go_to_definition()
 {
     if (!this->in_comment_or_string())
@@ -1700,6 +2033,23 @@ void CodeEditor::scrollflagarea_paint_event(QPaintEvent *event)
         }
     }
 
+    // 差异标记画在左边缘，高度覆盖修改的所有行
+    if (this->diff_gutter_enabled) {
+        painter.setPen(Qt::NoPen);
+        foreach (const GutterHunk& hunk, this->diff_gutter->changes()) {
+            QString color = this->diff_modified_color;
+            if (hunk.new_count == 0)
+                color = this->diff_deleted_color;
+            else if (hunk.old_count == 0)
+                color = this->diff_added_color;
+            int top = static_cast<int>(this->scrollflagarea->value_to_position(hunk.new_start + 1));
+            int bottom = static_cast<int>(this->scrollflagarea->value_to_position(hunk.new_start + hunk.new_count + 1));
+            painter.setBrush(QColor(color));
+            painter.drawRect(QRect(0, top - ScrollFlagArea::FLAGS_DY/2, ScrollFlagArea::FLAGS_DX/2,
+                                   qMax(ScrollFlagArea::FLAGS_DY, bottom - top)));
+        }
+    }
+
     QColor pen_color = QColor(Qt::white);
     pen_color.setAlphaF(0.8);
     painter.setPen(pen_color);
@@ -1716,6 +2066,7 @@ void CodeEditor::resizeEvent(QResizeEvent *event)
     this->linenumberarea->setGeometry(QRect(cr.left(),cr.top(),
                                             compute_linenumberarea_width(),
                                             cr.height()));
+    this->__set_foldingarea_geometry();
     this->__set_scrollflagarea_geometry(cr);
 }
 
@@ -1776,8 +2127,10 @@ void CodeEditor::apply_highlighter_settings(const QHash<QString, ColorBoolBool>
         this->highlighter->setup_formats(this->font());
         if (!color_scheme.isEmpty())
             this->set_color_scheme(color_scheme);
-        else
-            this->highlighter->rehighlight();
+        else {
+            this->highlighter->restyle();
+            this->apply_pending_restyle();
+        }
     }
 }
 
@@ -1803,6 +2156,7 @@ void CodeEditor::set_color_scheme(const QHash<QString,ColorBoolBool> &color_sche
     if (this->highlighter) {
         this->highlighter->set_color_scheme(color_scheme);
         this->_apply_highlighter_color_scheme();
+        this->apply_pending_restyle();
     }
     if (this->highlight_current_cell_enabled)
         this->highlight_current_cell();
@@ -1817,6 +2171,8 @@ void CodeEditor::set_color_scheme(const QHash<QString,ColorBoolBool> &color_sche
 
 void CodeEditor::set_text(const QString &text)
 {
+    this->long_line_length = longest_line(text);
+    this->set_long_line_guard(!full_features && long_line_length > LONG_LINE_LIMIT);
     this->setPlainText(text);
     //禁用下面这行，不然会导致调用下面的函数，使未发生改变的文档状态变为isModified，文件名后出现星号
     //this->set_eol_chars(text);
@@ -1824,12 +2180,13 @@ void CodeEditor::set_text(const QString &text)
 
 void CodeEditor::set_text_from_file(const QString &filename, QString language)
 {
-    QString text = encoding::read(filename);
+    encoding::DecodedText decoded = encoding::read_file(filename);
     if (language.isEmpty()) {
-        language = get_file_language(filename, text);
+        language = get_file_language(filename, decoded.text);
     }
     this->set_language(language, filename);
-    this->set_text(text);
+    this->set_text(decoded.text);
+    this->eol_chars = decoded.eol_chars;
 }
 
 void CodeEditor::append(const QString &text)
@@ -1840,6 +2197,27 @@ void CodeEditor::append(const QString &text)
 }
 
 
+// 退出长行保护模式，按完整的行重新高亮
+void CodeEditor::enable_full_features()
+{
+    this->full_features = true;
+    if (!this->long_line_guard)
+        return;
+    this->set_long_line_guard(false);
+    this->rehighlight();
+}
+
+// 高亮器是共享的，由发起改变的编辑器重新高亮，这里只同步设置
+void CodeEditor::sync_long_line_guard(bool enable)
+{
+    CodeEditor* editor = qobject_cast<CodeEditor*>(this->sender());
+    if (editor) {
+        this->long_line_length = editor->long_line_length;
+        this->full_features = editor->full_features;
+    }
+    this->set_long_line_guard(enable);
+}
+
 //@Slot()
 void CodeEditor::paste()
 {
@@ -1852,16 +2230,15 @@ void CodeEditor::paste()
     TextEditBaseWidget::paste();
 }
 
-void CodeEditor::get_block_data(const QTextBlock &block)
+BlockUserData* CodeEditor::get_block_data(const QTextBlock &block)
 {
-    // TODO highlighter.block_data是什么
+    return dynamic_cast<BlockUserData*>(block.userData());
 }
 
-void CodeEditor::get_fold_level(int block_nb)
+// 缩进的列数，空行为-1
+int CodeEditor::get_fold_level(int block_nb)
 {
-    QTextBlock block = this->document()->findBlockByNumber(block_nb);
-    //QTextBlockUserData* data = block.userData();
-    // TODO
+    return this->fold_index->level(block_nb);
 }
 
 
@@ -2075,28 +2452,23 @@ void CodeEditor::add_prefix(const QString& prefix)
     QTextCursor cursor = this->textCursor();
     if (this->has_selected_text()) {
         int start_pos=cursor.selectionStart(), end_pos=cursor.selectionEnd();
-        int first_pos = qMin(start_pos, end_pos);
         QTextCursor first_cursor = this->textCursor();
-        first_cursor.setPosition(first_pos);
+        first_cursor.setPosition(start_pos);
         bool begins_at_block_start = first_cursor.atBlockStart();
 
-        cursor.beginEditBlock();
-        cursor.setPosition(end_pos);
-        if (cursor.atBlockStart()) {
-            cursor.movePosition(QTextCursor::PreviousBlock);
-            if (cursor.position() <start_pos)
-                cursor.setPosition(start_pos);
+        QPair<int,int> range = this->selected_block_range();
+        QVector<LineEdit> edits;
+        edits.reserve(range.second - range.first + 1);
+        for (int block_nb = range.first; block_nb <= range.second; block_nb++) {
+            LineEdit edit;
+            edit.block_nb = block_nb;
+            edit.column = 0;
+            edit.removed = 0;
+            edit.text = prefix;
+            edits.append(edit);
         }
+        this->apply_line_edits(edits);
 
-        while (cursor.position() >= start_pos) {
-            cursor.movePosition(QTextCursor::StartOfBlock);
-            cursor.insertText(prefix);
-            if (start_pos==0 && cursor.blockNumber()==0)
-                break;
-            cursor.movePosition(QTextCursor::PreviousBlock);
-            cursor.movePosition(QTextCursor::EndOfBlock);
-        }
-        cursor.endEditBlock();
         if (begins_at_block_start) {
             cursor = this->textCursor();
             start_pos = cursor.selectionStart();
@@ -2134,59 +2506,31 @@ void CodeEditor::remove_suffix(const QString &suffix)
 
 void CodeEditor::remove_prefix(const QString &prefix)
 {
-    QTextCursor cursor = this->textCursor();
-    if (this->has_selected_text()) {
-        int start_pos = qMin(cursor.selectionStart(), cursor.selectionEnd());
-        int end_pos = qMax(cursor.selectionStart(), cursor.selectionEnd());
-        cursor.setPosition(start_pos);
-        if (!cursor.atBlockStart()) {
-            cursor.movePosition(QTextCursor::StartOfBlock);
-            start_pos = cursor.position();
-        }
-        cursor.beginEditBlock();
-        cursor.setPosition(end_pos);
-
-        if (cursor.atBlockStart()) {
-            cursor.movePosition(QTextCursor::PreviousBlock);
-            if (cursor.position() <start_pos)
-                cursor.setPosition(start_pos);
-        }
-
-        cursor.movePosition(QTextCursor::StartOfBlock);
-        int old_pos = INT_MIN;
-        while (cursor.position() >= start_pos) {
-            int new_pos = cursor.position();
-            if (old_pos == new_pos)
-                break;
-            else
-                old_pos = new_pos;
-            QString line_text = cursor.block().text();
-            if ((!prefix.trimmed().isEmpty() && lstrip(line_text).startsWith(prefix))
-                    || line_text.startsWith(prefix)) {
-                cursor.movePosition(QTextCursor::Right,
-                                    QTextCursor::MoveAnchor,
-                                    line_text.indexOf(prefix));
-                cursor.movePosition(QTextCursor::Right,
-                                    QTextCursor::KeepAnchor,prefix.size());
-                cursor.removeSelectedText();
-            }
-            cursor.movePosition(QTextCursor::PreviousBlock);
-        }
-        cursor.endEditBlock();
-    }
-    else {
-        cursor.movePosition(QTextCursor::StartOfBlock);
-        QString line_text = cursor.block().text();
+    auto prefix_edit = [&](int block_nb, const QString& line_text, LineEdit* edit) {
         if ((!prefix.trimmed().isEmpty() && lstrip(line_text).startsWith(prefix))
                 || line_text.startsWith(prefix)) {
-            cursor.movePosition(QTextCursor::Right,
-                                QTextCursor::MoveAnchor,
-                                line_text.indexOf(prefix));
-            cursor.movePosition(QTextCursor::Right,
-                                QTextCursor::KeepAnchor,prefix.size());
-            cursor.removeSelectedText();
+            edit->block_nb = block_nb;
+            edit->column = line_text.indexOf(prefix);
+            edit->removed = prefix.size();
+            return true;
         }
+        return false;
+    };
+
+    QPair<int,int> range;
+    if (this->has_selected_text())
+        range = this->selected_block_range();
+    else
+        range = qMakePair(this->textCursor().blockNumber(), this->textCursor().blockNumber());
+    QVector<LineEdit> edits;
+    QTextBlock block = this->document()->findBlockByNumber(range.first);
+    for (int block_nb = range.first; block.isValid() && block_nb <= range.second; block_nb++) {
+        LineEdit edit;
+        if (prefix_edit(block_nb, block.text(), &edit))
+            edits.append(edit);
+        block = block.next();
     }
+    this->apply_line_edits(edits);
 }
 
 
@@ -2784,8 +3128,37 @@ QString CodeEditor::__get_current_color(QTextCursor cursor)
         return QString();
 }
 
+// 高亮器记录的光标处的记号类型，没有记录记号时返回-1。
+// 和__get_current_color一样，在行尾时取前一个字符
+int CodeEditor::token_at_cursor(QTextCursor cursor)
+{
+    if (!this->highlighter || !this->highlighter->has_tokens())
+        return -1;
+    if (cursor.isNull())
+        cursor = this->textCursor();
+    QTextBlock block = cursor.block();
+    int pos = cursor.position() - block.position();
+    if (cursor.atBlockEnd()) {
+        if (pos == 0)
+            return sh::TOKEN_CODE;
+        pos--;
+    }
+    return this->highlighter->token_at(block, pos);
+}
+
+bool CodeEditor::__is_code_position(const QTextBlock &block, int pos)
+{
+    if (!this->highlighter || !this->highlighter->has_tokens())
+        return true;
+    int kind = this->highlighter->token_at(block, pos);
+    return kind != sh::TOKEN_STRING && kind != sh::TOKEN_COMMENT;
+}
+
 bool CodeEditor::in_comment_or_string(QTextCursor cursor)
 {
+    int kind = this->token_at_cursor(cursor);
+    if (kind != -1)
+        return kind == sh::TOKEN_COMMENT || kind == sh::TOKEN_STRING;
     if (this->highlighter) {
         QString current_color;
         if (cursor.isNull())
@@ -2835,42 +3208,61 @@ bool CodeEditor::__forbidden_colon_end_char(QString text)
     return false;
 }
 
+// text是当前行从行首开始的文本。括号在text内没有配对时返回true，
+// 和find_brace_match一样每种括号分别配对，但只看这一行，并跳过字符串和注释
 bool CodeEditor::__unmatched_braces_in_line(const QString &text,const QChar& closing_braces_type)
 {
-    QList<QChar> opening_braces, closing_braces;
-    if (closing_braces_type == QChar(0)) {
-        opening_braces = {'(', '[', '{'};
-        closing_braces = {')', ']', '}'};
-    }
-    else {
-        closing_braces = {closing_braces_type};
-        QHash<QChar,QChar> dict = {{')','('}, {'}','{'}, {']','['}};
-        opening_braces = {dict[closing_braces_type]};
-    }
+    const QString opening_braces = "([{";
+    const QString closing_braces = ")]}";
+    int depth[3] = {0, 0, 0};
     QTextBlock block = this->textCursor().block();
-    int line_pos = block.position();
     for (int pos = 0; pos < text.size(); ++pos) {
         QChar _char = text[pos];
-        if (opening_braces.contains(_char)) {
-            int match = this->find_brace_match(line_pos+pos, _char, true);
-            if ((match == -1) || (match > line_pos+text.size()))
-                return true;
-        }
-        if (closing_braces.contains(_char)) {
-            int match = this->find_brace_match(line_pos+pos, _char, false);
-            if ((match == -1) || (match < line_pos))
-                return true;
-        }
+        int opening = opening_braces.indexOf(_char);
+        int closing = closing_braces.indexOf(_char);
+        int type = opening != -1 ? opening : closing;
+        if (type == -1)
+            continue;
+        if (closing_braces_type != QChar(0) && closing_braces[type] != closing_braces_type)
+            continue;
+        if (!this->__is_code_position(block, pos))
+            continue;
+        if (opening != -1)
+            depth[type]++;
+        else if (depth[type] == 0)
+            return true;
+        else
+            depth[type]--;
     }
-    return false;
+    return depth[0] || depth[1] || depth[2];
 }
 
+// 一次遍历：冒号之前没有未配对的括号
 bool CodeEditor::__has_colon_not_in_brackets(const QString &text)
 {
+    const QString opening_braces = "([{";
+    const QString closing_braces = ")]}";
+    int depth[3] = {0, 0, 0};
+    QTextBlock block = this->textCursor().block();
     for (int pos = 0; pos < text.size(); ++pos) {
         QChar _char = text[pos];
-        if (_char == ':' && !this->__unmatched_braces_in_line(text.left(pos)))
-            return true;
+        int opening = opening_braces.indexOf(_char);
+        int closing = closing_braces.indexOf(_char);
+        if (_char != ':' && opening == -1 && closing == -1)
+            continue;
+        if (!this->__is_code_position(block, pos))
+            continue;
+        if (_char == ':') {
+            if (!depth[0] && !depth[1] && !depth[2])
+                return true;
+        }
+        else if (opening != -1)
+            depth[opening]++;
+        else if (depth[closing] == 0)
+            // 之后的冒号前面都有这个未配对的右括号
+            return false;
+        else
+            depth[closing]--;
     }
     return false;
 }
@@ -2917,6 +3309,9 @@ QString CodeEditor::__next_char()
 
 bool CodeEditor::__in_comment()
 {
+    int kind = this->token_at_cursor();
+    if (kind != -1)
+        return kind == sh::TOKEN_COMMENT;
     if (this->highlighter) {
         QString current_color = this->__get_current_color();
         QString comment_color = this->highlighter->get_color_name("comment");
@@ -3110,6 +3505,8 @@ void CodeEditor::keyReleaseEvent(QKeyEvent *event)
 
 void CodeEditor::keyPressEvent(QKeyEvent *event)
 {
+    TraceSpan span("keyPressEvent", "input");
+    Tracer::instance()->key_pressed();
     int key = event->key();
     bool ctrl=  event->modifiers() & Qt::ControlModifier;
     bool shift = event->modifiers() & Qt::ShiftModifier;
@@ -3454,9 +3851,20 @@ void CodeEditor::dropEvent(QDropEvent *event)
 //------ Paint event
 void CodeEditor::paintEvent(QPaintEvent *event)
 {
-    update_visible_blocks(event);
-    TextEditBaseWidget::paintEvent(event);
-    emit this->painted(event);
+    {
+        TraceSpan span("paintEvent", "paint");
+        update_visible_blocks(event);
+        TextEditBaseWidget::paintEvent(event);
+        emit this->painted(event);
+    }
+    if (Tracer::enabled())
+        Tracer::instance()->painted();
+}
+
+void CodeEditor::showEvent(QShowEvent *event)
+{
+    TextEditBaseWidget::showEvent(event);
+    this->apply_pending_restyle();
 }
 
 void CodeEditor::update_visible_blocks(QPaintEvent *event)
@@ -3476,7 +3884,7 @@ void CodeEditor::update_visible_blocks(QPaintEvent *event)
             break;
         if (block.isVisible())
             this->__visible_blocks.append(IntIntTextblock(top, blockNumber+1, block));
-        block = block.next();
+        block = this->next_visible_block(block);
         top = bottom;
         bottom = top + static_cast<int>(this->blockBoundingRect(block).height());
         blockNumber = block.blockNumber();
@@ -3493,16 +3901,45 @@ void CodeEditor::_draw_editor_cell_divider()
         pen.setBrush(cell_line_color);
         painter.setPen(pen);
 
+        QVector<int> separators = this->cell_separator_blocks();
         foreach (auto pair, this->__visible_blocks) {
             int top = pair.top;
             QTextBlock block = pair.block;
             // TODO源码是if self.is_cell_separator(block):
-            if (this->is_cell_separator(QTextCursor(),block))
+            if (std::binary_search(separators.begin(), separators.end(), block.blockNumber()))
                 painter.drawLine(4,top,this->width(),top);
         }
     }
 }
 
+// 折叠的块下面画一条虚线
+void CodeEditor::_draw_folded_blocks()
+{
+    if (!this->fold_index->has_folds())
+        return;
+    QPainter painter(this->viewport());
+    QPen pen = painter.pen();
+    pen.setStyle(Qt::DotLine);
+    pen.setBrush(this->linenumbers_color);
+    painter.setPen(pen);
+
+    int font_height = this->fontMetrics().height();
+    foreach (auto pair, this->__visible_blocks) {
+        if (this->fold_index->is_folded(pair.block.blockNumber())) {
+            int bottom = pair.top + font_height;
+            painter.drawLine(0, bottom, this->viewport()->width(), bottom);
+        }
+    }
+}
+
+// 分隔行的索引由语法高亮器在高亮时维护
+QVector<int> CodeEditor::cell_separator_blocks()
+{
+    if (this->highlighter)
+        return this->highlighter->cell_separator_blocks();
+    return TextEditBaseWidget::cell_separator_blocks();
+}
+
 QList<IntIntTextblock> CodeEditor::visible_blocks()
 {
     return __visible_blocks;
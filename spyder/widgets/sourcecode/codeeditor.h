@@ -5,9 +5,12 @@
 #include "utils/encoding.h"
 #include "utils/qthelpers.h"
 #include "utils/syntaxhighlighters.h"
+#include "widgets/sourcecode/folding.h"
+#include "widgets/sourcecode/diffgutter.h"
 #include "widgets/editortools.h"
 #include "widgets/sourcecode/widgets_base.h"
 #include "widgets/sourcecode/kill_ring.h"
+#include "utils/introspection/completion_engine.h"
 #include <QDebug>
 #include <QPrinter>
 
@@ -45,6 +48,20 @@ public:
 };
 
 
+// 行号栏右边的折叠栏，折叠起点显示三角形，单击折叠或展开
+class FoldingArea : public QWidget
+{
+    Q_OBJECT
+public:
+    FoldingArea(CodeEditor* editor);
+    QSize sizeHint() const override;
+    void paintEvent(QPaintEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    CodeEditor* code_editor;
+};
+
+
 class ScrollFlagArea : public QWidget
 {
     Q_OBJECT
@@ -123,6 +140,7 @@ signals:
     void sig_cursor_position_changed(int,int);
     void focus_changed();
     void sig_new_file(const QString&);
+    void sig_long_line_guard_changed(bool);
 
 public:
     bool edge_line_enabled;
@@ -143,6 +161,28 @@ public:
     int linenumberarea_pressed;
     int linenumberarea_released;
 
+    bool folding_enabled;
+    FoldingArea* foldingarea;
+    FoldIndex* fold_index;
+
+    bool diff_gutter_enabled;
+    int diff_gutter_width;
+    DiffGutter* diff_gutter;
+    QString diff_added_color;
+    QString diff_modified_color;
+    QString diff_deleted_color;
+
+    // 长行保护模式：读入的文本中有超过LONG_LINE_LIMIT个字符的行时，每行只高亮开头
+    // LONG_LINE_HIGHLIGHT个字符，长行上不做括号匹配，并关闭自动换行和高亮相同的单词
+    static const int LONG_LINE_LIMIT = 20000;
+    static const int LONG_LINE_HIGHLIGHT = 3000;
+    bool long_line_guard;
+    // 用户选择了全部功能，重新加载时也不再进入保护模式
+    bool full_features;
+    int long_line_length;
+    // 保护模式中不换行，退出时恢复
+    bool wrap_requested;
+
     QColor occurrence_color;
     QColor ctrl_click_color;
     QColor sideareas_color;
@@ -263,11 +303,13 @@ public:
     void intelligent_backtab();
 
     void rehighlight();
+    void apply_pending_restyle();
     void rehighlight_cells();
     void setup_margins(bool linenumbers=true,bool markers=true);
     void remove_trailing_spaces();
     void fix_indentation();
     QString get_current_object();
+    int find_enclosing_call(QTextCursor cursor=QTextCursor());
 
     QTextCursor __find_first(const QString& text);
     QTextCursor __find_next(const QString& text,QTextCursor cursor);
@@ -299,6 +341,22 @@ public:
     void linenumberarea_select_lines(int linenumber_pressed,
                                      int linenumber_released);
 
+    void set_folding_enabled(bool state);
+    int compute_foldingarea_width();
+    void __set_foldingarea_geometry();
+    void foldingarea_paint_event(QPaintEvent* event);
+    void foldingarea_mousepress_event(QMouseEvent* event);
+    void setup_fold_index();
+    QTextBlock next_visible_block(const QTextBlock& block) override;
+
+    void set_diff_gutter_enabled(bool state);
+    int get_diff_gutter_margin();
+    void setup_diff_gutter();
+
+    static int longest_line(const QString& text);
+    void set_long_line_guard(bool enable);
+    bool is_long_line_guarded() const { return long_line_guard; }
+
     void add_remove_breakpoint(int line_number=-1,QString condition=QString(),
                                bool edit_condition=false);
     QList<QList<QVariant>> get_breakpoints();
@@ -331,8 +389,8 @@ public:
     void set_text_from_file(const QString& filename,QString language=QString());
     void append(const QString& text);
 
-    void get_block_data(const QTextBlock& block);
-    void get_fold_level(int block_nb);
+    BlockUserData* get_block_data(const QTextBlock& block);
+    int get_fold_level(int block_nb);
 
     void go_to_line(int line,const QString& word="");
     void exec_gotolinedialog();
@@ -368,6 +426,8 @@ public:
 
 
     QString __get_current_color(QTextCursor cursor=QTextCursor());
+    int token_at_cursor(QTextCursor cursor=QTextCursor());
+    bool __is_code_position(const QTextBlock& block, int pos);
     bool in_comment_or_string(QTextCursor cursor=QTextCursor());
     bool __colon_keyword(QString text);
     bool __forbidden_colon_end_char(QString text);
@@ -392,9 +452,11 @@ public:
     void dragEnterEvent(QDragEnterEvent *event) override;
     void dropEvent(QDropEvent *event) override;
     void paintEvent(QPaintEvent *event) override;
+    void showEvent(QShowEvent *event) override;
     void update_visible_blocks(QPaintEvent *event);
     QList<IntIntTextblock> visible_blocks();
     bool is_editor();
+    QVector<int> cell_separator_blocks() override;
 
 public slots:
     void cb_maker(int attr);
@@ -406,8 +468,10 @@ public slots:
     void __mark_occurrences();
     void __text_has_changed();
     void _draw_editor_cell_divider();
+    void _draw_folded_blocks();
 
     void do_completion(bool automatic=false);
+    void show_local_completions(bool automatic=false);
     void do_go_to_definition();
     void toggle_comment();
     void blockcomment();
@@ -422,6 +486,8 @@ public slots:
 
     void _delete();
     void paste();
+    void enable_full_features();
+    void sync_long_line_guard(bool enable);
     void center_cursor_on_next_focus();
     void clear_all_output();
     void convert_notebook();
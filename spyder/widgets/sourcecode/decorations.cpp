@@ -0,0 +1,151 @@
+#include "decorations.h"
+
+#include <QTextCursor>
+#include <algorithm>
+
+static bool start_less(const Decoration& a, const Decoration& b)
+{
+    return a.start < b.start;
+}
+
+DecorationLayer::DecorationLayer(const QString &key)
+{
+    this->key = key;
+    this->dirty = false;
+    this->foreground_dirty = false;
+    this->max_span = 0;
+    this->foreground_count = 0;
+}
+
+bool DecorationLayer::is_foreground(const Decoration &decoration)
+{
+    return decoration.format.hasProperty(QTextFormat::ForegroundBrush);
+}
+
+Decoration DecorationLayer::from_selection(const QTextEdit::ExtraSelection &selection)
+{
+    Decoration decoration;
+    decoration.start = selection.cursor.selectionStart();
+    decoration.end = selection.cursor.selectionEnd();
+    decoration.format = selection.format;
+    return decoration;
+}
+
+void DecorationLayer::update_stats()
+{
+    max_span = 0;
+    foreground_count = 0;
+    foreach (const Decoration& decoration, _items) {
+        max_span = qMax(max_span, decoration.end - decoration.start);
+        if (is_foreground(decoration))
+            foreground_count++;
+    }
+}
+
+// 内容没有变化时返回false，不标记为dirty
+bool DecorationLayer::set(const QVector<Decoration> &items)
+{
+    if (items == _items)
+        return false;
+    bool had_foreground = this->has_foreground();
+    _items = items;
+    std::stable_sort(_items.begin(), _items.end(), start_less);
+    this->update_stats();
+    this->dirty = true;
+    this->foreground_dirty = this->foreground_dirty || had_foreground || this->has_foreground();
+    return true;
+}
+
+void DecorationLayer::append(const Decoration &decoration)
+{
+    // 按文档顺序添加时直接追加到末尾
+    if (_items.isEmpty() || _items.last().start <= decoration.start)
+        _items.append(decoration);
+    else
+        _items.insert(std::upper_bound(_items.begin(), _items.end(), decoration, start_less),
+                      decoration);
+    max_span = qMax(max_span, decoration.end - decoration.start);
+    if (is_foreground(decoration)) {
+        foreground_count++;
+        this->foreground_dirty = true;
+    }
+    this->dirty = true;
+}
+
+void DecorationLayer::clear()
+{
+    if (_items.isEmpty())
+        return;
+    this->foreground_dirty = this->foreground_dirty || this->has_foreground();
+    _items.clear();
+    max_span = 0;
+    foreground_count = 0;
+    this->dirty = true;
+}
+
+// 先删除再插入：删除范围内的位置移到position，position及之后的位置后移added。
+// 原来非空、平移后变为空的装饰被丢弃
+void DecorationLayer::shift(int position, int removed, int added)
+{
+    if (_items.isEmpty())
+        return;
+    auto map = [=](int pos) {
+        if (pos < position)
+            return pos;
+        return qMax(position, pos - removed) + added;
+    };
+    int keep = 0;
+    bool changed = false;
+    for (int i = 0; i < _items.size(); i++) {
+        Decoration& decoration = _items[i];
+        if (decoration.end < position) {
+            _items[keep++] = decoration;
+            continue;
+        }
+        int start = map(decoration.start);
+        int end = map(decoration.end);
+        changed = true;
+        if (start == end && decoration.start != decoration.end) {
+            if (is_foreground(decoration))
+                this->foreground_dirty = true;
+            continue;
+        }
+        decoration.start = start;
+        decoration.end = end;
+        _items[keep++] = decoration;
+    }
+    _items.resize(keep);
+    if (changed)
+        this->update_stats();
+}
+
+QVector<int> DecorationLayer::visible(int from, int to) const
+{
+    QVector<int> result;
+    Decoration key;
+    key.start = from - max_span;
+    auto it = std::lower_bound(_items.begin(), _items.end(), key, start_less);
+    for (; it != _items.end() && it->start <= to; ++it) {
+        if (it->end >= from)
+            result.append(int(it - _items.begin()));
+    }
+    return result;
+}
+
+QList<QTextEdit::ExtraSelection> DecorationLayer::to_extra_selections(QTextDocument *document,
+                                                                      bool foreground_only) const
+{
+    QList<QTextEdit::ExtraSelection> selections;
+    int last = document->characterCount() - 1;
+    foreach (const Decoration& decoration, _items) {
+        if (foreground_only && !is_foreground(decoration))
+            continue;
+        QTextEdit::ExtraSelection selection;
+        selection.format = decoration.format;
+        selection.cursor = QTextCursor(document);
+        selection.cursor.setPosition(qMin(decoration.start, last));
+        selection.cursor.setPosition(qMin(decoration.end, last), QTextCursor::KeepAnchor);
+        selections.append(selection);
+    }
+    return selections;
+}
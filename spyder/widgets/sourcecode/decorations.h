@@ -0,0 +1,59 @@
+#pragma once
+
+#include <QPair>
+#include <QVector>
+#include <QTextEdit>
+#include <QTextCharFormat>
+
+// 一条装饰：文档中[start,end)范围的背景色、下划线等
+struct Decoration
+{
+    int start;
+    int end;
+    QTextCharFormat format;
+
+    bool operator==(const Decoration& other) const
+    { return start == other.start && end == other.end && format == other.format; }
+    bool operator!=(const Decoration& other) const { return !(*this == other); }
+};
+
+
+// 一层装饰(当前行、当前单元格、查找结果、代码分析等)，按起点排序。
+// 文档修改时按修改位置平移，和QTextCursor的行为一致
+class DecorationLayer
+{
+public:
+    DecorationLayer(const QString& key = QString());
+
+    QString key;
+    // 自上次刷新后是否修改过
+    bool dirty;
+    // 含有前景色的装饰交给QPlainTextEdit的extraSelections绘制，
+    // 这类装饰增减时需要重新设置extraSelections
+    bool foreground_dirty;
+
+    const QVector<Decoration>& items() const { return _items; }
+    bool isEmpty() const { return _items.isEmpty(); }
+    int size() const { return _items.size(); }
+    bool has_foreground() const { return foreground_count > 0; }
+
+    bool set(const QVector<Decoration>& items);
+    void append(const Decoration& decoration);
+    void clear();
+    void shift(int position, int removed, int added);
+
+    // 与[from,to)相交的装饰的下标
+    QVector<int> visible(int from, int to) const;
+    QList<QTextEdit::ExtraSelection> to_extra_selections(QTextDocument* document,
+                                                         bool foreground_only = false) const;
+
+    static Decoration from_selection(const QTextEdit::ExtraSelection& selection);
+    static bool is_foreground(const Decoration& decoration);
+
+private:
+    QVector<Decoration> _items;
+    int max_span;
+    int foreground_count;
+
+    void update_stats();
+};
@@ -0,0 +1,374 @@
+#include "diffgutter.h"
+#include "utils/encoding.h"
+
+#include <QFileInfo>
+#include <QProcess>
+#include <QCoreApplication>
+#include <algorithm>
+
+static bool hunk_less(const GutterHunk& a, const GutterHunk& b)
+{
+    if (a.new_start != b.new_start)
+        return a.new_start < b.new_start;
+    return a.new_count < b.new_count;
+}
+
+
+/********** DiffWorker **********/
+DiffWorker* DiffWorker::instance()
+{
+    static DiffWorker* worker = nullptr;
+    if (worker == nullptr) {
+        qRegisterMetaType<DiffJob>("DiffJob");
+        worker = new DiffWorker;
+    }
+    return worker;
+}
+
+DiffWorker::DiffWorker()
+    : QObject (nullptr)
+{
+    thread = new QThread;
+    thread->setObjectName("DiffWorker");
+    this->moveToThread(thread);
+    thread->start(QThread::LowPriority);
+
+    if (qApp)
+        connect(qApp, &QCoreApplication::aboutToQuit, [this](){ this->shutdown(); });
+}
+
+void DiffWorker::shutdown()
+{
+    if (!thread->isRunning())
+        return;
+    thread->quit();
+    thread->wait();
+}
+
+QStringList DiffWorker::split_lines(const QString &text)
+{
+    QString normalized = text;
+    normalized.replace("\r\n", "\n");
+    normalized.replace('\r', '\n');
+    return normalized.split('\n');
+}
+
+// git show只在文件所在目录运行一次；不是git仓库、文件没有提交过或没有安装git时用磁盘上的文件
+QStringList DiffWorker::read_base(const QString &filename, bool use_git, bool *ok)
+{
+    QFileInfo info(filename);
+    if (use_git) {
+        QProcess process;
+        process.setWorkingDirectory(info.absolutePath());
+        process.start("git", QStringList() << "show" << "HEAD:./" + info.fileName());
+        if (process.waitForFinished(5000) && process.exitStatus() == QProcess::NormalExit &&
+                process.exitCode() == 0) {
+            *ok = true;
+            return split_lines(encoding::decode(process.readAllStandardOutput()).text);
+        }
+    }
+    encoding::DecodedText decoded = encoding::read_file(filename, ok);
+    if (!*ok)
+        return QStringList();
+    return split_lines(decoded.text);
+}
+
+void DiffWorker::compute(DiffJob &job)
+{
+    job.hunks.clear();
+    if (job.load_base) {
+        job.base = read_base(job.filename, job.use_git, &job.ok);
+        if (job.ok)
+            job.hunks = diff::diff_lines(job.base, job.new_slices.value(0));
+        return;
+    }
+    job.ok = true;
+    for (int k = 0; k < job.windows.size(); k++) {
+        const DiffHunk& window = job.windows[k];
+        foreach (DiffHunk hunk, diff::diff_lines(job.old_slices[k], job.new_slices[k])) {
+            hunk.old_start += window.old_start;
+            hunk.new_start += window.new_start;
+            job.hunks.append(hunk);
+        }
+    }
+}
+
+void DiffWorker::run(DiffJob job)
+{
+    compute(job);
+    emit sig_finished(job);
+}
+
+
+/********** DiffGutter **********/
+DiffGutter* DiffGutter::for_document(QTextDocument *document)
+{
+    DiffGutter* gutter = document->findChild<DiffGutter*>(QString(), Qt::FindDirectChildrenOnly);
+    if (gutter == nullptr)
+        gutter = new DiffGutter(document);
+    return gutter;
+}
+
+DiffGutter::DiffGutter(QTextDocument *document)
+    : QObject (document)
+{
+    static quint64 next_id = 1;
+    this->document = document;
+    this->id = next_id++;
+    this->_has_base = false;
+    this->use_git = false;
+    this->blocks = document->blockCount();
+    this->revision = document->revision();
+    this->serial = 0;
+    this->base_serial = 0;
+    this->running = false;
+    this->loading = false;
+
+    timer = new QTimer(this);
+    timer->setSingleShot(true);
+    timer->setInterval(DELAY);
+    connect(timer, SIGNAL(timeout()), this, SLOT(start_diff()));
+    connect(document, SIGNAL(contentsChange(int,int,int)),
+            this, SLOT(contents_change(int,int,int)));
+    connect(DiffWorker::instance(), SIGNAL(sig_finished(DiffJob)),
+            this, SLOT(diff_finished(DiffJob)));
+}
+
+QStringList DiffGutter::block_lines(int first, int count) const
+{
+    QStringList lines;
+    lines.reserve(count);
+    QTextBlock block = document->findBlockByNumber(first);
+    for (int i = 0; i < count && block.isValid(); i++) {
+        lines.append(block.text());
+        block = block.next();
+    }
+    return lines;
+}
+
+void DiffGutter::set_file(const QString &filename, bool use_git)
+{
+    this->filename = filename;
+    this->use_git = use_git;
+    base_serial++;
+    loading = true;
+
+    DiffJob job;
+    job.owner = id;
+    job.serial = serial;
+    job.base_serial = base_serial;
+    job.load_base = true;
+    job.filename = filename;
+    job.use_git = use_git;
+    job.ok = false;
+    job.new_slices.append(this->block_lines(0, blocks));
+    QMetaObject::invokeMethod(DiffWorker::instance(), "run", Qt::QueuedConnection,
+                              Q_ARG(DiffJob, job));
+}
+
+void DiffGutter::set_base_text(const QStringList &base)
+{
+    base_serial++;
+    loading = false;
+    timer->stop();
+    this->base = base;
+    _has_base = true;
+    hunks.clear();
+    foreach (const DiffHunk& hunk, diff::diff_lines(base, this->block_lines(0, blocks))) {
+        GutterHunk change;
+        static_cast<DiffHunk&>(change) = hunk;
+        change.dirty = false;
+        hunks.append(change);
+    }
+    emit sig_changed();
+}
+
+void DiffGutter::clear()
+{
+    base_serial++;
+    loading = false;
+    timer->stop();
+    _has_base = false;
+    base.clear();
+    filename.clear();
+    hunks.clear();
+    emit sig_changed();
+}
+
+// 整个文档作为一处还没有比较的修改
+void DiffGutter::mark_all_dirty()
+{
+    GutterHunk change;
+    change.old_start = 0;
+    change.old_count = base.size();
+    change.new_start = 0;
+    change.new_count = blocks;
+    change.dirty = true;
+    hunks.clear();
+    hunks.append(change);
+    timer->start();
+}
+
+DiffGutter::Mark DiffGutter::mark(int block_nb) const
+{
+    if (hunks.isEmpty())
+        return NONE;
+    auto it = std::upper_bound(hunks.begin(), hunks.end(), block_nb,
+                               [](int nb, const GutterHunk& hunk) { return nb < hunk.new_start; });
+    // 只可能是在这一行之前删除的行，或者包含这一行的修改
+    while (it != hunks.begin()) {
+        --it;
+        if (it->new_count > 0) {
+            if (block_nb < it->new_start + it->new_count)
+                return it->old_count == 0 ? ADDED : MODIFIED;
+            break;
+        }
+        if (it->new_start == block_nb)
+            return DELETED;
+    }
+    // 文件末尾删除的行标在最后一行上
+    const GutterHunk& last = hunks.last();
+    if (block_nb == blocks - 1 && last.new_count == 0 && last.new_start == blocks)
+        return DELETED;
+    return NONE;
+}
+
+// 旧文档中[c0, c1]行被修改。与它相交或相邻的修改合并为一个dirty范围，
+// 基准中的起止行由之前各处修改的行数差(base - doc)推算，之后的修改平移
+void DiffGutter::contents_change(int position, int removed, int added)
+{
+    // markContentsDirty(高亮、折叠)也发出contentsChange，但不改变revision
+    int revision = document->revision();
+    if ((removed == added && revision == this->revision) || (removed == 0 && added == 0))
+        return;
+    this->revision = revision;
+    serial++;
+
+    QTextBlock first = document->findBlock(position);
+    if (!first.isValid())
+        first = document->lastBlock();
+    QTextBlock last = document->findBlock(position + added);
+    if (!last.isValid())
+        last = document->lastBlock();
+    int delta = document->blockCount() - blocks;
+    blocks = document->blockCount();
+    if (!_has_base)
+        return;
+
+    int c0 = first.blockNumber();
+    int c1 = last.blockNumber() - delta;
+    int offset = 0;
+    int i = 0;
+    while (i < hunks.size() && hunks[i].new_start + hunks[i].new_count < c0) {
+        offset += hunks[i].old_count - hunks[i].new_count;
+        i++;
+    }
+    int keep = i;
+    int lo = c0;
+    int hi = c1 + 1;
+    if (i < hunks.size() && hunks[i].new_start <= c1 + 1)
+        lo = qMin(lo, hunks[i].new_start);
+    int base_lo = lo + offset;
+    while (i < hunks.size() && hunks[i].new_start <= c1 + 1) {
+        hi = qMax(hi, hunks[i].new_start + hunks[i].new_count);
+        offset += hunks[i].old_count - hunks[i].new_count;
+        i++;
+    }
+    int base_hi = hi + offset;
+
+    GutterHunk change;
+    change.old_start = base_lo;
+    change.old_count = qMax(0, qMin(base_hi, base.size()) - base_lo);
+    change.new_start = lo;
+    change.new_count = hi - lo + delta;
+    change.dirty = true;
+
+    QVector<GutterHunk> after = hunks.mid(i);
+    hunks.resize(keep);
+    hunks.append(change);
+    for (int j = 0; j < after.size(); j++) {
+        after[j].new_start += delta;
+        hunks.append(after[j]);
+    }
+    timer->start();
+}
+
+DiffJob DiffGutter::dirty_job()
+{
+    DiffJob job;
+    job.owner = id;
+    job.serial = serial;
+    job.base_serial = base_serial;
+    job.load_base = false;
+    job.use_git = use_git;
+    job.ok = false;
+    foreach (const GutterHunk& hunk, hunks) {
+        if (!hunk.dirty)
+            continue;
+        job.windows.append(hunk);
+        job.old_slices.append(base.mid(hunk.old_start, hunk.old_count));
+        job.new_slices.append(this->block_lines(hunk.new_start, hunk.new_count));
+    }
+    return job;
+}
+
+// 同一时间只有一个比较任务，上一个完成之前的编辑由完成时重新启动的计时器处理。
+// 正在读入新的基准时也不比较，读入后会重新比较
+void DiffGutter::start_diff()
+{
+    if (!_has_base || running || loading)
+        return;
+    DiffJob job = this->dirty_job();
+    if (job.windows.isEmpty())
+        return;
+    running = true;
+    QMetaObject::invokeMethod(DiffWorker::instance(), "run", Qt::QueuedConnection,
+                              Q_ARG(DiffJob, job));
+}
+
+void DiffGutter::diff_finished(const DiffJob &job)
+{
+    if (job.owner != id)
+        return;
+    if (job.load_base) {
+        if (job.base_serial != base_serial)
+            return;
+        loading = false;
+        if (!job.ok) {
+            _has_base = false;
+            base.clear();
+            hunks.clear();
+            emit sig_changed();
+            return;
+        }
+        base = job.base;
+        _has_base = true;
+        if (job.serial != serial) {
+            this->mark_all_dirty();
+            return;
+        }
+        hunks.clear();
+    }
+    else {
+        running = false;
+        if (job.base_serial != base_serial || job.serial != serial) {
+            if (_has_base)
+                timer->start();
+            return;
+        }
+        int keep = 0;
+        for (int i = 0; i < hunks.size(); i++) {
+            if (!hunks[i].dirty)
+                hunks[keep++] = hunks[i];
+        }
+        hunks.resize(keep);
+    }
+    foreach (const DiffHunk& hunk, job.hunks) {
+        GutterHunk change;
+        static_cast<DiffHunk&>(change) = hunk;
+        change.dirty = false;
+        hunks.append(change);
+    }
+    std::sort(hunks.begin(), hunks.end(), hunk_less);
+    emit sig_changed();
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "utils/diff.h"
+#include <QTimer>
+#include <QThread>
+#include <QTextDocument>
+
+// 一处修改。dirty为true表示编辑后还没有重新比较，绘制时暂时当作修改过的行
+struct GutterHunk : public DiffHunk
+{
+    bool dirty;
+};
+
+// 交给后台线程的一次比较：load_base为true时先读入基准(磁盘上的文件或git HEAD中的版本)
+// 再和整个文档比较，否则只比较windows中的各个范围，old_slices/new_slices是对应的行
+struct DiffJob
+{
+    quint64 owner;
+    int serial;
+    int base_serial;
+    bool load_base;
+    QString filename;
+    bool use_git;
+
+    QVector<DiffHunk> windows;
+    QList<QStringList> old_slices;
+    QList<QStringList> new_slices;
+
+    // 结果。读不到基准时ok为false
+    bool ok;
+    QStringList base;
+    QVector<DiffHunk> hunks;
+};
+Q_DECLARE_METATYPE(DiffJob)
+
+
+// 所有文档共用的比较线程
+class DiffWorker : public QObject
+{
+    Q_OBJECT
+signals:
+    void sig_finished(const DiffJob& job);
+
+public:
+    static DiffWorker* instance();
+    void shutdown();
+
+    static QStringList split_lines(const QString& text);
+    static QStringList read_base(const QString& filename, bool use_git, bool* ok);
+    static void compute(DiffJob& job);
+
+public slots:
+    void run(DiffJob job);
+
+private:
+    QThread* thread;
+    DiffWorker();
+};
+
+
+// 行号栏的差异标记，每个文档一个(复制的编辑器共享)。文档修改时只把受影响的行
+// 连同相邻的修改合并为一个dirty范围，基准中对应的范围由前面各处修改的行数差推算；
+// 停止输入DELAY毫秒后只在后台重新比较这些范围，所以大文件中打字时的开销与文件长度无关
+class DiffGutter : public QObject
+{
+    Q_OBJECT
+public:
+    enum Mark { NONE, ADDED, MODIFIED, DELETED };
+    static const int DELAY = 250;
+
+    static DiffGutter* for_document(QTextDocument* document);
+
+    // 在后台读入基准并和当前内容比较，保存、重新加载、改名后再调用一次
+    void set_file(const QString& filename, bool use_git);
+    void set_base_text(const QStringList& base);
+    void clear();
+    bool has_base() const { return _has_base; }
+
+    Mark mark(int block_nb) const;
+    const QVector<GutterHunk>& changes() const { return hunks; }
+
+    // 当前所有dirty范围的比较任务
+    DiffJob dirty_job();
+
+signals:
+    void sig_changed();
+
+public slots:
+    void diff_finished(const DiffJob& job);
+
+private slots:
+    void contents_change(int position, int removed, int added);
+    void start_diff();
+
+private:
+    QTextDocument* document;
+    quint64 id;
+    QTimer* timer;
+    bool _has_base;
+    QStringList base;
+    QString filename;
+    bool use_git;
+    // 按new_start排序，互不重叠
+    QVector<GutterHunk> hunks;
+    int blocks;
+    int revision;
+    // 每次编辑加一，比较结果的serial不一致时丢弃
+    int serial;
+    int base_serial;
+    bool running;
+    bool loading;
+
+    DiffGutter(QTextDocument* document);
+    QStringList block_lines(int first, int count) const;
+    void mark_all_dirty();
+};
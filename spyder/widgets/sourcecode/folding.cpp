@@ -0,0 +1,261 @@
+#include "folding.h"
+
+#include <algorithm>
+
+FoldIndex* FoldIndex::for_document(QTextDocument *document)
+{
+    FoldIndex* index = document->findChild<FoldIndex*>(QString(), Qt::FindDirectChildrenOnly);
+    if (index == nullptr)
+        index = new FoldIndex(document);
+    return index;
+}
+
+FoldIndex::FoldIndex(QTextDocument *document)
+    : QObject (document)
+{
+    this->document = document;
+    levels.reserve(document->blockCount());
+    for (QTextBlock block = document->begin(); block.isValid(); block = block.next())
+        levels.append(compute_level(block.text()));
+    connect(document, SIGNAL(contentsChange(int,int,int)),
+            this, SLOT(contents_change(int,int,int)));
+}
+
+int FoldIndex::compute_level(const QString &text)
+{
+    int column = 0;
+    foreach (const QChar& ch, text) {
+        if (ch == ' ')
+            column++;
+        else if (ch == '\t')
+            column = (column / 8 + 1) * 8;
+        else
+            return column;
+    }
+    return -1;
+}
+
+int FoldIndex::level(int block_nb) const
+{
+    if (block_nb < 0 || block_nb >= levels.size())
+        return -1;
+    return levels[block_nb];
+}
+
+bool FoldIndex::is_continuation(const QTextBlock &block) const
+{
+    QTextBlock previous = block.previous();
+    return previous.isValid() && previous.userState() > 0;
+}
+
+// 只看后面第一个非空行，绘制折叠栏时对每个可见块调用
+bool FoldIndex::is_fold_start(const QTextBlock &block) const
+{
+    int block_nb = block.blockNumber();
+    int base = this->level(block_nb);
+    if (base < 0 || this->is_continuation(block))
+        return false;
+    int nb = block_nb;
+    for (QTextBlock next = block.next(); next.isValid(); next = next.next()) {
+        nb++;
+        if (this->is_continuation(next))
+            return true;
+        int level = this->level(nb);
+        if (level >= 0)
+            return level > base;
+    }
+    return false;
+}
+
+// 折叠区域的最后一块(不含末尾的空行)，不是折叠起点时返回-1
+int FoldIndex::fold_end(const QTextBlock &block) const
+{
+    int block_nb = block.blockNumber();
+    int base = this->level(block_nb);
+    if (base < 0 || this->is_continuation(block))
+        return -1;
+    int last = block_nb;
+    int nb = block_nb;
+    for (QTextBlock next = block.next(); next.isValid(); next = next.next()) {
+        nb++;
+        if (this->is_continuation(next)) {
+            last = nb;
+            continue;
+        }
+        int level = this->level(nb);
+        if (level < 0)
+            continue;
+        if (level <= base)
+            break;
+        last = nb;
+    }
+    return last > block_nb ? last : -1;
+}
+
+int FoldIndex::find_folded(int block_nb) const
+{
+    FoldRange key;
+    key.start = block_nb;
+    auto it = std::lower_bound(folded.begin(), folded.end(), key);
+    if (it != folded.end() && it->start == block_nb)
+        return int(it - folded.begin());
+    return -1;
+}
+
+bool FoldIndex::is_folded(int block_nb) const
+{
+    return this->find_folded(block_nb) >= 0;
+}
+
+// 显示时跳过仍然折叠着的嵌套区域。只通知布局重新计算这些块，不产生contentsChange
+void FoldIndex::set_visible(int first, int last, bool visible)
+{
+    if (first > last)
+        return;
+    QTextBlock block = document->findBlockByNumber(first);
+    if (!block.isValid())
+        return;
+    int start_pos = block.position();
+    QTextBlock end_block = block;
+    int nb = first;
+    while (block.isValid() && nb <= last) {
+        block.setVisible(visible);
+        end_block = block;
+        int inner = visible ? this->find_folded(nb) : -1;
+        if (inner >= 0 && folded[inner].end > nb) {
+            int skip_to = qMin(folded[inner].end, last);
+            end_block = document->findBlockByNumber(skip_to);
+            block = end_block.next();
+            nb = skip_to + 1;
+            continue;
+        }
+        block = block.next();
+        nb++;
+    }
+    document->markContentsDirty(start_pos, end_block.position() + end_block.length() - start_pos);
+}
+
+void FoldIndex::fold(const QTextBlock &block)
+{
+    int block_nb = block.blockNumber();
+    if (this->is_folded(block_nb))
+        return;
+    int end = this->fold_end(block);
+    if (end < 0)
+        return;
+    FoldRange range;
+    range.start = block_nb;
+    range.end = end;
+    folded.insert(std::lower_bound(folded.begin(), folded.end(), range), range);
+    this->set_visible(block_nb + 1, end, false);
+    emit sig_folding_changed();
+}
+
+void FoldIndex::unfold(int block_nb)
+{
+    int index = this->find_folded(block_nb);
+    if (index < 0)
+        return;
+    FoldRange range = folded.takeAt(index);
+    this->set_visible(range.start + 1, range.end, true);
+    emit sig_folding_changed();
+}
+
+void FoldIndex::toggle(const QTextBlock &block)
+{
+    if (this->is_folded(block.blockNumber()))
+        this->unfold(block.blockNumber());
+    else
+        this->fold(block);
+}
+
+void FoldIndex::unfold_all()
+{
+    if (folded.isEmpty())
+        return;
+    int first = folded.first().start + 1;
+    int last = first;
+    foreach (const FoldRange& range, folded)
+        last = qMax(last, range.end);
+    folded.clear();
+    this->set_visible(first, last, true);
+    emit sig_folding_changed();
+}
+
+// 展开包含该块的所有区域，例如光标跳到了被折叠的行上
+void FoldIndex::reveal(int block_nb)
+{
+    QVector<int> starts;
+    foreach (const FoldRange& range, folded) {
+        if (range.start < block_nb && block_nb <= range.end)
+            starts.append(range.start);
+    }
+    // 从外层到内层
+    foreach (int start, starts)
+        this->unfold(start);
+}
+
+QTextBlock FoldIndex::next_visible_block(const QTextBlock &block) const
+{
+    if (folded.isEmpty())
+        return block.next();
+    int index = this->find_folded(block.blockNumber());
+    if (index < 0)
+        return block.next();
+    return document->findBlockByNumber(folded[index].end + 1);
+}
+
+void FoldIndex::contents_change(int position, int removed, int added)
+{
+    Q_UNUSED(removed);
+    QTextBlock first = document->findBlock(position);
+    if (!first.isValid())
+        first = document->lastBlock();
+    int first_nb = first.blockNumber();
+    int delta = document->blockCount() - levels.size();
+    int at = qMin(first_nb + 1, levels.size());
+    if (delta > 0)
+        levels.insert(at, delta, -1);
+    else if (delta < 0)
+        levels.remove(at, qMin(-delta, levels.size() - at));
+
+    // 修改落在折叠区域内(或在标题行上增删了行)时展开该区域，之后的区域平移
+    QVector<FoldRange> revealed;
+    int keep = 0;
+    for (int i = 0; i < folded.size(); i++) {
+        FoldRange range = folded[i];
+        bool drop = false;
+        if (range.start > first_nb) {
+            range.start += delta;
+            range.end += delta;
+            if (range.start <= first_nb) {
+                range.start = first_nb;
+                drop = true;
+            }
+        }
+        else if (range.end >= first_nb && (range.start < first_nb || delta != 0)) {
+            range.end += delta;
+            drop = true;
+        }
+        if (drop)
+            revealed.append(range);
+        else
+            folded[keep++] = range;
+    }
+    folded.resize(keep);
+    std::sort(folded.begin(), folded.end());
+    foreach (const FoldRange& range, revealed)
+        this->set_visible(range.start + 1, qMin(range.end, document->blockCount() - 1), true);
+
+    QTextBlock last = document->findBlock(position + added);
+    if (!last.isValid())
+        last = document->lastBlock();
+    int last_nb = last.blockNumber();
+    QTextBlock block = first;
+    for (int nb = first_nb; block.isValid() && nb <= last_nb; nb++) {
+        levels[nb] = compute_level(block.text());
+        block = block.next();
+    }
+    if (!revealed.isEmpty())
+        emit sig_folding_changed();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <QVector>
+#include <QTextBlock>
+#include <QTextDocument>
+
+// 代码折叠的索引，每个文档一个(复制的编辑器共享同一个文档，也共享折叠状态)。
+// 每个块的折叠级别是缩进的列数，空行为-1；前一块的高亮状态不为0时
+// (多行字符串、多行注释、Markdown代码块)该块属于前面的语句，不参与比较。
+// 文档修改时只重新计算修改涉及的块，已折叠的区域随之平移
+class FoldIndex : public QObject
+{
+    Q_OBJECT
+public:
+    static FoldIndex* for_document(QTextDocument* document);
+
+    int level(int block_nb) const;
+    bool is_fold_start(const QTextBlock& block) const;
+    int fold_end(const QTextBlock& block) const;
+    bool is_folded(int block_nb) const;
+    bool has_folds() const { return !folded.isEmpty(); }
+
+    void fold(const QTextBlock& block);
+    void unfold(int block_nb);
+    void toggle(const QTextBlock& block);
+    void unfold_all();
+    void reveal(int block_nb);
+    QTextBlock next_visible_block(const QTextBlock& block) const;
+
+signals:
+    void sig_folding_changed();
+
+private slots:
+    void contents_change(int position, int removed, int added);
+
+private:
+    struct FoldRange
+    {
+        int start;
+        int end;
+        bool operator<(const FoldRange& other) const { return start < other.start; }
+    };
+
+    QTextDocument* document;
+    QVector<int> levels;
+    // 已折叠的区域，按起点排序，嵌套的区域也分别保存
+    QVector<FoldRange> folded;
+
+    FoldIndex(QTextDocument* document);
+    static int compute_level(const QString& text);
+    bool is_continuation(const QTextBlock& block) const;
+    int find_folded(int block_nb) const;
+    void set_visible(int first, int last, bool visible);
+};
@@ -12,10 +12,14 @@ ANSIEscapeCodeHandler::ANSIEscapeCodeHandler()
                          QStringList({"#c0c0c0", "#ffffff"})};
 
     this->intensity = 0;
+    this->italic = false;
+    this->bold = false;
+    this->underline = false;
     this->foreground_color = -1;
     this->background_color = -1;
     this->default_foreground_color = 30;
     this->default_background_color = 47;
+    this->style_changed = true;
 }
 
 void ANSIEscapeCodeHandler::set_code(int code)
@@ -44,7 +48,25 @@ void ANSIEscapeCodeHandler::set_code(int code)
         this->background_color = code;
     else if (code == 49)
         this->background_color = this->default_background_color;
-    this->set_style();
+    this->style_changed = true;
+}
+
+void ANSIEscapeCodeHandler::set_codes(const QVector<int> &codes)
+{
+    foreach (int code, codes)
+        this->set_code(code);
+}
+
+// 当前状态的紧凑编码，用作格式缓存的键
+quint32 ANSIEscapeCodeHandler::state_key() const
+{
+    quint32 key = quint32(this->foreground_color + 1) & 0xff;
+    key |= (quint32(this->background_color + 1) & 0xff) << 8;
+    key |= quint32(this->intensity & 1) << 16;
+    key |= quint32(this->italic) << 17;
+    key |= quint32(this->bold) << 18;
+    key |= quint32(this->underline) << 19;
+    return key;
 }
 
 void ANSIEscapeCodeHandler::reset()
@@ -56,4 +78,234 @@ void ANSIEscapeCodeHandler::reset()
     this->underline = false;
     this->foreground_color = -1;
     this->background_color = -1;
+    this->style_changed = true;
+}
+
+
+/********** ANSIEscapeCodeParser **********/
+ANSIEscapeCodeParser::ANSIEscapeCodeParser()
+{
+    this->reset();
+}
+
+void ANSIEscapeCodeParser::reset()
+{
+    this->state = Text;
+    this->params.clear();
+}
+
+void ANSIEscapeCodeParser::flush_params(QList<ANSISegment> *segments)
+{
+    QVector<int> codes;
+    // "\x1b[m"等价于"\x1b[0m"
+    if (this->params.isEmpty())
+        codes.append(0);
+    foreach (const QStringRef& param, this->params.splitRef(';')) {
+        bool ok;
+        int code = param.toInt(&ok);
+        if (!ok)
+            break;
+        codes.append(code);
+    }
+    this->params.clear();
+
+    // 相邻的转义序列合并到同一个段中
+    if (segments->isEmpty() || !segments->last().text.isEmpty())
+        segments->append(ANSISegment());
+    segments->last().codes += codes;
+}
+
+static bool is_sgr_params(const QString& params)
+{
+    foreach (const QChar& ch, params) {
+        if (!ch.isDigit() && ch != QLatin1Char(';'))
+            return false;
+    }
+    return true;
+}
+
+void ANSIEscapeCodeParser::feed(const QString &text, QList<ANSISegment> *segments)
+{
+    const QChar* data = text.constData();
+    const int length = text.size();
+    int start = 0;
+
+    auto emit_text = [&](int end) {
+        if (end <= start)
+            return;
+        if (segments->isEmpty())
+            segments->append(ANSISegment());
+        segments->last().text.append(data + start, end - start);
+    };
+
+    for (int i = 0; i < length; i++) {
+        ushort c = data[i].unicode();
+        switch (this->state) {
+        case Text:
+            // \x01和\x02是readline的不可见字符标记，直接丢弃
+            if (c == 0x1b || c == 0x01 || c == 0x02) {
+                emit_text(i);
+                start = i + 1;
+                if (c == 0x1b)
+                    this->state = Escape;
+            }
+            break;
+        case Escape:
+            if (c == '[') {
+                this->state = Csi;
+                this->params.clear();
+            }
+            else
+                this->state = Text;
+            start = i + 1;
+            break;
+        case Csi:
+            // 0x20-0x3F是参数和中间字节，0x40-0x7E是结束字节
+            if (c >= 0x20 && c <= 0x3F)
+                this->params.append(data[i]);
+            else {
+                // 只处理SGR(以'm'结尾并且只含数字和';')，其余CSI序列被忽略，
+                // 如"\x1b[?25l"
+                if (c == 'm' && is_sgr_params(this->params))
+                    this->flush_params(segments);
+                else
+                    this->params.clear();
+                this->state = Text;
+            }
+            start = i + 1;
+            break;
+        }
+    }
+    if (this->state == Text)
+        emit_text(length);
+}
+
+
+/********** ConsoleOutputBuffer **********/
+static int count_lines(const QString& text)
+{
+    return text.count(QLatin1Char('\n'));
+}
+
+ConsoleOutputBuffer::ConsoleOutputBuffer(QObject *parent, int interval)
+    : QObject (parent)
+{
+    this->max_line_count = 0;
+    this->line_count = 0;
+    this->clear_requested = false;
+
+    this->timer = new QTimer(this);
+    this->timer->setSingleShot(true);
+    this->timer->setInterval(interval);
+    connect(this->timer, SIGNAL(timeout()), this, SIGNAL(flush_requested()));
+}
+
+// 0表示不限制缓冲区中保留的行数
+void ConsoleOutputBuffer::set_max_line_count(int count)
+{
+    this->max_line_count = count;
+    this->trim();
+}
+
+void ConsoleOutputBuffer::append(const QString &text, int kind)
+{
+    if (text.isEmpty())
+        return;
+    QString tmp = text;
+
+    // QChar(12) = '\x0c'，清屏之前的输出都不必再插入文档
+    int index = tmp.lastIndexOf(QChar(12));
+    if (index != -1) {
+        this->chunks.clear();
+        this->line_count = 0;
+        this->clear_requested = true;
+        tmp = tmp.mid(index+1);
+    }
+
+    if (!tmp.isEmpty()) {
+        if (!this->chunks.isEmpty() && this->chunks.last().kind == kind)
+            this->chunks.last().text.append(tmp);
+        else
+            this->chunks.append(ConsoleChunk(kind, tmp));
+        this->line_count += count_lines(tmp);
+        this->trim();
+    }
+
+    if (!this->timer->isActive())
+        this->timer->start();
+}
+
+QList<ConsoleChunk> ConsoleOutputBuffer::take(bool *clear_requested)
+{
+    this->timer->stop();
+    if (clear_requested)
+        *clear_requested = this->clear_requested;
+    this->clear_requested = false;
+    this->line_count = 0;
+
+    QList<ConsoleChunk> result;
+    result.swap(this->chunks);
+    return result;
+}
+
+bool ConsoleOutputBuffer::is_empty() const
+{
+    return this->chunks.isEmpty() && !this->clear_requested;
+}
+
+int ConsoleOutputBuffer::pending_line_count() const
+{
+    return this->line_count;
+}
+
+// 丢弃会立即被文档的maximumBlockCount淘汰掉的行，
+// 但保留其中的SGR序列，使得颜色状态不受影响
+void ConsoleOutputBuffer::trim()
+{
+    if (this->max_line_count <= 0)
+        return;
+    QString carried_codes;
+    while (this->line_count > this->max_line_count && !this->chunks.isEmpty()) {
+        ConsoleChunk& head = this->chunks.first();
+        int excess = this->line_count - this->max_line_count;
+        int head_lines = count_lines(head.text);
+
+        QString dropped;
+        if (head_lines <= excess) {
+            dropped = head.text;
+            this->line_count -= head_lines;
+            head.text.clear();
+        }
+        else {
+            int pos = -1;
+            for (int i = 0; i < excess; i++)
+                pos = head.text.indexOf(QLatin1Char('\n'), pos+1);
+            dropped = head.text.left(pos+1);
+            head.text.remove(0, pos+1);
+            this->line_count -= excess;
+        }
+
+        if (head.kind == Output && dropped.contains(QChar(0x1b))) {
+            ANSIEscapeCodeParser parser;
+            QList<ANSISegment> segments;
+            parser.feed(dropped, &segments);
+            QStringList list;
+            foreach (const ANSISegment& segment, segments) {
+                foreach (int code, segment.codes)
+                    list.append(QString::number(code));
+            }
+            if (!list.isEmpty())
+                carried_codes.append(QString("\x1b[%1m").arg(list.join(';')));
+        }
+
+        if (head.text.isEmpty())
+            this->chunks.removeFirst();
+    }
+
+    if (!carried_codes.isEmpty()) {
+        if (!this->chunks.isEmpty() && this->chunks.first().kind == Output)
+            this->chunks.first().text.prepend(carried_codes);
+        else
+            this->chunks.prepend(ConsoleChunk(Output, carried_codes));
+    }
 }
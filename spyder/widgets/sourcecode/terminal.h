@@ -1,6 +1,9 @@
 #pragma once
 
 #include "os.h"
+#include <QHash>
+#include <QTimer>
+#include <QVector>
 #include <QStringList>
 #include <QTextCharFormat>
 
@@ -18,10 +21,70 @@ public:
     int default_foreground_color;
     int default_background_color;
 
+    // set_code只修改状态，格式在get_format时才按需重新生成
+    bool style_changed;
+
     QTextCharFormat current_format;//出现在109行
     ANSIEscapeCodeHandler();
+    virtual ~ANSIEscapeCodeHandler() {}
     void set_code(int code);
+    void set_codes(const QVector<int>& codes);
+    quint32 state_key() const;
     virtual void set_style() = 0;
     void reset();
 };
 
+
+// SGR转义序列的状态机解析器，序列可以跨多次feed被截断
+struct ANSISegment
+{
+    QVector<int> codes;// 在text之前生效的SGR参数
+    QString text;
+};
+
+class ANSIEscapeCodeParser
+{
+public:
+    enum State { Text, Escape, Csi };
+
+    ANSIEscapeCodeParser();
+    void feed(const QString& text, QList<ANSISegment>* segments);
+    void reset();
+private:
+    State state;
+    QString params;
+    void flush_params(QList<ANSISegment>* segments);
+};
+
+
+// 控制台输出缓冲：合并输出块，每帧最多刷新一次文档
+struct ConsoleChunk
+{
+    int kind;
+    QString text;
+    ConsoleChunk(int _kind = 0, const QString& _text = QString())
+        : kind(_kind), text(_text) {}
+};
+
+class ConsoleOutputBuffer : public QObject
+{
+    Q_OBJECT
+signals:
+    void flush_requested();
+public:
+    enum Kind { Output = 0, Error, Prompt };
+
+    ConsoleOutputBuffer(QObject* parent = nullptr, int interval = 16);
+    void set_max_line_count(int count);
+    void append(const QString& text, int kind = Output);
+    QList<ConsoleChunk> take(bool* clear_requested = nullptr);
+    bool is_empty() const;
+    int pending_line_count() const;
+private:
+    QList<ConsoleChunk> chunks;
+    QTimer* timer;
+    int max_line_count;
+    int line_count;
+    bool clear_requested;
+    void trim();
+};
@@ -1,6 +1,10 @@
 #include "widgets_base.h"
 #include "../calltip.h"
 
+#include <QPainter>
+#include <QPainterPath>
+#include <algorithm>
+
 static void insert_text_to(QTextCursor* cursor, QString text, const QTextCharFormat& fmt)
 {
     // QChar(8) = backspace
@@ -16,18 +20,135 @@ static void insert_text_to(QTextCursor* cursor, QString text, const QTextCharFor
     cursor->insertText(text, fmt);
 }
 
+/********** CompletionModel **********/
+CompletionModel::CompletionModel(QObject *parent)
+    : QAbstractListModel (parent)
+{
+    this->show_icons = false;
+    this->filter_case = false;
+}
+
+static bool is_subsequence(const QString& needle, const QString& hay)
+{
+    int j = 0;
+    for (int i = 0; i < needle.size(); ++i) {
+        while (j < hay.size() && hay[j] != needle[i])
+            j++;
+        if (j == hay.size())
+            return false;
+        j++;
+    }
+    return true;
+}
+
+bool any(const QStringList& iterable) {
+    foreach (const QString& element, iterable) {
+        if (!element.isEmpty())
+            return true;
+    }
+    return false;
+}
+
+void CompletionModel::set_completions(const QStringList &completions, const QStringList &types)
+{
+    this->beginResetModel();
+    this->completions = completions;
+    this->types = types;
+    this->show_icons = any(types);
+    this->lowered.clear();
+    this->lowered.reserve(completions.size());
+    foreach (const QString& completion, completions)
+        this->lowered.append(completion.toLower());
+    this->visible.resize(completions.size());
+    for (int i = 0; i < completions.size(); ++i)
+        this->visible[i] = i;
+    this->filter_text.clear();
+    this->endResetModel();
+}
+
+// 补全引擎给出的候选项可能是模糊匹配，所以这里按子序列而不是前缀筛选，保持原有的排序
+void CompletionModel::narrow(const QString &text, bool case_sensitive)
+{
+    bool extends = !filter_text.isEmpty() && case_sensitive == filter_case
+            && text.startsWith(filter_text);
+    QVector<int> source;
+    if (extends)
+        source = visible;
+    else {
+        source.resize(completions.size());
+        for (int i = 0; i < completions.size(); ++i)
+            source[i] = i;
+    }
+
+    QString needle = case_sensitive ? text : text.toLower();
+    QVector<int> narrowed;
+    narrowed.reserve(source.size());
+    foreach (int i, source) {
+        if (is_subsequence(needle, case_sensitive ? completions[i] : lowered[i]))
+            narrowed.append(i);
+    }
+
+    this->beginResetModel();
+    this->visible = narrowed;
+    this->filter_text = text;
+    this->filter_case = case_sensitive;
+    this->endResetModel();
+}
+
+QString CompletionModel::text(int row) const
+{
+    if (row < 0 || row >= visible.size())
+        return QString();
+    return completions[visible[row]];
+}
+
+int CompletionModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return visible.size();
+}
+
+QVariant CompletionModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= visible.size())
+        return QVariant();
+    int i = visible[index.row()];
+    if (role == Qt::DisplayRole)
+        return completions[i];
+    if (role == Qt::DecorationRole && show_icons) {
+        static QHash<QString,QString> icons_map = {{"instance", "attribute"},
+                                                   {"statement", "attribute"},
+                                                   {"method", "method"},
+                                                   {"function", "function"},
+                                                   {"class", "class"},
+                                                   {"module", "module"}};
+        static QHash<QString,QIcon> icons;
+        QString name = icons_map.value(types.value(i), "no_match");
+        if (!icons.contains(name))
+            icons[name] = ima::icon(name);
+        return icons[name];
+    }
+    return QVariant();
+}
+
+
+/********** CompletionWidget **********/
 CompletionWidget::CompletionWidget(TextEditBaseWidget *parent,
                                    QWidget* ancestor)
-    : QListWidget (ancestor)
+    : QListView (ancestor)
 {
     this->setWindowFlags(Qt::SubWindow | Qt::FramelessWindowHint);
     this->textedit = parent;
+    this->model = new CompletionModel(this);
+    this->setModel(model);
+    this->setUniformItemSizes(true);
     this->completion_list = QStringList();
     this->case_sensitive = false;
     this->enter_select = false;
     this->hide();
-    connect(this,SIGNAL(itemActivated(QListWidgetItem *)),
-            this,SLOT(item_selected(QListWidgetItem *)));
+    connect(this,SIGNAL(activated(QModelIndex)),
+            this,SLOT(item_selected(QModelIndex)));
 }
 
 void CompletionWidget::setup_appearance(const QSize &size, const QFont &font)
@@ -36,13 +157,6 @@ void CompletionWidget::setup_appearance(const QSize &size, const QFont &font)
     this->setFont(font);
 }
 
-bool any(const QStringList& iterable) {
-    foreach (const QString& element, iterable) {
-        if (!element.isEmpty())
-            return true;
-    }
-    return false;
-}
 void CompletionWidget::show_list(const QList<QPair<QString, QString> >& completion_list, bool automatic)
 {
     QStringList types, _completion_list;
@@ -56,24 +170,9 @@ void CompletionWidget::show_list(const QList<QPair<QString, QString> >& completi
     }
 
     this->completion_list = _completion_list;
-    this->clear();
-
-    QHash<QString,QString> icons_map = {{"instance", "attribute"},
-                                        {"statement", "attribute"},
-                                        {"method", "method"},
-                                        {"function", "function"},
-                                        {"class", "class"},
-                                        {"module", "module"}};
     this->type_list = types;
-    if (any(types)) {
-        for (int i = 0; i<std::min(_completion_list.size(), types.size()); ++i) {
-            QString icon = icons_map.value(types[i],"no_match");
-            this->addItem(new QListWidgetItem(ima::icon(icon),_completion_list[i]));
-        }
-    }
-    else
-        this->addItems(_completion_list);
-    setCurrentRow(0);
+    this->model->set_completions(_completion_list, types);
+    this->setCurrentIndex(this->model->index(0));
 
     QApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
     this->show();
@@ -149,7 +248,7 @@ void CompletionWidget::keyPressEvent(QKeyEvent *event)
     }
     else if ((key==Qt::Key_Up || key==Qt::Key_Down || key==Qt::Key_PageUp || key==Qt::Key_PageDown ||
               key==Qt::Key_Home || key==Qt::Key_End || key==Qt::Key_CapsLock) && !modifier) {
-        QListWidget::keyPressEvent(event);
+        QListView::keyPressEvent(event);
     }
     else if (text.size() || key==Qt::Key_Backspace) {
         this->textedit->keyPressEvent(event);
@@ -160,7 +259,7 @@ void CompletionWidget::keyPressEvent(QKeyEvent *event)
     }
     else {
         this->hide();
-        QListWidget::keyPressEvent(event);
+        QListView::keyPressEvent(event);
     }
 }
 
@@ -168,23 +267,13 @@ void CompletionWidget::update_current()
 {
     QString completion_text = this->textedit->completion_text;
     if (!completion_text.isEmpty()) {
-        bool break_flag = true;
-        for (int i = 0; i < this->completion_list.size(); ++i) {
-            QString completion = this->completion_list[i];
-            if (!this->case_sensitive) {
-                qDebug() << completion_text;
-                completion = completion.toLower();
-                completion_text = completion_text.toLower();
-            }
-            if (completion.startsWith(completion_text)) {
-                this->setCurrentRow(i);
-                this->scrollTo(this->currentIndex(),
-                               QAbstractItemView::PositionAtTop);
-                break_flag = false;
-                break;
-            }
+        this->model->narrow(completion_text, this->case_sensitive);
+        if (this->model->rowCount() > 0) {
+            this->setCurrentIndex(this->model->index(0));
+            this->scrollTo(this->currentIndex(),
+                           QAbstractItemView::PositionAtTop);
         }
-        if (break_flag)
+        else
             this->hide();
     }
     else
@@ -202,11 +291,12 @@ void CompletionWidget::focusOutEvent(QFocusEvent *event)
 #endif
 }
 
-void CompletionWidget::item_selected(QListWidgetItem *item)
+void CompletionWidget::item_selected(const QModelIndex &index)
 {
-    if (item == nullptr)
-        item = this->currentItem();
-    this->textedit->insert_completion(item->text());
+    int row = index.isValid() ? index.row() : this->currentIndex().row();
+    QString text = this->model->text(row);
+    if (!text.isEmpty())
+        this->textedit->insert_completion(text);
     this->hide();
 }
 
@@ -216,11 +306,12 @@ TextEditBaseWidget::TextEditBaseWidget(QWidget* parent)
     : BaseEditMixin<QPlainTextEdit> (parent)
 {
     BRACE_MATCHING_SCOPE = QPair<QString,QString>("sof","eof");
+    brace_line_limit = 0;
     cell_separators = QStringList();
 
     this->setAttribute(Qt::WA_DeleteOnClose);
 
-    this->extra_selections_dict = QHash<QString,QList<QTextEdit::ExtraSelection>>();
+    this->watch_document();
 
     connect(this,SIGNAL(textChanged()),this,SLOT(changed()));
     connect(this,SIGNAL(cursorPositionChanged()),
@@ -307,13 +398,15 @@ void TextEditBaseWidget::set_palette(const QColor &background, const QColor &for
 }
 
 //------Extra selections
+// 装饰按层保存为排序的区间，绘制时只画与可见块相交的部分(见paintEvent)。
+// 修改某一层时只重绘该层修改前后所在的区域，
+// 只有含前景色的装饰(例如Ctrl+单击的链接)才通过setExtraSelections交给Qt绘制
 int TextEditBaseWidget::extra_selection_length(const QString& key)
 {
-    QList<QTextEdit::ExtraSelection> selection = this->get_extra_selections(key);
-    if (!selection.isEmpty()) {
-        QTextCursor cursor = this->extra_selections_dict[key][0].cursor;
-        int selection_length = cursor.selectionEnd() - cursor.selectionStart();
-        return selection_length;
+    DecorationLayer& layer = this->decoration_layer(key);
+    if (!layer.isEmpty()) {
+        const Decoration& decoration = layer.items().first();
+        return decoration.end - decoration.start;
     }
     else
         return 0;
@@ -321,38 +414,247 @@ int TextEditBaseWidget::extra_selection_length(const QString& key)
 
 QList<QTextEdit::ExtraSelection> TextEditBaseWidget::get_extra_selections(const QString& key)
 {
-    return this->extra_selections_dict.value(key,QList<QTextEdit::ExtraSelection>());
+    return this->decoration_layer(key).to_extra_selections(this->document());
+}
+
+DecorationLayer& TextEditBaseWidget::decoration_layer(const QString &key)
+{
+    for (int i = 0; i < this->decoration_layers.size(); i++) {
+        if (this->decoration_layers[i].key == key)
+            return this->decoration_layers[i];
+    }
+    // 当前单元格画在最下面，其次是当前行，其余的层按创建顺序
+    int index = this->decoration_layers.size();
+    if (key == "current_cell")
+        index = 0;
+    else if (key == "current_line")
+        index = (!this->decoration_layers.isEmpty() &&
+                 this->decoration_layers[0].key == "current_cell") ? 1 : 0;
+    this->decoration_layers.insert(index, DecorationLayer(key));
+    return this->decoration_layers[index];
 }
 
 void TextEditBaseWidget::set_extra_selections(const QString &key, QList<QTextEdit::ExtraSelection> extra_selections)
 {
-    this->extra_selections_dict[key] = extra_selections;
-    // this->extra_selections_dict = OrderedDict
-    // TODO实现OrderedDict,具体实现位于odictobject.c，用到了双向链表+字典
+    QVector<Decoration> items;
+    items.reserve(extra_selections.size());
+    foreach (const QTextEdit::ExtraSelection& selection, extra_selections)
+        items.append(DecorationLayer::from_selection(selection));
+
+    DecorationLayer& layer = this->decoration_layer(key);
+    if (items == layer.items())
+        return;
+    if (!layer.dirty)
+        this->pending_decoration_region += this->decoration_region(layer);
+    layer.set(items);
 }
 
-void TextEditBaseWidget::update_extra_selections()
+void TextEditBaseWidget::append_extra_selection(const QString &key, const QTextEdit::ExtraSelection &selection)
 {
-    QList<QTextEdit::ExtraSelection> extra_selections;
-    if (this->extra_selections_dict.contains("current_cell"))
-        extra_selections.append(this->extra_selections_dict["current_cell"]);
-    if (this->extra_selections_dict.contains("current_line"))
-        extra_selections.append(this->extra_selections_dict["current_line"]);
+    this->decoration_layer(key).append(DecorationLayer::from_selection(selection));
+}
 
-    for (auto it = this->extra_selections_dict.begin(); it!=this->extra_selections_dict.end(); ++it) {
-        if (!(it.key()=="current_line" || it.key()=="current_cell"))
-            extra_selections.append(it.value());
+void TextEditBaseWidget::update_extra_selections()
+{
+    bool foreground_dirty = false;
+    for (int i = 0; i < this->decoration_layers.size(); i++) {
+        DecorationLayer& layer = this->decoration_layers[i];
+        if (!layer.dirty)
+            continue;
+        this->pending_decoration_region += this->decoration_region(layer);
+        foreground_dirty = foreground_dirty || layer.foreground_dirty;
+        layer.dirty = false;
+        layer.foreground_dirty = false;
+    }
+    if (foreground_dirty) {
+        QList<QTextEdit::ExtraSelection> extra_selections;
+        foreach (const DecorationLayer& layer, this->decoration_layers) {
+            if (layer.has_foreground())
+                extra_selections.append(layer.to_extra_selections(this->document(), true));
+        }
+        //下面这一行代码用来使光标所在处单词呈现ctrlclick_color颜色
+        this->setExtraSelections(extra_selections);
+    }
+    if (!this->pending_decoration_region.isEmpty()) {
+        this->viewport()->update(this->pending_decoration_region);
+        this->pending_decoration_region = QRegion();
     }
-    //下面这一行代码用来使光标所在处单词呈现occurrence_color颜色
-    this->setExtraSelections(extra_selections);
 }
 
 void TextEditBaseWidget::clear_extra_selections(const QString &key)
 {
-    this->extra_selections_dict[key] = QList<QTextEdit::ExtraSelection>();
+    DecorationLayer& layer = this->decoration_layer(key);
+    if (!layer.isEmpty()) {
+        if (!layer.dirty)
+            this->pending_decoration_region += this->decoration_region(layer);
+        layer.clear();
+    }
     this->update_extra_selections();
 }
 
+// 装饰的位置是整数，文档修改时自己平移。复制的编辑器调用setDocument后要重新连接
+void TextEditBaseWidget::watch_document()
+{
+    connect(this->document(), SIGNAL(contentsChange(int,int,int)),
+            this, SLOT(shift_decorations(int,int,int)), Qt::UniqueConnection);
+}
+
+void TextEditBaseWidget::shift_decorations(int position, int removed, int added)
+{
+    // 只修改了格式(setCharFormat)或等长替换时位置不变
+    if (removed == added)
+        return;
+    for (int i = 0; i < this->decoration_layers.size(); i++)
+        this->decoration_layers[i].shift(position, removed, added);
+}
+
+QVector<ViewportBlock> TextEditBaseWidget::viewport_blocks()
+{
+    QVector<ViewportBlock> blocks;
+    QTextBlock block = this->firstVisibleBlock();
+    if (!block.isValid())
+        return blocks;
+    QRectF rect = this->blockBoundingGeometry(block).translated(this->contentOffset());
+    int height = this->viewport()->height();
+    while (block.isValid() && rect.top() <= height) {
+        if (block.isVisible()) {
+            ViewportBlock item;
+            item.block = block;
+            item.rect = rect;
+            blocks.append(item);
+        }
+        block = this->next_visible_block(block);
+        rect = QRectF(rect.left(), rect.top() + rect.height(),
+                      rect.width(), this->blockBoundingRect(block).height());
+    }
+    return blocks;
+}
+
+// 装饰在视口中的矩形，每个文本行一个。full_width为true时，
+// 跨过行尾的装饰延伸到视口右边，空的装饰占据光标所在的整行
+QVector<QRectF> TextEditBaseWidget::decoration_rects(const Decoration &decoration,
+                                                     const QVector<ViewportBlock> &blocks,
+                                                     bool full_width)
+{
+    QVector<QRectF> rects;
+    if (blocks.isEmpty())
+        return rects;
+    qreal right = this->viewport()->width();
+
+    // 找到包含start的块
+    int lo = 0, hi = blocks.size() - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (blocks[mid].block.position() <= decoration.start)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    for (int i = lo; i < blocks.size(); i++) {
+        const QTextBlock& block = blocks[i].block;
+        int block_pos = block.position();
+        if (block_pos > decoration.end)
+            break;
+        QTextLayout* layout = block.layout();
+        QPointF origin = blocks[i].rect.topLeft() + layout->position();
+        for (int j = 0; j < layout->lineCount(); j++) {
+            QTextLine line = layout->lineAt(j);
+            int line_start = block_pos + line.textStart();
+            int line_end = line_start + line.textLength();
+            qreal top = origin.y() + line.y();
+            if (decoration.start == decoration.end) {
+                bool last_line = j == layout->lineCount() - 1;
+                if (full_width && decoration.start >= line_start &&
+                        (decoration.start < line_end || (last_line && decoration.start == line_end)))
+                    rects.append(QRectF(0, top, right, line.height()));
+                continue;
+            }
+            if (decoration.end <= line_start || decoration.start > line_end)
+                continue;
+            qreal x1 = origin.x() + line.cursorToX(qMax(decoration.start, line_start) - block_pos);
+            qreal x2 = origin.x() + line.cursorToX(qMin(decoration.end, line_end) - block_pos);
+            if (full_width && decoration.end > line_end) {
+                x2 = right;
+                if (decoration.start <= line_start)
+                    x1 = 0;
+            }
+            if (x2 > x1)
+                rects.append(QRectF(x1, top, x2 - x1, line.height()));
+        }
+    }
+    return rects;
+}
+
+QRegion TextEditBaseWidget::decoration_region(const DecorationLayer &layer)
+{
+    QRegion region;
+    if (layer.isEmpty())
+        return region;
+    QVector<ViewportBlock> blocks = this->viewport_blocks();
+    if (blocks.isEmpty())
+        return region;
+    int from = blocks.first().block.position();
+    int to = blocks.last().block.position() + blocks.last().block.length();
+    foreach (int index, layer.visible(from, to)) {
+        const Decoration& decoration = layer.items()[index];
+        bool full_width = decoration.format.boolProperty(QTextFormat::FullWidthSelection);
+        foreach (const QRectF& rect, this->decoration_rects(decoration, blocks, full_width))
+            region += rect.toAlignedRect().adjusted(0, 0, 0, 1);
+    }
+    return region;
+}
+
+void TextEditBaseWidget::paint_decorations(QPainter *painter, const QRect &rect, bool underlines)
+{
+    QVector<ViewportBlock> blocks = this->viewport_blocks();
+    if (blocks.isEmpty())
+        return;
+    int from = blocks.first().block.position();
+    int to = blocks.last().block.position() + blocks.last().block.length();
+    foreach (const DecorationLayer& layer, this->decoration_layers) {
+        foreach (int index, layer.visible(from, to)) {
+            const Decoration& decoration = layer.items()[index];
+            if (DecorationLayer::is_foreground(decoration))
+                continue;
+            const QTextCharFormat& format = decoration.format;
+            if (underlines) {
+                int style = format.intProperty(QTextFormat::TextUnderlineStyle);
+                if (style == QTextCharFormat::NoUnderline)
+                    continue;
+                QColor color = format.colorProperty(QTextFormat::TextUnderlineColor);
+                painter->setPen(QPen(color, 1));
+                foreach (const QRectF& r, this->decoration_rects(decoration, blocks, false)) {
+                    if (!r.intersects(rect))
+                        continue;
+                    qreal y = r.bottom() - 1.5;
+                    if (style == QTextCharFormat::WaveUnderline ||
+                            style == QTextCharFormat::SpellCheckUnderline) {
+                        QPainterPath path(QPointF(r.left(), y));
+                        bool up = true;
+                        for (qreal x = r.left() + 2; x < r.right() + 2; x += 2) {
+                            path.lineTo(x, up ? y - 2 : y);
+                            up = !up;
+                        }
+                        painter->drawPath(path);
+                    }
+                    else
+                        painter->drawLine(QPointF(r.left(), y), QPointF(r.right(), y));
+                }
+            }
+            else {
+                QBrush background = format.background();
+                if (background.style() == Qt::NoBrush)
+                    continue;
+                bool full_width = format.boolProperty(QTextFormat::FullWidthSelection);
+                foreach (const QRectF& r, this->decoration_rects(decoration, blocks, full_width)) {
+                    if (r.intersects(rect))
+                        painter->fillRect(r, background);
+                }
+            }
+        }
+    }
+}
+
 void TextEditBaseWidget::changed()
 {
     emit this->modificationChanged(this->document()->isModified());
@@ -415,65 +717,52 @@ void TextEditBaseWidget::unhighlight_current_cell()
 }
 
 //------Brace matching
+// 从position处的括号开始逐个文本块计数嵌套层数，不复制到文件首尾的文本。
+// 范围是"sol"/"eol"时只在当前行中查找；长行保护打开时遇到超过brace_line_limit的行就停止
 int TextEditBaseWidget::find_brace_match(int position,
                                           QChar brace, bool forward)
 {
-    QString start_pos = this->BRACE_MATCHING_SCOPE.first;
-    QString end_pos = this->BRACE_MATCHING_SCOPE.second;
     QHash<QChar,QChar> bracemap;
-    QString text;
-    int i_start_open, i_start_close;
-    if (forward) {
-        bracemap['('] = ')';
-        bracemap['['] = ']';
-        bracemap['{'] = '}';
-        text = this->get_text(position,end_pos);
-        i_start_open = 1;
-        i_start_close = 1;
-    }
-    else {
-        bracemap[')'] = '(';
-        bracemap[']'] = '[';
-        bracemap['}'] = '{';
-        text = this->get_text(start_pos,position);
-        i_start_open = text.size()-1;
-        i_start_close = text.size()-1;
-    }
-
-    while (true) {
-        int i_close, i_open;
-        if (forward)
-            i_close = text.indexOf(bracemap[brace], i_start_close);
-        else
-            // python中str.rfind(char,0,len)对应qstring.lastIndexOf(char,len-1);
-            i_close = text.lastIndexOf(bracemap[brace], i_start_close);
-        if (i_close > -1) {
-            if (forward) {
-                i_start_close = i_close+1;
-                i_open = text.left(i_close).indexOf(brace, i_start_open);
-            }
-            else {
-                i_start_close = i_close-1;
-                i_open = text.lastIndexOf(brace, i_start_open);
-                if (i_open < i_close)
-                    i_open = -1;
-            }
-            if (i_open > -1) {
-                if (forward)
-                    i_start_open = i_open+1;
-                else
-                    i_start_open = i_open-1;
+    bracemap['('] = ')';
+    bracemap['['] = ']';
+    bracemap['{'] = '}';
+    bracemap[')'] = '(';
+    bracemap[']'] = '[';
+    bracemap['}'] = '{';
+    QChar match = bracemap.value(brace);
+    bool whole_document = (this->BRACE_MATCHING_SCOPE.first == "sof");
+
+    QTextBlock block = this->document()->findBlock(position);
+    int offset = position - block.position();
+    int depth = 0;
+    while (block.isValid()) {
+        if (this->brace_line_limit > 0 && block.length() > this->brace_line_limit)
+            return -1;
+        QString text = block.text();
+        if (forward) {
+            for (int i = offset; i < text.size(); i++) {
+                if (text[i] == brace)
+                    depth++;
+                else if (text[i] == match && --depth == 0)
+                    return block.position() + i;
             }
-            else {
-                if (forward)
-                    return position+i_close;
-                else
-                    return position-(text.size()-i_close);
+            block = block.next();
+            offset = 0;
+        }
+        else {
+            for (int i = qMin(offset, text.size() - 1); i >= 0; i--) {
+                if (text[i] == brace)
+                    depth++;
+                else if (text[i] == match && --depth == 0)
+                    return block.position() + i;
             }
+            block = block.previous();
+            offset = block.length();
         }
-        else
-            return -1;
+        if (!whole_document)
+            break;
     }
+    return -1;
 }
 
 void TextEditBaseWidget::__highlight(const QList<int> &positions, QColor color, bool cancel)
@@ -508,6 +797,9 @@ void TextEditBaseWidget::cursor_position_changed()
     QTextCursor cursor = this->textCursor();
     if (cursor.position() == 0)
         return;
+    // 光标所在的行太长时不匹配
+    if (this->brace_line_limit > 0 && cursor.block().length() > this->brace_line_limit)
+        return;
     cursor.movePosition(QTextCursor::PreviousCharacter,
                         QTextCursor::KeepAnchor);
     QString text = cursor.selectedText();
@@ -705,6 +997,19 @@ QString TextEditBaseWidget::get_last_cell_as_executable_code()
     return text;
 }
 
+QVector<int> TextEditBaseWidget::cell_separator_blocks()
+{
+    // 没有语法高亮器维护的索引时逐块扫描，CodeEditor中重写
+    QVector<int> blocks;
+    if (this->cell_separators.isEmpty())
+        return blocks;
+    for (QTextBlock block = this->document()->begin(); block.isValid(); block = block.next()) {
+        if (startswith(lstrip(block.text()),this->cell_separators))
+            blocks.append(block.blockNumber());
+    }
+    return blocks;
+}
+
 bool TextEditBaseWidget::is_cell_separator(const QTextCursor &cursor, const QTextBlock &block)
 {
     // Return True if cursor (or text block) is on a block separator
@@ -714,18 +1019,28 @@ bool TextEditBaseWidget::is_cell_separator(const QTextCursor &cursor, const QTex
     //当光标点击超过当前行号的区域，下面这行代码会导致程序异常结束
     Q_ASSERT(!cursor.isNull() || block.isValid());
     // A null cursor is created by the default constructor.
-    QString text;
-    if (!cursor.isNull()) {
-        QTextCursor cursor0 = QTextCursor(cursor);
-        cursor0.select(QTextCursor::BlockUnderCursor);
-        text = cursor0.selectedText();
-    }
-    else
-        text = block.text();
     if (this->cell_separators.isEmpty())
         return false;
-    else
-        return startswith(lstrip(text),this->cell_separators);
+    int block_nb = !cursor.isNull() ? cursor.blockNumber() : block.blockNumber();
+    QVector<int> blocks = this->cell_separator_blocks();
+    return std::binary_search(blocks.begin(), blocks.end(), block_nb);
+}
+
+// 查找光标所在单元格前后的分隔行(没有时为-1)。
+// 光标在分隔行上时先跳到后面第一个非分隔行，跳到文件末尾时返回false
+static bool find_cell(const QVector<int>& blocks, int block_count,
+                      int* block_nb, int* prev_sep, int* next_sep)
+{
+    auto it = std::lower_bound(blocks.begin(), blocks.end(), *block_nb);
+    while (it != blocks.end() && *it == *block_nb) {
+        if (*block_nb + 1 >= block_count)
+            return false;
+        ++*block_nb;
+        ++it;
+    }
+    *prev_sep = it == blocks.begin() ? -1 : *(it-1);
+    *next_sep = it == blocks.end() ? -1 : *it;
+    return true;
 }
 
 QPair<QTextCursor,bool> TextEditBaseWidget::select_current_cell()
@@ -733,99 +1048,79 @@ QPair<QTextCursor,bool> TextEditBaseWidget::select_current_cell()
     // returns the textCursor and a boolean indicating if the
     // entire file is selected
     QTextCursor cursor = this->textCursor();
-    cursor.movePosition(QTextCursor::StartOfBlock);
-    int cur_pos = cursor.position(), prev_pos = cursor.position();
-
-    while (this->is_cell_separator(cursor)) {
-        cursor.movePosition(QTextCursor::NextBlock);
-        prev_pos = cur_pos;
-        cur_pos = cursor.position();
-        if (cur_pos == prev_pos)
-            return qMakePair(cursor,false);
-    }
-    prev_pos = cur_pos;
-
-    while (!this->is_cell_separator(cursor)) {
-        cursor.movePosition(QTextCursor::PreviousBlock);
-        prev_pos = cur_pos;
-        cur_pos = cursor.position();
-        if (cur_pos == prev_pos) {
-            if (this->is_cell_separator(cursor))
-                return qMakePair(cursor,false);
-            else
-                break;
-        }
-    }
-    cursor.setPosition(prev_pos);
-    bool cell_at_file_start = cursor.atStart();
-
-    while (!this->is_cell_separator(cursor)) {
-        cursor.movePosition(QTextCursor::NextBlock,
-                            QTextCursor::KeepAnchor);
-        cur_pos = cursor.position();
-        if (cur_pos == prev_pos) {
-            cursor.movePosition(QTextCursor::EndOfBlock,
-                                QTextCursor::KeepAnchor);
-            break;
-        }
-        prev_pos = cur_pos;
-    }
-    bool cell_at_file_end = cursor.atEnd();
+    QTextDocument* doc = this->document();
+    int block_nb = cursor.blockNumber();
+    int prev_sep, next_sep;
+    if (!find_cell(this->cell_separator_blocks(), doc->blockCount(),
+                   &block_nb, &prev_sep, &next_sep)) {
+        cursor.setPosition(doc->lastBlock().position());
+        return qMakePair(cursor,false);
+    }
+
+    int start_nb = prev_sep + 1;
+    cursor.setPosition(doc->findBlockByNumber(start_nb).position());
+    if (next_sep >= 0)
+        cursor.setPosition(doc->findBlockByNumber(next_sep).position(),
+                           QTextCursor::KeepAnchor);
+    else
+        cursor.movePosition(QTextCursor::End, QTextCursor::KeepAnchor);
+    bool cell_at_file_start = start_nb == 0;
+    bool cell_at_file_end = next_sep < 0;
     return qMakePair(cursor, cell_at_file_start && cell_at_file_end);
 }
 
 CursorBoolBool TextEditBaseWidget::select_current_cell_in_visible_portion()
 {
     QTextCursor cursor = this->textCursor();
-    cursor.movePosition(QTextCursor::StartOfBlock);
-    int cur_pos = cursor.position(), prev_pos = cursor.position();
+    QTextDocument* doc = this->document();
 
     int beg_pos = this->cursorForPosition(QPoint(0,0)).position();
     QPoint bottom_right = QPoint(this->viewport()->width() - 1,
                                  this->viewport()->height() - 1);
     int end_pos = this->cursorForPosition(bottom_right).position();
 
-    while (this->is_cell_separator(cursor)) {
-        cursor.movePosition(QTextCursor::NextBlock);
-        int prev_pos = cur_pos;
-        cur_pos = cursor.position();
-        if (cur_pos == prev_pos)
-            return CursorBoolBool(cursor,false,false);
-    }
-    prev_pos = cur_pos;
-    while (!this->is_cell_separator(cursor)
-           && cursor.position() >= beg_pos) {
-        cursor.movePosition(QTextCursor::PreviousBlock);
-        prev_pos = cur_pos;
-        cur_pos = cursor.position();
-        if (cur_pos == prev_pos) {
-            if (this->is_cell_separator(cursor))
-                return CursorBoolBool(cursor,false,false);
-            else
-                break;
-        }
+    int block_nb = cursor.blockNumber();
+    int prev_sep, next_sep;
+    if (!find_cell(this->cell_separator_blocks(), doc->blockCount(),
+                   &block_nb, &prev_sep, &next_sep)) {
+        cursor.setPosition(doc->lastBlock().position());
+        return CursorBoolBool(cursor,false,false);
+    }
+
+    // 单元格的起点不超出屏幕顶端：first_visible是起点位于beg_pos之后的第一个块
+    QTextBlock beg_block = doc->findBlock(beg_pos);
+    int first_visible = beg_block.blockNumber();
+    if (beg_block.position() < beg_pos)
+        first_visible++;
+    int start_nb;
+    bool cell_at_screen_start;
+    if (block_nb < first_visible) {
+        start_nb = block_nb;
+        cell_at_screen_start = true;
     }
-    bool cell_at_screen_start = cursor.position() <= beg_pos;
-    cursor.setPosition(prev_pos);
-    bool cell_at_file_start = cursor.atStart();
-    if (!cell_at_file_start) {
-        cursor.movePosition(QTextCursor::PreviousBlock);
-        cursor.movePosition(QTextCursor::NextBlock,
-                            QTextCursor::KeepAnchor);
+    else {
+        int stop_nb = qMax(prev_sep, first_visible - 1);
+        start_nb = stop_nb + 1;
+        cell_at_screen_start = stop_nb < 0 ||
+                doc->findBlockByNumber(stop_nb).position() <= beg_pos;
     }
 
-    while (!this->is_cell_separator(cursor)
-           && cursor.position() <= end_pos) {
-        cursor.movePosition(QTextCursor::NextBlock,
-                            QTextCursor::KeepAnchor);
-        cur_pos = cursor.position();
-        if (cur_pos == prev_pos) {
-            cursor.movePosition(QTextCursor::EndOfBlock,
-                                QTextCursor::KeepAnchor);
-            break;
-        }
-        prev_pos = cur_pos;
-    }
+    bool cell_at_file_start = start_nb == 0;
+    // 选中单元格的标题行
+    if (cell_at_file_start)
+        cursor.setPosition(0);
+    else
+        cursor.setPosition(doc->findBlockByNumber(start_nb - 1).position());
+
+    // 终点同样不超出屏幕底端
+    int stop_nb = doc->findBlock(end_pos).blockNumber() + 1;
+    if (next_sep >= 0)
+        stop_nb = qMin(stop_nb, next_sep);
+    if (stop_nb < doc->blockCount())
+        cursor.setPosition(doc->findBlockByNumber(stop_nb).position(),
+                           QTextCursor::KeepAnchor);
+    else
+        cursor.movePosition(QTextCursor::End, QTextCursor::KeepAnchor);
     bool cell_at_file_end = cursor.atEnd();
     bool cell_at_screen_end = cursor.position() >= end_pos;
     return CursorBoolBool(cursor,
@@ -835,36 +1130,28 @@ CursorBoolBool TextEditBaseWidget::select_current_cell_in_visible_portion()
 
 void TextEditBaseWidget::go_to_next_cell()
 {
+    QVector<int> blocks = this->cell_separator_blocks();
+    auto it = std::upper_bound(blocks.begin(), blocks.end(),
+                               this->textCursor().blockNumber());
+    if (it == blocks.end())
+        return;
     QTextCursor cursor = this->textCursor();
-    cursor.movePosition(QTextCursor::NextBlock);
-    int cur_pos = cursor.position(), prev_pos = cursor.position();
-    while (!this->is_cell_separator(cursor)) {
-        cursor.movePosition(QTextCursor::NextBlock);
-        prev_pos = cur_pos;
-        cur_pos = cursor.position();
-        if (cur_pos == prev_pos)
-            return;
-    }
+    cursor.setPosition(this->document()->findBlockByNumber(*it).position());
     this->setTextCursor(cursor);
 }
 
 void TextEditBaseWidget::go_to_previous_cell()
 {
+    QVector<int> blocks = this->cell_separator_blocks();
+    int block_nb = this->textCursor().blockNumber();
+    // 光标在分隔行上时跳到上一个分隔行
+    if (std::binary_search(blocks.begin(), blocks.end(), block_nb))
+        block_nb--;
+    auto it = std::upper_bound(blocks.begin(), blocks.end(), block_nb);
+    if (block_nb < 0 || it == blocks.begin())
+        return;
     QTextCursor cursor = this->textCursor();
-    int cur_pos = cursor.position(), prev_pos = cursor.position();
-
-    if (this->is_cell_separator(cursor)) {
-        cursor.movePosition(QTextCursor::PreviousBlock);
-        cur_pos = prev_pos = cursor.position();
-    }
-
-    while (!this->is_cell_separator(cursor)) {
-        cursor.movePosition(QTextCursor::PreviousBlock);
-        prev_pos = cur_pos;
-        cur_pos = cursor.position();
-        if (cur_pos == prev_pos)
-            return;
-    }
+    cursor.setPosition(this->document()->findBlockByNumber(*(it-1)).position());
     this->setTextCursor(cursor);
 }
 
@@ -887,6 +1174,72 @@ void TextEditBaseWidget::__restore_selection(int start_pos, int end_pos)
     this->setTextCursor(cursor);
 }
 
+// 去掉相同的开头和结尾后剩下的修改，内容相同时返回false
+bool TextEditBaseWidget::line_edit(int block_nb, const QString &before, const QString &after,
+                                   LineEdit *edit)
+{
+    if (before == after)
+        return false;
+    int prefix = 0;
+    int common = qMin(before.size(), after.size());
+    while (prefix < common && before[prefix] == after[prefix])
+        prefix++;
+    int suffix = 0;
+    while (suffix < common - prefix &&
+           before[before.size() - 1 - suffix] == after[after.size() - 1 - suffix])
+        suffix++;
+    edit->block_nb = block_nb;
+    edit->column = prefix;
+    edit->removed = before.size() - prefix - suffix;
+    edit->text = after.mid(prefix, after.size() - prefix - suffix);
+    return true;
+}
+
+// 选中的第一块和最后一块，选区结束于块开头时不包括该块
+QPair<int,int> TextEditBaseWidget::selected_block_range()
+{
+    QTextCursor cursor = this->textCursor();
+    int start_pos = cursor.selectionStart();
+    int end_pos = cursor.selectionEnd();
+    QTextBlock first = this->document()->findBlock(start_pos);
+    QTextBlock last = this->document()->findBlock(end_pos);
+    if (!last.isValid())
+        last = this->document()->lastBlock();
+    int last_nb = last.blockNumber();
+    if (end_pos > start_pos && end_pos == last.position() && last_nb > first.blockNumber())
+        last_nb--;
+    return qMakePair(first.blockNumber(), last_nb);
+}
+
+// edits按块号升序。只用setPosition定位，不做需要布局的光标移动；
+// 修改不含换行符，块号不变，所以只需沿着块向后走一遍
+void TextEditBaseWidget::apply_line_edits(const QVector<LineEdit> &edits)
+{
+    if (edits.isEmpty())
+        return;
+    QTextCursor cursor(this->document());
+    cursor.beginEditBlock();
+    QTextBlock block = this->document()->findBlockByNumber(edits.first().block_nb);
+    int block_nb = edits.first().block_nb;
+    foreach (const LineEdit& edit, edits) {
+        while (block.isValid() && block_nb < edit.block_nb) {
+            block = block.next();
+            block_nb++;
+        }
+        if (!block.isValid())
+            break;
+        int position = block.position() + edit.column;
+        cursor.setPosition(position);
+        if (edit.removed > 0)
+            cursor.setPosition(position + edit.removed, QTextCursor::KeepAnchor);
+        if (edit.text.isEmpty())
+            cursor.removeSelectedText();
+        else
+            cursor.insertText(edit.text);
+    }
+    cursor.endEditBlock();
+}
+
 void TextEditBaseWidget::__duplicate_line_or_selection(bool after_current_line)
 {
     QTextCursor cursor = this->textCursor();
@@ -1342,6 +1695,18 @@ void TextEditBaseWidget::wheelEvent(QWheelEvent *event)
     this->highlight_current_cell();
 }
 
+// 背景在文本之前画，下划线在文本之后画
+void TextEditBaseWidget::paintEvent(QPaintEvent *event)
+{
+    {
+        QPainter painter(this->viewport());
+        this->paint_decorations(&painter, event->rect(), false);
+    }
+    QPlainTextEdit::paintEvent(event);
+    QPainter painter(this->viewport());
+    this->paint_decorations(&painter, event->rect(), true);
+}
+
 
 /********** QtANSIEscapeCodeHandler**********/
 QtANSIEscapeCodeHandler::QtANSIEscapeCodeHandler()
@@ -1366,22 +1731,33 @@ void QtANSIEscapeCodeHandler::set_light_background(bool state)
 void QtANSIEscapeCodeHandler::set_base_format(const QTextCharFormat &base_format)
 {
     this->base_format = base_format;
+    this->format_cache.clear();
+    this->style_changed = true;
 }
 
-QTextCharFormat QtANSIEscapeCodeHandler::get_format() const
+QTextCharFormat QtANSIEscapeCodeHandler::get_format()
 {
+    if (this->style_changed)
+        this->set_style();
     return this->current_format;
 }
 
 void QtANSIEscapeCodeHandler::set_style()
 {
-    if (this->current_format.isEmpty()) {
-        Q_ASSERT(!this->base_format.isEmpty());
-        this->current_format = QTextCharFormat(this->base_format);
+    this->style_changed = false;
+    // 同一组SGR状态只生成一次QTextCharFormat
+    quint32 key = this->state_key();
+    auto it = this->format_cache.constFind(key);
+    if (it != this->format_cache.constEnd()) {
+        this->current_format = it.value();
+        return;
     }
 
+    Q_ASSERT(!this->base_format.isEmpty());
+    this->current_format = QTextCharFormat(this->base_format);
+
     QBrush qcolor;
-    if (this->foreground_color != -1)
+    if (this->foreground_color == -1)
         qcolor = this->base_format.foreground();
     else {
         QString cstr = this->ANSI_COLORS[this->foreground_color-30][this->intensity];
@@ -1389,7 +1765,7 @@ void QtANSIEscapeCodeHandler::set_style()
     }
     this->current_format.setForeground(qcolor);
 
-    if (this->background_color != -1)
+    if (this->background_color == -1)
         qcolor = this->base_format.background();
     else {
         QString cstr = this->ANSI_COLORS[this->background_color-40][this->intensity];
@@ -1402,6 +1778,7 @@ void QtANSIEscapeCodeHandler::set_style()
     font.setBold(this->bold);
     font.setUnderline(this->underline);
     this->current_format.setFont(font);
+    this->format_cache.insert(key, this->current_format);
 }
 
 /********** ConsoleFontStyle **********/
@@ -1445,10 +1822,11 @@ ConsoleBaseWidget::ConsoleBaseWidget(QWidget* parent)
     : TextEditBaseWidget (parent)
 {
     this->BRACE_MATCHING_SCOPE = QPair<QString,QString>("sol", "eol");
-    this->COLOR_PATTERN = QRegularExpression("\\x01?\\x1b\\[(.*?)m\\x02?");
 
     this->light_background = true;
-    this->setMaximumBlockCount(300);
+    this->output_buffer = new ConsoleOutputBuffer(this);
+    connect(this->output_buffer, SIGNAL(flush_requested()), this, SLOT(flush()));
+    this->set_max_line_count(300);
     this->ansi_handler = new QtANSIEscapeCodeHandler;
     this->setUndoRedoEnabled(false);
     connect(this, &ConsoleBaseWidget::userListActivated,
@@ -1494,20 +1872,19 @@ void ConsoleBaseWidget::paste()
 
 void ConsoleBaseWidget::append_text_to_shell(QString text, bool error, bool prompt)
 {
-    QTextCursor cursor = this->textCursor();
-    cursor.movePosition(QTextCursor::End);
     if (text.contains('\r')) {
         text.replace("\r\n", "\n");
         text.replace('\r', '\n');
     }
-    while (true) {
-        // QChar(12) = '\x0c'
-        int index = text.indexOf(QChar(12));
-        if (index == -1)
-            break;
+    // QChar(12) = '\x0c'
+    int index = text.lastIndexOf(QChar(12));
+    if (index != -1) {
         text = text.mid(index+1);
         this->clear();
     }
+    QTextCursor cursor = this->textCursor();
+    cursor.movePosition(QTextCursor::End);
+    cursor.beginEditBlock();
     if (error) {
         bool is_traceback = false;
         foreach (QString tmp, splitlines(text, true)) {
@@ -1524,30 +1901,58 @@ void ConsoleBaseWidget::append_text_to_shell(QString text, bool error, bool prom
     else if (prompt)
         insert_text_to(&cursor, text, this->prompt_style->format);
     else {
-        int last_end = 0;
-        QRegularExpressionMatchIterator iterator = this->COLOR_PATTERN.globalMatch(text);
-        while (iterator.hasNext()) {
-            QRegularExpressionMatch match = iterator.next();
-            insert_text_to(&cursor, text.mid(last_end, match.capturedStart()-last_end),
-                           this->default_style->format);
-            last_end = match.capturedEnd();
-            foreach (QString _c, match.captured(1).split(';')) {
-                bool ok;
-                int code = _c.toInt(&ok);
-                if (ok)
-                    this->ansi_handler->set_code(code);
-                else
-                    break;
+        QList<ANSISegment> segments;
+        this->ansi_parser.feed(text, &segments);
+        foreach (const ANSISegment& segment, segments) {
+            if (!segment.codes.isEmpty()) {
+                this->ansi_handler->set_codes(segment.codes);
+                this->default_style->format = this->ansi_handler->get_format();
             }
-            this->default_style->format = this->ansi_handler->get_format();
+            insert_text_to(&cursor, segment.text, this->default_style->format);
         }
-        insert_text_to(&cursor, text.mid(last_end), this->default_style->format);
     }
+    cursor.endEditBlock();
 
     this->set_cursor_position("eof");
     this->setCurrentCharFormat(this->default_style->format);
 }
 
+// 输出先进入缓冲区，每帧最多刷新一次文档
+void ConsoleBaseWidget::write(const QString &text, bool error, bool prompt)
+{
+    int kind = ConsoleOutputBuffer::Output;
+    if (error)
+        kind = ConsoleOutputBuffer::Error;
+    else if (prompt)
+        kind = ConsoleOutputBuffer::Prompt;
+    this->output_buffer->append(text, kind);
+}
+
+void ConsoleBaseWidget::flush()
+{
+    bool clear_requested = false;
+    QList<ConsoleChunk> chunks = this->output_buffer->take(&clear_requested);
+    if (clear_requested)
+        this->clear();
+    if (chunks.isEmpty())
+        return;
+
+    // 外层的edit block使得整批输出只触发一次布局更新
+    QTextCursor cursor = this->textCursor();
+    cursor.beginEditBlock();
+    foreach (const ConsoleChunk& chunk, chunks)
+        this->append_text_to_shell(chunk.text,
+                                   chunk.kind == ConsoleOutputBuffer::Error,
+                                   chunk.kind == ConsoleOutputBuffer::Prompt);
+    cursor.endEditBlock();
+}
+
+void ConsoleBaseWidget::set_max_line_count(int max_line_count)
+{
+    this->setMaximumBlockCount(max_line_count);
+    this->output_buffer->set_max_line_count(max_line_count);
+}
+
 void ConsoleBaseWidget::set_pythonshell_font(const QFont &font)
 {
     foreach (ConsoleFontStyle* style, this->font_styles) {
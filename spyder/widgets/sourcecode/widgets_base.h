@@ -6,9 +6,36 @@
 
 #include "widgets/mixins.h"
 #include "widgets/sourcecode/terminal.h"
+#include "widgets/sourcecode/decorations.h"
 
 class TextEditBaseWidget;
-class CompletionWidget : public QListWidget
+
+// 补全列表的模型：保存全部候选项，继续输入时只在上一次筛选的结果中查找，
+// 删除字符时才从全部候选项重新筛选
+class CompletionModel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    CompletionModel(QObject* parent = nullptr);
+    void set_completions(const QStringList& completions, const QStringList& types);
+    void narrow(const QString& text, bool case_sensitive);
+    QString text(int row) const;
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+
+private:
+    QStringList completions;
+    QStringList lowered;
+    QStringList types;
+    bool show_icons;
+    QVector<int> visible;
+    QString filter_text;
+    bool filter_case;
+};
+
+
+class CompletionWidget : public QListView
 {
     Q_OBJECT
 public:
@@ -23,10 +50,11 @@ signals:
     void sig_show_completions(const QStringList&);
 public slots:
     void hide();
-    void item_selected(QListWidgetItem *item=nullptr);
+    void item_selected(const QModelIndex& index = QModelIndex());
 
 public:
     TextEditBaseWidget* textedit;
+    CompletionModel* model;
     QStringList completion_list;
     QStringList type_list;
     bool case_sensitive;
@@ -42,6 +70,22 @@ struct CursorBoolBool
     cursor(_cursor),file(_file),portion(_portion){}
 };
 
+// 一行内的修改：把第block_nb块从column开始的removed个字符替换为text(不含换行符)
+struct LineEdit
+{
+    int block_nb;
+    int column;
+    int removed;
+    QString text;
+};
+
+// 视口中可见的文本块及其在视口中的矩形
+struct ViewportBlock
+{
+    QTextBlock block;
+    QRectF rect;
+};
+
 class TextEditBaseWidget : public BaseEditMixin<QPlainTextEdit>
 {
     Q_OBJECT
@@ -67,9 +111,20 @@ public:
     int extra_selection_length(const QString& key);
     QList<QTextEdit::ExtraSelection> get_extra_selections(const QString& key);
     void set_extra_selections(const QString& key,QList<QTextEdit::ExtraSelection> extra_selections);
+    void append_extra_selection(const QString& key,const QTextEdit::ExtraSelection& selection);
     void update_extra_selections();
     void clear_extra_selections(const QString& key);
 
+    DecorationLayer& decoration_layer(const QString& key);
+    void watch_document();
+    virtual QTextBlock next_visible_block(const QTextBlock& block) { return block.next(); }
+    QVector<ViewportBlock> viewport_blocks();
+    QVector<QRectF> decoration_rects(const Decoration& decoration,
+                                     const QVector<ViewportBlock>& blocks,
+                                     bool full_width);
+    QRegion decoration_region(const DecorationLayer& layer);
+    void paint_decorations(QPainter* painter, const QRect& rect, bool underlines);
+
 
     void highlight_current_line();
     void unhighlight_current_line();
@@ -93,6 +148,7 @@ public:
     QString get_cell_as_executable_code();
     QString get_last_cell_as_executable_code();
 
+    virtual QVector<int> cell_separator_blocks();
     bool is_cell_separator(const QTextCursor& cursor=QTextCursor(),
                            const QTextBlock& block=QTextBlock());
     QPair<QTextCursor,bool> select_current_cell();
@@ -104,6 +160,12 @@ public:
     void __restore_selection(int start_pos,int end_pos);
     void __duplicate_line_or_selection(bool after_current_line=true);
 
+    // 批量修改多行：先按当前内容算出各行的修改，再在一个编辑块中一次应用。
+    // 文档在最后只发出一次contentsChange，高亮和布局只处理一遍修改的范围，撤销也只有一步
+    static bool line_edit(int block_nb, const QString& before, const QString& after, LineEdit* edit);
+    QPair<int,int> selected_block_range();
+    void apply_line_edits(const QVector<LineEdit>& edits);
+
 
     void __move_line_or_selection(bool after_current_line=true);
 
@@ -149,6 +211,7 @@ public:
     void focusInEvent(QFocusEvent *event) override;
     void focusOutEvent(QFocusEvent *event) override;
     void wheelEvent(QWheelEvent *event) override;
+    void paintEvent(QPaintEvent *event) override;
 public slots:
     void copy();
 
@@ -161,8 +224,12 @@ public slots:
     void move_line_up();
     void move_line_down();
     void go_to_new_line();
+    void shift_decorations(int position, int removed, int added);
 public:
-    QHash<QString,QList<QTextEdit::ExtraSelection>> extra_selections_dict;
+    // 按绘制顺序排列的装饰层，当前单元格和当前行在最下面
+    QList<DecorationLayer> decoration_layers;
+    // 已修改的层在修改前所占的区域，刷新时和修改后的区域一起重绘
+    QRegion pending_decoration_region;
     QString indent_chars;
 
     CompletionWidget* completion_widget;
@@ -180,6 +247,8 @@ public:
     QColor currentcell_color;
 
     QList<int> bracepos;
+    // 大于0时，长度超过它的行上不做括号匹配
+    int brace_line_limit;
     QColor matched_p_color;
     QColor unmatched_p_color;
     QTextCursor last_cursor_cell;
@@ -190,11 +259,12 @@ class QtANSIEscapeCodeHandler : public ANSIEscapeCodeHandler
 {
 public:
     QTextCharFormat base_format;
+    QHash<quint32,QTextCharFormat> format_cache;
 
     QtANSIEscapeCodeHandler();
     void set_light_background(bool state);
     void set_base_format(const QTextCharFormat& base_format);
-    QTextCharFormat get_format() const;
+    QTextCharFormat get_format();
     void set_style();
 };
 
@@ -221,10 +291,11 @@ signals:
     void completion_widget_activated(const QString&);
 
 public:
-    QRegularExpression COLOR_PATTERN;
     bool light_background;
 
     QtANSIEscapeCodeHandler* ansi_handler;
+    ANSIEscapeCodeParser ansi_parser;
+    ConsoleOutputBuffer* output_buffer;
     ConsoleFontStyle* default_style;
     ConsoleFontStyle* error_style;
     ConsoleFontStyle* traceback_link_style;
@@ -235,7 +306,10 @@ public:
     void set_light_background(bool state);
     void insert_text(const QString& text) override;
     void append_text_to_shell(QString text, bool error, bool prompt);
+    void write(const QString& text, bool error=false, bool prompt=false);
+    void set_max_line_count(int max_line_count);
     void set_pythonshell_font(const QFont& font=QFont());
 public slots:
     void paste();
+    void flush();
 };
@@ -15,11 +15,59 @@ StatusBarWidget::StatusBarWidget(QWidget* parent, QStatusBar* statusbar)
 }
 
 
+/********** SparklineWidget **********/
+SparklineWidget::SparklineWidget(QWidget* parent, int max_points)
+    : QWidget (parent)
+{
+    this->max_points = max_points;
+    setSizePolicy(QSizePolicy::Fixed, QSizePolicy::Preferred);
+}
+
+void SparklineWidget::add_value(double value)
+{
+    history.append(value);
+    if (history.size() > max_points)
+        history.remove(0, history.size() - max_points);
+    update();
+}
+
+QSize SparklineWidget::sizeHint() const
+{
+    return QSize(max_points, fontMetrics().height());
+}
+
+void SparklineWidget::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+    if (history.size() < 2)
+        return;
+    double maximum = 100.0;
+    foreach (double v, history)
+        maximum = qMax(maximum, v);
+
+    QPainter painter(this);
+    painter.setRenderHint(QPainter::Antialiasing);
+    QRectF rect = QRectF(this->rect()).adjusted(0.5, 1.5, -0.5, -1.5);
+    double dx = rect.width() / (max_points - 1);
+    double x0 = rect.right() - dx * (history.size() - 1);
+    QPolygonF points;
+    for (int i = 0; i < history.size(); i++) {
+        double y = rect.bottom() - rect.height() * qMax(history[i], 0.0) / maximum;
+        points.append(QPointF(x0 + i * dx, y));
+    }
+    painter.setPen(QPen(palette().color(QPalette::Highlight), 1));
+    painter.drawPolyline(points);
+}
+
+
+/********** BaseTimerStatus **********/
 BaseTimerStatus::BaseTimerStatus(QWidget* parent, QStatusBar* statusbar)
     : StatusBarWidget (parent, statusbar)
 {
     label = new QLabel(TITLE);
     value = new QLabel;
+    sparkline = new SparklineWidget(this);
+    interval = 2000;
 
     setToolTip(TIP);
     value->setAlignment(Qt::AlignRight);
@@ -30,23 +78,69 @@ BaseTimerStatus::BaseTimerStatus(QWidget* parent, QStatusBar* statusbar)
     QHBoxLayout* layout = dynamic_cast<QHBoxLayout*>(this->layout());
     layout->addWidget(label);
     layout->addWidget(value);
+    layout->addWidget(sparkline);
     layout->addSpacing(20);
 
-    timer = new QTimer;
-    connect(timer,SIGNAL(timeout()),this,SLOT(update_label()));
-    timer->start(2000);
+    connect(ResourceSampler::instance(), SIGNAL(sig_sample(ResourceSample)),
+            this, SLOT(update_label(ResourceSample)));
 }
 
-void BaseTimerStatus::set_interval(int interval)
+BaseTimerStatus::~BaseTimerStatus()
 {
-    if (timer)
-        timer->setInterval(interval);
+    ResourceSampler::instance()->unsubscribe(this);
 }
 
-void BaseTimerStatus::update_label()
+void BaseTimerStatus::set_interval(int interval)
 {
+    this->interval = interval;
     if (isVisible())
-        value->setText(QString::asprintf("%d %%", get_value()));
+        ResourceSampler::instance()->subscribe(this, interval);
+}
+
+QString BaseTimerStatus::get_tooltip(const ResourceSample &sample)
+{
+    Q_UNUSED(sample);
+    return TIP;
+}
+
+void BaseTimerStatus::update_label(const ResourceSample& sample)
+{
+    if (!isVisible())
+        return;
+    // 采样线程按所有订阅者中最小的间隔运行，这里按自己的间隔跳过多余的采样
+    if (last_update.isValid() && last_update.elapsed() < interval * 9 / 10)
+        return;
+    last_update.start();
+
+    double v = get_value(sample);
+    if (v < 0) {
+        value->setText("--");
+        return;
+    }
+    value->setText(QString::asprintf("%d %%", qRound(v)));
+    sparkline->add_value(v);
+    setToolTip(get_tooltip(sample));
+}
+
+void BaseTimerStatus::showEvent(QShowEvent *event)
+{
+    ResourceSampler::instance()->subscribe(this, interval);
+    StatusBarWidget::showEvent(event);
+}
+
+void BaseTimerStatus::hideEvent(QHideEvent *event)
+{
+    ResourceSampler::instance()->unsubscribe(this);
+    StatusBarWidget::hideEvent(event);
+}
+
+static QString format_kb(qint64 kb)
+{
+    if (kb < 0)
+        return "?";
+    if (kb >= 1024 * 1024)
+        return QString::number(kb / (1024.0 * 1024.0), 'f', 2) + " GB";
+    return QString::number(kb / 1024.0, 'f', 1) + " MB";
 }
 
 /********** MemoryStatus **********/
@@ -54,24 +148,181 @@ MemoryStatus::MemoryStatus(QWidget* parent, QStatusBar* statusbar)
     : BaseTimerStatus (parent, statusbar)
 {
     TITLE = "Memory:";
-    TIP = "Memory usage status: "
-          "requires the `psutil` (>=v0.3) library on non-Windows platforms";
+    TIP = "Memory usage status";
+    label->setText(TITLE);
+    setToolTip(TIP);
+}
+
+double MemoryStatus::get_value(const ResourceSample& sample)
+{
+    return sample.system_memory_percent;
+}
+
+QString MemoryStatus::get_tooltip(const ResourceSample &sample)
+{
+    QStringList lines;
+    lines << TIP;
+    lines << QString("System: %1 used of %2")
+             .arg(format_kb(sample.system_total_kb - sample.system_available_kb))
+             .arg(format_kb(sample.system_total_kb));
+    lines << QString("Spyder: %1").arg(format_kb(sample.ide_rss_kb));
+    foreach (const ChildProcessInfo& child, sample.children)
+        lines << QString("  %1 (%2): %3").arg(child.name).arg(child.pid).arg(format_kb(child.rss_kb));
+    return lines.join('\n');
+}
+
+/********** CPUStatus **********/
+CPUStatus::CPUStatus(QWidget* parent, QStatusBar* statusbar)
+    : BaseTimerStatus (parent, statusbar)
+{
+    TITLE = "CPU:";
+    TIP = "CPU usage status";
     label->setText(TITLE);
     setToolTip(TIP);
 }
 
-DWORD memory_usage()
+double CPUStatus::get_value(const ResourceSample& sample)
+{
+    return sample.ide_cpu_percent;
+}
+
+QString CPUStatus::get_tooltip(const ResourceSample &sample)
+{
+    QStringList lines;
+    lines << TIP;
+    if (sample.system_cpu_percent >= 0)
+        lines << QString("System: %1 %").arg(qRound(sample.system_cpu_percent));
+    lines << QString("Spyder: %1 % (%2 threads)")
+             .arg(qRound(sample.ide_cpu_percent)).arg(sample.thread_count);
+    foreach (const ChildProcessInfo& child, sample.children)
+        lines << QString("  %1 (%2): %3 %").arg(child.name).arg(child.pid)
+                 .arg(qRound(child.cpu_percent));
+    return lines.join('\n');
+}
+
+/********** LatencyStatus **********/
+LatencyStatus::LatencyStatus(QWidget* parent, QStatusBar* statusbar)
+    : StatusBarWidget (parent, statusbar)
+{
+    label = new QLabel("Latency:");
+    value = new QLabel("--");
+    timer = new QTimer(this);
+    timer->setInterval(1000);
+    connect(timer, SIGNAL(timeout()), SLOT(update_label()));
+
+    setToolTip("Keypress to paint latency (p50 / p95)");
+    value->setAlignment(Qt::AlignRight);
+    value->setFont(label_font);
+
+    QHBoxLayout* layout = dynamic_cast<QHBoxLayout*>(this->layout());
+    layout->addWidget(label);
+    layout->addWidget(value);
+    layout->addSpacing(20);
+    this->set_tracing(Tracer::enabled());
+}
+
+void LatencyStatus::set_tracing(bool enabled)
+{
+    setVisible(enabled);
+    if (enabled) {
+        this->update_label();
+        timer->start();
+    }
+    else
+        timer->stop();
+}
+
+void LatencyStatus::update_label()
+{
+    const LatencyHistogram& histogram = Tracer::instance()->latency();
+    if (histogram.count() == 0) {
+        value->setText("--");
+        return;
+    }
+    value->setText(QString("%1 / %2 ms")
+                   .arg(histogram.percentile(50), 0, 'f', 1)
+                   .arg(histogram.percentile(95), 0, 'f', 1));
+
+    QStringList lines;
+    lines << QString("Keypress to paint latency, last %1 keys").arg(histogram.count());
+    lines << QString("p99: %1 ms").arg(histogram.percentile(99), 0, 'f', 1);
+    for (int i = 0; i < LatencyHistogram::BUCKETS; i++) {
+        int count = histogram.bucket_count(i);
+        if (count == 0)
+            continue;
+        int bar = qMax(1, count * 30 / histogram.count());
+        lines << QString("%1 %2 %3").arg(LatencyHistogram::bucket_label(i), 10)
+                 .arg(QString(bar, QChar(0x2588))).arg(count);
+    }
+    setToolTip(lines.join('\n'));
+}
+
+/********** FileOperationsStatus **********/
+FileOperationsStatus::FileOperationsStatus(QWidget* parent, QStatusBar* statusbar)
+    : StatusBarWidget (parent, statusbar)
+{
+    label = new QLabel;
+    progress = new QProgressBar;
+    progress->setMaximumWidth(100);
+    progress->setMaximumHeight(14);
+    progress->setTextVisible(false);
+    cancel_button = new QToolButton;
+    cancel_button->setText("Cancel");
+    cancel_button->setAutoRaise(true);
+    cancel_button->setToolTip("Cancel all file operations");
+
+    QHBoxLayout* layout = dynamic_cast<QHBoxLayout*>(this->layout());
+    layout->addWidget(label);
+    layout->addWidget(progress);
+    layout->addWidget(cancel_button);
+    layout->addSpacing(20);
+
+    FileOperations* operations = FileOperations::instance();
+    connect(cancel_button, &QToolButton::clicked, this, [operations](){ operations->cancel(); });
+    connect(operations, SIGNAL(sig_started(FileOperation)),
+            this, SLOT(operation_started(FileOperation)));
+    connect(operations, SIGNAL(sig_progress(qint64,qint64,double,int)),
+            this, SLOT(update_progress(qint64,qint64,double,int)));
+    connect(operations, SIGNAL(sig_idle()), this, SLOT(operations_idle()));
+    setVisible(false);
+}
+
+void FileOperationsStatus::operation_started(const FileOperation &operation)
 {
-    MEMORYSTATUS memorystatus;
-    GlobalMemoryStatus(&memorystatus);
-    return memorystatus.dwMemoryLoad;
+    description = operation.description();
+    label->setText(description);
+    setToolTip(operation.source);
+    progress->setRange(0, 0);
+    setVisible(true);
 }
 
-DWORD MemoryStatus::get_value()
+void FileOperationsStatus::update_progress(qint64 done, qint64 total, double bytes_per_second,
+                                           int pending)
 {
-    return memory_usage();
+    // QProgressBar只接受int，按千分比显示
+    if (total > 0) {
+        progress->setRange(0, 1000);
+        progress->setValue(int(qMin(done, total) * 1000 / total));
+    }
+    QString text = description;
+    QStringList details;
+    if (bytes_per_second > 0)
+        details << QString("%1 MB/s").arg(bytes_per_second / (1024 * 1024), 0, 'f', 1);
+    if (pending > 0)
+        details << QString("%1 queued").arg(pending);
+    if (!details.isEmpty())
+        text += QString(" (%1)").arg(details.join(", "));
+    label->setText(text);
 }
 
+void FileOperationsStatus::operations_idle()
+{
+    setVisible(false);
+    description.clear();
+    label->clear();
+}
+
+
 /********** ReadWriteStatus **********/
 ReadWriteStatus::ReadWriteStatus(QWidget* parent, QStatusBar* statusbar)
     : StatusBarWidget (parent, statusbar)
@@ -179,5 +430,6 @@ static void test()
     new EncodingStatus(win, statusbar);
     new CursorPositionStatus(win, statusbar);
     new MemoryStatus(win, statusbar);
+    new CPUStatus(win, statusbar);
     win->show();
 }
@@ -1,8 +1,10 @@
 #pragma once
 
 #include <QtWidgets>
-#include <windows.h>
 #include "str.h"
+#include "utils/resourcemonitor.h"
+#include "utils/tracing.h"
+#include "utils/fileops.h"
 
 class StatusBarWidget : public QWidget
 {
@@ -14,6 +16,24 @@ public:
 };
 
 
+// 状态栏中显示最近一段时间数值变化的小折线图
+class SparklineWidget : public QWidget
+{
+    Q_OBJECT
+public:
+    int max_points;
+    QVector<double> history;
+
+    SparklineWidget(QWidget* parent = nullptr, int max_points = 60);
+    void add_value(double value);
+    QSize sizeHint() const override;
+protected:
+    void paintEvent(QPaintEvent* event) override;
+};
+
+
+// 数值由后台线程中的ResourceSampler采样，这里只负责显示，
+// 不在GUI线程中做任何系统调用
 class BaseTimerStatus : public StatusBarWidget
 {
     Q_OBJECT
@@ -22,22 +42,77 @@ public:
     QString TIP;
     QLabel* label;
     QLabel* value;
-    QTimer* timer;
+    SparklineWidget* sparkline;
+    int interval;
+    QElapsedTimer last_update;
 
     BaseTimerStatus(QWidget* parent, QStatusBar* statusbar);
+    ~BaseTimerStatus();
     void set_interval(int interval);
-    virtual DWORD get_value() = 0;
+    virtual double get_value(const ResourceSample& sample) = 0;
+    virtual QString get_tooltip(const ResourceSample& sample);
 public slots:
-    void update_label();
+    void update_label(const ResourceSample& sample);
+protected:
+    void showEvent(QShowEvent* event) override;
+    void hideEvent(QHideEvent* event) override;
 };
 
 
+// 系统内存占用百分比，提示中给出本进程和子进程的常驻内存
 class MemoryStatus : public BaseTimerStatus
 {
     Q_OBJECT
 public:
     MemoryStatus(QWidget* parent, QStatusBar* statusbar);
-    DWORD get_value();
+    double get_value(const ResourceSample& sample) override;
+    QString get_tooltip(const ResourceSample& sample) override;
+};
+
+
+// 本进程的CPU占用百分比，提示中给出线程数和各子进程的占用
+class CPUStatus : public BaseTimerStatus
+{
+    Q_OBJECT
+public:
+    CPUStatus(QWidget* parent, QStatusBar* statusbar);
+    double get_value(const ResourceSample& sample) override;
+    QString get_tooltip(const ResourceSample& sample) override;
+};
+
+
+// 性能跟踪开启时显示按键到绘制完成的延迟，提示中给出各区间的分布
+class LatencyStatus : public StatusBarWidget
+{
+    Q_OBJECT
+public:
+    QLabel* label;
+    QLabel* value;
+    QTimer* timer;
+
+    LatencyStatus(QWidget* parent, QStatusBar* statusbar);
+    void set_tracing(bool enabled);
+public slots:
+    void update_label();
+};
+
+
+// 后台文件操作的进度，没有操作时隐藏
+class FileOperationsStatus : public StatusBarWidget
+{
+    Q_OBJECT
+public:
+    QLabel* label;
+    QProgressBar* progress;
+    QToolButton* cancel_button;
+    // 当前操作的描述，速度和排队数加在它后面
+    QString description;
+
+    FileOperationsStatus(QWidget* parent, QStatusBar* statusbar);
+public slots:
+    void operation_started(const FileOperation& operation);
+    void update_progress(qint64 done, qint64 total, double bytes_per_second, int pending);
+    void operations_idle();
 };
 
 
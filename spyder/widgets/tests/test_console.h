@@ -0,0 +1,76 @@
+#pragma once
+
+#include "widgets/sourcecode/widgets_base.h"
+#include <QDebug>
+#include <QElapsedTimer>
+
+void test_ansi_parser()
+{
+    ANSIEscapeCodeParser parser;
+    QList<ANSISegment> segments;
+
+    parser.feed("a\x1b[1;31mb\x1b[", &segments);
+    //# 被截断的序列要等到下一次feed
+    parser.feed("0mc\x01\x02" "d", &segments);
+    Q_ASSERT(segments.size() == 3);
+    Q_ASSERT(segments[0].codes.isEmpty() && segments[0].text == "a");
+    Q_ASSERT(segments[1].codes == QVector<int>({1, 31}) && segments[1].text == "b");
+    Q_ASSERT(segments[2].codes == QVector<int>({0}) && segments[2].text == "cd");
+
+    //# 私有参数和中间字节属于序列本身，不能当作文本输出
+    segments.clear();
+    parser.feed("e\x1b[?25lf\x1b[>4;2mg\x1b[2 qh", &segments);
+    Q_ASSERT(segments.size() == 1 && segments[0].text == "efgh");
+}
+
+void test_output_buffer_trim()
+{
+    ConsoleOutputBuffer buffer;
+    buffer.set_max_line_count(2);
+    buffer.append("1\n\x1b[32m2\n3\n4\n");
+    Q_ASSERT(buffer.pending_line_count() == 2);
+    QList<ConsoleChunk> chunks = buffer.take();
+    Q_ASSERT(chunks.size() == 1);
+    //# 被丢弃行中的颜色状态要保留下来
+    Q_ASSERT(chunks[0].text == "\x1b[32m3\n4\n");
+
+    buffer.append("x\n\x0cy");
+    bool clear_requested = false;
+    chunks = buffer.take(&clear_requested);
+    Q_ASSERT(clear_requested);
+    Q_ASSERT(chunks.size() == 1 && chunks[0].text == "y");
+}
+
+// 向控制台灌入大量带颜色的输出，输出持续吞吐量(行/秒)和事件循环的最大延迟
+void benchmark_console_flood(int total_lines = 1000000, int lines_per_chunk = 100)
+{
+    ConsoleBaseWidget widget;
+    widget.show();
+
+    QString chunk;
+    for (int i = 0; i < lines_per_chunk; i++)
+        chunk += QString("\x1b[32mok\x1b[0m line %1 of the flood\n").arg(i);
+
+    QElapsedTimer total;
+    total.start();
+    qint64 max_latency = 0;
+    qint64 sum_latency = 0;
+    int iterations = 0;
+    for (int i = 0; i < total_lines; i += lines_per_chunk) {
+        widget.write(chunk);
+        QElapsedTimer latency;
+        latency.start();
+        QCoreApplication::processEvents();
+        qint64 elapsed = latency.elapsed();
+        max_latency = qMax(max_latency, elapsed);
+        sum_latency += elapsed;
+        iterations++;
+    }
+    widget.flush();
+    qint64 elapsed = qMax<qint64>(total.elapsed(), 1);
+
+    qDebug() << "console flood:" << total_lines * 1000.0 / elapsed << "lines/s,"
+             << "UI latency avg" << double(sum_latency) / qMax(iterations, 1) << "ms,"
+             << "max" << max_latency << "ms";
+    Q_ASSERT(widget.blockCount() <= widget.maximumBlockCount());
+}
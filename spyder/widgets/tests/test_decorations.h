@@ -0,0 +1,97 @@
+#pragma once
+
+#include "widgets/sourcecode/widgets_base.h"
+#include <QDebug>
+#include <QElapsedTimer>
+
+static Decoration make_decoration(int start, int end)
+{
+    Decoration decoration;
+    decoration.start = start;
+    decoration.end = end;
+    decoration.format.setBackground(Qt::yellow);
+    return decoration;
+}
+
+void test_decoration_layer_shift()
+{
+    DecorationLayer layer("find");
+    layer.append(make_decoration(0, 3));
+    layer.append(make_decoration(10, 14));
+    layer.append(make_decoration(20, 20));
+
+    //# 在前面插入，后面的装饰整体后移
+    layer.shift(5, 0, 2);
+    Q_ASSERT(layer.items()[0].start == 0 && layer.items()[0].end == 3);
+    Q_ASSERT(layer.items()[1].start == 12 && layer.items()[1].end == 16);
+    Q_ASSERT(layer.items()[2].start == 22 && layer.items()[2].end == 22);
+
+    //# 整个被删除的装饰被丢弃，空装饰(当前行)保留
+    layer.shift(11, 6, 0);
+    Q_ASSERT(layer.size() == 2);
+    Q_ASSERT(layer.items()[1].start == 16 && layer.items()[1].end == 16);
+
+    Q_ASSERT(layer.visible(5, 15).isEmpty());
+    Q_ASSERT(layer.visible(0, 1) == QVector<int>({0}));
+    Q_ASSERT(!layer.set(layer.items()));
+}
+
+// 10k条装饰：比较整个视口重绘和移动光标(只重绘当前行)的耗时，
+// 以及同样数量的装饰交给QPlainTextEdit::setExtraSelections时的耗时
+void benchmark_decoration_paint(int count = 10000, int repaints = 200)
+{
+    QString text;
+    for (int i = 0; i < count; i++)
+        text += QString("value_%1 = compute(value_%1)\n").arg(i);
+
+    TextEditBaseWidget widget;
+    widget.setPlainText(text);
+    widget.resize(800, 600);
+    widget.show();
+
+    QElapsedTimer timer;
+    timer.start();
+    QList<QTextEdit::ExtraSelection> selections;
+    QTextCursor cursor(widget.document());
+    for (QTextBlock block = widget.document()->begin(); block.isValid(); block = block.next()) {
+        QTextEdit::ExtraSelection selection;
+        selection.format.setBackground(Qt::yellow);
+        selection.cursor = cursor;
+        selection.cursor.setPosition(block.position());
+        selection.cursor.setPosition(block.position() + 5, QTextCursor::KeepAnchor);
+        selections.append(selection);
+    }
+    widget.set_extra_selections("find", selections);
+    widget.update_extra_selections();
+    qint64 set_ms = timer.elapsed();
+
+    timer.restart();
+    for (int i = 0; i < repaints; i++)
+        widget.viewport()->repaint();
+    double paint_ms = double(timer.nsecsElapsed()) / 1e6 / repaints;
+
+    timer.restart();
+    for (int i = 0; i < repaints; i++) {
+        widget.moveCursor(i % 2 ? QTextCursor::Up : QTextCursor::Down);
+        widget.highlight_current_line();
+        QCoreApplication::processEvents();
+    }
+    double move_ms = double(timer.nsecsElapsed()) / 1e6 / repaints;
+
+    QPlainTextEdit plain;
+    plain.setPlainText(text);
+    plain.resize(800, 600);
+    plain.show();
+    selections = widget.get_extra_selections("find");
+    timer.restart();
+    plain.setExtraSelections(selections);
+    qint64 qt_set_ms = timer.elapsed();
+    timer.restart();
+    for (int i = 0; i < repaints; i++)
+        plain.viewport()->repaint();
+    double qt_paint_ms = double(timer.nsecsElapsed()) / 1e6 / repaints;
+
+    qDebug() << "decorations:" << count << "items, set" << set_ms << "ms,"
+             << "paint" << paint_ms << "ms, cursor move" << move_ms << "ms;"
+             << "setExtraSelections" << qt_set_ms << "ms, paint" << qt_paint_ms << "ms";
+}
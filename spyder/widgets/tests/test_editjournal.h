@@ -0,0 +1,59 @@
+#pragma once
+
+#include "utils/editjournal.h"
+
+static JournalRecord make_journal_record(int type, quint32 id, const QString& text = QString(),
+                                         int position = 0, int removed = 0)
+{
+    JournalRecord record;
+    record.type = type;
+    record.id = id;
+    record.text = text;
+    record.position = position;
+    record.removed = removed;
+    return record;
+}
+
+void test_edit_journal_replay()
+{
+    QVector<JournalRecord> records;
+    //# 不在磁盘上的新文件：内容记录在OPEN中
+    JournalRecord open = make_journal_record(JournalRecord::OPEN, 1, "a = 1\n");
+    open.filename = "untitled0.py";
+    records << open;
+    records << make_journal_record(JournalRecord::EDIT, 1, "0", 5, 0);
+    records << make_journal_record(JournalRecord::EDIT, 1, "b", 0, 1);
+
+    //# 关闭的文档不恢复
+    open.id = 2;
+    open.filename = "untitled1.py";
+    records << open;
+    records << make_journal_record(JournalRecord::EDIT, 2, "x", 0, 0);
+    records << make_journal_record(JournalRecord::CLOSE, 2);
+
+    //# 检查点之后的修改在检查点的内容上重放
+    open.id = 3;
+    open.filename = "untitled2.py";
+    records << open;
+    records << make_journal_record(JournalRecord::CHECKPOINT, 3, "def f():\n    pass\n");
+    records << make_journal_record(JournalRecord::EDIT, 3, "return 0", 13, 4);
+
+    //# 改回原来的内容时不需要恢复
+    open.id = 4;
+    open.filename = "untitled3.py";
+    records << open;
+    records << make_journal_record(JournalRecord::EDIT, 4, "zz", 0, 0);
+    records << make_journal_record(JournalRecord::EDIT, 4, QString(), 0, 2);
+
+    QByteArray data = JournalWriter::header() + JournalWriter::serialize(records);
+    QList<RecoveredDocument> documents = EditJournal::replay(data);
+    Q_ASSERT(documents.size() == 2);
+    Q_ASSERT(documents[0].filename == "untitled0.py" && documents[0].text == "b = 10\n");
+    Q_ASSERT(documents[1].text == "def f():\n    return 0\n");
+
+    //# 最后一条记录只写了一部分
+    data += JournalWriter::serialize({make_journal_record(JournalRecord::EDIT, 1, "lost", 0, 0)});
+    data.chop(3);
+    documents = EditJournal::replay(data);
+    Q_ASSERT(documents.size() == 2 && documents[0].text == "b = 10\n");
+}
@@ -0,0 +1,437 @@
+#include "arraybuffer.h"
+#include <QThread>
+#include <QRegularExpression>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <climits>
+#include <limits>
+
+// 元素个数超过该值时，min_max分块并行计算
+const qint64 PARALLEL_MIN_MAX_SIZE = 1 << 20;
+
+static int element_size(ArrayBuffer::DType dtype)
+{
+    switch (dtype) {
+    case ArrayBuffer::Bool:
+        return 1;
+    case ArrayBuffer::Int64:
+    case ArrayBuffer::Double:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+/********** ArrayStorage **********/
+ArrayStorage::ArrayStorage()
+{
+    this->file = nullptr;
+    this->mapped = nullptr;
+}
+
+ArrayStorage::~ArrayStorage()
+{
+    if (this->file) {
+        if (this->mapped)
+            this->file->unmap(this->mapped);
+        delete this->file;
+    }
+}
+
+const char* ArrayStorage::const_data() const
+{
+    if (this->mapped)
+        return reinterpret_cast<const char*>(this->mapped);
+    return this->bytes.constData();
+}
+
+char* ArrayStorage::data()
+{
+    Q_ASSERT(!this->mapped);
+    return this->bytes.data();
+}
+
+
+/********** ArrayBuffer **********/
+ArrayBuffer::ArrayBuffer()
+{
+    this->_dtype = Invalid;
+    this->_rows = 0;
+    this->_cols = 0;
+    this->_offset = 0;
+    this->_row_stride = 0;
+    this->_col_stride = 0;
+}
+
+ArrayBuffer::ArrayBuffer(DType dtype, int rows, int cols, bool row_major)
+    : ArrayBuffer ()
+{
+    if (!fits(dtype, rows, cols))
+        return;
+    this->storage = new ArrayStorage;
+    this->storage->bytes = QByteArray(int(byte_size(dtype, rows, cols)), '\0');
+    this->_dtype = dtype;
+    this->_rows = rows;
+    this->_cols = cols;
+    this->_offset = 0;
+    this->_row_stride = row_major ? cols : 1;
+    this->_col_stride = row_major ? 1 : rows;
+}
+
+qint64 ArrayBuffer::byte_size(DType dtype, qint64 rows, qint64 cols)
+{
+    return rows * cols * element_size(dtype);
+}
+
+ArrayBuffer ArrayBuffer::from_variants(const QVector<QVector<QVariant>>& data)
+{
+    if (data.isEmpty() || data[0].isEmpty())
+        return ArrayBuffer();
+
+    DType dtype;
+    switch (data[0][0].type()) {
+    case QVariant::Bool:
+        dtype = Bool;
+        break;
+    case QVariant::Int:
+    case QVariant::UInt:
+    case QVariant::LongLong:
+        dtype = Int64;
+        break;
+    case QVariant::Double:
+        dtype = Double;
+        break;
+    default:
+        return ArrayBuffer();
+    }
+
+    int rows = data.size();
+    int cols = data[0].size();
+    ArrayBuffer result(dtype, rows, cols);
+    if (!result.is_valid())
+        return result;
+    char* base = result.storage->data();
+    for (int i = 0; i < rows; ++i) {
+        const QVector<QVariant>& row = data[i];
+        for (int j = 0; j < cols && j < row.size(); ++j) {
+            qint64 k = qint64(i) * cols + j;
+            if (dtype == Bool)
+                base[k] = row[j].toBool();
+            else if (dtype == Int64)
+                reinterpret_cast<qint64*>(base)[k] = row[j].toLongLong();
+            else
+                reinterpret_cast<double*>(base)[k] = row[j].toDouble();
+        }
+    }
+    return result;
+}
+
+// 内存映射.npy文件，只支持小端的bool/int64/float64的0~2维数组
+ArrayBuffer ArrayBuffer::load_npy(const QString &filename, QString *error)
+{
+    auto fail = [error](const QString& message) {
+        if (error)
+            *error = message;
+        return ArrayBuffer();
+    };
+
+    QFile* file = new QFile(filename);
+    if (!file->open(QIODevice::ReadOnly)) {
+        delete file;
+        return fail(QString("Unable to open '%1'").arg(filename));
+    }
+
+    QByteArray magic = file->read(8);
+    if (magic.size() < 8 || !magic.startsWith("\x93NUMPY")) {
+        delete file;
+        return fail(QString("'%1' is not a NumPy file").arg(filename));
+    }
+    int major = uchar(magic[6]);
+    QByteArray len = file->read(major == 1 ? 2 : 4);
+    qint64 header_len = 0;
+    for (int k = len.size()-1; k >= 0; --k)
+        header_len = (header_len << 8) | uchar(len[k]);
+    QString header = QString::fromLatin1(file->read(header_len));
+    qint64 data_offset = file->pos();
+
+    QRegularExpressionMatch match = QRegularExpression(
+                "'descr'\\s*:\\s*'([<>|=])([a-z])(\\d+)'").match(header);
+    if (!match.hasMatch()) {
+        delete file;
+        return fail("Invalid NumPy header");
+    }
+    QString byteorder = match.captured(1);
+    QString kind = match.captured(2);
+    int itemsize = match.captured(3).toInt();
+    DType dtype = Invalid;
+    if (kind == "f" && itemsize == 8)
+        dtype = Double;
+    else if (kind == "i" && itemsize == 8)
+        dtype = Int64;
+    else if (kind == "b" && itemsize == 1)
+        dtype = Bool;
+    if (dtype == Invalid || (byteorder == ">" && itemsize > 1)) {
+        delete file;
+        return fail(QString("%1 arrays are currently not supported")
+                    .arg(match.captured(0).section(':', 1).trimmed()));
+    }
+
+    bool fortran_order = header.contains(QRegularExpression(
+                                             "'fortran_order'\\s*:\\s*True"));
+    match = QRegularExpression("'shape'\\s*:\\s*\\(([^)]*)\\)").match(header);
+    QList<qint64> shape;
+    foreach (const QString& dim, match.captured(1).split(',', QString::SkipEmptyParts))
+        shape.append(dim.trimmed().toLongLong());
+    if (shape.size() > 2) {
+        delete file;
+        return fail("Arrays with more than 2 dimensions are not supported");
+    }
+    // 1维数组显示为一列
+    qint64 rows = shape.size() > 0 ? shape[0] : 1;
+    qint64 cols = shape.size() > 1 ? shape[1] : 1;
+    qint64 nbytes = rows * cols * itemsize;
+    if (rows > INT_MAX || cols > INT_MAX || file->size() - data_offset < nbytes) {
+        delete file;
+        return fail("Truncated or invalid NumPy file");
+    }
+
+    ArrayBuffer result;
+    result.storage = new ArrayStorage;
+    if (nbytes > 0) {
+        uchar* mapped = file->map(data_offset, nbytes);
+        if (mapped) {
+            result.storage->file = file;
+            result.storage->mapped = mapped;
+            file = nullptr;
+        }
+        else {
+            // 无法映射时退回到一次性读入，QByteArray放不下或者读到的字节不够时失败
+            if (nbytes > MAX_BYTES) {
+                delete file;
+                return fail("The array is too large to be loaded into memory");
+            }
+            file->seek(data_offset);
+            result.storage->bytes = file->read(nbytes);
+            if (result.storage->bytes.size() != nbytes) {
+                delete file;
+                return fail(QString("Unable to read '%1'").arg(filename));
+            }
+        }
+    }
+    delete file;
+
+    result._dtype = dtype;
+    result._rows = int(rows);
+    result._cols = int(cols);
+    result._offset = 0;
+    result._row_stride = fortran_order ? 1 : cols;
+    result._col_stride = fortran_order ? rows : 1;
+    return result;
+}
+
+QVector<QVector<QVariant>> ArrayBuffer::to_variants() const
+{
+    QVector<QVector<QVariant>> result;
+    result.reserve(_rows);
+    for (int i = 0; i < _rows; ++i) {
+        QVector<QVariant> row;
+        row.reserve(_cols);
+        for (int j = 0; j < _cols; ++j)
+            row.append(this->variant(i, j));
+        result.append(row);
+    }
+    return result;
+}
+
+QString ArrayBuffer::dtype_name() const
+{
+    switch (_dtype) {
+    case Bool:
+        return "bool";
+    case Int64:
+        return "int";
+    case Double:
+        return "double";
+    default:
+        return QString();
+    }
+}
+
+bool ArrayBuffer::is_mapped() const
+{
+    return this->storage && this->storage->mapped;
+}
+
+ArrayBuffer ArrayBuffer::view(int row, int col, int rows, int cols) const
+{
+    Q_ASSERT(row >= 0 && col >= 0 && row + rows <= _rows && col + cols <= _cols);
+    ArrayBuffer result(*this);
+    result._offset = element_index(row, col);
+    result._rows = rows;
+    result._cols = cols;
+    return result;
+}
+
+QVariant ArrayBuffer::variant(int i, int j) const
+{
+    switch (_dtype) {
+    case Bool:
+        return bool(storage->const_data()[element_index(i, j)]);
+    case Int64:
+        return this->int_value(i, j);
+    case Double:
+        return this->value(i, j);
+    default:
+        return QVariant();
+    }
+}
+
+bool ArrayBuffer::set_value(int i, int j, const QVariant &value)
+{
+    if (!this->detach())
+        return false;
+    char* base = storage->data();
+    qint64 k = element_index(i, j);
+    switch (_dtype) {
+    case Bool:
+        base[k] = value.toBool();
+        break;
+    case Int64:
+        reinterpret_cast<qint64*>(base)[k] = value.toLongLong();
+        break;
+    case Double:
+        reinterpret_cast<double*>(base)[k] = value.toDouble();
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+// 写之前复制：共享的存储和映射的文件都复制成行主序的自有内存
+char* ArrayBuffer::data()
+{
+    if (!this->detach())
+        return nullptr;
+    return this->storage->data() + this->_offset * element_size(this->_dtype);
+}
+
+// 自有内存放不下时返回false，数组保持不变
+bool ArrayBuffer::detach()
+{
+    if (!this->storage || (this->storage->ref.load() == 1 && !this->storage->mapped))
+        return true;
+    if (!fits(_dtype, _rows, _cols))
+        return false;
+    int itemsize = element_size(_dtype);
+    ArrayStorage* copy = new ArrayStorage;
+    copy->bytes.resize(int(byte_size(_dtype, _rows, _cols)));
+    const char* src = this->storage->const_data();
+    char* dst = copy->bytes.data();
+    for (int i = 0; i < _rows; ++i) {
+        if (_col_stride == 1) {
+            std::memcpy(dst + qint64(i) * _cols * itemsize,
+                        src + element_index(i, 0) * itemsize, size_t(_cols) * itemsize);
+            continue;
+        }
+        for (int j = 0; j < _cols; ++j)
+            std::memcpy(dst + (qint64(i) * _cols + j) * itemsize,
+                        src + element_index(i, j) * itemsize, size_t(itemsize));
+    }
+    this->storage = copy;
+    this->_offset = 0;
+    this->_row_stride = _cols;
+    this->_col_stride = 1;
+    return true;
+}
+
+template <typename T>
+static void min_max_run(const T* p, qint64 count, qint64 stride, double* lo, double* hi)
+{
+    // NaN与任何值比较都为false，因此会被跳过(同np.nanmin/np.nanmax)
+    double l = *lo;
+    double h = *hi;
+    if (stride == 1) {
+        for (qint64 k = 0; k < count; ++k) {
+            double v = double(p[k]);
+            l = v < l ? v : l;
+            h = v > h ? v : h;
+        }
+    }
+    else {
+        for (qint64 k = 0; k < count; ++k) {
+            double v = double(p[k * stride]);
+            l = v < l ? v : l;
+            h = v > h ? v : h;
+        }
+    }
+    *lo = l;
+    *hi = h;
+}
+
+QPair<double,double> ArrayBuffer::min_max() const
+{
+    double lo = std::numeric_limits<double>::infinity();
+    double hi = -std::numeric_limits<double>::infinity();
+    if (!this->is_valid() || this->size() == 0)
+        return qMakePair(lo, hi);
+
+    // 外层沿步长较大的维度，使内层尽量连续；整块连续时展开成一维
+    bool rows_outer = _row_stride >= _col_stride;
+    qint64 outer = rows_outer ? _rows : _cols;
+    qint64 inner = rows_outer ? _cols : _rows;
+    qint64 outer_stride = rows_outer ? _row_stride : _col_stride;
+    qint64 inner_stride = rows_outer ? _col_stride : _row_stride;
+    if (inner_stride == 1 && outer_stride == inner) {
+        inner *= outer;
+        outer = 1;
+    }
+
+    const int itemsize = element_size(_dtype);
+    const char* base = storage->const_data() + _offset * itemsize;
+    const DType dtype = _dtype;
+    auto scan = [=](qint64 first, qint64 last, double* l, double* h) {
+        for (qint64 k = first; k < last; ) {
+            qint64 o = k / inner;
+            qint64 in = k % inner;
+            qint64 n = qMin(inner - in, last - k);
+            const char* p = base + (o * outer_stride + in * inner_stride) * itemsize;
+            if (dtype == Double)
+                min_max_run(reinterpret_cast<const double*>(p), n, inner_stride, l, h);
+            else if (dtype == Int64)
+                min_max_run(reinterpret_cast<const qint64*>(p), n, inner_stride, l, h);
+            else
+                min_max_run(reinterpret_cast<const qint8*>(p), n, inner_stride, l, h);
+            k += n;
+        }
+    };
+
+    qint64 total = outer * inner;
+    int nthreads = 1;
+    if (total >= PARALLEL_MIN_MAX_SIZE)
+        nthreads = qMax(1, QThread::idealThreadCount());
+    if (nthreads == 1) {
+        scan(0, total, &lo, &hi);
+        return qMakePair(lo, hi);
+    }
+
+    std::vector<double> los(nthreads, lo);
+    std::vector<double> his(nthreads, hi);
+    std::vector<std::thread> workers;
+    qint64 chunk = (total + nthreads - 1) / nthreads;
+    for (int t = 0; t < nthreads; ++t) {
+        qint64 first = t * chunk;
+        qint64 last = qMin(total, first + chunk);
+        if (first >= last)
+            break;
+        workers.emplace_back(scan, first, last, &los[t], &his[t]);
+    }
+    for (auto& worker : workers)
+        worker.join();
+    for (int t = 0; t < nthreads; ++t) {
+        lo = qMin(lo, los[t]);
+        hi = qMax(hi, his[t]);
+    }
+    return qMakePair(lo, hi);
+}
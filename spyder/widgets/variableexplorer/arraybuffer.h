@@ -0,0 +1,102 @@
+#pragma once
+
+#include <QFile>
+#include <QPair>
+#include <QVector>
+#include <QVariant>
+#include <QByteArray>
+#include <QSharedData>
+#include <climits>
+
+// 数组的底层存储，可以是自有内存，也可以是内存映射的文件
+class ArrayStorage : public QSharedData
+{
+public:
+    QByteArray bytes;
+    QFile* file;
+    uchar* mapped;
+
+    ArrayStorage();
+    ~ArrayStorage();
+    const char* const_data() const;
+    char* data();
+};
+
+
+// 类型化的连续二维数组，替代QVector<QVector<QVariant>>。
+// 行主序和列主序(fortran_order)都通过步长表示，view()不复制数据
+class ArrayBuffer
+{
+public:
+    enum DType { Invalid = 0, Bool, Int64, Double };
+
+    ArrayBuffer();
+    // 字节数超过MAX_BYTES时构造出无效的数组，调用前用fits检查
+    ArrayBuffer(DType dtype, int rows, int cols, bool row_major = true);
+
+    // 自有内存放在QByteArray中，长度受int限制
+    static const qint64 MAX_BYTES = INT_MAX;
+    static qint64 byte_size(DType dtype, qint64 rows, qint64 cols);
+    static bool fits(DType dtype, qint64 rows, qint64 cols)
+    { return rows >= 0 && cols >= 0 && byte_size(dtype, rows, cols) <= MAX_BYTES; }
+
+    static ArrayBuffer from_variants(const QVector<QVector<QVariant>>& data);
+    static ArrayBuffer load_npy(const QString& filename, QString* error = nullptr);
+    QVector<QVector<QVariant>> to_variants() const;
+    // 元素的起始地址，新构造的数组按构造时的行/列主序连续存放，用于整块写入。
+    // 映射的数组太大、无法复制到自有内存时返回nullptr
+    char* data();
+
+    bool is_valid() const { return _dtype != Invalid; }
+    DType dtype() const { return _dtype; }
+    QString dtype_name() const;
+    int rows() const { return _rows; }
+    int cols() const { return _cols; }
+    qint64 size() const { return qint64(_rows) * _cols; }
+    bool is_mapped() const;
+
+    ArrayBuffer view(int row, int col, int rows, int cols) const;
+
+    inline double value(int i, int j) const;
+    inline qint64 int_value(int i, int j) const;
+    QVariant variant(int i, int j) const;
+    bool set_value(int i, int j, const QVariant& value);
+
+    QPair<double,double> min_max() const;
+
+private:
+    QExplicitlySharedDataPointer<ArrayStorage> storage;
+    DType _dtype;
+    int _rows;
+    int _cols;
+    qint64 _offset;
+    qint64 _row_stride;
+    qint64 _col_stride;
+
+    inline qint64 element_index(int i, int j) const
+    { return _offset + i * _row_stride + j * _col_stride; }
+    bool detach();
+};
+
+inline double ArrayBuffer::value(int i, int j) const
+{
+    const char* base = storage->const_data();
+    qint64 k = element_index(i, j);
+    switch (_dtype) {
+    case Double:
+        return reinterpret_cast<const double*>(base)[k];
+    case Int64:
+        return double(reinterpret_cast<const qint64*>(base)[k]);
+    case Bool:
+        return base[k] ? 1.0 : 0.0;
+    default:
+        return 0.0;
+    }
+}
+
+inline qint64 ArrayBuffer::int_value(int i, int j) const
+{
+    if (_dtype == Int64)
+        return reinterpret_cast<const qint64*>(storage->const_data())[element_index(i, j)];
+    return qint64(value(i, j));
+}
@@ -24,7 +24,15 @@ static QRect get_idx_rect(const QModelIndexList& index_list)
 int ArrayModel::ROWS_TO_LOAD = 500;
 int ArrayModel::COLS_TO_LOAD = 40;
 
-ArrayModel::ArrayModel(const QVector<QVector<QVariant>>& data,
+// 色相量化的级数
+const int COLOR_TABLE_SIZE = 256;
+
+static quint64 cell_key(int i, int j)
+{
+    return (quint64(quint32(i)) << 32) | quint32(j);
+}
+
+ArrayModel::ArrayModel(const ArrayBuffer& data,
            const QString& format,
            const QStringList& xlabels,
            const QStringList& ylabels,
@@ -36,14 +44,14 @@ ArrayModel::ArrayModel(const QVector<QVector<QVariant>>& data,
     this->xlabels = xlabels;
     this->ylabels = ylabels;
     this->readonly = readonly;
-    switch (data[0][0].type()) {
-    case QVariant::Bool:
+    switch (data.dtype()) {
+    case ArrayBuffer::Bool:
         test_array = false;
         break;
-    case QVariant::Int:
+    case ArrayBuffer::Int64:
         test_array = 0;
         break;
-    case QVariant::Double:
+    case ArrayBuffer::Double:
         test_array = 0.0;
         break;
     default:
@@ -57,37 +65,40 @@ ArrayModel::ArrayModel(const QVector<QVector<QVariant>>& data,
 
     _data = data;
     _format = format;
-
-    total_rows = _data.size();
-    total_cols = _data[0].size();
-    int size = total_rows * total_cols;
-
-    vmin = INT_MAX;
-    vmax = INT_MIN;
-    if (data[0][0].type() == QVariant::Bool ||
-        data[0][0].type() == QVariant::Int ||
-        data[0][0].type() == QVariant::Double) {
-        for (int i = 0; i < total_rows; ++i) {
-            for (int j = 0; j < total_cols; ++j) {
-                vmin = qMin(vmin, data[i][j].toDouble());
-                vmax = qMax(vmax, data[i][j].toDouble());
-            }
+    _format_latin1 = format.toLatin1();
+    display_cache.setMaxCost(4 * ROWS_TO_LOAD * COLS_TO_LOAD);
+
+    total_rows = _data.rows();
+    total_cols = _data.cols();
+    qint64 size = _data.size();
+
+    if (_data.is_valid()) {
+        QPair<double,double> range = _data.min_max();
+        vmin = range.first;
+        vmax = range.second;
+        if (vmin > vmax) {
+            // 全部是NaN
+            vmin = 0.0;
+            vmax = 0.0;
         }
         if (vmax - vmin < 1e-5)
             vmin -= 1;
         hue0 = huerange[0];
         dhue = huerange[1] - huerange[0];
         bgcolor_enabled = true;
+        update_color_table();
     }
     else {
+        vmin = 0.0;
+        vmax = 0.0;
         hue0 = -1.0;
         dhue = -1.0;
         bgcolor_enabled = false;
     }
 
     if (size > LARGE_SIZE) {
-        rows_loaded = ROWS_TO_LOAD;
-        cols_loaded = COLS_TO_LOAD;
+        rows_loaded = qMin(total_rows, ROWS_TO_LOAD);
+        cols_loaded = qMin(total_cols, COLS_TO_LOAD);
     }
     else {
         if (total_rows > LARGE_NROWS)
@@ -106,7 +117,7 @@ QString ArrayModel::get_format() const
     return _format;
 }
 
-QVector<QVector<QVariant>> ArrayModel::get_data() const
+ArrayBuffer ArrayModel::get_data() const
 {
     return _data;
 }
@@ -114,9 +125,52 @@ QVector<QVector<QVariant>> ArrayModel::get_data() const
 void ArrayModel::set_format(const QString &format)
 {
     _format = format;
+    _format_latin1 = format.toLatin1();
+    display_cache.clear();
     reset();
 }
 
+QString ArrayModel::format_value(const QVariant &value) const
+{
+    switch (_data.dtype()) {
+    case ArrayBuffer::Bool:
+        return value.toBool() ? "True" : "False";
+    case ArrayBuffer::Int64:
+        return QString::number(value.toLongLong());
+    case ArrayBuffer::Double:
+        return QString::asprintf(_format_latin1.constData(), value.toDouble());
+    default:
+        return value.toString();
+    }
+}
+
+QString ArrayModel::format_value(int i, int j) const
+{
+    if (changes.isEmpty() || !changes.contains(qMakePair(i, j))) {
+        switch (_data.dtype()) {
+        case ArrayBuffer::Bool:
+            return _data.value(i, j) != 0.0 ? "True" : "False";
+        case ArrayBuffer::Int64:
+            return QString::number(_data.int_value(i, j));
+        case ArrayBuffer::Double:
+            return QString::asprintf(_format_latin1.constData(), _data.value(i, j));
+        default:
+            return QString();
+        }
+    }
+    return format_value(changes[qMakePair(i, j)]);
+}
+
+// vmin/vmax变化时重新生成，data()里只做一次查表
+void ArrayModel::update_color_table()
+{
+    color_table.resize(COLOR_TABLE_SIZE);
+    for (int k = 0; k < COLOR_TABLE_SIZE; ++k) {
+        double hue = hue0 + dhue * double(k) / (COLOR_TABLE_SIZE - 1);
+        color_table[k] = QColor::fromHsvF(qAbs(hue), sat, val, alp);
+    }
+}
+
 int ArrayModel::columnCount(const QModelIndex &parent) const
 {
     Q_UNUSED(parent);
@@ -165,10 +219,10 @@ void ArrayModel::fetch_more(bool rows, bool columns)
     if (can_fetch_more(false, columns)) {
         int reminder = total_cols - cols_loaded;
         int items_to_fetch = qMin(reminder, COLS_TO_LOAD);
-        beginInsertRows(QModelIndex(), cols_loaded,
-                        cols_loaded + items_to_fetch - 1);
+        beginInsertColumns(QModelIndex(), cols_loaded,
+                           cols_loaded + items_to_fetch - 1);
         cols_loaded += items_to_fetch;
-        endInsertRows();
+        endInsertColumns();
     }
 }
 
@@ -182,41 +236,38 @@ QVariant ArrayModel::get_value(const QModelIndex &index) const
 {
     int i = index.row();
     int j = index.column();
-    QVariant value = _data[i][j];
-    return changes.value(qMakePair(i, j), value);
+    if (!changes.isEmpty()) {
+        auto it = changes.constFind(qMakePair(i, j));
+        if (it != changes.constEnd())
+            return it.value();
+    }
+    return _data.variant(i, j);
 }
 
 QVariant ArrayModel::data(const QModelIndex &index, int role) const
 {
     if (!index.isValid())
         return QVariant();
-    QVariant value = get_value(index);
+    int i = index.row();
+    int j = index.column();
     if (role == Qt::DisplayRole) {
-        switch (value.type()) {
-        case QVariant::Bool:
-            return QString::asprintf(_format.toLatin1(), value.toBool());
-        case QVariant::Int:
-            return QString::asprintf(_format.toLatin1(), value.toInt());
-        case QVariant::Double:
-            return QString::asprintf(_format.toLatin1(), value.toDouble());
-        default:
-            break;
-        }
-        return value.toString();
+        quint64 key = cell_key(i, j);
+        if (QString* text = display_cache.object(key))
+            return *text;
+        QString text = format_value(i, j);
+        display_cache.insert(key, new QString(text));
+        return text;
     }
     else if (role == Qt::TextAlignmentRole)
         return int(Qt::AlignCenter|Qt::AlignVCenter);
-    else if (role == Qt::BackgroundColorRole && bgcolor_enabled) {
-        if (value.type() == QVariant::Bool || // True和False颜色不同
-            value.type() == QVariant::Int ||
-            value.type() == QVariant::Double) {
-            double hue = (hue0 +
-                          dhue * (double(vmax) - value.toDouble())
-                          / (double(vmax) - vmin));
-            hue = qAbs(hue);
-            QColor color = QColor::fromHsvF(hue, sat, val, alp);
-            return color;
-        }
+    else if (role == Qt::BackgroundColorRole && bgcolor_enabled && _data.is_valid()) {
+        // True和False颜色不同
+        double value = get_value(index).toDouble();
+        if (qIsNaN(value))
+            return QVariant();
+        double t = (double(vmax) - value) / (double(vmax) - vmin);
+        int k = qBound(0, qRound(t * (COLOR_TABLE_SIZE - 1)), COLOR_TABLE_SIZE - 1);
+        return color_table[k];
     }
     else if (role == Qt::FontRole) {
         QFont font("Consolas", 9, 50);
@@ -234,36 +285,36 @@ bool ArrayModel::setData(const QModelIndex &index, const QVariant &value, int ro
     int i = index.row();
     int j = index.column();
     QVariant val;
-    if (_data[0][0].type() == QVariant::Bool) {
+    double number;
+    if (_data.dtype() == ArrayBuffer::Bool) {
         val = value.toBool();
-        if (value.toBool() > vmax)
-            vmax = value.toBool();
-        if (value.toBool() < vmin)
-            vmin = value.toBool();
-    }
-    else if (_data[0][0].type() == QVariant::Int) {
-        val = value.toInt();
-        if (value.toInt() > vmax)
-            vmax = value.toInt();
-        if (value.toInt() < vmin)
-            vmin = value.toInt();
-    }
-    else if (_data[0][0].type() == QVariant::Double) {
+        number = value.toBool();
+    }
+    else if (_data.dtype() == ArrayBuffer::Int64) {
+        val = value.toLongLong();
+        number = value.toLongLong();
+    }
+    else if (_data.dtype() == ArrayBuffer::Double) {
         val = value.toDouble();
-        if (value.toDouble() > vmax)
-            vmax = value.toDouble();
-        if (value.toDouble() < vmin)
-            vmin = value.toDouble();
+        number = value.toDouble();
     }
     else {
         QMessageBox::critical(dialog, "Error",
                               QString("Value error: %1").arg(value.typeName()));
         return false;
     }
+    if (number > vmax || number < vmin) {
+        vmax = qMax(vmax, number);
+        vmin = qMin(vmin, number);
+        emit dataChanged(this->index(0, 0),
+                         this->index(rowCount()-1, columnCount()-1),
+                         QVector<int>() << Qt::BackgroundColorRole);
+    }
     test_array = val;
 
     // Add change to self.changes
     changes[qMakePair(i,j)] = val;
+    display_cache.remove(cell_key(i, j));
     emit dataChanged(index, index);
     return true;
 }
@@ -311,7 +362,7 @@ QWidget* ArrayDelegate::createEditor(QWidget *parent, const QStyleOptionViewItem
     const ArrayModel* mdl = qobject_cast<const ArrayModel*>(index.model());
     ArrayModel* model = const_cast<ArrayModel*>(mdl);
     QVariant value = model->get_value(index);
-    if (model->_data[0][0].type() == QVariant::Bool) {
+    if (model->_data.dtype() == ArrayBuffer::Bool) {
         bool val = !value.toBool();
         model->setData(index, val);
         return nullptr;
@@ -461,49 +512,19 @@ QString ArrayView::_sel_to_text(const QModelIndexList &cell_range)
     if (row_min == 0 && row_max == (model->rows_loaded-1))
         row_max = model->total_rows-1;
 
-    QVector<QVector<QVariant>> _data = model->get_data();
-    QString contents;
-    if (_data[0][0].type() == QVariant::Bool) {
-        for (int i = row_min; i < row_max+1; ++i) {
-            for (int j = col_min; j < col_max; ++j) {
-                contents += QString::asprintf(model->get_format().toLatin1(),
-                                              _data[i][j].toBool());
-                contents += "\t";
-            }
-            contents += QString::asprintf(model->get_format().toLatin1(),
-                                          _data[i][col_max].toBool());
-            contents += "\n";
-        }
-    }
-    else if (_data[0][0].type() == QVariant::Int) {
-        for (int i = row_min; i < row_max+1; ++i) {
-            for (int j = col_min; j < col_max; ++j) {
-                contents += QString::asprintf(model->get_format().toLatin1(),
-                                              _data[i][j].toInt());
-                contents += "\t";
-            }
-            contents += QString::asprintf(model->get_format().toLatin1(),
-                                          _data[i][col_max].toInt());
-            contents += "\n";
-        }
-    }
-    else if (_data[0][0].type() == QVariant::Double) {
-        for (int i = row_min; i < row_max+1; ++i) {
-            for (int j = col_min; j < col_max; ++j) {
-                contents += QString::asprintf(model->get_format().toLatin1(),
-                                              _data[i][j].toDouble());
-                contents += "\t";
-            }
-            contents += QString::asprintf(model->get_format().toLatin1(),
-                                          _data[i][col_max].toDouble());
-            contents += "\n";
-        }
-    }
-    else {
+    if (!model->get_data().is_valid()) {
         QMessageBox::warning(this, "Warning",
                              "It was not possible to copy values for this array");
         return QString();
-
+    }
+    QString contents;
+    for (int i = row_min; i < row_max+1; ++i) {
+        for (int j = col_min; j < col_max; ++j) {
+            contents += model->format_value(i, j);
+            contents += "\t";
+        }
+        contents += model->format_value(i, col_max);
+        contents += "\n";
     }
     return contents;
 }
@@ -518,7 +539,7 @@ void ArrayView::copy()
 
 /********** ArrayEditorWidget **********/
 ArrayEditorWidget::ArrayEditorWidget(QWidget* parent,
-                  const QVector<QVector<QVariant>>& data,
+                  const ArrayBuffer& data,
                   bool readonly,
                   const QStringList& xlabels,
                   const QStringList& ylabels)
@@ -526,26 +547,23 @@ ArrayEditorWidget::ArrayEditorWidget(QWidget* parent,
 {
     this->data = data;
 
-    QString dtype;
+    QString dtype = data.dtype_name();
     QString format = "%s";
-    switch (data[0][0].type()) {
-    case QVariant::Bool:
-        dtype = "bool";
+    switch (data.dtype()) {
+    case ArrayBuffer::Bool:
         format = "%r";
         break;
-    case QVariant::Int:
-        dtype = "int";
+    case ArrayBuffer::Int64:
         format = "%d";
         break;
-    case QVariant::Double:
-        dtype = "double";
+    case ArrayBuffer::Double:
         format = "%.6g";
         break;
     default:
         break;
     }
     model = new ArrayModel(data, format, xlabels, ylabels, readonly, this);
-    QPair<int,int> shape = qMakePair(data.size(), data[0].size());
+    QPair<int,int> shape = qMakePair(data.rows(), data.cols());
     view = new ArrayView(this, model, dtype, shape);
 
     QHBoxLayout* btn_layout = new QHBoxLayout;
@@ -578,7 +596,12 @@ void ArrayEditorWidget::accept_changes()
         int i = it.key().first;
         int j = it.key().second;
         QVariant value = it.value();
-        this->data[i][j] = value;
+        if (!this->data.set_value(i, j, value)) {
+            QMessageBox::critical(this, "Error",
+                                  "The array is too large to be copied into memory, "
+                                  "changes were not applied");
+            break;
+        }
     }
     //old_data_shape is not None说明构造函数传入的data是一维或0维的，不是二维的
 }
@@ -613,6 +636,9 @@ ArrayEditor::ArrayEditor(QWidget* parent)
     : QDialog (parent)
 {
     setAttribute(Qt::WA_DeleteOnClose);
+    // setup_and_check失败时reject会用到
+    stack = nullptr;
+    arraywidget = nullptr;
 }
 
 bool ArrayEditor::setup_and_check(const QVector<QVector<QVariant> > &data,
@@ -620,6 +646,38 @@ bool ArrayEditor::setup_and_check(const QVector<QVector<QVariant> > &data,
                                   bool readonly,
                                   const QStringList &xlabels,
                                   const QStringList &ylabels)
+{
+    ArrayBuffer array = ArrayBuffer::from_variants(data);
+    if (!array.is_valid()) {
+        QString arr = QString("%1 arrays").arg(data.isEmpty() || data[0].isEmpty()
+                                               ? "Empty" : data[0][0].typeName());
+        error(QString("%1 are currently not supported").arg(arr));
+        return false;
+    }
+    return setup_and_check(array, title, readonly, xlabels, ylabels);
+}
+
+// 直接内存映射.npy文件，打开大数组时不需要复制数据
+bool ArrayEditor::setup_and_check_npy(const QString &filename,
+                                      QString title,
+                                      bool readonly)
+{
+    QString message;
+    ArrayBuffer array = ArrayBuffer::load_npy(filename, &message);
+    if (!array.is_valid()) {
+        error(message);
+        return false;
+    }
+    if (title.isEmpty())
+        title = QFileInfo(filename).fileName();
+    return setup_and_check(array, title, readonly);
+}
+
+bool ArrayEditor::setup_and_check(const ArrayBuffer &data,
+                                  QString title,
+                                  bool readonly,
+                                  const QStringList &xlabels,
+                                  const QStringList &ylabels)
 {
     this->data = data;
     bool is_record_array = false;
@@ -627,34 +685,20 @@ bool ArrayEditor::setup_and_check(const QVector<QVector<QVariant> > &data,
     // dt.names：('name', 'grades')
     bool is_masked_array = false;
 
-    if (!xlabels.empty() && xlabels.size() != data[0].size()) {
+    if (!xlabels.empty() && xlabels.size() != data.cols()) {
         error("The 'xlabels' argument length do no match array "
               "column number");
         return false;
     }
-    if (!ylabels.empty() && ylabels.size() != data.size()) {
+    if (!ylabels.empty() && ylabels.size() != data.rows()) {
         error("The 'ylabels' argument length do no match array "
               "row number");
         return false;
     }
     if (is_record_array == false) {
-        QString dtn;
-        switch (data[0][0].type()) {
-        case QVariant::Bool:
-            dtn = "bool";
-            break;
-        case QVariant::Int:
-            dtn = "int";
-            break;
-        case QVariant::Double:
-            dtn = "double";
-            break;
-        default:
-            break;
-        }
+        QString dtn = data.dtype_name();
         if (dtn.isEmpty()) {
-            QString arr = QString("%1 arrays").arg(data[0][0].typeName());
-            error(QString("%1 are currently not supported").arg(arr));
+            error("Empty arrays are currently not supported");
             return false;
         }
     }
@@ -737,6 +781,11 @@ void ArrayEditor::accept()
 }
 
 QVector<QVector<QVariant>> ArrayEditor::get_value() const
+{
+    return data.to_variants();
+}
+
+ArrayBuffer ArrayEditor::get_array() const
 {
     return data;
 }
@@ -2,6 +2,7 @@
 
 #include "utils/icon_manager.h"
 #include "utils/qthelpers.h"
+#include "arraybuffer.h"
 #include <QtWidgets>
 
 class ArrayModel : public QAbstractTableModel
@@ -20,8 +21,9 @@ public:
     double sat;
     double val;
     double alp;
-    QVector<QVector<QVariant>> _data;
+    ArrayBuffer _data;
     QString _format;
+    QByteArray _format_latin1;
     int total_rows;
     int total_cols;
 
@@ -32,16 +34,23 @@ public:
     bool bgcolor_enabled;
     int rows_loaded;
     int cols_loaded;
+
+    // 可见单元格的格式化字符串缓存，以及按色相量化的背景色表
+    mutable QCache<quint64,QString> display_cache;
+    QVector<QColor> color_table;
 public:
-    ArrayModel(const QVector<QVector<QVariant>>& data,
+    ArrayModel(const ArrayBuffer& data,
                const QString& format = "%.6g",
                const QStringList& xlabels=QStringList(),
                const QStringList& ylabels=QStringList(),
                bool readonly = false,
                QWidget* parent = nullptr);
     QString get_format() const;
-    QVector<QVector<QVariant>> get_data() const;
+    ArrayBuffer get_data() const;
     void set_format(const QString& format);
+    QString format_value(const QVariant& value) const;
+    QString format_value(int i, int j) const;
+    void update_color_table();
     int columnCount(const QModelIndex &parent = QModelIndex()) const override;
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
     bool can_fetch_more(bool rows=false,bool columns=false) const;
@@ -100,11 +109,11 @@ class ArrayEditorWidget : public QWidget
 {
     Q_OBJECT
 public:
-    QVector<QVector<QVariant>> data;
+    ArrayBuffer data;
     ArrayModel* model;
     ArrayView* view;
     ArrayEditorWidget(QWidget* parent,
-                      const QVector<QVector<QVariant>>& data,
+                      const ArrayBuffer& data,
                       bool readonly = false,
                       const QStringList& xlabels=QStringList(),
                       const QStringList& ylabels=QStringList());
@@ -119,7 +128,7 @@ class ArrayEditor : public QDialog
 {
     Q_OBJECT
 public:
-    QVector<QVector<QVariant>> data;
+    ArrayBuffer data;
     ArrayEditorWidget* arraywidget;
     QStackedWidget* stack;
     QGridLayout* layout;
@@ -132,7 +141,16 @@ public:
                          bool readonly = false,
                          const QStringList& xlabels=QStringList(),
                          const QStringList& ylabels=QStringList());
+    bool setup_and_check(const ArrayBuffer& data,
+                         QString title = "",
+                         bool readonly = false,
+                         const QStringList& xlabels=QStringList(),
+                         const QStringList& ylabels=QStringList());
+    bool setup_and_check_npy(const QString& filename,
+                             QString title = "",
+                             bool readonly = false);
     QVector<QVector<QVariant>> get_value() const;
+    ArrayBuffer get_array() const;
     void error(const QString& message);
 public slots:
     void save_and_close_enable(const QModelIndex& left_top,
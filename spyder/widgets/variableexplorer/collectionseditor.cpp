@@ -1,5 +1,8 @@
 #include "collectionseditor.h"
 
+#include <algorithm>
+#include <functional>
+
 const int LARGE_NROWS = 100;
 const int ROWS_TO_LOAD = 50;
 
@@ -22,6 +25,8 @@ ReadOnlyCollectionsModel::ReadOnlyCollectionsModel(QObject* parent,
     this->title = title;
     if (!this->title.isEmpty())
         this->title = this->title + " - ";
+    sort_column = -1;
+    sort_order = Qt::AscendingOrder;
     set_data(data);
 }
 
@@ -41,29 +46,38 @@ void ReadOnlyCollectionsModel::set_data(const QVariant &data)
     header0 = "Index";
     if (names)
         header0 = "Name";
+    list_data.clear();
+    dict_data.clear();
+    dict_keys.clear();
+    int count = 0;
     //暂未实现元组
     if (data.type() == QVariant::List) {
-        QList<QVariant> list = data.toList();
-        keys.clear();
-        for (int i=0;i<list.size();i++)
-            keys.append(i);
+        list_data = data.toList();
+        count = list_data.size();
         title += "List";
     }
     else if (data.type() == QVariant::Hash) {
-        QHash<QString, QVariant> dict = data.toHash();
-        keys.clear();
-        for (auto it=dict.begin();it!=dict.end();it++) {
-            QString key = it.key();
-            keys.append(key);
-        }
+        dict_data = data.toHash();
+        dict_keys = dict_data.keys();
+        count = dict_keys.size();
         title += "Dictionary";
         if (!names)
             header0 = "Key";
     }
     //实现不了对象，QVariant没有toMetaObject之类的方法
-    title += " (" + QString::number(keys.size()) + " elements)";
-
-    total_rows = keys.size();
+    title += " (" + QString::number(count) + " elements)";
+
+    order.resize(count);
+    for (int i = 0; i < count; i++)
+        order[i] = i;
+    sizes.fill(-1, count);
+    displays.clear();
+    displays.resize(count);
+    // 新的数据保持原来的排序
+    if (sort_column >= 0)
+        this->sort(sort_column, sort_order);
+
+    total_rows = count;
     if (total_rows > LARGE_NROWS)
         rows_loaded = ROWS_TO_LOAD;
     else
@@ -73,68 +87,138 @@ void ReadOnlyCollectionsModel::set_data(const QVariant &data)
     reset();
 }
 
-void ReadOnlyCollectionsModel::set_size_and_type(int start, int stop)
+QVariant ReadOnlyCollectionsModel::element(int source) const
+{
+    if (_data.type() == QVariant::List)
+        return list_data.at(source);
+    else if (_data.type() == QVariant::Hash)
+        return dict_data.value(dict_keys.at(source));
+    return QVariant();
+}
+
+int ReadOnlyCollectionsModel::element_size(int source) const
 {
-    QVariant data = _data;
+    int& size = sizes[source];
+    if (size < 0)
+        size = get_size(this->element(source));
+    return size;
+}
+
+QString ReadOnlyCollectionsModel::element_display(int source) const
+{
+    QString& display = displays[source];
+    if (display.isNull()) {
+        QVariant value = this->element(source);
+        if (remote)
+            value = value.toHash()["view"];
+        display = value_to_display(value);
+        if (display.isNull())
+            display = QString("");
+    }
+    return display;
+}
 
-    bool fetch_more;
-    if (start != -1 && stop != -1) {
+// 预先计算[start, stop)行的大小，不指定时计算已加载的行
+void ReadOnlyCollectionsModel::set_size_and_type(int start, int stop)
+{
+    if (start == -1 && stop == -1) {
         start = 0;
         stop = rows_loaded;
-        fetch_more = false;
     }
-    else
-        fetch_more = true;
+    if (remote)
+        return;
+    for (int row = start; row < stop && row < order.size(); ++row)
+        this->element_size(order[row]);
+}
 
-    QList<int> sizes;
-    QList<QString> types;
-    if (remote) {
-        ;//
-    }
-    else {
-        if (data.type() == QVariant::List) {
-            QList<QVariant> data_ = data.toList();
-            for (int index = start; index < stop; ++index) {
-                int idx = keys[index].toInt();
-                sizes.append(get_size(data_[idx]));
-                types.append(data_[idx].typeName());//get_human_readable_type
-            }
-        }
-        else if (data.type() == QVariant::Hash) {
-            QHash<QString, QVariant> data_ = data.toHash();
-            for (int index = start; index < stop; ++index) {
-                QString idx = keys[index].toString();
-                sizes.append(get_size(data_[idx]));
-                types.append(data_[idx].typeName());
-                //get_human_readable_type直接用typeName()代替
-            }
-        }
+// 数字在前、字符串其次、其他类型最后，同类之间比较值，其他类型比较显示的文本
+static int value_rank(const QVariant& value)
+{
+    switch (value.type()) {
+    case QVariant::Bool:
+    case QVariant::Int:
+    case QVariant::UInt:
+    case QVariant::LongLong:
+    case QVariant::ULongLong:
+    case QVariant::Double:
+        return 0;
+    case QVariant::String:
+        return 1;
+    default:
+        return 2;
     }
+}
 
-    if (fetch_more) {
-        this->sizes = this->sizes + sizes;
-        this->types = this->types + types;
+// 排序值时每个元素的比较键，排序前一次算好
+struct ValueKey
+{
+    int rank;
+    double number;
+    QString text;
+};
+
+// 只对下标数组排序；降序时交换比较的两个参数，保持相等元素的原有顺序。
+// 类型名、值的比较键先按元素算好，比较时不再从容器中取元素
+void ReadOnlyCollectionsModel::sort(int column, Qt::SortOrder order)
+{
+    if (column < 0 || column >= this->columnCount())
+        return;
+    bool is_dict = (_data.type() == QVariant::Hash);
+    int count = this->order.size();
+    QVector<const char*> type_names;
+    QVector<ValueKey> value_keys;
+    std::function<bool(int,int)> less;
+    if (column == 0) {
+        if (is_dict)
+            less = [this](int a, int b) { return dict_keys.at(a) < dict_keys.at(b); };
+        else
+            less = [](int a, int b) { return a < b; };
+    }
+    else if (column == 1) {
+        type_names.resize(count);
+        for (int i = 0; i < count; i++)
+            type_names[i] = this->element(i).typeName();
+        less = [&type_names](int a, int b) {
+            return qstrcmp(type_names[a], type_names[b]) < 0;
+        };
+    }
+    else if (column == 2) {
+        less = [this](int a, int b) { return this->element_size(a) < this->element_size(b); };
     }
     else {
-        this->sizes = sizes;
-        this->types = types;
+        value_keys.resize(count);
+        for (int i = 0; i < count; i++) {
+            QVariant value = this->element(i);
+            ValueKey& key = value_keys[i];
+            key.rank = value_rank(value);
+            key.number = 0;
+            if (key.rank == 0)
+                key.number = value.toDouble();
+            else if (key.rank == 1)
+                key.text = value.toString();
+            else
+                key.text = this->element_display(i);
+        }
+        less = [&value_keys](int a, int b) {
+            const ValueKey& key_a = value_keys[a];
+            const ValueKey& key_b = value_keys[b];
+            if (key_a.rank != key_b.rank)
+                return key_a.rank < key_b.rank;
+            if (key_a.rank == 0)
+                return key_a.number < key_b.number;
+            return key_a.text < key_b.text;
+        };
     }
-}
 
-template<class T1, class T2>
-QList<T1> sort_against(QList<T1> list1, QList<T2> list2, bool reverse=false)
-{
-    Q_ASSERT(list1.size() == list2.size());
-    QList<QPair<T2,T1>> tmp;
-    for (int i=0;i<list1.size();i++)
-        tmp.append(QPair<T2,T1>(list2[i], list1[i]));
-    std::sort(tmp.begin(),tmp.end());
-    if (reverse)
-        std::reverse(tmp.begin(), tmp.end());
-    QList<T1> res;
-    for (int i=0;i<list1.size();i++)
-        res.append(tmp[i].second);
-    return res;
+    beginResetModel();
+    if (order == Qt::AscendingOrder)
+        std::stable_sort(this->order.begin(), this->order.end(), less);
+    else
+        std::stable_sort(this->order.begin(), this->order.end(),
+                         [&less](int a, int b) { return less(b, a); });
+    sort_column = column;
+    sort_order = order;
+    endResetModel();
 }
 
 int ReadOnlyCollectionsModel::columnCount(const QModelIndex &parent) const
@@ -174,7 +258,12 @@ void ReadOnlyCollectionsModel::fetchMore(const QModelIndex &parent)
 
 QModelIndex ReadOnlyCollectionsModel::get_index_from_key(const QVariant &key) const
 {
-    int idx = keys.indexOf(key);
+    int source = -1;
+    if (_data.type() == QVariant::List)
+        source = key.toInt();
+    else if (_data.type() == QVariant::Hash)
+        source = dict_keys.indexOf(key.toString());
+    int idx = source >= 0 ? order.indexOf(source) : -1;
     if (idx != -1)
         return createIndex(idx, 0);
     else
@@ -183,26 +272,22 @@ QModelIndex ReadOnlyCollectionsModel::get_index_from_key(const QVariant &key) co
 
 QVariant ReadOnlyCollectionsModel::get_key(const QModelIndex &index) const
 {
-    return keys[index.row()];
+    int source = order[index.row()];
+    if (_data.type() == QVariant::Hash)
+        return dict_keys[source];
+    return source;
 }
 
 QVariant ReadOnlyCollectionsModel::get_value(const QModelIndex &index) const
 {
+    int source = order[index.row()];
     if (index.column() == 0)
-        return keys[index.row()];
+        return this->get_key(index);
     else if (index.column() == 1)
-        return types[index.row()];
+        return QString(this->element(source).typeName());
     else if (index.column() == 2)
-        return sizes[index.column()];
-    else if (_data.type() == QVariant::List) {
-        QList<QVariant> data = _data.toList();
-        return data[keys[index.row()].toInt()];
-    }
-    else if (_data.type() == QVariant::Hash) {
-        QHash<QString, QVariant> data = _data.toHash();
-        return data[keys[index.row()].toString()];
-    }
-    return QVariant();
+        return this->element_size(source);
+    return this->element(source);
 }
 
 QColor ReadOnlyCollectionsModel::get_bgcolor(const QModelIndex &index) const
@@ -227,37 +312,31 @@ QVariant ReadOnlyCollectionsModel::data(const QModelIndex &index, int role) cons
 {
     if (!index.isValid())
         return QVariant();
-    QVariant value = get_value(index);
-    if (index.column() == 3 && remote)
-        value = value.toHash()["view"];
+    if (role == Qt::BackgroundColorRole)
+        return get_bgcolor(index);
+    else if (role == Qt::FontRole) {
+        QFont font("Consolas", 9, 50);
+        font.setItalic(false);
+        return font;
+    }
+    else if (role != Qt::DisplayRole && role != Qt::EditRole && role != Qt::TextAlignmentRole)
+        return QVariant();
+
     QString display;
     if (index.column() == 3)
-        display = value_to_display(value);
+        display = this->element_display(order[index.row()]);
     else
-        display = value.toString();
+        display = get_value(index).toString();
 
-    if (role == Qt::DisplayRole)
+    if (role == Qt::DisplayRole || role == Qt::EditRole)
         return display;
-    else if (role == Qt::EditRole)
-        return value_to_display(value);
-    else if (role == Qt::TextAlignmentRole) {
-        if (index.column() == 3) {
-            if (display.split(QRegExp("[\r\n]"),QString::SkipEmptyParts).size() < 3)
-                return int(Qt::AlignLeft|Qt::AlignVCenter);
-            else
-                return int(Qt::AlignLeft|Qt::AlignTop);
-        }
-        else
+    if (index.column() == 3) {
+        if (display.split(QRegExp("[\r\n]"),QString::SkipEmptyParts).size() < 3)
             return int(Qt::AlignLeft|Qt::AlignVCenter);
+        else
+            return int(Qt::AlignLeft|Qt::AlignTop);
     }
-    else if (role == Qt::BackgroundColorRole)
-        return get_bgcolor(index);
-    else if (role == Qt::FontRole) {
-        QFont font("Consolas", 9, 50);
-        font.setItalic(false);
-        return font;
-    }
-    return QVariant();
+    return int(Qt::AlignLeft|Qt::AlignVCenter);
 }
 
 QVariant ReadOnlyCollectionsModel::headerData(int section, Qt::Orientation orientation, int role) const
@@ -301,24 +380,18 @@ CollectionsModel::CollectionsModel(QObject* parent,
 
 void CollectionsModel::set_value(const QModelIndex &index, const QVariant &value)
 {
+    int source = order[index.row()];
     if (_data.type() == QVariant::List) {
-        QList<QVariant> list = _data.toList();
-        list[keys[index.row()].toInt()] = value;
-        _data = list;
-        list = showndata.toList();
-        list[keys[index.row()].toInt()] = value;
-        showndata = list;
+        list_data[source] = value;
+        _data = list_data;
     }
     else if (_data.type() == QVariant::Hash) {
-        QHash<QString, QVariant> dict = _data.toHash();
-        dict[keys[index.row()].toString()] = value;
-        _data = dict;
-        dict = showndata.toHash();
-        dict[keys[index.row()].toString()] = value;
-        showndata = dict;
+        dict_data[dict_keys[source]] = value;
+        _data = dict_data;
     }
-    sizes[index.row()] = get_size(value);
-    types[index.row()] = value.typeName();
+    showndata = _data;
+    sizes[source] = get_size(value);
+    displays[source] = QString();
     emit sig_setting_data();
 }
 
@@ -357,3 +430,15 @@ bool CollectionsModel::setData(const QModelIndex &index, const QVariant &value,
 /********** CollectionsDelegate **********/
 
 
+/********** CollectionsEditorTableView **********/
+CollectionsEditorTableView::CollectionsEditorTableView(QWidget* parent,
+                                                       ReadOnlyCollectionsModel* model)
+    : QTableView (parent)
+{
+    setModel(model);
+    // 打开排序时视图立即按表头的排序标记排一次，先把标记设成模型当前的排序
+    horizontalHeader()->setSortIndicator(model->sort_column, model->sort_order);
+    setSortingEnabled(true);
+    horizontalHeader()->setStretchLastSection(true);
+    setSelectionBehavior(QAbstractItemView::SelectRows);
+}
@@ -3,6 +3,8 @@
 #include "nsview.h"
 #include "arrayeditor.h"
 
+// 集合的表格模型。行号通过order映射到容器中的下标(字典按键的下标)，排序只重排order，
+// 不复制元素。每个元素的大小和显示的文本在第一次用到时计算并缓存
 class ReadOnlyCollectionsModel : public QAbstractTableModel
 {
     Q_OBJECT
@@ -18,10 +20,19 @@ public:
     int total_rows;
     int rows_loaded; //源码179行
     QVariant showndata;
-    QList<QVariant> keys;
     QString title;
-    QList<int> sizes;
-    QList<QString> types;//暂定
+
+    QList<QVariant> list_data;
+    QHash<QString, QVariant> dict_data;
+    QStringList dict_keys;
+    // 第row行对应的元素下标
+    QVector<int> order;
+    // 当前按哪一列排序，-1表示不排序；set_data之后按它重新排序
+    int sort_column;
+    Qt::SortOrder sort_order;
+    // 按元素下标，-1或空字符串(isNull)表示还没有计算
+    mutable QVector<int> sizes;
+    mutable QVector<QString> displays;
 
 public:
     ReadOnlyCollectionsModel(QObject* parent,
@@ -34,7 +45,7 @@ public:
     QVariant get_data() const;
     void set_data(const QVariant& data);//暂时没有实现coll_filter
     void set_size_and_type(int start=-1,int stop=-1);
-    //void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
     int columnCount(const QModelIndex &parent = QModelIndex()) const override;
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
     bool canFetchMore(const QModelIndex &parent) const override;
@@ -47,6 +58,10 @@ public:
     QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
     Qt::ItemFlags flags(const QModelIndex &index) const override;
     void reset();
+
+    QVariant element(int source) const;
+    int element_size(int source) const;
+    QString element_display(int source) const;
 };
 
 
@@ -67,4 +82,10 @@ public:
 };
 
 
-
+// 集合的表格视图，点击表头按列排序
+class CollectionsEditorTableView : public QTableView
+{
+    Q_OBJECT
+public:
+    CollectionsEditorTableView(QWidget* parent, ReadOnlyCollectionsModel* model);
+};
@@ -0,0 +1,723 @@
+#include "importengine.h"
+#include <QMetaType>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <limits>
+
+// 小于该大小的数据不值得并行解析
+const qint64 PARALLEL_PARSE_SIZE = 4 << 20;
+// 每解析这么多行更新一次进度
+const int PROGRESS_ROWS = 4096;
+
+static inline bool is_blank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static void trim(const char** begin, const char** end)
+{
+    while (*begin < *end && is_blank(**begin))
+        (*begin)++;
+    while (*end > *begin && is_blank(*(*end - 1)))
+        (*end)--;
+}
+
+static bool parse_int(const char* p, const char* end, qint64* out)
+{
+    if (p == end)
+        return false;
+    bool negative = false;
+    if (*p == '-' || *p == '+') {
+        negative = *p == '-';
+        p++;
+    }
+    if (p == end || end - p > 18)
+        return false;
+    qint64 value = 0;
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9')
+            return false;
+        value = value * 10 + (*p - '0');
+    }
+    *out = negative ? -value : value;
+    return true;
+}
+
+// 快速路径：尾数不超过2^53且10的指数不超过22时，一次乘除即可得到精确结果；
+// 其余情况(nan、inf、超长尾数)交给QByteArray::toDouble，它与locale无关
+static bool parse_double(const char* begin, const char* end, double* out)
+{
+    static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                   1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+                                   1e20, 1e21, 1e22};
+    const char* p = begin;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    quint64 mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + quint64(*p - '0');
+            if (mantissa)
+                digits++;
+        }
+        else
+            exponent++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        for (; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + quint64(*p - '0');
+                if (mantissa)
+                    digits++;
+                exponent--;
+            }
+        }
+    }
+    if (any && p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool exp_negative = false;
+        if (q < end && (*q == '-' || *q == '+')) {
+            exp_negative = *q == '-';
+            q++;
+        }
+        int e = 0;
+        bool exp_any = false;
+        for (; q < end && *q >= '0' && *q <= '9'; q++, exp_any = true)
+            e = qMin(e * 10 + (*q - '0'), 100000);
+        if (exp_any) {
+            exponent += exp_negative ? -e : e;
+            p = q;
+        }
+    }
+
+    if (any && p == end && mantissa < (quint64(1) << 53) &&
+            exponent >= -22 && exponent <= 22) {
+        double value = double(mantissa);
+        value = exponent < 0 ? value / pow10[-exponent] : value * pow10[exponent];
+        *out = negative ? -value : value;
+        return true;
+    }
+
+    bool ok;
+    double value = QByteArray(begin, int(end - begin)).toDouble(&ok);
+    if (ok)
+        *out = value;
+    return ok;
+}
+
+static bool parse_bool(const char* p, const char* end, bool* out)
+{
+    int n = int(end - p);
+    if (n == 4 && (qstrnicmp(p, "true", 4) == 0)) {
+        *out = true;
+        return true;
+    }
+    if (n == 5 && (qstrnicmp(p, "false", 5) == 0)) {
+        *out = false;
+        return true;
+    }
+    return false;
+}
+
+static QString unquote(const char* begin, const char* end, bool quoted)
+{
+    if (!quoted)
+        return QString::fromUtf8(begin, int(end - begin));
+    QByteArray tmp(begin + 1, int(end - begin - 2));
+    return QString::fromUtf8(tmp.replace("\"\"", "\""));
+}
+
+
+/********** ImportOptions **********/
+static bool is_single_ascii(const QString& sep)
+{
+    return sep.size() == 1 && sep.at(0).unicode() < 0x80;
+}
+
+QString ImportOptions::check() const
+{
+    if (!this->col_sep.isEmpty() && !is_single_ascii(this->col_sep))
+        return QString("Column separator '%1' is not a single ASCII character").arg(this->col_sep);
+    if (!is_single_ascii(this->row_sep))
+        return QString("Row separator '%1' is not a single ASCII character").arg(this->row_sep);
+    if (!this->col_sep.isEmpty() && this->col_sep == this->row_sep)
+        return "Column and row separators must be different";
+    return QString();
+}
+
+bool ImportOptions::operator==(const ImportOptions &other) const
+{
+    return this->col_sep == other.col_sep && this->row_sep == other.row_sep &&
+            this->skiprows == other.skiprows && this->comments == other.comments &&
+            this->preview_rows == other.preview_rows;
+}
+
+
+/********** ImportColumn **********/
+ImportColumn::ImportColumn(Type type)
+{
+    this->type = type;
+}
+
+int ImportColumn::size() const
+{
+    switch (this->type) {
+    case Int:
+        return this->ints.size();
+    case Bool:
+        return this->bools.size();
+    case Float:
+        return this->floats.size();
+    default:
+        return this->texts.size();
+    }
+}
+
+QVariant ImportColumn::value(int row) const
+{
+    switch (this->type) {
+    case Int:
+        return this->ints[row];
+    case Bool:
+        return this->bools[row];
+    case Float:
+        return this->floats[row];
+    default:
+        return this->texts[row];
+    }
+}
+
+// 不符合当前类型时仍然追加一个占位值以保持各列等长，并返回false
+bool ImportColumn::append(const char *begin, const char *end, bool quoted)
+{
+    if (this->type == Text) {
+        this->texts.append(unquote(begin, end, quoted));
+        return true;
+    }
+    if (quoted) {
+        begin++;
+        end--;
+    }
+    switch (this->type) {
+    case Int: {
+        qint64 value = 0;
+        bool ok = parse_int(begin, end, &value);
+        this->ints.append(value);
+        return ok;
+    }
+    case Bool: {
+        bool value = false;
+        bool ok = parse_bool(begin, end, &value);
+        this->bools.append(value);
+        return ok;
+    }
+    default: {
+        double value = std::numeric_limits<double>::quiet_NaN();
+        bool ok = begin == end || parse_double(begin, end, &value);
+        this->floats.append(value);
+        return ok;
+    }
+    }
+}
+
+bool ImportColumn::append_missing()
+{
+    switch (this->type) {
+    case Int:
+        this->ints.append(0);
+        return false;
+    case Bool:
+        this->bools.append(false);
+        return false;
+    case Float:
+        this->floats.append(std::numeric_limits<double>::quiet_NaN());
+        return true;
+    default:
+        this->texts.append(QString());
+        return true;
+    }
+}
+
+void ImportColumn::extend(const ImportColumn &other)
+{
+    Q_ASSERT(this->type == other.type);
+    this->ints += other.ints;
+    this->bools += other.bools;
+    this->floats += other.floats;
+    this->texts += other.texts;
+}
+
+
+/********** DelimitedParser **********/
+DelimitedParser::DelimitedParser(const ImportOptions &options)
+{
+    this->data = nullptr;
+    this->length = 0;
+    this->file = nullptr;
+    this->mapped = nullptr;
+
+    // options应已通过check()
+    Q_ASSERT(options.check().isEmpty());
+    this->whitespace_sep = options.col_sep.isEmpty();
+    this->col_sep = this->whitespace_sep ? ' ' : options.col_sep.at(0).toLatin1();
+    this->row_sep = options.row_sep.at(0).toLatin1();
+    this->comments = options.comments.toUtf8();
+    this->skiprows = options.skiprows;
+}
+
+DelimitedParser::~DelimitedParser()
+{
+    this->close();
+}
+
+void DelimitedParser::close()
+{
+    if (this->file) {
+        if (this->mapped)
+            this->file->unmap(this->mapped);
+        delete this->file;
+    }
+    this->file = nullptr;
+    this->mapped = nullptr;
+    this->bytes.clear();
+    this->data = nullptr;
+    this->length = 0;
+}
+
+bool DelimitedParser::open(const QString &filename, QString *error)
+{
+    this->close();
+    this->file = new QFile(filename);
+    if (!this->file->open(QIODevice::ReadOnly)) {
+        if (error)
+            *error = QString("Unable to open '%1'").arg(filename);
+        this->close();
+        return false;
+    }
+    this->length = this->file->size();
+    if (this->length > 0)
+        this->mapped = this->file->map(0, this->length);
+    if (this->mapped)
+        this->data = reinterpret_cast<const char*>(this->mapped);
+    else {
+        // 无法映射时退回到读入内存
+        this->bytes = this->file->readAll();
+        this->data = this->bytes.constData();
+        this->length = this->bytes.size();
+    }
+    return true;
+}
+
+void DelimitedParser::set_text(const QString &text)
+{
+    this->close();
+    this->bytes = text.toUtf8();
+    this->data = this->bytes.constData();
+    this->length = this->bytes.size();
+}
+
+// 行尾分隔符的位置，引号内的分隔符不算。引号外用memchr跳跃查找
+qint64 DelimitedParser::row_end(qint64 pos) const
+{
+    bool in_quotes = false;
+    qint64 sep_pos = -1;
+    while (pos < this->length) {
+        if (in_quotes) {
+            const char* quote = static_cast<const char*>(
+                        std::memchr(this->data + pos, '"', size_t(this->length - pos)));
+            if (!quote)
+                return this->length;
+            in_quotes = false;
+            pos = quote - this->data + 1;
+            continue;
+        }
+        if (sep_pos < pos) {
+            const char* sep = static_cast<const char*>(
+                        std::memchr(this->data + pos, this->row_sep, size_t(this->length - pos)));
+            sep_pos = sep ? sep - this->data : this->length;
+        }
+        const char* quote = static_cast<const char*>(
+                    std::memchr(this->data + pos, '"', size_t(sep_pos - pos)));
+        if (!quote)
+            return sep_pos;
+        in_quotes = true;
+        pos = quote - this->data + 1;
+    }
+    return this->length;
+}
+
+qint64 DelimitedParser::data_start() const
+{
+    qint64 pos = 0;
+    if (this->length >= 3 && std::memcmp(this->data, "\xef\xbb\xbf", 3) == 0)
+        pos = 3;
+    for (int i = 0; i < this->skiprows && pos < this->length; i++)
+        pos = this->row_end(pos) + 1;
+    return qMin(pos, this->length);
+}
+
+bool DelimitedParser::is_comment(qint64 begin, qint64 end) const
+{
+    while (begin < end && is_blank(this->data[begin]))
+        begin++;
+    if (begin == end)
+        return true;// 空行
+    if (this->comments.isEmpty() || end - begin < this->comments.size())
+        return false;
+    return std::memcmp(this->data + begin, this->comments.constData(),
+                       size_t(this->comments.size())) == 0;
+}
+
+// callback(row_begin, row_end)返回false时停止；只处理起始位置小于end的行
+template <typename F>
+void DelimitedParser::for_each_row(qint64 begin, qint64 end, F callback) const
+{
+    qint64 pos = begin;
+    while (pos < end && pos < this->length) {
+        qint64 stop = this->row_end(pos);
+        qint64 rend = stop;
+        if (this->row_sep == '\n' && rend > pos && this->data[rend-1] == '\r')
+            rend--;
+        if (!this->is_comment(pos, rend) && !callback(pos, rend))
+            break;
+        pos = stop + 1;
+    }
+}
+
+// callback(column, field_begin, field_end, quoted)
+template <typename F>
+void DelimitedParser::for_each_field(qint64 begin, qint64 end, F callback) const
+{
+    qint64 p = begin;
+    if (this->whitespace_sep)
+        while (p < end && is_blank(this->data[p]))
+            p++;
+    int column = 0;
+    while (true) {
+        qint64 field_begin = p;
+        bool in_quotes = false;
+        for (; p < end; p++) {
+            char c = this->data[p];
+            if (c == '"')
+                in_quotes = !in_quotes;
+            else if (!in_quotes && (this->whitespace_sep ? is_blank(c) : c == this->col_sep))
+                break;
+        }
+        const char* fb = this->data + field_begin;
+        const char* fe = this->data + p;
+        trim(&fb, &fe);
+        bool quoted = fe - fb >= 2 && *fb == '"' && *(fe - 1) == '"';
+        callback(column++, fb, fe, quoted);
+
+        if (p >= end)
+            break;
+        p++;
+        if (this->whitespace_sep) {
+            while (p < end && is_blank(this->data[p]))
+                p++;
+            if (p >= end)
+                break;
+        }
+    }
+}
+
+QList<QStringList> DelimitedParser::preview(int max_rows) const
+{
+    QList<QStringList> rows;
+    this->for_each_row(this->data_start(), this->length, [&](qint64 rb, qint64 re) {
+        QStringList fields;
+        this->for_each_field(rb, re, [&](int, const char* fb, const char* fe, bool quoted) {
+            fields.append(unquote(fb, fe, quoted));
+        });
+        rows.append(fields);
+        return rows.size() < max_rows;
+    });
+    return rows;
+}
+
+// 由样本推断每列能容纳所有值的最窄类型
+QVector<ImportColumn::Type> DelimitedParser::infer_types(int sample_rows) const
+{
+    QVector<bool> could_int, could_bool, could_float, any_value;
+    int nrows = 0;
+    this->for_each_row(this->data_start(), this->length, [&](qint64 rb, qint64 re) {
+        int ncols = 0;
+        this->for_each_field(rb, re, [&](int column, const char* fb, const char* fe, bool quoted) {
+            if (column >= could_int.size()) {
+                // 新出现的列在之前的行中是缺失值
+                bool missing = nrows > 0;
+                could_int.append(!missing);
+                could_bool.append(!missing);
+                could_float.append(true);
+                any_value.append(false);
+            }
+            if (quoted) {
+                fb++;
+                fe--;
+            }
+            if (fb == fe) {
+                could_int[column] = false;
+                could_bool[column] = false;
+            }
+            else {
+                any_value[column] = true;
+                qint64 i;
+                bool b;
+                double d;
+                if (could_int[column] && !parse_int(fb, fe, &i))
+                    could_int[column] = false;
+                if (could_bool[column] && !parse_bool(fb, fe, &b))
+                    could_bool[column] = false;
+                if (could_float[column] && !parse_double(fb, fe, &d))
+                    could_float[column] = false;
+            }
+            ncols = column + 1;
+        });
+        for (int column = ncols; column < could_int.size(); column++) {
+            could_int[column] = false;
+            could_bool[column] = false;
+        }
+        nrows++;
+        return nrows < sample_rows;
+    });
+
+    QVector<ImportColumn::Type> types;
+    for (int column = 0; column < could_int.size(); column++) {
+        if (could_bool[column] && any_value[column])
+            types.append(ImportColumn::Bool);
+        else if (could_int[column] && any_value[column])
+            types.append(ImportColumn::Int);
+        else if (could_float[column])
+            types.append(ImportColumn::Float);
+        else
+            types.append(ImportColumn::Text);
+    }
+    return types;
+}
+
+void DelimitedParser::parse_range(qint64 begin, qint64 end, bool first, bool in_quotes,
+                                  QVector<ImportColumn> *columns, QVector<bool> *failed,
+                                  std::atomic<bool>* stopped,
+                                  std::atomic<qint64>* progress) const
+{
+    // 定位本块内第一个行首：紧跟在引号外的行分隔符之后
+    qint64 pos = begin;
+    if (!first && (in_quotes || this->data[begin-1] != this->row_sep)) {
+        for (; pos < end; pos++) {
+            char c = this->data[pos];
+            if (c == '"')
+                in_quotes = !in_quotes;
+            else if (c == this->row_sep && !in_quotes)
+                break;
+        }
+        pos++;
+    }
+
+    const int ncols = columns->size();
+    int nrows = 0;
+    qint64 reported = pos;
+    this->for_each_row(pos, end, [&](qint64 rb, qint64 re) {
+        int seen = 0;
+        this->for_each_field(rb, re, [&](int column, const char* fb, const char* fe, bool quoted) {
+            if (column < ncols) {
+                if (!(*columns)[column].append(fb, fe, quoted))
+                    (*failed)[column] = true;
+                seen = column + 1;
+            }
+        });
+        for (int column = seen; column < ncols; column++) {
+            if (!(*columns)[column].append_missing())
+                (*failed)[column] = true;
+        }
+        if (++nrows % PROGRESS_ROWS == 0) {
+            if (progress) {
+                progress->fetch_add(re - reported);
+                reported = re;
+            }
+            if (stopped && stopped->load())
+                return false;
+        }
+        return true;
+    });
+    if (progress)
+        progress->fetch_add(qMax<qint64>(0, end - reported));
+}
+
+bool DelimitedParser::parse(QVector<ImportColumn> *columns, int nthreads,
+                            std::atomic<bool> *stopped,
+                            std::atomic<qint64> *progress) const
+{
+    columns->clear();
+    QVector<ImportColumn::Type> types = this->infer_types();
+    if (types.isEmpty())
+        return true;
+
+    const qint64 start = this->data_start();
+    const qint64 total = this->length - start;
+    if (nthreads <= 0)
+        nthreads = qMax(1, QThread::idealThreadCount());
+    if (total < PARALLEL_PARSE_SIZE)
+        nthreads = 1;
+
+    QVector<qint64> bounds;
+    for (int c = 0; c <= nthreads; c++)
+        bounds.append(start + total * c / nthreads);
+
+    // 第一遍：并行统计每块中的引号个数，前缀和的奇偶性给出每块开头是否在引号内
+    std::vector<qint64> quotes(size_t(nthreads), 0);
+    if (nthreads > 1) {
+        std::vector<std::thread> workers;
+        for (int c = 0; c < nthreads; c++) {
+            workers.emplace_back([&, c]() {
+                qint64 count = 0;
+                const char* p = this->data + bounds[c];
+                const char* e = this->data + bounds[c+1];
+                while ((p = static_cast<const char*>(std::memchr(p, '"', size_t(e - p))))) {
+                    count++;
+                    p++;
+                }
+                quotes[size_t(c)] = count;
+            });
+        }
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    // 第二遍：每块独立解析起始于本块的行；类型不符时放宽类型重新解析
+    for (int attempt = 0; attempt < 4; attempt++) {
+        if (progress)
+            progress->store(0);
+        QVector<QVector<ImportColumn>> parts(nthreads);
+        QVector<QVector<bool>> failures(nthreads);
+        for (int c = 0; c < nthreads; c++) {
+            foreach (ImportColumn::Type type, types)
+                parts[c].append(ImportColumn(type));
+            failures[c] = QVector<bool>(types.size(), false);
+        }
+
+        if (nthreads == 1)
+            this->parse_range(start, this->length, true, false, &parts[0], &failures[0],
+                              stopped, progress);
+        else {
+            std::vector<std::thread> workers;
+            qint64 quote_count = 0;
+            for (int c = 0; c < nthreads; c++) {
+                bool in_quotes = quote_count % 2 == 1;
+                quote_count += quotes[size_t(c)];
+                workers.emplace_back([&, c, in_quotes]() {
+                    this->parse_range(bounds[c], bounds[c+1], c == 0, in_quotes,
+                                      &parts[c], &failures[c], stopped, progress);
+                });
+            }
+            for (auto& worker : workers)
+                worker.join();
+        }
+        if (stopped && stopped->load())
+            return false;
+
+        bool retry = false;
+        for (int column = 0; column < types.size(); column++) {
+            bool column_failed = false;
+            for (int c = 0; c < nthreads; c++)
+                column_failed = column_failed || failures[c][column];
+            if (!column_failed)
+                continue;
+            retry = true;
+            if (types[column] == ImportColumn::Int)
+                types[column] = ImportColumn::Float;
+            else
+                types[column] = ImportColumn::Text;
+        }
+        if (retry)
+            continue;
+
+        *columns = parts[0];
+        for (int c = 1; c < nthreads; c++) {
+            for (int column = 0; column < types.size(); column++)
+                (*columns)[column].extend(parts[c][column]);
+        }
+        return true;
+    }
+    return false;
+}
+
+
+/********** ImportThread **********/
+ImportThread::ImportThread(QObject *parent)
+    : QThread (parent)
+{
+    qRegisterMetaType<QList<QStringList>>("QList<QStringList>");
+    this->stopped = false;
+    this->progress = 0;
+    this->completed = false;
+}
+
+void ImportThread::initialize(const QString &filename, const ImportOptions &options)
+{
+    this->filename = filename;
+    this->text.clear();
+    this->options = options;
+    this->stopped = false;
+    this->completed = false;
+    this->error_flag.clear();
+}
+
+void ImportThread::initialize_text(const QString &text, const ImportOptions &options)
+{
+    this->filename.clear();
+    this->text = text;
+    this->options = options;
+    this->stopped = false;
+    this->completed = false;
+    this->error_flag.clear();
+}
+
+void ImportThread::stop()
+{
+    this->stopped = true;
+}
+
+void ImportThread::run()
+{
+    this->error_flag = this->options.check();
+    if (!this->error_flag.isEmpty()) {
+        emit sig_finished(false);
+        return;
+    }
+    DelimitedParser parser(this->options);
+    if (!this->filename.isEmpty()) {
+        if (!parser.open(this->filename, &this->error_flag)) {
+            emit sig_finished(false);
+            return;
+        }
+    }
+    else
+        parser.set_text(this->text);
+
+    // 先给出前几行的预览，其余部分在后台继续解析
+    emit sig_preview(parser.preview(this->options.preview_rows));
+
+    std::atomic<bool> done(false);
+    bool result = false;
+    std::thread worker([&]() {
+        result = parser.parse(&this->columns, 0, &this->stopped, &this->progress);
+        done = true;
+    });
+    while (!done.load()) {
+        QThread::msleep(100);
+        emit sig_progress(this->progress.load(), parser.size());
+    }
+    worker.join();
+
+    this->completed = result && !this->stopped.load();
+    emit sig_progress(parser.size(), parser.size());
+    emit sig_finished(this->completed);
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <QFile>
+#include <QThread>
+#include <QVector>
+#include <QVariant>
+#include <QStringList>
+#include <atomic>
+
+struct ImportOptions
+{
+    QString col_sep;// 空字符串表示任意空白
+    QString row_sep;
+    int skiprows;
+    QString comments;
+    int preview_rows;
+    ImportOptions()
+        : col_sep(","), row_sep("\n"), skiprows(0), comments("#"), preview_rows(100) {}
+    // 解析器按字节查找分隔符，分隔符只能是一个ASCII字符。返回错误信息，没有错误时为空
+    QString check() const;
+    bool operator==(const ImportOptions& other) const;
+    bool operator!=(const ImportOptions& other) const { return !(*this == other); }
+};
+
+
+// 导入后的一列数据，按推断出的类型连续存储
+class ImportColumn
+{
+public:
+    enum Type { Int = 0, Bool, Float, Text };
+
+    Type type;
+    QVector<qint64> ints;
+    QVector<double> floats;
+    QVector<bool> bools;
+    QStringList texts;
+
+    ImportColumn(Type type = Text);
+    int size() const;
+    QVariant value(int row) const;
+    bool append(const char* begin, const char* end, bool quoted);
+    bool append_missing();
+    void extend(const ImportColumn& other);
+};
+
+
+// 分隔符文本的解析器：内存映射文件，按块并行查找行边界(考虑引号)，
+// 字段直接解析到类型化的列中，不为每个字段生成QString
+class DelimitedParser
+{
+public:
+    DelimitedParser(const ImportOptions& options = ImportOptions());
+    ~DelimitedParser();
+
+    bool open(const QString& filename, QString* error = nullptr);
+    void set_text(const QString& text);
+    qint64 size() const { return length; }
+
+    QList<QStringList> preview(int max_rows) const;
+    QVector<ImportColumn::Type> infer_types(int sample_rows = 1000) const;
+    bool parse(QVector<ImportColumn>* columns, int nthreads = 0,
+               std::atomic<bool>* stopped = nullptr,
+               std::atomic<qint64>* progress = nullptr) const;
+
+private:
+    const char* data;
+    qint64 length;
+    QFile* file;
+    uchar* mapped;
+    QByteArray bytes;
+
+    char col_sep;
+    bool whitespace_sep;
+    char row_sep;
+    QByteArray comments;
+    int skiprows;
+
+    void close();
+    qint64 data_start() const;
+    qint64 row_end(qint64 pos) const;
+    bool is_comment(qint64 begin, qint64 end) const;
+    template <typename F>
+    void for_each_row(qint64 begin, qint64 end, F callback) const;
+    template <typename F>
+    void for_each_field(qint64 begin, qint64 end, F callback) const;
+    void parse_range(qint64 begin, qint64 end, bool first, bool in_quotes,
+                     QVector<ImportColumn>* columns, QVector<bool>* failed,
+                     std::atomic<bool>* stopped,
+                     std::atomic<qint64>* progress) const;
+};
+
+
+class ImportThread : public QThread
+{
+    Q_OBJECT
+signals:
+    void sig_preview(const QList<QStringList>&);
+    void sig_progress(qint64, qint64);
+    void sig_finished(bool);
+public:
+    std::atomic<bool> stopped;
+    std::atomic<qint64> progress;
+    QString error_flag;
+    QString filename;
+    QString text;
+    ImportOptions options;
+    QVector<ImportColumn> columns;
+    bool completed;
+
+    ImportThread(QObject* parent);
+    void initialize(const QString& filename, const ImportOptions& options);
+    void initialize_text(const QString& text, const ImportOptions& options);
+    void stop();
+protected:
+    void run() override;
+};
@@ -1,4 +1,24 @@
 #include "importwizard.h"
+#include "arrayeditor.h"
+#include <cstring>
+#include <climits>
+
+// 不生成中间的QStringList，只统计非空行数
+static int count_rows(const QString& text)
+{
+    int rows = 0;
+    bool empty = true;
+    foreach (const QChar& c, text) {
+        if (c == '\r' || c == '\n') {
+            if (!empty)
+                rows++;
+            empty = true;
+        }
+        else
+            empty = false;
+    }
+    return empty ? rows : rows + 1;
+}
 
 
 ContentsWidget::ContentsWidget(QWidget* parent, const QString& text)
@@ -7,6 +27,10 @@ ContentsWidget::ContentsWidget(QWidget* parent, const QString& text)
     text_editor = new QTextEdit(this);
     text_editor->setText(text);
     text_editor->setReadOnly(true);
+    preview_editor = new QTextEdit(this);
+    preview_editor->setReadOnly(true);
+    preview_editor->setLineWrapMode(QTextEdit::NoWrap);
+    preview_editor->hide();
 
     QHBoxLayout* type_layout = new QHBoxLayout;
     QLabel* type_label = new QLabel("Import as");
@@ -81,7 +105,7 @@ ContentsWidget::ContentsWidget(QWidget* parent, const QString& text)
     other_layout->addWidget(skiprows_label, 0, 0);
     skiprows_edt = new QLineEdit("0");
     skiprows_edt->setMaximumWidth(30);
-    QIntValidator* intvalid = new QIntValidator(0, text.split(QRegExp("[\r\n]"),QString::SkipEmptyParts).size(),
+    QIntValidator* intvalid = new QIntValidator(0, count_rows(text),
                                                 skiprows_edt);
     skiprows_edt->setValidator(intvalid);
     other_layout->addWidget(skiprows_edt, 0, 1);
@@ -109,13 +133,33 @@ ContentsWidget::ContentsWidget(QWidget* parent, const QString& text)
     connect(code_btn, SIGNAL(toggled(bool)),
             opts_frame, SLOT(set_as_code(bool)));
 
+    progress_bar = new QProgressBar(this);
+    progress_bar->setRange(0, 100);
+    progress_bar->hide();
+
+    import_thread = new ImportThread(this);
+    connect(import_thread, SIGNAL(sig_preview(QList<QStringList>)),
+            this, SLOT(show_preview(QList<QStringList>)));
+    connect(import_thread, SIGNAL(sig_progress(qint64, qint64)),
+            this, SLOT(import_progress(qint64, qint64)));
+    connect(import_thread, SIGNAL(sig_finished(bool)),
+            this, SLOT(import_finished(bool)));
+
     QVBoxLayout* layout = new QVBoxLayout;
     layout->addWidget(type_frame);
     layout->addWidget(text_editor);
+    layout->addWidget(preview_editor);
+    layout->addWidget(progress_bar);
     layout->addWidget(opts_frame);
     setLayout(layout);
 }
 
+ContentsWidget::~ContentsWidget()
+{
+    import_thread->stop();
+    import_thread->wait();
+}
+
 bool ContentsWidget::get_as_data() const
 {
     return _as_data;
@@ -144,7 +188,7 @@ QString ContentsWidget::get_row_sep() const
 {
     if (eol_btn->isChecked())
         return "\n";
-    return line_edt->text();
+    return line_edt_row->text();
 }
 
 int ContentsWidget::get_skiprows() const
@@ -157,6 +201,90 @@ QString ContentsWidget::get_comments() const
     return comments_edt->text();
 }
 
+ImportOptions ContentsWidget::get_options() const
+{
+    ImportOptions options;
+    options.col_sep = get_col_sep();
+    options.row_sep = get_row_sep();
+    options.skiprows = get_skiprows();
+    options.comments = get_comments();
+    return options;
+}
+
+// 在后台解析文件，前几行显示在预览框中，text_editor保持为空
+void ContentsWidget::load_file(const QString &filename)
+{
+    this->filename = filename;
+    text_editor->clear();
+    text_editor->hide();
+    preview_editor->clear();
+    preview_editor->show();
+    // 行数要等解析完才知道
+    QIntValidator* intvalid = new QIntValidator(0, INT_MAX, skiprows_edt);
+    skiprows_edt->setValidator(intvalid);
+    start_import();
+}
+
+// 按当前选项重新解析文件或text_editor中的全部文本，结果在import_thread->columns中
+bool ContentsWidget::start_import()
+{
+    if (import_thread->isRunning()) {
+        import_thread->stop();
+        import_thread->wait();
+    }
+    // 丢弃上一次解析还没有送达的信号
+    QCoreApplication::removePostedEvents(this, QEvent::MetaCall);
+
+    ImportOptions options = get_options();
+    QString error = options.check();
+    if (!error.isEmpty()) {
+        QMessageBox::critical(this, "Import error", error);
+        return false;
+    }
+    progress_bar->setValue(0);
+    progress_bar->show();
+    if (!filename.isEmpty())
+        import_thread->initialize(filename, options);
+    else
+        import_thread->initialize_text(text_editor->toPlainText(), options);
+    import_thread->start();
+    return true;
+}
+
+// 正在或已经按当前选项解析
+bool ContentsWidget::is_import_current() const
+{
+    return import_thread->options == get_options() &&
+            (import_thread->isRunning() || import_thread->completed);
+}
+
+void ContentsWidget::show_preview(const QList<QStringList> &rows)
+{
+    if (filename.isEmpty())
+        return;
+    QString sep = get_col_sep();
+    if (sep.isEmpty())
+        sep = " ";
+    QStringList lines;
+    foreach (const QStringList& row, rows)
+        lines.append(row.join(sep));
+    preview_editor->setPlainText(lines.join('\n'));
+}
+
+void ContentsWidget::import_progress(qint64 done, qint64 total)
+{
+    if (total > 0)
+        progress_bar->setValue(int(100 * done / total));
+}
+
+void ContentsWidget::import_finished(bool completed)
+{
+    progress_bar->hide();
+    if (!completed && !import_thread->error_flag.isEmpty())
+        QMessageBox::critical(this, "Import error", import_thread->error_flag);
+    emit sig_import_finished(completed);
+}
+
 //@Slot(bool)
 void ContentsWidget::set_as_data(bool as_data)
 {
@@ -172,3 +300,200 @@ void ContentsWidget::set_as_code(bool as_code)
 
 
 /********** PreviewTableModel **********/
+PreviewTableModel::PreviewTableModel(QObject *parent)
+    : QAbstractTableModel (parent)
+{}
+
+void PreviewTableModel::set_columns(const QVector<ImportColumn> &columns)
+{
+    beginResetModel();
+    this->columns = columns;
+    endResetModel();
+}
+
+int PreviewTableModel::rowCount(const QModelIndex &parent) const
+{
+    Q_UNUSED(parent);
+    return columns.isEmpty() ? 0 : columns[0].size();
+}
+
+int PreviewTableModel::columnCount(const QModelIndex &parent) const
+{
+    Q_UNUSED(parent);
+    return columns.size();
+}
+
+QVariant PreviewTableModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || role != Qt::DisplayRole)
+        return QVariant();
+    return columns[index.column()].value(index.row());
+}
+
+QVariant PreviewTableModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (role != Qt::DisplayRole)
+        return QVariant();
+    if (orientation == Qt::Vertical)
+        return section;
+    static const char* type_names[] = {"int", "bool", "float", "str"};
+    return QString("%1 (%2)").arg(section).arg(type_names[columns[section].type]);
+}
+
+
+/********** ImportWizard **********/
+ImportWizard::ImportWizard(QWidget *parent, const QString &filename)
+    : QDialog (parent)
+{
+    setAttribute(Qt::WA_DeleteOnClose);
+    setWindowTitle(QString("Import wizard - %1").arg(QFileInfo(filename).fileName()));
+    resize(700, 500);
+
+    text_widget = new ContentsWidget(this, QString());
+    table_model = new PreviewTableModel(this);
+    table_view = new QTableView(this);
+    table_view->setModel(table_model);
+
+    stack = new QStackedWidget(this);
+    stack->addWidget(text_widget);
+    stack->addWidget(table_view);
+
+    QPushButton* cancel_btn = new QPushButton("Cancel");
+    back_btn = new QPushButton("Previous");
+    back_btn->setEnabled(false);
+    fwd_btn = new QPushButton("Next");
+    done_btn = new QPushButton("Done");
+    done_btn->setEnabled(false);
+    connect(cancel_btn, SIGNAL(clicked()), this, SLOT(reject()));
+    connect(back_btn, &QPushButton::clicked, [this](){ this->_set_step(-1); });
+    connect(fwd_btn, &QPushButton::clicked, [this](){ this->_set_step(1); });
+    connect(done_btn, SIGNAL(clicked()), this, SLOT(process()));
+    connect(text_widget, SIGNAL(sig_import_finished(bool)), this, SLOT(import_finished(bool)));
+
+    QHBoxLayout* btns_layout = new QHBoxLayout;
+    btns_layout->addStretch();
+    btns_layout->addWidget(cancel_btn);
+    btns_layout->addWidget(back_btn);
+    btns_layout->addWidget(fwd_btn);
+    btns_layout->addWidget(done_btn);
+
+    QVBoxLayout* layout = new QVBoxLayout;
+    layout->addWidget(stack);
+    layout->addLayout(btns_layout);
+    setLayout(layout);
+
+    text_widget->load_file(filename);
+}
+
+bool ImportWizard::is_numeric() const
+{
+    if (table_model->rowCount() == 0)
+        return false;
+    foreach (const ImportColumn& column, table_model->columns) {
+        if (column.type == ImportColumn::Text)
+            return false;
+    }
+    return true;
+}
+
+ArrayBuffer ImportWizard::get_array(QString* error) const
+{
+    if (!is_numeric())
+        return ArrayBuffer();
+    const QVector<ImportColumn>& columns = table_model->columns;
+    int rows = columns[0].size();
+    int cols = columns.size();
+
+    bool all_int = true;
+    bool all_bool = true;
+    foreach (const ImportColumn& column, columns) {
+        all_int = all_int && column.type == ImportColumn::Int;
+        all_bool = all_bool && column.type == ImportColumn::Bool;
+    }
+    ArrayBuffer::DType dtype = all_bool ? ArrayBuffer::Bool
+                                        : (all_int ? ArrayBuffer::Int64 : ArrayBuffer::Double);
+
+    // 不转置时按列主序存放，转置时按行主序存放，两种情况下每一列都连续，整列复制
+    bool transpose = text_widget->trnsp_box->isChecked();
+    if (!ArrayBuffer::fits(dtype, rows, cols)) {
+        if (error)
+            *error = QString("The imported data (%1 x %2) is too large to be opened "
+                             "as an array").arg(rows).arg(cols);
+        return ArrayBuffer();
+    }
+    ArrayBuffer array(dtype, transpose ? cols : rows, transpose ? rows : cols, transpose);
+    char* base = array.data();
+    for (int j = 0; j < cols; j++) {
+        const ImportColumn& column = columns[j];
+        qint64 offset = qint64(j) * rows;
+        if (dtype == ArrayBuffer::Bool) {
+            for (int i = 0; i < rows; i++)
+                base[offset + i] = column.bools[i];
+        }
+        else if (dtype == ArrayBuffer::Int64)
+            std::memcpy(reinterpret_cast<qint64*>(base) + offset, column.ints.constData(),
+                        size_t(rows) * sizeof(qint64));
+        else {
+            double* out = reinterpret_cast<double*>(base) + offset;
+            if (column.type == ImportColumn::Float)
+                std::memcpy(out, column.floats.constData(), size_t(rows) * sizeof(double));
+            else if (column.type == ImportColumn::Int) {
+                for (int i = 0; i < rows; i++)
+                    out[i] = double(column.ints[i]);
+            }
+            else {
+                for (int i = 0; i < rows; i++)
+                    out[i] = column.bools[i] ? 1.0 : 0.0;
+            }
+        }
+    }
+    return array;
+}
+
+void ImportWizard::_set_step(int step)
+{
+    int new_index = stack->currentIndex() + step;
+    if (new_index == 1) {
+        // 选项改变后重新解析，解析完成后由import_finished填充表格
+        table_model->set_columns(QVector<ImportColumn>());
+        if (!text_widget->is_import_current()) {
+            if (!text_widget->start_import())
+                return;
+        }
+        else if (text_widget->import_thread->completed)
+            table_model->set_columns(text_widget->import_thread->columns);
+    }
+    stack->setCurrentIndex(new_index);
+    back_btn->setEnabled(new_index > 0);
+    fwd_btn->setEnabled(new_index == 0);
+    done_btn->setEnabled(new_index == 1 && is_numeric());
+}
+
+void ImportWizard::import_finished(bool completed)
+{
+    if (!completed) {
+        if (stack->currentIndex() == 1)
+            _set_step(-1);
+        return;
+    }
+    if (stack->currentIndex() == 1) {
+        table_model->set_columns(text_widget->import_thread->columns);
+        done_btn->setEnabled(is_numeric());
+    }
+}
+
+// 数值数据用数组编辑器打开
+void ImportWizard::process()
+{
+    QString error;
+    ArrayBuffer array = get_array(&error);
+    if (!array.is_valid()) {
+        if (!error.isEmpty())
+            QMessageBox::critical(this, "Import error", error);
+        return;
+    }
+    ArrayEditor* editor = new ArrayEditor(parentWidget());
+    if (editor->setup_and_check(array, QFileInfo(text_widget->filename).baseName()))
+        editor->show();
+    accept();
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "importengine.h"
+#include "arraybuffer.h"
 #include <QtWidgets>
 
 
@@ -8,8 +10,14 @@ class ContentsWidget : public QWidget
     Q_OBJECT
 signals:
     void asDataChanged(bool);
+    void sig_import_finished(bool);
 public:
     QTextEdit* text_editor;
+    // 从文件导入时只显示前几行，完整数据在import_thread->columns中
+    QTextEdit* preview_editor;
+    QString filename;
+    QProgressBar* progress_bar;
+    ImportThread* import_thread;
     bool _as_data;
     bool _as_code;
     bool _as_num;
@@ -23,6 +31,7 @@ public:
     QCheckBox* trnsp_box;
 public:
     ContentsWidget(QWidget* parent, const QString& text);
+    ~ContentsWidget();
     bool get_as_data() const;
     bool get_as_code() const;
     bool get_as_num() const;
@@ -30,9 +39,58 @@ public:
     QString get_row_sep() const;
     int get_skiprows() const;
     QString get_comments() const;
+    ImportOptions get_options() const;
+    void load_file(const QString& filename);
+    bool start_import();
+    bool is_import_current() const;
 
 public slots:
     void set_as_data(bool as_data);
     void set_as_code(bool as_code);
+    void show_preview(const QList<QStringList>& rows);
+    void import_progress(qint64 done, qint64 total);
+    void import_finished(bool completed);
 };
 
+
+
+// 导入结果的表格，直接读取类型化的列
+class PreviewTableModel : public QAbstractTableModel
+{
+    Q_OBJECT
+public:
+    QVector<ImportColumn> columns;
+
+    PreviewTableModel(QObject* parent = nullptr);
+    void set_columns(const QVector<ImportColumn>& columns);
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation,
+                        int role = Qt::DisplayRole) const override;
+};
+
+
+class ImportWizard : public QDialog
+{
+    Q_OBJECT
+public:
+    ContentsWidget* text_widget;
+    QTableView* table_view;
+    PreviewTableModel* table_model;
+    QStackedWidget* stack;
+    QPushButton* back_btn;
+    QPushButton* fwd_btn;
+    QPushButton* done_btn;
+
+    ImportWizard(QWidget* parent, const QString& filename);
+    bool is_numeric() const;
+    // 全部是数值列时转换为数组，transpose选中时转置
+    // 数据太大、数组放不下时返回无效的数组并设置error
+    ArrayBuffer get_array(QString* error = nullptr) const;
+
+public slots:
+    void _set_step(int step);
+    void import_finished(bool completed);
+    void process();
+};